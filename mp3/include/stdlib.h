@@ -12,5 +12,7 @@ void exit(int status);
 pid_t Fork(void);
 void Execv(const char *pathname, char *const argv[]);
 void Waitpid(pid_t pid, int *wstatus);
+void Pipe(int fds[2]);
+void Dup2(int oldfd, int newfd);
 
 #endif /* _STDLIB_H_ */
@@ -17,4 +17,8 @@ typedef signed long ssize_t;
 typedef unsigned long pid_t;
 #endif /* pid_t */
 
+#ifndef TIME_T
+typedef unsigned long time_t;
+#endif /* time_t */
+
 #endif /* _TYPES_H_*/
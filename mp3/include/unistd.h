@@ -25,37 +25,232 @@ typedef enum {
     SYS_SBRK,
     SYS_MMAP,
     SYS_MUNMAP,
-    SYS_STAT
+    SYS_PROCSTAT,
+    SYS_NICE,
+    SYS_SETPRIORITY,
+    SYS_GETPRIORITY,
+    SYS_SCHED_SETSCHEDULER,
+    SYS_CLONE,
+    SYS_FUTEX,
+    SYS_PIPE,
+    SYS_DUP2,
+    SYS_VFORK,
+    SYS_CREAT,
+    SYS_UNLINK,
+    SYS_FTRUNCATE,
+    SYS_MKDIR,
+    SYS_CHDIR,
+    SYS_GETCWD,
+    SYS_RMDIR,
+    SYS_MMAP_FILE,
+    SYS_LSEEK,
+    SYS_PREAD,
+    SYS_PWRITE,
+    SYS_READV,
+    SYS_WRITEV,
+    SYS_SYNC,
+    SYS_DUP,
+    SYS_IOCTL,
+    SYS_POLL,
+    SYS_GETDENTS,
+    SYS_STAT,
+    SYS_FSTAT
 } sysnum;
 
+/* targets of setpriority and getpriority */
+#define PRIO_PROCESS    0
+#define PRIO_PGRP       1
+#define PRIO_USER       2
+
+/* scheduling policies */
+#define SCHED_NORMAL    0
+#define SCHED_FIFO      1
+#define SCHED_RR        2
+
+/* futex operations */
+#define FUTEX_WAIT      0
+#define FUTEX_WAKE      1
+
+/* signals */
+#define DIV_ZERO        0
+#define SEGFAULT        1
+#define INTERRUPT       2
+#define ALARM           3
+#define USER1           4
+
+/* clocks */
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+
+
+/* page of kernel data mapped read-only into every process,
+ * same layout as vdso_data_t in the kernel (boot/vdso.h) */
+#define VDSO_ADDR       0x8400000
+
+struct vdso {
+    volatile unsigned int seq;          /* odd while the kernel updates the page */
+    volatile unsigned int pid;          /* pid of the running task */
+    volatile unsigned int ppid;         /* pid of its parent */
+    volatile unsigned int ticks;        /* ms since boot */
+    volatile unsigned int clock_lo;     /* scheduler clock in ns */
+    volatile unsigned int clock_hi;
+    volatile unsigned int tv_sec;       /* wall clock */
+    volatile unsigned int tv_nsec;
+};
+
+#define vdso            ((const struct vdso *) VDSO_ADDR)
+
+/* lseek */
+#define SEEK_SET        0
+#define SEEK_CUR        1
+#define SEEK_END        2
+
+/* ioctl commands of the rtc */
+#define RTC_IRQP_SET    1               /* set the frequency of the interrupt, a power of 2 */
+#define RTC_IRQP_READ   2               /* get the frequency of the interrupt */
+
+/* one buffer of readv and writev, at most IOV_MAX of them */
+#define IOV_MAX         64
+
+struct iovec {
+    void   *iov_base;                   /* start of the buffer */
+    size_t  iov_len;                    /* size of the buffer */
+};
+
+struct timespec {
+    time_t tv_sec;                      /* seconds */
+    long   tv_nsec;                     /* nanoseconds */
+};
+
+/* file types, in d_type and st_type */
+#define DT_RTC          0               /* real-time clock */
+#define DT_DIR          1               /* directory */
+#define DT_REG          2               /* regular file */
+#define DT_TERM         3               /* terminal */
+#define DT_PIPE         4               /* one end of a pipe */
+
+/* a record of getdents, the next one starts d_reclen bytes further */
+struct dirent {
+    unsigned int   d_ino;               /* inode, 0 for a device */
+    unsigned int   d_size;              /* size in bytes */
+    unsigned short d_reclen;            /* length of this record */
+    unsigned char  d_type;              /* DT_REG, DT_DIR, ... */
+    char           d_name[1];           /* name, '\0' terminated, up to 32 bytes */
+};
+
+struct stat {
+    unsigned int st_ino;                /* inode, 0 for a device or a pipe */
+    unsigned int st_type;               /* DT_REG, DT_DIR, ... */
+    unsigned int st_size;               /* size in bytes */
+    unsigned int st_blocks;             /* 4KB blocks in use */
+};
+
+struct timeval {
+    time_t tv_sec;                      /* seconds */
+    long   tv_usec;                     /* microseconds */
+};
+
+/* events of poll */
+#define POLLIN          0x001           /* a read would not block */
+#define POLLOUT         0x004           /* a write would not block */
+#define POLLERR         0x008           /* error (a pipe without readers) */
+#define POLLHUP         0x010           /* hang up (a pipe without writers) */
+#define POLLNVAL        0x020           /* fd is not open */
+
+struct pollfd {
+    int   fd;                           /* file descriptor, ignored if negative */
+    short events;                       /* events to wait for */
+    short revents;                      /* events that happened */
+};
+
+/* descriptor sets of select, for descriptors below FD_SETSIZE */
+#define FD_SETSIZE      256
+
+typedef struct {
+    unsigned int bits[FD_SETSIZE / 32];
+} fd_set;
+
+#define FD_ZERO(set)                                    \
+do {                                                    \
+    int __i;                                            \
+    for (__i = 0; __i < FD_SETSIZE / 32; ++__i)         \
+        (set)->bits[__i] = 0;                           \
+} while (0)
+#define FD_SET(fd, set) ((set)->bits[(fd) / 32] |= 1U << ((fd) % 32))
+#define FD_CLR(fd, set) ((set)->bits[(fd) / 32] &= ~(1U << ((fd) % 32)))
+#define FD_ISSET(fd, set) (((set)->bits[(fd) / 32] >> ((fd) % 32)) & 1)
+
+
+
+extern char **environ;
 
 int syscall(sysnum sysnum, int arg0, int arg1, int arg2);
+int syscall_int80(sysnum sysnum, int arg0, int arg1, int arg2);
+void __thread_exit(void);
 
 /* process */
 pid_t fork(void);
+pid_t vfork(void) __attribute__((returns_twice));
 void _exit(int status);
 int execv(const char *pathname, char *const argv[]);
+int execve(const char *pathname, char *const argv[], char *const envp[]);
 int execute(const char *cmd);
 pid_t wait(int *wstatus);
 pid_t waitpid(pid_t pid, int *wstatus);
 pid_t getpid(void);
 pid_t getppid(void);
 int getargs (char* buf, int nbytes);
+int nice(int inc);
+int setpriority(int which, int who, int prio);
+int getpriority(int which, int who);
+int sched_setscheduler(pid_t pid, int policy, int priority);
+int clone(int (*fn)(void *), void *stack, void *arg);
+int futex(int *uaddr, int op, int val);
+int set_handler(int signum, void (*handler)(int));
 
 /* Debug */
-int stat(char *info[]);
+int procstat(char *info[]);
+
+/* time */
+time_t time(time_t *tloc);
+int clock_gettime(int clockid, struct timespec *tp);
 
 
 /* file system */
 int open(const char *pathname);
+int creat(const char *pathname);
+int unlink(const char *pathname);
+int ftruncate(int fd, int length);
+int mkdir(const char *pathname);
+int rmdir(const char *pathname);
+int chdir(const char *path);
+char *getcwd(char *buf, size_t size);
 int close(int fd);
 ssize_t read(int fd, void *buf, size_t count);
 ssize_t write(int fd, const void *buf, size_t count);
+int lseek(int fd, int offset, int whence);
+ssize_t pread(int fd, void *buf, size_t count, int offset);
+ssize_t pwrite(int fd, const void *buf, size_t count, int offset);
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt);
+int sync(void);
+int getdents(int fd, struct dirent *dirp, unsigned int count);
+int stat(const char *pathname, struct stat *statbuf);
+int fstat(int fd, struct stat *statbuf);
+int pipe(int fds[2]);
+int dup(int oldfd);
+int dup2(int oldfd, int newfd);
+int ioctl(int fd, int cmd, int arg);
+int poll(struct pollfd *fds, unsigned int nfds, int timeout);
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
 
 /* memory management */
 void *sbrk(size_t increment);
 int vidmap(char **screen_start);
+#define MAP_FAILED ((void *) -1)
+
 void *mmap(void *addr, size_t size);
+void *mmap_file(int fd, int offset, size_t length);
 int munmap(void *addr, size_t size);
 
 
@@ -4,23 +4,105 @@
 #include <string.h>
 
 
+#define OUT_IOV     16      /* pieces of output gathered before a writev */
+#define OUT_CONV    128     /* bytes of converted numbers and characters */
+
+/* Output of printf being gathered: literal runs of the format and %s 
+ * strings are pointed to where they are, converted numbers are built 
+ * in conv. Everything goes out in one writev, unless it overflows. */
+typedef struct {
+    int fd;
+    int total;
+    int cnt;
+    int used;
+    struct iovec iov[OUT_IOV];
+    char conv[OUT_CONV];
+} out_t;
+
+
 /**
- * @brief Write output to stdout.
+ * @brief write the gathered output and start over
+ * 
+ * @param out : output being gathered
+ */
+static void out_flush(out_t *out) {
+    if (out->cnt)
+        writev(out->fd, out->iov, out->cnt);
+    out->cnt = 0;
+    out->used = 0;
+}
+
+
+/**
+ * @brief add len bytes at s to the output, s must stay valid until the
+ * output is flushed
  * 
+ * @param out : output being gathered
+ * @param s : the bytes
+ * @param len : number of bytes
+ */
+static void out_add(out_t *out, const char *s, int len) {
+    struct iovec *last;
+
+    if (!len)
+        return;
+
+    out->total += len;
+
+    /* the next character of a literal run, or of conv */
+    if (out->cnt) {
+        last = &out->iov[out->cnt - 1];
+        if ((char *)last->iov_base + last->iov_len == s) {
+            last->iov_len += len;
+            return;
+        }
+    }
+
+    if (out->cnt == OUT_IOV)
+        out_flush(out);
+
+    out->iov[out->cnt].iov_base = (void *)s;
+    out->iov[out->cnt].iov_len = len;
+    out->cnt++;
+}
+
+
+/**
+ * @brief copy a short string (a converted number) to the output
+ * 
+ * @param out : output being gathered
+ * @param s : the string, at most OUT_CONV bytes
+ */
+static void out_conv(out_t *out, const char *s) {
+    int len = strlen(s);
+
+    /* flushing in out_add would reuse conv under the new piece */
+    if (out->used + len > OUT_CONV || out->cnt == OUT_IOV)
+        out_flush(out);
+
+    memcpy(&out->conv[out->used], s, len);
+    out_add(out, &out->conv[out->used], len);
+    out->used += len;
+}
+
+
+/**
+ * @brief Format the arguments at esp and write them to fd, gathering 
+ * the pieces so that a call usually makes a single writev.
+ * 
+ * @param fd : file descriptor
  * @param format : format of the string
- * @param ... : arguments matched to the format
- * @return int : Upon successful return, these functions return 
- * the number of characters printed (excluding the null byte used 
- * to end output to strings).
+ * @param esp : first argument matched to the format
+ * @return int : the number of characters printed
  */
-int printf(const char *format, ...) {
+static int do_printf(int fd, const char *format, int *esp) {
+    out_t out;
 
     /* Pointer to the format string */
     char *buf = (char *)format;
 
-    /* Stack pointer for the other parameters */
-    int *esp = (void *)&format;
-    esp++;
+    out.fd = fd;
+    out.total = out.cnt = out.used = 0;
 
     while (*buf != '\0') {
         switch (*buf) {
@@ -34,7 +116,7 @@ format_char_switch:
                     switch (*buf) {
                         /* Print a literal '%' character */
                         case '%':
-                            putc('%');
+                            out_add(&out, buf, 1);
                             break;
 
                         /* Use alternate formatting */
@@ -52,7 +134,7 @@ format_char_switch:
                                 char conv_buf[64];
                                 if (alternate == 0) {
                                     itoa(*((unsigned int *)esp), conv_buf, 16);
-                                    puts(conv_buf);
+                                    out_conv(&out, conv_buf);
                                 } else {
                                     int starting_index;
                                     int i;
@@ -62,7 +144,7 @@ format_char_switch:
                                         conv_buf[i] = '0';
                                         i++;
                                     }
-                                    puts(&conv_buf[starting_index]);
+                                    out_conv(&out, &conv_buf[starting_index]);
                                 }
                                 esp++;
                             }
@@ -73,7 +155,7 @@ format_char_switch:
                             {
                                 char conv_buf[36];
                                 itoa(*((unsigned int *)esp), conv_buf, 10);
-                                puts(conv_buf);
+                                out_conv(&out, conv_buf);
                                 esp++;
                             }
                             break;
@@ -89,20 +171,26 @@ format_char_switch:
                                 } else {
                                     itoa(value, conv_buf, 10);
                                 }
-                                puts(conv_buf);
+                                out_conv(&out, conv_buf);
                                 esp++;
                             }
                             break;
 
                         /* Print a single character */
                         case 'c':
-                            putc((unsigned char) *((int *)esp));
-                            esp++;
+                            {
+                                char conv_buf[2];
+                                conv_buf[0] = (char) *((int *)esp);
+                                conv_buf[1] = '\0';
+                                if (conv_buf[0])
+                                    out_conv(&out, conv_buf);
+                                esp++;
+                            }
                             break;
 
                         /* Print a NULL-terminated string */
                         case 's':
-                            puts(*((char **)esp));
+                            out_add(&out, *((char **)esp), strlen(*((char **)esp)));
                             esp++;
                             break;
 
@@ -114,29 +202,42 @@ format_char_switch:
                 break;
 
             default:
-                putc(*buf);
+                out_add(&out, buf, 1);
                 break;
         }
         buf++;
     }
-    return (buf - format);
+
+    out_flush(&out);
+    return out.total;
+}
+
+
+/**
+ * @brief Write output to stdout.
+ * 
+ * @param format : format of the string
+ * @param ... : arguments matched to the format
+ * @return int : Upon successful return, these functions return 
+ * the number of characters printed (excluding the null byte used 
+ * to end output to strings).
+ */
+int printf(const char *format, ...) {
+    /* Stack pointer for the other parameters */
+    int *esp = (void *)&format;
+    return do_printf(stdout, format, esp + 1);
 }
 
 
 
 /**
- * @brief writes the string s and a trailing newline to stdout.
+ * @brief writes the string s to stdout.
  * 
  * @param s : string s
  * @return int : return a nonnegative number on success, or EOF on error.
  */
 int puts(char *s) {
-    register int index = 0;
-    while (s[index] != '\0') {
-        putc(s[index]);
-        index++;
-    }
-    return index;
+    return write(stdout, s, strlen(s));
 }
 
 
@@ -176,7 +277,8 @@ int sprintf(char *str, const char *format, ...) {
  * to end output to strings). 
  */
 int fprintf(int fd, const char *format, ...) {
-    return 0;
+    int *esp = (void *)&format;
+    return do_printf(fd, format, esp + 1);
 }
 
 
@@ -387,3 +387,26 @@ void Waitpid(pid_t pid, int *wstatus) {
     }
 }
 
+
+/**
+ * @brief Stevens-style error-handling wrapper function for pipe
+ * 
+ * @param fds : read end and write end of the new pipe
+ */
+void Pipe(int fds[2]) {
+    if (pipe(fds) < 0)
+        unix_error("Pipe failed");
+}
+
+
+/**
+ * @brief Stevens-style error-handling wrapper function for dup2
+ * 
+ * @param oldfd : an open file descriptor
+ * @param newfd : the file descriptor to set
+ */
+void Dup2(int oldfd, int newfd) {
+    if (dup2(oldfd, newfd) < 0)
+        unix_error("Dup2 failed");
+}
+
@@ -1,6 +1,10 @@
 #include <unistd.h>
 
 
+/* environment of the program, set up by _start from the stack */
+char **environ;
+
+
 /**
  * @brief Creates a new process by duplicating the calling process. 
  * The new process is referred to as the child process. The calling 
@@ -35,7 +39,24 @@ pid_t fork(void) {
  * returned, and errno is set appropriately.
  */
 int execv(const char *pathname, char *const argv[]) {
-    return syscall(SYS_EXECV, (int) pathname, (int) argv, 0);
+    return execve(pathname, argv, environ);
+}
+
+
+/**
+ * @brief Same as execv, with the environment of the new program given 
+ * in envp instead of the current one.
+ * 
+ * @param pathname : file name of the new program
+ * @param argv : arguments, terminated by a NULL pointer
+ * @param envp : strings of the form NAME=value, terminated by a NULL 
+ * pointer. The new program finds them in environ and in the third 
+ * argument of main().
+ * @return int : On success, execve() does not return, on error -1 is
+ * returned.
+ */
+int execve(const char *pathname, char *const argv[], char *const envp[]) {
+    return syscall(SYS_EXECV, (int) pathname, (int) argv, (int) envp);
 }
 
 
@@ -98,11 +119,12 @@ pid_t waitpid(pid_t pid, int *wstatus) {
 
 /**
  * @brief Get the process ID (PID) of the calling process.
+ * Read from the vDSO page, without a system call.
  * 
  * @return pid_t : pid of the calling process.
  */
 pid_t getpid(void) {
-    return (pid_t) syscall(SYS_GETPID, 0, 0, 0);
+    return (pid_t) vdso->pid;
 }
 
 
@@ -115,10 +137,130 @@ pid_t getpid(void) {
  * @return pid_t : pid of the parent of the calling process.
  */
 pid_t getppid(void) {
-    return (pid_t) syscall(SYS_GETPPID, 0, 0, 0);
+    return (pid_t) vdso->ppid;
+}
+
+
+/**
+ * @brief Adds inc to the nice value of the calling process. 
+ * A higher nice value means a lower priority.
+ * 
+ * @param inc : value added to the nice value
+ * @return int : On success, the new nice value is returned. 
+ * On error, -1 is returned.
+ */
+int nice(int inc) {
+    if (syscall(SYS_NICE, inc, 0, 0) < 0)
+        return -1;
+
+    return getpriority(PRIO_PROCESS, 0);
+}
+
+
+/**
+ * @brief Sets the nice value of a process. The value is clamped 
+ * into the range [-20, 19].
+ * 
+ * @param which : PRIO_PROCESS (PRIO_PGRP and PRIO_USER are not supported)
+ * @param who : process id, 0 for the calling process
+ * @param prio : new nice value
+ * @return int : On success, returns 0; On error, -1 is returned.
+ */
+int setpriority(int which, int who, int prio) {
+    return (syscall(SYS_SETPRIORITY, which, who, prio) < 0) ? -1 : 0;
 }
 
 
+/**
+ * @brief Gets the nice value of a process.
+ * 
+ * @param which : PRIO_PROCESS (PRIO_PGRP and PRIO_USER are not supported)
+ * @param who : process id, 0 for the calling process
+ * @return int : On success, the nice value in [-20, 19] is returned.
+ * On error, -1 is returned.
+ */
+int getpriority(int which, int who) {
+    int ret = syscall(SYS_GETPRIORITY, which, who, 0);
+
+    /* the kernel returns 20 - nice to keep the value positive */
+    return (ret < 0) ? -1 : 20 - ret;
+}
+
+
+/**
+ * @brief Sets the scheduling policy and priority of a process. 
+ * Runnable SCHED_FIFO and SCHED_RR tasks always run before 
+ * SCHED_NORMAL tasks, highest priority first.
+ * 
+ * @param pid : process id, 0 for the calling process
+ * @param policy : SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+ * @param priority : 1 (lowest) to 99 (highest) for SCHED_FIFO and 
+ * SCHED_RR, 0 for SCHED_NORMAL
+ * @return int : On success, returns 0; On error, -1 is returned.
+ */
+int sched_setscheduler(pid_t pid, int policy, int priority) {
+    return (syscall(SYS_SCHED_SETSCHEDULER, (int) pid, policy, priority) < 0) ? -1 : 0;
+}
+
+
+
+/**
+ * @brief Creates a new thread running fn(arg). The thread shares the
+ * memory, open files and terminal of the calling thread. When fn 
+ * returns, the thread exits with its return value.
+ * 
+ * @param fn : function run by the new thread
+ * @param stack : top of the memory used as the stack of the new thread,
+ * usually the end of a malloc'ed block
+ * @param arg : argument passed to fn
+ * @return int : On success, the thread ID of the new thread is returned.
+ * On failure, -1 is returned.
+ */
+int clone(int (*fn)(void *), void *stack, void *arg) {
+    unsigned int *sp = (unsigned int *) ((unsigned int) stack & ~0xF);
+    int tid;
+
+    /* fn(arg) returns into __thread_exit */
+    *--sp = (unsigned int) arg;
+    *--sp = (unsigned int) __thread_exit;
+
+    tid = syscall(SYS_CLONE, (int) fn, (int) sp, 0);
+    return (tid < 0) ? -1 : tid;
+}
+
+
+/**
+ * @brief Waits on or wakes up threads sleeping on the int at uaddr.
+ * FUTEX_WAIT sleeps until a FUTEX_WAKE on uaddr if *uaddr is still val,
+ * FUTEX_WAKE wakes up at most val threads waiting on uaddr.
+ * 
+ * @param uaddr : address of the futex word, 4-byte aligned
+ * @param op : FUTEX_WAIT or FUTEX_WAKE
+ * @param val : expected value (FUTEX_WAIT) or number of threads (FUTEX_WAKE)
+ * @return int : FUTEX_WAIT returns 0 when woken up, FUTEX_WAKE returns the 
+ * number of threads woken up. On error (including *uaddr != val for 
+ * FUTEX_WAIT), -1 is returned.
+ */
+int futex(int *uaddr, int op, int val) {
+    int ret = syscall(SYS_FUTEX, (int) uaddr, op, val);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Sets the function called when the signal signum is received. 
+ * The handler runs on the user stack with the signal blocked, when it 
+ * returns the program goes on where it was interrupted. 
+ * 
+ * @param signum : DIV_ZERO, SEGFAULT, INTERRUPT, ALARM or USER1
+ * @param handler : handler, NULL for the default action (DIV_ZERO, 
+ * SEGFAULT and INTERRUPT kill the program, the others are ignored)
+ * @return int : returns zero on success. On error, -1 is returned.
+ */
+int set_handler(int signum, void (*handler)(int)) {
+    return (syscall(SYS_SET_HANDLER, signum, (int) handler, 0) < 0) ? -1 : 0;
+}
+
 
 /**
  * @brief Stores the program arguments of the running process into buf
@@ -144,7 +286,103 @@ int getargs (char* buf, int nbytes) {
  * 
  */
 int open(const char *pathname) {
-    return syscall(SYS_READ, (int) pathname, 0, 0);
+    return syscall(SYS_OPEN, (int) pathname, 0, 0);
+}
+
+
+/**
+ * @brief Creates a regular file, or truncates an existing one to 
+ * length 0, and opens it.
+ * 
+ * @param pathname : name of the file
+ * @return int : a file descriptor on success. On error, -1 is returned.
+ */
+int creat(const char *pathname) {
+    int ret = syscall(SYS_CREAT, (int) pathname, 0, 0);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Deletes a name from the file system. If the file is still 
+ * open, it is removed when the last file descriptor referring to it 
+ * is closed.
+ * 
+ * @param pathname : name of the file
+ * @return int : returns zero on success. On error, -1 is returned.
+ */
+int unlink(const char *pathname) {
+    int ret = syscall(SYS_UNLINK, (int) pathname, 0, 0);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Causes the regular file referenced by fd to be truncated to 
+ * a size of precisely length bytes. If the file was larger, the extra
+ * data is lost, if it was shorter, it is extended with zeros.
+ * 
+ * @param fd : file descriptor of an open regular file
+ * @param length : the new size in bytes
+ * @return int : returns zero on success. On error, -1 is returned.
+ */
+int ftruncate(int fd, int length) {
+    int ret = syscall(SYS_FTRUNCATE, fd, length, 0);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Creates an empty directory named pathname, holding only 
+ * "." and "..".
+ * 
+ * @param pathname : path of the new directory
+ * @return int : returns zero on success. On error, -1 is returned.
+ */
+int mkdir(const char *pathname) {
+    int ret = syscall(SYS_MKDIR, (int) pathname, 0, 0);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Deletes a directory, which must be empty.
+ * 
+ * @param pathname : path of the directory
+ * @return int : returns zero on success. On error, -1 is returned.
+ */
+int rmdir(const char *pathname) {
+    int ret = syscall(SYS_RMDIR, (int) pathname, 0, 0);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Changes the current working directory of the calling process 
+ * to the directory specified in path. Paths not starting with '/' are
+ * resolved from the current working directory.
+ * 
+ * @param path : path of the directory
+ * @return int : returns zero on success. On error, -1 is returned.
+ */
+int chdir(const char *path) {
+    int ret = syscall(SYS_CHDIR, (int) path, 0, 0);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Copies the absolute pathname of the current working directory
+ * to buf, of length size.
+ * 
+ * @param buf : buffer for the path
+ * @param size : size of buf
+ * @return char* : buf on success. NULL if the path (with its '\0') does 
+ * not fit in size bytes or on error.
+ */
+char *getcwd(char *buf, size_t size) {
+    int ret = syscall(SYS_GETCWD, (int) buf, (int) size, 0);
+    return (ret < 0) ? NULL : buf;
 }
 
 
@@ -163,6 +401,49 @@ int close(int fd) {
 
 
 
+/**
+ * @brief Creates a pipe, a one-way channel between processes. Data 
+ * written to fds[1] can be read from fds[0]. A read blocks while the 
+ * pipe is empty and returns 0 once all write ends are closed, a write 
+ * blocks while it is full and fails once all read ends are closed.
+ * 
+ * @param fds : fds[0] is set to the read end, fds[1] to the write end
+ * @return int : returns zero on success. On error, -1 is returned.
+ */
+int pipe(int fds[2]) {
+    return (syscall(SYS_PIPE, (int) fds, 0, 0) < 0) ? -1 : 0;
+}
+
+
+
+/**
+ * @brief Makes newfd refer to the same open file as oldfd. If newfd 
+ * was open, it is closed first.
+ * 
+ * @param oldfd : an open file descriptor
+ * @param newfd : the file descriptor to set
+ * @return int : returns newfd on success. On error, -1 is returned.
+ */
+int dup2(int oldfd, int newfd) {
+    int ret = syscall(SYS_DUP2, oldfd, newfd, 0);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Makes the lowest free file descriptor refer to the same open 
+ * file as oldfd. The two share the file pointer.
+ * 
+ * @param oldfd : an open file descriptor
+ * @return int : returns the new file descriptor. On error, -1 is returned.
+ */
+int dup(int oldfd) {
+    int ret = syscall(SYS_DUP, oldfd, 0, 0);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+
 /**
  * @brief Attempts to read up to count bytes from file descriptor fd 
  * into the buffer starting at buf.
@@ -199,6 +480,246 @@ ssize_t write(int fd, const void *buf, size_t count) {
 }
 
 
+/**
+ * @brief Repositions the file offset of the open file fd to offset bytes
+ * from the start (SEEK_SET), the current offset (SEEK_CUR) or the end 
+ * of the file (SEEK_END). For a directory the offset counts entries.
+ * 
+ * @param fd : file descriptor
+ * @param offset : the new offset, relative to whence
+ * @param whence : SEEK_SET, SEEK_CUR or SEEK_END
+ * @return int : the resulting offset from the start of the file. On 
+ * error (fd is a pipe or the terminal, or the offset would be negative),
+ * -1 is returned.
+ */
+int lseek(int fd, int offset, int whence) {
+    int ret = syscall(SYS_LSEEK, fd, offset, whence);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Reads up to count bytes from the regular file fd at offset 
+ * into buf. The file offset is not changed.
+ * 
+ * @param fd : file descriptor
+ * @param buf : read buffer
+ * @param count : number of bytes to be read
+ * @param offset : position in the file to read from
+ * @return ssize_t : the number of bytes read (zero at end of file). 
+ * On error, -1 is returned.
+ */
+ssize_t pread(int fd, void *buf, size_t count, int offset) {
+    /* a system call has three arguments: buf and count go as one iovec */
+    struct iovec iov = { buf, count };
+    int ret = syscall(SYS_PREAD, fd, (int) &iov, offset);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Writes up to count bytes from buf to the regular file fd at 
+ * offset. The file offset is not changed.
+ * 
+ * @param fd : file descriptor
+ * @param buf : write buffer
+ * @param count : number of bytes to write
+ * @param offset : position in the file to write to
+ * @return ssize_t : the number of bytes written. On error, -1 is returned.
+ */
+ssize_t pwrite(int fd, const void *buf, size_t count, int offset) {
+    struct iovec iov = { (void *) buf, count };
+    int ret = syscall(SYS_PWRITE, fd, (int) &iov, offset);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Reads from fd into the iovcnt buffers of iov, filling each 
+ * before the next, with a single system call.
+ * 
+ * @param fd : file descriptor
+ * @param iov : array of buffers
+ * @param iovcnt : number of buffers, at most IOV_MAX
+ * @return ssize_t : the total number of bytes read. On error, -1 is returned.
+ */
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+    int ret = syscall(SYS_READV, fd, (int) iov, iovcnt);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Writes the iovcnt buffers of iov to fd, in order, with a 
+ * single system call.
+ * 
+ * @param fd : file descriptor
+ * @param iov : array of buffers
+ * @param iovcnt : number of buffers, at most IOV_MAX
+ * @return ssize_t : the total number of bytes written. On error, -1 is 
+ * returned.
+ */
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    int ret = syscall(SYS_WRITEV, fd, (int) iov, iovcnt);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Writes the changes of the file system to the disk it is 
+ * mounted from. The kernel also does it every few seconds.
+ * 
+ * @return int : 0 on success, -1 on a write error.
+ */
+int sync(void) {
+    int ret = syscall(SYS_SYNC, 0, 0, 0);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Reads entries of the directory fd into dirp, as many as fit, 
+ * each a struct dirent with the inode, type and size of the file. The 
+ * records follow each other at d_reclen bytes.
+ * 
+ * @param fd : an open directory
+ * @param dirp : buffer for the records
+ * @param count : size of dirp in bytes
+ * @return int : the number of bytes read, 0 at the end of the 
+ * directory. On error, or if dirp cannot hold a record, -1 is returned.
+ */
+int getdents(int fd, struct dirent *dirp, unsigned int count) {
+    int ret = syscall(SYS_GETDENTS, fd, (int)dirp, count);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Gets the inode, type and size of the file pathname names.
+ * 
+ * @param pathname : a path, from the current directory unless it 
+ * starts with '/'
+ * @param statbuf : filled with the information
+ * @return int : 0 on success. On error, -1 is returned.
+ */
+int stat(const char *pathname, struct stat *statbuf) {
+    int ret = syscall(SYS_STAT, (int)pathname, (int)statbuf, 0);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Gets the inode, type and size of the open file fd.
+ * 
+ * @param fd : an open file descriptor
+ * @param statbuf : filled with the information
+ * @return int : 0 on success. On error, -1 is returned.
+ */
+int fstat(int fd, struct stat *statbuf) {
+    int ret = syscall(SYS_FSTAT, fd, (int)statbuf, 0);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Gives a device specific command to an open file, e.g. 
+ * RTC_IRQP_SET to change the frequency of the rtc.
+ * 
+ * @param fd : an open file descriptor
+ * @param cmd : the command
+ * @param arg : the argument of the command
+ * @return int : what the command returns. On error, or if the file 
+ * takes no commands, -1 is returned.
+ */
+int ioctl(int fd, int cmd, int arg) {
+    int ret = syscall(SYS_IOCTL, fd, cmd, arg);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Waits until one of the file descriptors in fds is ready for 
+ * the events asked for: POLLIN (a read would not block), POLLOUT (a 
+ * write would not block). POLLERR, POLLHUP and POLLNVAL are reported 
+ * in revents without being asked for.
+ * 
+ * @param fds : the file descriptors, the events to wait for in events;
+ * the events that happened are stored in revents
+ * @param nfds : number of entries in fds
+ * @param timeout : ms to wait at most, 0 to return at once, negative 
+ * to wait until a file is ready
+ * @return int : the number of entries with revents set, 0 on timeout. 
+ * On error, or if a signal came first, -1 is returned.
+ */
+int poll(struct pollfd *fds, unsigned int nfds, int timeout) {
+    int ret = syscall(SYS_POLL, (int)fds, nfds, timeout);
+    return (ret < 0) ? -1 : ret;
+}
+
+
+/**
+ * @brief Waits until one of the file descriptors in readfds can be read 
+ * or one in writefds can be written without blocking, through poll().
+ * A descriptor at end of file or with an error is ready. There is no 
+ * exceptional condition, exceptfds is cleared.
+ * 
+ * @param nfds : one more than the highest descriptor in the sets, at 
+ * most FD_SETSIZE
+ * @param readfds : descriptors to read, replaced by those ready (may be NULL)
+ * @param writefds : descriptors to write, replaced by those ready (may be NULL)
+ * @param exceptfds : cleared (may be NULL)
+ * @param timeout : time to wait at most, NULL to wait until one is ready
+ * @return int : the number of descriptors in the sets, 0 on timeout. 
+ * On error (a descriptor is not open), or if a signal came first, -1 is returned.
+ */
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    struct pollfd fds[FD_SETSIZE];
+    int fd, i, n = 0, ret, ms = -1;
+
+    if (nfds < 0 || nfds > FD_SETSIZE)
+        return -1;
+
+    for (fd = 0; fd < nfds; ++fd) {
+        fds[n].fd = fd;
+        fds[n].events = 0;
+        if (readfds && FD_ISSET(fd, readfds))
+            fds[n].events |= POLLIN;
+        if (writefds && FD_ISSET(fd, writefds))
+            fds[n].events |= POLLOUT;
+        if (fds[n].events)
+            n++;
+    }
+
+    if (timeout)
+        ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+
+    if ((ret = poll(fds, n, ms)) < 0)
+        return -1;
+
+    if (readfds)
+        FD_ZERO(readfds);
+    if (writefds)
+        FD_ZERO(writefds);
+    if (exceptfds)
+        FD_ZERO(exceptfds);
+
+    for (ret = 0, i = 0; i < n; ++i) {
+        if (fds[i].revents & POLLNVAL)
+            return -1;
+        if ((fds[i].events & POLLIN) && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+            FD_SET(fds[i].fd, readfds);
+            ret++;
+        }
+        if ((fds[i].events & POLLOUT) && (fds[i].revents & (POLLOUT | POLLERR))) {
+            FD_SET(fds[i].fd, writefds);
+            ret++;
+        }
+    }
+
+    return ret;
+}
+
+
 
 /**
  * @brief Change the location of the program break, which defines 
@@ -263,6 +784,25 @@ void *mmap(void *addr, size_t size) {
 
 
 
+/**
+ * @brief Maps length bytes of the open regular file fd, from offset, 
+ * read only. The pages are the blocks of the file system image, so 
+ * nothing is copied; a page is mapped the first time it is touched.
+ * Touching a page past the end of the file, or writing to the mapping,
+ * raises SEGFAULT. The file cannot be truncated while it is mapped.
+ * 
+ * @param fd : an open regular file
+ * @param offset : first byte to map, a multiple of 4096
+ * @param length : number of bytes to map
+ * @return void* : On success, the address of the mapping. On error, 
+ * MAP_FAILED.
+ */
+void *mmap_file(int fd, int offset, size_t length) {
+    int ret = syscall(SYS_MMAP_FILE, fd, offset, (int) length);
+    return (ret < 0) ? MAP_FAILED : (void *) ret;
+}
+
+
 /**
  * @brief Unmap the virtual address space of the calling process
  * 
@@ -279,6 +819,59 @@ int munmap(void *addr, size_t size) {
 }
 
 
-int stat(char *info[]) {
-    return syscall(SYS_STAT, (int) info, 0, 0);
+int procstat(char *info[]) {
+    return syscall(SYS_PROCSTAT, (int) info, 0, 0);
+}
+
+
+/**
+ * @brief Returns the time as the number of seconds since the Epoch, 
+ * 1970-01-01 00:00:00 +0000 (UTC). Read from the vDSO page.
+ * 
+ * @param tloc : if not NULL, the return value is also stored here.
+ * @return time_t : seconds since the Epoch.
+ */
+time_t time(time_t *tloc) {
+    time_t t = vdso->tv_sec;
+
+    if (tloc)
+        *tloc = t;
+    return t;
+}
+
+
+/**
+ * @brief Retrieves the time of the specified clock. Read from the vDSO 
+ * page, and read again if the kernel updated it in the meantime.
+ * 
+ * @param clockid : CLOCK_REALTIME for the wall clock, 
+ * CLOCK_MONOTONIC for the time since boot (ms resolution).
+ * @param tp : the time is stored here.
+ * @return int : 0 on success, -1 on failure.
+ */
+int clock_gettime(int clockid, struct timespec *tp) {
+    unsigned int seq, ticks;
+
+    if (!tp)
+        return -1;
+
+    do {
+        while ((seq = vdso->seq) & 1);
+
+        switch (clockid) {
+        case CLOCK_REALTIME:
+            tp->tv_sec = vdso->tv_sec;
+            tp->tv_nsec = vdso->tv_nsec;
+            break;
+        case CLOCK_MONOTONIC:
+            ticks = vdso->ticks;
+            tp->tv_sec = ticks / 1000;
+            tp->tv_nsec = (ticks % 1000) * 1000000;
+            break;
+        default:
+            return -1;
+        }
+    } while (vdso->seq != seq);
+
+    return 0;
 }
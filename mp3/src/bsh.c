@@ -24,13 +24,22 @@
 #define MAXUSER 32              /* Max number of bytes a user name can be */
 #define MAXLINE 256             /* Max number of bytes a command line can hold */
 #define MAXDIR  256             /* Max number of bytes a directory name can be */
+#define NICEINC 10              /* Default nice increment used by the nice buildin */
+#define NICE_NORMAL 0           /* nice value the commands of the shell start at */
+#define NICE_KEEP   (-100)      /* launch: do not change the nice value */
+#define MAXPIPE 8               /* Max number of commands in a pipeline */
 
 
 /* local function prototypes */
 static int parse(char *buf, char *argv[]);
 static int eval(char *cmd);
-static int buildin(char *argv[]);
+static void launch(char *argv[], int background, int nice);
+static int split(char *buf, char *cmds[]);
+static void pipeline(char *cmds[], int n);
+static int buildin(char *argv[], int background);
 static void echo(char *argv[]);
+static void nice_cmd(char *argv[], int background);
+static void cd(char *argv[]);
 
 
 int main(void) {
@@ -43,8 +52,8 @@ int main(void) {
     // TODO
 
     /* get the current directory */
-    strcpy(dir, "~");
-    // TODO
+    if (!getcwd(dir, MAXDIR))
+        strcpy(dir, "~");
 
     /* REPL: read eval print loop */
     while (1) {
@@ -61,10 +70,12 @@ int main(void) {
         //     exit(0);
     
         /* eval */
-        if (eval(cmdline))
+        if (eval(cmdline)) {
             /* ask for current directory again */
-            // TODO
+            if (!getcwd(dir, MAXDIR))
+                strcpy(dir, "~");
             continue;
+        }
 
         /* add more feature in the future */
         // TODO
@@ -82,40 +93,155 @@ static int eval(char *cmd) {
     char *argv[MAXARGS];    /* argument list for exec() */
     char buf[MAXLINE];      /* holds modified command line */
     int background;         /* does the process run in background? */
-    pid_t pid;              /* process id */
-    // int status;             /* wait process status */
+    char *cmds[MAXPIPE];    /* commands of a pipeline */
+    int n;                  /* number of commands in the pipeline */
     
-    /* parse */
     strcpy(buf, cmd);
+
+    /* cmd1 | cmd2 | ... */
+    if ((n = split(buf, cmds)) > 1) {
+        pipeline(cmds, n);
+        return 0;
+    }
+
+    /* parse */
     background = parse(buf, argv);
 
     /* empty command */
     if (*argv == NULL) return 0;
 
     /* buildin command executes and exits */
-    if (buildin(argv)) return 0;
+    if (buildin(argv, background)) return !strcmp(argv[0], "cd");
+
+    /* not buildin command, start a new process */
+    launch(argv, background, NICE_KEEP);
+
+    return 0;
+}
+
+
+/**
+ * @brief start a command in a new process: vfork borrows our memory 
+ * until the child calls execv, so nothing is copied. The shell waits
+ * for the command unless it runs in background.
+ * 
+ * @param argv : argument list of the command
+ * @param background : 1 if the command runs in background
+ * @param nice : nice value of the command, NICE_KEEP for the default
+ */
+static void launch(char *argv[], int background, int nice) {
+    pid_t pid;              /* process id */
+    int status;             /* exit status of the command */
+
+    if ((pid = vfork()) < 0) {
+        printf("bsh: vfork failed\n");
+        return;
+    }
 
-    /* not buildin command, fork a new process */
-    if (!(pid = Fork())) {
-        /* child process */
+    if (!pid) {
+        /* child process: only system calls until execv, the memory
+         * is still ours */
+        if (nice != NICE_KEEP && setpriority(PRIO_PROCESS, 0, nice) < 0)
+            printf("nice: cannot set priority\n");
         Execv(argv[0], argv);
-    } else {    
-        /* parent process */
-        if (background) {
-            printf("%d is executing %s in background", pid, cmd);
-        } else {
-            /* parent waits for foreground process to terminate */
-            // not implemened yet due to lack of signals
-            // Waitpid(pid, &status);
-        }
     }
-    if (!strcmp(argv[0], "cd"))
-        return 1;
-    return 0;
+
+    /* parent process */
+    if (background)
+        printf("%d is executing %s in background\n", pid, argv[0]);
+    else 
+        waitpid(pid, &status);
 }
 
 
 
+/**
+ * @brief split the command line at each '|'
+ * 
+ * @param buf : copy of the command line, each '|' is replaced by '\0'
+ * @param cmds : commands to be set
+ * @return int : number of commands
+ */
+static int split(char *buf, char *cmds[]) {
+    char *delim;        /* points to the next '|' */
+    int n = 0;          /* number of commands */
+
+    cmds[n++] = buf;
+    while (n < MAXPIPE && (delim = strchr(buf, '|'))) {
+        *delim = '\0';
+        buf = delim + 1;
+        cmds[n++] = buf;
+    }
+
+    return n;
+}
+
+
+/**
+ * @brief run the commands of a pipeline, the standard output of 
+ * each command goes to the standard input of the next one
+ * 
+ * @param cmds : commands of the pipeline
+ * @param n : number of commands
+ */
+static void pipeline(char *cmds[], int n) {
+    char *argv[MAXPIPE][MAXARGS];   /* argument list of each command */
+    int fds[2];                     /* pipe to the next command */
+    int in = 0;                     /* standard input of the next command */
+    pid_t pid;                      /* process id */
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        parse(cmds[i], argv[i]);
+        if (*argv[i] == NULL) {
+            printf("bsh: syntax error near '|'\n");
+            return;
+        }
+    }
+
+    for (i = 0; i < n; ++i) {
+        if (i < n - 1)
+            Pipe(fds);
+
+        /* vfork cannot be wrapped like Fork: the child would return
+         * from the wrapper on our stack */
+        if ((pid = vfork()) < 0) {
+            printf("bsh: vfork failed\n");
+            if (in)
+                close(in);
+            if (i < n - 1) {
+                close(fds[0]);
+                close(fds[1]);
+            }
+            return;
+        }
+
+        if (!pid) {
+            /* child process: read from the previous command, 
+             * write to the next one (in its own copy of the files) */
+            if (in) {
+                Dup2(in, 0);
+                close(in);
+            }
+            if (i < n - 1) {
+                close(fds[0]);
+                Dup2(fds[1], 1);
+                close(fds[1]);
+            }
+            Execv(argv[i][0], argv[i]);
+        }
+
+        /* parent process: the children hold the ends they use */
+        if (in)
+            close(in);
+        if (i < n - 1) {
+            close(fds[1]);
+            in = fds[0];
+        }
+    }
+}
+
+
 /**
  * @brief parse the command line
  * 
@@ -129,8 +255,10 @@ static int parse(char *buf, char *argv[]) {
     int argc;           /* number of arguments */
     int background;     /* does the process run in background? */
 
-    /* replace trailing \n with space */
-    buf[strlen(buf) - 1] = ' ';
+    /* replace trailing \n with space (the last command of a pipeline
+     * has it, the others do not) */
+    if (*buf && buf[strlen(buf) - 1] == '\n')
+        buf[strlen(buf) - 1] = ' ';
 
     /* skipping leading spaces */
     while (*buf && (*buf == ' ')) ++buf;
@@ -146,6 +274,10 @@ static int parse(char *buf, char *argv[]) {
         /* skipping leading spaces */
         while (*buf && (*buf == ' ')) ++buf;
     }
+
+    /* last argument not followed by a space */
+    if (*buf)
+        argv[argc++] = buf;
     argv[argc] = NULL;
 
     /* blank line */
@@ -163,9 +295,10 @@ static int parse(char *buf, char *argv[]) {
  * @brief check if the command is buildin from the bsh
  * 
  * @param argv : argument list
+ * @param background : 1 if the command line ends with '&'
  * @return int 1 if is buildin, 0 otherwise
  */
-int buildin(char *argv[]) {
+int buildin(char *argv[], int background) {
     /* exit from the shell process */
     if (!strcmp(*argv, "exit"))
         exit(0);
@@ -179,6 +312,18 @@ int buildin(char *argv[]) {
     if (!strcmp(*argv, "echo"))
         echo(argv + 1);
     
+    /* run a command at a given nice value */
+    if (!strcmp(*argv, "nice")) {
+        nice_cmd(argv + 1, background);
+        return 1;
+    }
+
+
+    /* change the current directory */
+    if (!strcmp(*argv, "cd")) {
+        cd(argv + 1);
+        return 1;
+    }
 
     /* add more */
     // TODO
@@ -188,6 +333,19 @@ int buildin(char *argv[]) {
 }
 
 
+/**
+ * @brief build-in cd: change to the directory given, or to the root
+ * 
+ * @param argv : arguments after "cd"
+ */
+static void cd(char *argv[]) {
+    const char *path = *argv ? *argv : "/";
+
+    if (chdir(path) < 0)
+        printf("cd: %s: no such directory\n", path);
+}
+
+
 /**
  * @brief build-in function
  * 
@@ -200,3 +358,35 @@ static void echo(char *argv[]) {
             printf(" ");
     }
 }
+
+
+/**
+ * @brief build-in function: nice [-n N] command [args...]
+ * runs command at the default nice value raised by N (default 10),
+ * or prints the nice value of the shell if no command is given
+ * 
+ * @param argv : argument list following "nice"
+ * @param background : 1 if the command runs in background
+ */
+static void nice_cmd(char *argv[], int background) {
+    int inc = NICEINC;      /* nice increment */
+
+    if (*argv && !strcmp(*argv, "-n")) {
+        if (!*(argv + 1)) {
+            printf("nice: option requires an argument -- n\n");
+            return;
+        }
+        inc = atoi(*(argv + 1));
+        argv += 2;
+    }
+
+    /* no command: report the current nice value */
+    if (!*argv) {
+        printf("%d\n", getpriority(PRIO_PROCESS, 0));
+        return;
+    }
+
+    /* the increment is from the nice value commands start at, not 
+     * from the shell's own */
+    launch(argv, background, NICE_NORMAL + inc);
+}
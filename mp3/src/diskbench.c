@@ -0,0 +1,107 @@
+/**
+ * @file diskbench.c
+ * @brief Disk throughput: write a file, sync it to the disk, then read
+ * it in order with large reads and at random offsets with pread(). A
+ * read in order is served from the read ahead window, one disk request
+ * for several blocks; a random read misses the cache and costs a
+ * request per block. The file is larger than the buffer cache, so each
+ * pass goes to the disk. The time of each pass is measured with the
+ * time stamp counter.
+ *
+ * Run it with the file system mounted from a disk (qemu -hdb and root=hdb
+ * on the kernel command line), the image built with enough free blocks
+ * (fsimg build -b 200).
+ *
+ * usage: diskbench
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+
+#define NAME        "diskbench.tmp"
+#define TOTAL       (1 << 19)   /* size of the file */
+#define SEQ_CHUNK   (1 << 14)   /* read() size in order */
+#define RAND_CHUNK  4096        /* pread() size at random */
+#define ROUNDS      4           /* passes for each method */
+
+
+static char buf[SEQ_CHUNK];
+
+/* read the time stamp counter, in units of 1024 cycles */
+static unsigned int rdtsc_k(void) {
+    unsigned int lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (hi << 22) | (lo >> 10);
+}
+
+/* a linear congruential generator, enough to scatter the offsets */
+static unsigned int next_rand(unsigned int *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/* one pass in order, returns the bytes read */
+static int read_seq(int fd) {
+    int n, total = 0;
+
+    lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buf, SEQ_CHUNK)) > 0)
+        total += n;
+
+    return total;
+}
+
+/* as many bytes as in a pass in order, at random block offsets */
+static int read_rand(int fd, int size, unsigned int *seed) {
+    int i, total = 0;
+
+    for (i = 0; i < size / RAND_CHUNK; ++i)
+        total += pread(fd, buf, RAND_CHUNK, (next_rand(seed) % (size / RAND_CHUNK)) * RAND_CHUNK);
+
+    return total;
+}
+
+int main(void) {
+    unsigned int t, seed = 1;
+    int fd, i, n, size;
+
+    if ((fd = creat(NAME)) < 0) {
+        printf("cannot create %s\n", NAME);
+        return 1;
+    }
+
+    for (i = 0; i < SEQ_CHUNK; ++i)
+        buf[i] = i;
+    for (size = 0; size < TOTAL; size += n)
+        if ((n = write(fd, buf, SEQ_CHUNK)) <= 0)
+            break;
+
+    if (size < SEQ_CHUNK || sync() < 0) {
+        printf("cannot write %s\n", NAME);
+        close(fd);
+        unlink(NAME);
+        return 1;
+    }
+
+    printf("file size %d KB\n", size >> 10);
+    printf("pass        Kcycles     KB/Mcycle\n");
+
+    for (i = 0; i < ROUNDS; ++i) {
+        t = rdtsc_k();
+        n = read_seq(fd);
+        t = rdtsc_k() - t;
+        printf("sequential  %u     %u\n", t, (n >> 10) * 1024 / (t ? t : 1));
+    }
+
+    for (i = 0; i < ROUNDS; ++i) {
+        t = rdtsc_k();
+        n = read_rand(fd, size, &seed);
+        t = rdtsc_k() - t;
+        printf("random      %u     %u\n", t, (n >> 10) * 1024 / (t ? t : 1));
+    }
+
+    close(fd);
+    unlink(NAME);
+    sync();
+    return 0;
+}
@@ -0,0 +1,35 @@
+/**
+ * @file mkdir.c
+ * @brief Create or remove directories.
+ *
+ * usage: mkdir dir...
+ *        mkdir -r dir...     remove each (empty) directory
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+
+int main(int argc, char *argv[]) {
+    int i = 1, rm = 0, ret = 0;
+
+    if (argc > 1 && !strcmp(argv[1], "-r")) {
+        rm = 1;
+        ++i;
+    }
+
+    if (i >= argc) {
+        printf("usage: mkdir [-r] dir...\n");
+        return 1;
+    }
+
+    for (; i < argc; ++i) {
+        if ((rm ? rmdir(argv[i]) : mkdir(argv[i])) < 0) {
+            printf("mkdir: cannot %s %s\n", rm ? "remove" : "create", argv[i]);
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
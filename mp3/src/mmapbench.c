@@ -0,0 +1,100 @@
+/**
+ * @file mmapbench.c
+ * @brief Scan a file for newlines, as grep would, through read() into a
+ * buffer and through a read only mapping of the file. read() copies
+ * every byte out of the file system image, the mapping touches the
+ * blocks of the image in place and pays one page fault per page
+ * instead. The time of each pass is measured with the time stamp
+ * counter.
+ *
+ * usage: mmapbench [file]
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+
+#define ROUNDS      16          /* passes over the file for each method */
+#define CHUNK       4096        /* read() size */
+
+
+/* read the time stamp counter, in units of 1024 cycles */
+static unsigned int rdtsc_k(void) {
+    unsigned int lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (hi << 22) | (lo >> 10);
+}
+
+static int count_lines(const char *p, int n) {
+    int lines = 0;
+    while (n--)
+        lines += (*p++ == '\n');
+    return lines;
+}
+
+/* one pass with read(), sets *size to the size of the file */
+static int scan_read(const char *name, int *size) {
+    static char buf[CHUNK];
+    int fd, n, lines = 0;
+
+    if ((fd = open(name)) < 0)
+        return -1;
+
+    *size = 0;
+    while ((n = read(fd, buf, CHUNK)) > 0) {
+        lines += count_lines(buf, n);
+        *size += n;
+    }
+
+    close(fd);
+    return lines;
+}
+
+/* one pass through a mapping of the file */
+static int scan_map(const char *name, int size) {
+    char *p;
+    int fd, lines;
+
+    if ((fd = open(name)) < 0)
+        return -1;
+
+    if ((p = mmap_file(fd, 0, size)) == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    lines = count_lines(p, size);
+    munmap(p, size);
+    return lines;
+}
+
+int main(int argc, char *argv[]) {
+    const char *name = (argc > 1) ? argv[1] : "fish";
+    unsigned int start, t_read, t_map;
+    int i, size, lines, mlines = 0;
+
+    start = rdtsc_k();
+    for (i = 0; i < ROUNDS; ++i)
+        lines = scan_read(name, &size);
+    t_read = rdtsc_k() - start;
+
+    if (lines < 0 || !size) {
+        printf("mmapbench: cannot read %s\n", name);
+        return 1;
+    }
+
+    start = rdtsc_k();
+    for (i = 0; i < ROUNDS; ++i)
+        mlines = scan_map(name, size);
+    t_map = rdtsc_k() - start;
+
+    if (mlines != lines) {
+        printf("mmapbench: mmap_file failed or disagrees (%d, %d lines)\n", mlines, lines);
+        return 1;
+    }
+
+    printf("%s: %d bytes, %d lines\n", name, size, lines);
+    printf("read()     %u Kcycles/pass\n", t_read / ROUNDS);
+    printf("mmap_file  %u Kcycles/pass\n", t_map / ROUNDS);
+    return 0;
+}
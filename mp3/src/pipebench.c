@@ -0,0 +1,75 @@
+/**
+ * @file pipebench.c
+ * @brief Pipe throughput: a child reads everything from a pipe with a
+ * large buffer while the parent writes the same amount of data in
+ * chunks of different sizes. Small writes go through the ring buffer
+ * of the pipe, writes above PIPE_BUF bytes to a waiting reader are
+ * copied straight into its buffer. The time of each run is measured
+ * with the time stamp counter.
+ *
+ * usage: pipebench
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define TOTAL       (1 << 22)   /* bytes sent in one run */
+#define MAXCHUNK    (1 << 16)   /* largest write, also the read buffer */
+
+
+/* read the time stamp counter, in units of 1024 cycles */
+static unsigned int rdtsc_k(void) {
+    unsigned int lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (hi << 22) | (lo >> 10);
+}
+
+/* send TOTAL bytes in writes of chunk bytes, return Kcycles */
+static unsigned int run(int chunk, char *buf) {
+    int fds[2];
+    unsigned int start, sent;
+    int n;
+
+    if (pipe(fds) < 0) {
+        printf("pipe failed!\n");
+        return 0;
+    }
+
+    if (!Fork()) {
+        /* child: drain the pipe until the writer closes it */
+        close(fds[1]);
+        while (read(fds[0], buf, MAXCHUNK) > 0)
+            ;
+        exit(0);
+    }
+
+    close(fds[0]);
+    start = rdtsc_k();
+
+    for (sent = 0; sent < TOTAL; sent += n) {
+        if ((n = write(fds[1], buf, chunk)) <= 0) {
+            printf("write failed!\n");
+            break;
+        }
+    }
+
+    close(fds[1]);
+    return rdtsc_k() - start;
+}
+
+int main(void) {
+    char *buf = malloc(MAXCHUNK);
+    unsigned int t;
+    int chunk;
+
+    printf("write size  Kcycles     KB/Mcycle\n");
+
+    for (chunk = 256; chunk <= MAXCHUNK; chunk <<= 2) {
+        if (!(t = run(chunk, buf)))
+            return 1;
+        printf("%d        %u     %u\n", chunk, t, (TOTAL >> 10) * 1024 / t);
+    }
+
+    return 0;
+}
@@ -59,7 +59,7 @@ int main(void) {
     }
 
     // while(1) {
-        nproc = stat(info);
+        nproc = procstat(info);
         print_stat(nproc, info);
 
         // if (nproc >= sum_proc / 2) {
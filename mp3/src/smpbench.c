@@ -0,0 +1,86 @@
+/**
+ * @file smpbench.c
+ * @brief CPU-bound scaling benchmark: the same amount of work is split
+ * between 1, 2, 4 and 8 processes, and the time of each run is measured
+ * with the time stamp counter. fork places each child on the CPU with the
+ * fewest runnable tasks, so with several CPUs the run time goes down with
+ * more processes, on one CPU it stays the same.
+ *
+ * Processes are used rather than threads: threads sharing an address
+ * space stay on the CPU of their parent.
+ *
+ * usage: smpbench
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define MAXPROCS    8
+#define WORK        (1 << 26)   /* total loop iterations of one run */
+
+static volatile unsigned int sink;
+
+
+/* read the time stamp counter, in units of 1024 cycles */
+static unsigned int rdtsc_k(void) {
+    unsigned int lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (hi << 22) | (lo >> 10);
+}
+
+/* one share of the work, in the child */
+static void worker(int id, int nprocs) {
+    unsigned int i, n, x = id;
+
+    n = WORK / nprocs;
+
+    for (i = 0; i < n; ++i)
+        x = x * 1103515245 + 12345;
+
+    sink = x;
+
+    _exit(0);
+}
+
+/* run the work with nprocs processes, return Kcycles, 0 on error */
+static unsigned int run(int nprocs) {
+    pid_t pids[MAXPROCS];
+    unsigned int start;
+    int i, status;
+
+    start = rdtsc_k();
+
+    for (i = 0; i < nprocs; ++i) {
+        if ((pids[i] = fork()) < 0) {
+            printf("fork failed!\n");
+            while (i--)
+                waitpid(pids[i], &status);
+            return 0;
+        }
+        if (!pids[i])
+            worker(i, nprocs);
+    }
+
+    for (i = 0; i < nprocs; ++i)
+        waitpid(pids[i], &status);
+
+    return rdtsc_k() - start;
+}
+
+int main(void) {
+    unsigned int base = 0, t;
+    int n;
+
+    printf("procs    Kcycles     speedup(x100)\n");
+
+    for (n = 1; n <= MAXPROCS; n <<= 1) {
+        if (!(t = run(n)))
+            return 1;
+        if (n == 1)
+            base = t;
+        printf("%d        %u     %u\n", n, t, base * 100 / t);
+    }
+
+    return 0;
+}
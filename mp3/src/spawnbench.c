@@ -0,0 +1,122 @@
+/**
+ * @file spawnbench.c
+ * @brief Shell command throughput: a trivial command (this program with
+ * -c, which exits at once) is started many times, the way a shell does,
+ * through fork + execv, through vfork + execv and through execute, and
+ * the number of commands per second is measured. fork copies the whole
+ * address space only for execv to throw it away, vfork borrows it until
+ * execv, and execute builds the child straight from the file.
+ *
+ * The parent waits for each command by reading a pipe the child holds
+ * the write end of, which reaches end of file when the child exits.
+ *
+ * usage: spawnbench
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NCMDS       200         /* commands started in one run */
+
+#define FORK        0
+#define VFORK       1
+
+
+/* read the time stamp counter, in units of 1024 cycles */
+static unsigned int rdtsc_k(void) {
+    unsigned int lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (hi << 22) | (lo >> 10);
+}
+
+/* start argv[0] with fork or vfork and wait for it, return -1 on error */
+static int spawn(int how, char *const argv[]) {
+    int fds[2];
+    char c;
+    pid_t pid;
+
+    if (pipe(fds) < 0)
+        return -1;
+
+    pid = (how == VFORK) ? vfork() : fork();
+
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (!pid) {
+        /* child: keep the write end open across execv */
+        close(fds[0]);
+        execv(argv[0], argv);
+        _exit(1);
+    }
+
+    close(fds[1]);
+    while (read(fds[0], &c, 1) > 0)
+        ;
+    close(fds[0]);
+
+    return 0;
+}
+
+/* start NCMDS commands, return Kcycles, 0 on error */
+static unsigned int run(int how, char *const argv[], const char *cmd) {
+    unsigned int start;
+    int i;
+
+    start = rdtsc_k();
+
+    for (i = 0; i < NCMDS; ++i) {
+        if (cmd ? execute(cmd) < 0 : spawn(how, argv) < 0) {
+            printf("spawn failed!\n");
+            return 0;
+        }
+    }
+
+    return rdtsc_k() - start;
+}
+
+/* print one result line, with the commands per second from the ms clock */
+static void report(const char *name, unsigned int t, unsigned int ms) {
+    printf("%s  %u Kcycles/cmd  %u cmds/s\n", name, t / NCMDS,
+           ms ? NCMDS * 1000 / ms : 0);
+}
+
+int main(int argc, char *argv[]) {
+    char *child[3];
+    char cmd[64];
+    unsigned int t, ms;
+
+    /* the command being started */
+    if (argc > 1 && !strcmp(argv[1], "-c"))
+        return 0;
+
+    child[0] = argv[0];
+    child[1] = "-c";
+    child[2] = NULL;
+    sprintf(cmd, "%s -c", argv[0]);
+
+    /* warm up the file system and the page allocator */
+    run(VFORK, child, NULL);
+
+    ms = vdso->ticks;
+    if (!(t = run(FORK, child, NULL)))
+        return 1;
+    report("fork+execv ", t, vdso->ticks - ms);
+
+    ms = vdso->ticks;
+    if (!(t = run(VFORK, child, NULL)))
+        return 1;
+    report("vfork+execv", t, vdso->ticks - ms);
+
+    ms = vdso->ticks;
+    if (!(t = run(0, NULL, cmd)))
+        return 1;
+    report("execute    ", t, vdso->ticks - ms);
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file sysbench.c
+ * @brief Null system call latency: getpid() is called many times through
+ * the int $0x80 gate, through SYSENTER and through the vDSO page (no
+ * kernel entry at all), and the average cost of one call is measured
+ * with the time stamp counter.
+ *
+ * Then the file operation path: a read() of 0 bytes from a regular file
+ * and an ioctl() on the rtc, each dispatched through the operation table
+ * of the open file, measure what the file layer adds to a system call.
+ *
+ * usage: sysbench
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+
+#define NCALLS      100000
+#define NAME        "sysbench.tmp"
+
+typedef int (*syscall_t)(sysnum, int, int, int);
+
+
+/* read the time stamp counter, in units of 16 cycles */
+static unsigned int rdtsc16(void) {
+    unsigned int lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (hi << 28) | (lo >> 4);
+}
+
+/* return the cycles of one call, averaged over NCALLS calls */
+static unsigned int run(syscall_t call, sysnum num, int a, int b, int c) {
+    unsigned int start, i;
+
+    start = rdtsc16();
+
+    for (i = 0; i < NCALLS; ++i)
+        call(num, a, b, c);
+
+    return (rdtsc16() - start) * 16 / NCALLS;
+}
+
+/* the same for the library getpid(), which reads the vDSO page */
+static unsigned int run_vdso(void) {
+    unsigned int start, i;
+
+    start = rdtsc16();
+
+    for (i = 0; i < NCALLS; ++i)
+        getpid();
+
+    return (rdtsc16() - start) * 16 / NCALLS;
+}
+
+int main(void) {
+    unsigned int trap, fast, vdso_cost, read_cost, ioctl_cost;
+    char c;
+    int fd;
+
+    /* warm up the caches and the TLB */
+    run(syscall_int80, SYS_GETPID, 0, 0, 0);
+
+    trap = run(syscall_int80, SYS_GETPID, 0, 0, 0);
+    fast = run(syscall, SYS_GETPID, 0, 0, 0);
+    vdso_cost = run_vdso();
+
+    printf("int $0x80   %u cycles/call\n", trap);
+    printf("syscall()   %u cycles/call\n", fast);
+    printf("getpid()    %u cycles/call (vDSO)\n", vdso_cost);
+    if (fast)
+        printf("speedup     %u.%u%ux\n", trap / fast, (trap * 10 / fast) % 10, (trap * 100 / fast) % 10);
+
+    if ((fd = creat(NAME)) >= 0) {
+        write(fd, "x", 1);
+        read_cost = run(syscall, SYS_READ, fd, (int)&c, 0);
+        printf("read()      %u cycles/call (0 bytes, regular file)\n", read_cost);
+        close(fd);
+        unlink(NAME);
+    }
+
+    if ((fd = open("rtc")) >= 0) {
+        ioctl_cost = run(syscall, SYS_IOCTL, fd, RTC_IRQP_READ, 0);
+        printf("ioctl()     %u cycles/call (rtc, RTC_IRQP_READ)\n", ioctl_cost);
+        close(fd);
+    }
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define NTHREADS    4
+#define NLOOPS      1000
+#define STACKSIZE   4096
+
+static int lock;            /* 0: unlocked, 1: locked */
+static int counter;         /* protected by lock */
+static int done;            /* number of threads finished */
+
+
+/* atomically set *p to new if it is old, return the old value */
+static int cmpxchg(int *p, int old, int new) {
+    int prev;
+    asm volatile("lock; cmpxchgl %2, %1"
+                 : "=a"(prev), "+m"(*p)
+                 : "r"(new), "0"(old)
+                 : "memory");
+    return prev;
+}
+
+static void mutex_lock(int *m) {
+    while (cmpxchg(m, 0, 1))
+        futex(m, FUTEX_WAIT, 1);
+}
+
+static void mutex_unlock(int *m) {
+    *m = 0;
+    futex(m, FUTEX_WAKE, 1);
+}
+
+static int worker(void *arg) {
+    int i;
+
+    for (i = 0; i < NLOOPS; ++i) {
+        mutex_lock(&lock);
+        counter++;
+        mutex_unlock(&lock);
+    }
+
+    mutex_lock(&lock);
+    done++;
+    mutex_unlock(&lock);
+    futex(&done, FUTEX_WAKE, 1);
+
+    return 0;
+}
+
+
+/**
+ * @expected:
+ * counter = 4000
+ */
+int main(void) {
+    int i, n;
+
+    for (i = 0; i < NTHREADS; ++i) {
+        if (clone(worker, (char *)malloc(STACKSIZE) + STACKSIZE, NULL) < 0) {
+            printf("clone failed!\n");
+            return 1;
+        }
+    }
+
+    /* wait for all workers */
+    while ((n = done) < NTHREADS)
+        futex(&done, FUTEX_WAIT, n);
+
+    printf("counter = %d\n", counter);
+    return 0;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file ticker.c
+ * @brief An event loop on poll(): the program sleeps until the rtc
+ * ticks or a line is typed, whichever comes first. It counts the ticks
+ * of the rtc at 2 Hz and prints the time every second, and echoes the
+ * lines typed in between without waiting for a tick. A line "q" quits.
+ *
+ * usage: ticker
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+
+#define RTC_FREQ    2           /* ticks per second */
+#define LINE        128
+
+
+int main(void) {
+    struct pollfd fds[2];
+    char line[LINE];
+    int rtc, n, ticks = 0;
+
+    if ((rtc = open("rtc")) < 0 || ioctl(rtc, RTC_IRQP_SET, RTC_FREQ) < 0) {
+        printf("cannot open the rtc\n");
+        return 1;
+    }
+
+    fds[0].fd = 0;
+    fds[0].events = POLLIN;
+    fds[1].fd = rtc;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0)
+            break;
+
+        if (fds[1].revents & POLLIN) {
+            read(rtc, &n, sizeof(n));
+            if (!(++ticks % RTC_FREQ))
+                printf("%d s\n", ticks / RTC_FREQ);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            if ((n = read(0, line, LINE - 1)) <= 0)
+                break;
+            line[n] = '\0';
+            if (line[0] == 'q' && line[1] == '\n')
+                break;
+            printf("typed: %s", line);
+        }
+    }
+
+    close(rtc);
+    return 0;
+}
@@ -0,0 +1,402 @@
+/**
+ * @file ata.c
+ * @brief IDE/ATA disks, in PIO mode.
+ * @overview:
+ * The four drives of the two IDE channels (the disks -hda to -hdd of
+ * QEMU) are probed with IDENTIFY DEVICE, and each ATA drive found is
+ * registered as a block device ("hda" to "hdd"). A request for a run of
+ * blocks is one READ SECTORS or WRITE SECTORS command of up to 256
+ * sectors (BIO_MAX blocks) in LBA28, the sectors moving through the
+ * data port with rep insw / rep outsw.
+ *
+ * A command is issued under ata_mutex, a sleeping lock, as the thread
+ * sleeps until the drive is done. At boot the device interrupts are off
+ * (nIEN) and the driver polls the status register: the file system is
+ * mounted and the first programs are loaded before the scheduler runs.
+ * ata_irq_init() then turns the interrupts on, and a request sleeps on
+ * ata_queue until the interrupt of its channel, raised when a sector can
+ * be transferred or the command is done. Drives that only do packet
+ * commands (CD-ROMs) are skipped.
+ *
+ * @reference:
+ * ATA/ATAPI-6, T13/1410D (8.15 IDENTIFY DEVICE, 8.34 READ SECTORS, 8.62 WRITE SECTORS)
+ * https://wiki.osdev.org/ATA_PIO_Mode
+ *
+ */
+
+#include <drivers/ata.h>
+#include <drivers/blkdev.h>
+#include <boot/i8259.h>
+#include <pro/mutex.h>
+#include <pro/wait.h>
+#include <spinlock.h>
+#include <errno.h>
+#include <lib.h>
+
+
+static ata_drive_t drives[ATA_DRIVES];
+static DEFINE_MUTEX(ata_mutex);             /* one command at a time on the channels */
+static DEFINE_SPINLOCK(ata_irq_lock);       /* protects ata_irq_seen and ata_queue */
+static DECLARE_WAIT_QUEUE_HEAD(ata_queue);  /* the request waiting for an interrupt */
+static volatile uint8_t ata_irq_seen[ATA_CHANNELS]; /* an interrupt came since the command or the last wait */
+static uint8_t ata_irq_on;                  /* requests sleep until the interrupt, they poll before */
+
+static const uint16_t ata_base[ATA_CHANNELS] = { ATA_PRIMARY, ATA_SECONDARY };
+static const uint16_t ata_ctl[ATA_CHANNELS] = { ATA_PRIMARY_CTL, ATA_SECONDARY_CTL };
+static const uint8_t ata_irq[ATA_CHANNELS] = { ATA_PRIMARY_IRQ, ATA_SECONDARY_IRQ };
+
+
+static int32_t ata_probe(ata_drive_t *d);
+static int32_t ata_read(blkdev_t *dev, uint32_t block, uint32_t count, int8_t **bufs);
+static int32_t ata_write(blkdev_t *dev, uint32_t block, uint32_t count, int8_t **bufs);
+static int32_t ata_flush(blkdev_t *dev);
+static int32_t ata_rw(ata_drive_t *d, uint32_t block, uint32_t count, int8_t **bufs, uint8_t cmd);
+static int32_t ata_command(ata_drive_t *d, uint32_t lba, uint32_t nsect, uint8_t cmd);
+static int32_t ata_wait(ata_drive_t *d, int32_t drq);
+static int32_t ata_intr_wait(ata_drive_t *d, int32_t drq);
+static void ata_intr(uint32_t ch);
+static void ata_delay(ata_drive_t *d);
+
+
+/**
+ * @brief find the drives and register them as block devices
+ *
+ */
+void ata_init(void) {
+    ata_drive_t *d;
+    uint32_t i;
+
+    for (i = 0; i < ATA_DRIVES; ++i) {
+        d = &drives[i];
+        d->channel = i / 2;
+        d->base = ata_base[d->channel];
+        d->ctl = ata_ctl[d->channel];
+        d->slave = i & 1;
+
+        if (ata_probe(d) < 0)
+            continue;
+
+        d->dev.name[0] = 'h';
+        d->dev.name[1] = 'd';
+        d->dev.name[2] = 'a' + i;
+        d->dev.name[3] = '\0';
+        d->dev.read = ata_read;
+        d->dev.write = ata_write;
+        d->dev.flush = ata_flush;
+        d->dev.private_data = d;
+
+        blkdev_register(&d->dev);
+    }
+}
+
+
+/**
+ * @brief let the channels with a drive interrupt, a request sleeps until
+ * the interrupt from now on. Called once, when the programs of the boot
+ * are loaded and before interrupts are turned on.
+ *
+ */
+void ata_irq_init(void) {
+    uint32_t i, ch;
+
+    for (ch = 0; ch < ATA_CHANNELS; ++ch) {
+        for (i = 0; i < ATA_DRIVES; ++i)
+            if (drives[i].channel == ch && drives[i].dev.read)
+                break;
+        if (i == ATA_DRIVES)
+            continue;
+
+        /* nIEN off, and a pending interrupt acknowledged */
+        outb(0, ata_ctl[ch]);
+        inb(ata_base[ch] + ATA_STATUS);
+        enable_irq(ata_irq[ch]);
+    }
+
+    ata_irq_on = 1;
+}
+
+
+/**
+ * @brief interrupt of the primary channel
+ *
+ */
+void do_ata_primary(void) {
+    ata_intr(0);
+}
+
+
+/**
+ * @brief interrupt of the secondary channel
+ *
+ */
+void do_ata_secondary(void) {
+    ata_intr(1);
+}
+
+
+/**
+ * @brief identify a drive and get its size
+ *
+ * @param d : the drive, with base, ctl and slave set
+ * @return int32_t : 0 if it is an ATA drive, -ENODEV otherwise
+ */
+static int32_t ata_probe(ata_drive_t *d) {
+    uint16_t id[ATA_SECTOR / 2];
+    uint32_t i, sectors;
+
+    outb(ATA_NIEN, d->ctl);
+
+    outb(0xA0 | (d->slave << 4), d->base + ATA_DRIVE);
+    ata_delay(d);
+
+    /* nothing on the channel: the bus floats high */
+    if (inb(d->base + ATA_STATUS) == 0xFF)
+        return -ENODEV;
+
+    outb(0, d->base + ATA_NSECT);
+    outb(0, d->base + ATA_LBA0);
+    outb(0, d->base + ATA_LBA1);
+    outb(0, d->base + ATA_LBA2);
+    outb(ATA_IDENTIFY, d->base + ATA_COMMAND);
+    ata_delay(d);
+
+    if (!inb(d->base + ATA_STATUS))
+        return -ENODEV;
+
+    for (i = 0; i < ATA_TIMEOUT && (inb(d->base + ATA_STATUS) & ATA_BSY); ++i)
+        ;
+
+    /* a packet device sets a signature here and aborts the command */
+    if (i == ATA_TIMEOUT || inb(d->base + ATA_LBA1) || inb(d->base + ATA_LBA2))
+        return -ENODEV;
+
+    if (ata_wait(d, 1) < 0)
+        return -ENODEV;
+
+    insw(d->base + ATA_DATA, id, ATA_SECTOR / 2);
+
+    /* word 49 bit 9: LBA, words 60-61: sectors reachable with LBA28 */
+    sectors = id[60] | ((uint32_t)id[61] << 16);
+    if (!(id[49] & (1 << 9)) || sectors < ATA_BLOCK_SECT)
+        return -ENODEV;
+
+    d->dev.nblocks = sectors / ATA_BLOCK_SECT;
+    return 0;
+}
+
+
+/**
+ * @brief read consecutive blocks (blk_rw_t of the drive)
+ *
+ * @param dev : the drive
+ * @param block : first block
+ * @param count : number of blocks
+ * @param bufs : a buffer for each block
+ * @return int32_t : 0 on success, -EIO on error
+ */
+static int32_t ata_read(blkdev_t *dev, uint32_t block, uint32_t count, int8_t **bufs) {
+    return ata_rw(dev->private_data, block, count, bufs, ATA_READ);
+}
+
+
+/**
+ * @brief write consecutive blocks (blk_rw_t of the drive)
+ *
+ * @param dev : the drive
+ * @param block : first block
+ * @param count : number of blocks
+ * @param bufs : a buffer for each block
+ * @return int32_t : 0 on success, -EIO on error
+ */
+static int32_t ata_write(blkdev_t *dev, uint32_t block, uint32_t count, int8_t **bufs) {
+    return ata_rw(dev->private_data, block, count, bufs, ATA_WRITE);
+}
+
+
+/**
+ * @brief put the data in the write cache of the drive on the media
+ *
+ * @param dev : the drive
+ * @return int32_t : 0 on success, -EIO on error
+ */
+static int32_t ata_flush(blkdev_t *dev) {
+    ata_drive_t *d = dev->private_data;
+    int32_t errno;
+
+    mutex_lock(&ata_mutex);
+
+    if (!(errno = ata_command(d, 0, 0, ATA_FLUSH)))
+        errno = ata_intr_wait(d, 0);
+
+    mutex_unlock(&ata_mutex);
+    return errno;
+}
+
+
+/**
+ * @brief move blocks between the drive and the buffers, 256 sectors
+ * (BIO_MAX blocks) per command
+ *
+ * @param d : the drive
+ * @param block : first block
+ * @param count : number of blocks
+ * @param bufs : a buffer for each block
+ * @param cmd : ATA_READ or ATA_WRITE
+ * @return int32_t : 0 on success, -EIO on error
+ */
+static int32_t ata_rw(ata_drive_t *d, uint32_t block, uint32_t count, int8_t **bufs, uint8_t cmd) {
+    uint32_t lba, nsect, s;
+    int8_t *buf;
+
+    if (block >= d->dev.nblocks || count > d->dev.nblocks - block)
+        return -EIO;
+
+    mutex_lock(&ata_mutex);
+
+    while (count) {
+        nsect = (count < BIO_MAX) ? count * ATA_BLOCK_SECT : BIO_MAX * ATA_BLOCK_SECT;
+        lba = block * ATA_BLOCK_SECT;
+
+        /* a sector count of 0 means 256 */
+        if (ata_command(d, lba, nsect & 0xFF, cmd) < 0)
+            goto error;
+
+        for (s = 0; s < nsect; ++s) {
+            /* the first sector of a write is asked for without an interrupt */
+            if (((cmd == ATA_WRITE && !s) ? ata_wait(d, 1) : ata_intr_wait(d, 1)) < 0)
+                goto error;
+
+            buf = bufs[s / ATA_BLOCK_SECT] + (s % ATA_BLOCK_SECT) * ATA_SECTOR;
+            if (cmd == ATA_READ)
+                insw(d->base + ATA_DATA, buf, ATA_SECTOR / 2);
+            else
+                outsw(d->base + ATA_DATA, buf, ATA_SECTOR / 2);
+        }
+
+        /* the last sector of a write is on the drive at the next interrupt */
+        if (cmd == ATA_WRITE && ata_intr_wait(d, 0) < 0)
+            goto error;
+
+        block += nsect / ATA_BLOCK_SECT;
+        bufs += nsect / ATA_BLOCK_SECT;
+        count -= nsect / ATA_BLOCK_SECT;
+    }
+
+    mutex_unlock(&ata_mutex);
+    return 0;
+
+error:
+    mutex_unlock(&ata_mutex);
+    printf("%s: %s error at block %d\n", d->dev.name, (cmd == ATA_READ) ? "read" : "write", block);
+    return -EIO;
+}
+
+
+/**
+ * @brief select the drive and issue a command with an LBA28 address,
+ * with ata_mutex held
+ *
+ * @param d : the drive
+ * @param lba : first sector, below ATA_LBA28_MAX
+ * @param nsect : sector count register (0 for 256)
+ * @param cmd : the command
+ * @return int32_t : 0 on success, -EIO if the drive stays busy
+ */
+static int32_t ata_command(ata_drive_t *d, uint32_t lba, uint32_t nsect, uint8_t cmd) {
+    outb(0xE0 | (d->slave << 4) | ((lba >> 24) & 0x0F), d->base + ATA_DRIVE);
+    ata_delay(d);
+
+    if (ata_wait(d, 0) < 0)
+        return -EIO;
+
+    outb(nsect, d->base + ATA_NSECT);
+    outb(lba & 0xFF, d->base + ATA_LBA0);
+    outb((lba >> 8) & 0xFF, d->base + ATA_LBA1);
+    outb((lba >> 16) & 0xFF, d->base + ATA_LBA2);
+
+    /* the interrupts of an earlier command do not count */
+    ata_irq_seen[d->channel] = 0;
+    outb(cmd, d->base + ATA_COMMAND);
+    ata_delay(d);
+
+    return 0;
+}
+
+
+/**
+ * @brief poll the status until the drive is not busy
+ *
+ * @param d : the drive
+ * @param drq : 1 to also wait until a sector can be transferred
+ * @return int32_t : 0 on success, -EIO on an error, a fault or a timeout
+ */
+static int32_t ata_wait(ata_drive_t *d, int32_t drq) {
+    uint32_t i, status;
+
+    for (i = 0; i < ATA_TIMEOUT; ++i) {
+        status = inb(d->base + ATA_STATUS);
+        if (status & ATA_BSY)
+            continue;
+        if (status & (ATA_ERR | ATA_DF))
+            return -EIO;
+        if (!drq || (status & ATA_DRQ))
+            return 0;
+    }
+
+    return -EIO;
+}
+
+
+/**
+ * @brief wait for the next step of a command: sleep until the interrupt
+ * of the channel once interrupts are on, then check the status as
+ * ata_wait() does. Polls before that.
+ *
+ * @param d : the drive
+ * @param drq : 1 if a sector is to be transferred
+ * @return int32_t : 0 on success, -EIO on an error or a fault
+ */
+static int32_t ata_intr_wait(ata_drive_t *d, int32_t drq) {
+    uint32_t flags;
+
+    if (ata_irq_on) {
+        spin_lock_irqsave(&ata_irq_lock, flags);
+        while (!ata_irq_seen[d->channel])
+            sleep_on_uninterruptible(&ata_queue, &ata_irq_lock);
+        ata_irq_seen[d->channel] = 0;
+        spin_unlock_irqrestore(&ata_irq_lock, flags);
+    }
+
+    return ata_wait(d, drq);
+}
+
+
+/**
+ * @brief an interrupt of a channel: acknowledge it by reading the status
+ * and wake up the request waiting for it
+ *
+ * @param ch : the channel
+ */
+static void ata_intr(uint32_t ch) {
+    /* interrupts are already off in the handler */
+    spin_lock(&ata_irq_lock);
+    inb(ata_base[ch] + ATA_STATUS);
+    ata_irq_seen[ch] = 1;
+    wake_up(&ata_queue);
+    send_eoi(ata_irq[ch]);
+    spin_unlock(&ata_irq_lock);
+}
+
+
+/**
+ * @brief wait 400ns for the status to be valid after a drive select or
+ * a command, by reading the alternate status register four times
+ *
+ * @param d : the drive
+ */
+static void ata_delay(ata_drive_t *d) {
+    inb(d->ctl);
+    inb(d->ctl);
+    inb(d->ctl);
+    inb(d->ctl);
+}
@@ -0,0 +1,508 @@
+/**
+ * @file blkdev.c
+ * @brief Block devices and the buffer cache.
+ * @overview:
+ * A disk driver registers a blkdev_t that reads and writes runs of
+ * consecutive BLOCK_SIZE blocks. Blocks are used through the buffer
+ * cache: NBUF buffers, hashed by (disk, block) and kept on an LRU list.
+ * bread() returns a held buffer with the data of a block, reading it
+ * only on a miss, brelse() lets it go. A buffer is reused for another
+ * block only when nobody holds it, the least recently used one first.
+ *
+ * Writes are written back: bdirty() marks a buffer, and the data goes
+ * to the disk when the buffer is reused or at bsync(), which sorts the
+ * dirty blocks and writes each run of consecutive blocks with a single
+ * request. bsync_blocks() does the same for a range of blocks only, so
+ * that the owner of the disk can order its writes. Before a buffer is
+ * written back to be reused, the pre_evict hook of the disk lets the
+ * owner prepare for a block reaching the disk out of that order.
+ *
+ * breada() reads a list of blocks ahead of their use: the missing ones
+ * that follow each other on the disk are read with a single request, so
+ * a file read in order costs one request per window instead of one per
+ * block.
+ *
+ * A request sleeps until the disk is done, so bcache_lock is dropped
+ * around it. The buffers of the request are held and marked B_BUSY in
+ * the meantime: they are not reused, and a thread that wants one of them
+ * sleeps on bwait until the request is over.
+ *
+ * @reference:
+ * Bovet, Daniel P. and Cesati, Marco, Understanding the Linux Kernel (Chapter 15, The Page Cache)
+ * Love, Robert, Linux Kernel Development (Chapter 14, The Block I/O Layer)
+ *
+ */
+
+#include <drivers/blkdev.h>
+#include <pro/wait.h>
+#include <kmalloc.h>
+#include <spinlock.h>
+#include <errno.h>
+#include <lib.h>
+
+
+static blkdev_t *blkdevs[BLKDEV_MAX];   /* registered disks */
+static uint32_t nblkdev;
+
+static buf_t bufs[NBUF];
+static buf_t *bhash[BHASH_SIZE];        /* first buffer of each bucket */
+static LIST_HEAD(lru);                  /* all buffers, most recently used first */
+static DEFINE_SPINLOCK(bcache_lock);    /* protects the buffers, the hash and the LRU list */
+static DECLARE_WAIT_QUEUE_HEAD(bwait);  /* threads waiting for a busy buffer */
+
+#define bhashfn(dev, block)     ((((uint32_t)(dev) >> 4) ^ (block)) & (BHASH_SIZE - 1))
+
+
+static buf_t *lookup(blkdev_t *dev, uint32_t block);
+static buf_t *getblk(blkdev_t *dev, uint32_t block);
+static void unhash(buf_t *b);
+static void touch(buf_t *b);
+static void wait_buf(buf_t *b);
+static int32_t read_run(buf_t **run, uint32_t n);
+static int32_t write_run(buf_t **run, uint32_t n);
+
+
+/**
+ * @brief make a disk known to the kernel
+ *
+ * @param dev : the disk, filled in by its driver
+ * @return int32_t : its index, -ENOSPC if BLKDEV_MAX disks are registered
+ */
+int32_t blkdev_register(blkdev_t *dev) {
+    if (nblkdev == BLKDEV_MAX)
+        return -ENOSPC;
+
+    blkdevs[nblkdev] = dev;
+    return nblkdev++;
+}
+
+
+/**
+ * @brief the ith registered disk
+ *
+ * @param i : index, in the order of registration
+ * @return blkdev_t* : the disk, NULL if there are not so many
+ */
+blkdev_t *blkdev_get(uint32_t i) {
+    return (i < nblkdev) ? blkdevs[i] : NULL;
+}
+
+
+/**
+ * @brief allocate the buffers of the cache
+ *
+ */
+void bcache_init(void) {
+    uint32_t i;
+
+    for (i = 0; i < NBUF; ++i) {
+        if (!(bufs[i].data = get_page(0)))
+            panic("cannot allocate the buffer cache");
+
+        bufs[i].dev = NULL;
+        bufs[i].flags = 0;
+        bufs[i].count = 0;
+        bufs[i].hnext = NULL;
+        list_add_tail(&bufs[i].lru, &lru);
+    }
+}
+
+
+/**
+ * @brief get a block, read from the disk if it is not cached
+ *
+ * @param dev : the disk
+ * @param block : block number
+ * @return buf_t* : the buffer, held until brelse(), NULL on a read error
+ *                  or if every buffer is held
+ */
+buf_t *bread(blkdev_t *dev, uint32_t block) {
+    uint32_t flags;
+    buf_t *b;
+
+    spin_lock_irqsave(&bcache_lock, flags);
+
+    if (!(b = getblk(dev, block))) {
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return NULL;
+    }
+
+    b->count++;
+    touch(b);
+    wait_buf(b);
+
+    if (!(b->flags & B_VALID)) {
+        b->flags |= B_BUSY;
+        if (read_run(&b, 1) < 0) {
+            b->count--;
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            return NULL;
+        }
+    }
+
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return b;
+}
+
+
+/**
+ * @brief get a buffer for a block that is about to be overwritten
+ * whole, without reading it. The data is undefined unless the block
+ * was cached, the caller fills it and calls bdirty().
+ *
+ * @param dev : the disk
+ * @param block : block number
+ * @return buf_t* : the buffer, held until brelse(), NULL if every buffer is held
+ */
+buf_t *bget(blkdev_t *dev, uint32_t block) {
+    uint32_t flags;
+    buf_t *b;
+
+    spin_lock_irqsave(&bcache_lock, flags);
+
+    if ((b = getblk(dev, block))) {
+        b->count++;
+        touch(b);
+        wait_buf(b);
+    }
+
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return b;
+}
+
+
+/**
+ * @brief read blocks ahead of their use. Nothing is done if the first
+ * block is cached, so the caller can ask before every block it uses;
+ * otherwise the missing blocks are read, each run of consecutive block
+ * numbers with one request.
+ *
+ * @param dev : the disk
+ * @param blocks : block numbers, in the order they will be used
+ * @param n : number of blocks, at most NBUF / 2 are read
+ */
+void breada(blkdev_t *dev, const uint32_t *blocks, uint32_t n) {
+    buf_t *run[BIO_MAX];
+    uint32_t flags, i, k = 0;
+    buf_t *b;
+
+    if (n > NBUF / 2)
+        n = NBUF / 2;
+
+    spin_lock_irqsave(&bcache_lock, flags);
+
+    /* cached, or being read already */
+    if (!n || ((b = lookup(dev, blocks[0])) && (b->flags & (B_VALID | B_BUSY)))) {
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return;
+    }
+
+    for (i = 0; i <= n; ++i) {
+        b = NULL;
+
+        if (i < n && blocks[i] < dev->nblocks &&
+            (b = getblk(dev, blocks[i])) && (b->flags & (B_VALID | B_BUSY)))
+            b = NULL;
+
+        /* the run ends here: read it */
+        if (k && (!b || k == BIO_MAX || blocks[i] != run[k - 1]->block + 1)) {
+            read_run(run, k);
+            while (k--)
+                run[k]->count--;
+            k = 0;
+        }
+
+        if (b) {
+            /* held and busy, so that nobody else takes or reads it */
+            b->count++;
+            b->flags |= B_BUSY;
+            touch(b);
+            run[k++] = b;
+        }
+    }
+
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+
+/**
+ * @brief let a buffer go, it stays cached until it is reused
+ *
+ * @param b : a buffer from bread() or bget()
+ */
+void brelse(buf_t *b) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&bcache_lock, flags);
+    b->count--;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+
+/**
+ * @brief mark a held buffer as changed, it is written back later
+ *
+ * @param b : a buffer from bread() or bget()
+ */
+void bdirty(buf_t *b) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&bcache_lock, flags);
+    b->flags |= B_VALID | B_DIRTY;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+
+/**
+ * @brief write the dirty blocks of a disk in the order of their block
+ * numbers, a run of consecutive blocks with one request, then flush
+ * the write cache of the disk
+ *
+ * @param dev : the disk
+ * @return int32_t : 0 on success, -EIO if a write failed (those blocks
+ *                   stay dirty)
+ */
+int32_t bsync(blkdev_t *dev) {
+    return bsync_blocks(dev, 0, dev->nblocks);
+}
+
+
+/**
+ * @brief write the dirty blocks first to first + n - 1 of a disk as
+ * bsync() does, then flush the write cache of the disk
+ *
+ * @param dev : the disk
+ * @param first : first block
+ * @param n : number of blocks
+ * @return int32_t : 0 on success, -EIO if a write failed (those blocks
+ *                   stay dirty)
+ */
+int32_t bsync_blocks(blkdev_t *dev, uint32_t first, uint32_t n) {
+    buf_t *dirty[NBUF], *b;
+    uint32_t flags, i, j, start, last = first + n;
+    int32_t errno = 0;
+
+    spin_lock_irqsave(&bcache_lock, flags);
+
+    /* sorted by block number, insertion sort on at most NBUF buffers */
+    for (n = 0, i = 0; i < NBUF; ++i) {
+        b = &bufs[i];
+        if (b->dev != dev || (b->flags & (B_DIRTY | B_BUSY)) != B_DIRTY ||
+            b->block < first || b->block >= last)
+            continue;
+        for (j = n++; j && dirty[j - 1]->block > b->block; --j)
+            dirty[j] = dirty[j - 1];
+        dirty[j] = b;
+    }
+
+    /* a buffer changed again while it is written is dirty again */
+    for (i = 0; i < n; ++i) {
+        dirty[i]->count++;
+        dirty[i]->flags = (dirty[i]->flags & ~B_DIRTY) | B_BUSY;
+    }
+
+    for (start = 0, i = 1; i <= n; ++i) {
+        if (i < n && i - start < BIO_MAX && dirty[i]->block == dirty[i - 1]->block + 1)
+            continue;
+        if (write_run(&dirty[start], i - start) < 0)
+            errno = -EIO;
+        start = i;
+    }
+
+    for (i = 0; i < n; ++i)
+        dirty[i]->count--;
+
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    if (dev->flush && dev->flush(dev) < 0)
+        errno = -EIO;
+
+    return errno;
+}
+
+
+/**
+ * @brief the buffer of a block, if it is cached, with bcache_lock held
+ *
+ * @param dev : the disk
+ * @param block : block number
+ * @return buf_t* : the buffer, NULL if the block is not cached
+ */
+static buf_t *lookup(blkdev_t *dev, uint32_t block) {
+    buf_t *b;
+
+    for (b = bhash[bhashfn(dev, block)]; b; b = b->hnext)
+        if (b->dev == dev && b->block == block)
+            return b;
+
+    return NULL;
+}
+
+
+/**
+ * @brief the buffer of a block: the cached one, or the least recently
+ * used buffer nobody holds, written back first if it is dirty (after
+ * the pre_evict hook of its disk). With bcache_lock held, which is
+ * dropped during a write back: the block may be cached by then, so it
+ * is looked up again.
+ *
+ * @param dev : the disk
+ * @param block : block number
+ * @return buf_t* : the buffer (not valid if it was not cached),
+ *                  NULL if every buffer is held
+ */
+static buf_t *getblk(blkdev_t *dev, uint32_t block) {
+    list_head *pos;
+    int32_t errno;
+    buf_t *b;
+
+    while (!(b = lookup(dev, block))) {
+        /* a busy buffer is held */
+        list_for_each_prev(pos, &lru) {
+            b = list_entry(pos, buf_t, lru);
+            if (!b->count)
+                break;
+        }
+        if (pos == &lru)
+            return NULL;
+
+        if (!(b->flags & B_DIRTY)) {
+            if (b->dev)
+                unhash(b);
+
+            b->dev = dev;
+            b->block = block;
+            b->hnext = bhash[bhashfn(dev, block)];
+            bhash[bhashfn(dev, block)] = b;
+            break;
+        }
+
+        b->count++;
+        b->flags = (b->flags & ~B_DIRTY) | B_BUSY;
+
+        spin_unlock(&bcache_lock);
+        errno = b->dev->pre_evict ? b->dev->pre_evict(b->dev) : 0;
+        spin_lock(&bcache_lock);
+
+        /* the data is lost if it cannot be written */
+        if (errno < 0 || write_run(&b, 1) < 0) {
+            printf("%s: lost block %d\n", b->dev->name, b->block);
+            b->flags &= ~(B_DIRTY | B_BUSY);
+            wake_up(&bwait);
+        }
+        b->count--;
+    }
+
+    return b;
+}
+
+
+/**
+ * @brief take a buffer out of the hash, it holds no block anymore.
+ * With bcache_lock held.
+ *
+ * @param b : a buffer holding a block
+ */
+static void unhash(buf_t *b) {
+    buf_t **p;
+
+    for (p = &bhash[bhashfn(b->dev, b->block)]; *p; p = &(*p)->hnext) {
+        if (*p == b) {
+            *p = b->hnext;
+            break;
+        }
+    }
+
+    b->dev = NULL;
+    b->flags = 0;
+    b->hnext = NULL;
+}
+
+
+/**
+ * @brief move a buffer to the head of the LRU list, with bcache_lock held
+ *
+ * @param b : a buffer
+ */
+static void touch(buf_t *b) {
+    list_del(&b->lru);
+    list_add(&b->lru, &lru);
+}
+
+
+/**
+ * @brief wait until nobody reads or writes a buffer, with bcache_lock
+ * held and the buffer held
+ *
+ * @param b : a buffer
+ */
+static void wait_buf(buf_t *b) {
+    while (b->flags & B_BUSY)
+        sleep_on_uninterruptible(&bwait, &bcache_lock);
+}
+
+
+/**
+ * @brief read buffers of consecutive blocks with one request, with
+ * bcache_lock held. The buffers are held and busy, the lock is dropped
+ * during the read.
+ *
+ * @param run : the buffers, in block order
+ * @param n : number of buffers, at most BIO_MAX
+ * @return int32_t : 0 on success, -EIO on a read error (the buffers stay
+ *                   not valid)
+ */
+static int32_t read_run(buf_t **run, uint32_t n) {
+    int8_t *data[BIO_MAX];
+    uint32_t i;
+    int32_t errno;
+
+    for (i = 0; i < n; ++i)
+        data[i] = run[i]->data;
+
+    spin_unlock(&bcache_lock);
+    errno = run[0]->dev->read(run[0]->dev, run[0]->block, n, data);
+    spin_lock(&bcache_lock);
+
+    for (i = 0; i < n; ++i) {
+        if (errno >= 0)
+            run[i]->flags |= B_VALID;
+        run[i]->flags &= ~B_BUSY;
+    }
+    wake_up(&bwait);
+
+    return (errno < 0) ? -EIO : 0;
+}
+
+
+/**
+ * @brief write buffers of consecutive blocks with one request, with
+ * bcache_lock held. The buffers are held and busy with B_DIRTY cleared,
+ * the lock is dropped during the write.
+ *
+ * @param run : the buffers, in block order
+ * @param n : number of buffers, at most BIO_MAX
+ * @return int32_t : 0 on success, -EIO on a write error (the buffers are
+ *                   dirty again)
+ */
+static int32_t write_run(buf_t **run, uint32_t n) {
+    int8_t *data[BIO_MAX];
+    uint32_t i;
+    int32_t errno;
+
+    for (i = 0; i < n; ++i)
+        data[i] = run[i]->data;
+
+    spin_unlock(&bcache_lock);
+    errno = run[0]->dev->write(run[0]->dev, run[0]->block, n, data);
+    spin_lock(&bcache_lock);
+
+    for (i = 0; i < n; ++i) {
+        if (errno < 0)
+            run[i]->flags |= B_DIRTY;
+        run[i]->flags &= ~B_BUSY;
+    }
+    wake_up(&bwait);
+
+    return (errno < 0) ? -EIO : 0;
+}
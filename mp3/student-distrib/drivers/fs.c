@@ -1,5 +1,81 @@
+/**
+ * @file fs.c
+ * @brief The file system image: lookup, read, and write.
+ * @overview:
+ * The image is a boot block (the entries of the root directory and where
+ * the maps of used inodes and data blocks are), the inodes, the maps, 
+ * then the data blocks. Each map has a bit per inode or data block and 
+ * takes the blocks it needs, so n_inode and n_datab are the only limits.
+ * An image whose state is 0, or without FS_MAPS in the boot block, keeps
+ * the maps in the boot block itself and has no map blocks: only its 
+ * first INODES_MAX inodes and DATAB_MAX data blocks are used.
+ * A file is created, written, truncated and unlinked in place.
+ *
+ * The root directory is the 63 entries of the boot block, as in the 
+ * images without subdirectories, and is inode 0. Any other directory is
+ * an inode whose data is an array of dentry_t, starting with "." and 
+ * "..", so it is not limited to 63 entries. A path is walked one name at
+ * a time from the root ('/') or the current directory: the root is 
+ * searched through the name hash, other directories through the dentry 
+ * cache (directory, hash of the name) -> entry index, filled on a miss 
+ * by a scan of the directory.
+ *
+ * The image is a page-aligned module and blocks are BLOCK_SIZE, so each
+ * data block can be mapped into a program as it is (fs_block_addr). A 
+ * file that is mapped keeps its inode after an unlink and cannot shrink,
+ * so a mapped page always belongs to the file.
+ *
+ * The image can also be mounted from a disk (fs_mount), where it starts
+ * at block 0, when the kernel command line names the disk (root=hdb). 
+ * The blocks before the data (boot block, inodes, maps) are then read 
+ * into memory and stay there, and the data blocks go through the buffer
+ * cache: a file read in order is read ahead RA_BLOCKS at a time, and 
+ * written data stays in the cache until fs_sync(), run every 
+ * WRITEBACK_TICKS by the worker thread. fs_sync() marks the boot block 
+ * on the disk FS_DIRTY, writes the data and the changed inode and map 
+ * blocks, then the boot block, each step flushed before the next, so a
+ * crash in between leaves an image whose maps are rebuilt. A data or
+ * directory block the cache writes on its own, to reuse its buffer, 
+ * could reach the disk ahead of the inodes and maps that go with it: 
+ * the boot block on the disk is marked FS_DIRTY first (fs_mark_dirty),
+ * and stays so until the next fs_sync(). Files of a disk cannot be 
+ * mapped.
+ *
+ * A request to a disk sleeps, which no thread may do with a spinlock
+ * held. Every operation that may go to the disk holds fs_mutex, a
+ * sleeping lock, which keeps the buffer cache still for it, and fs_lock
+ * while it uses the maps, inodes and entries in memory. fs_lock is
+ * dropped around each call into the buffer cache (block_data, readahead,
+ * sync_blocks), where only fs_iget() to fs_mput() can get in: they run
+ * where a thread cannot sleep (the exit of a program) and take fs_lock
+ * alone, and the inode the last close of an unlinked file frees there is
+ * used by no operation.
+ *
+ * Every update is a series of steps in a fixed order, each changing one
+ * 512-byte sector of the image (an inode, a directory entry, a map, the
+ * boot block), and the step that makes the change visible comes last:
+ *  - new data blocks are taken from the map and filled before the inode 
+ *    size covers them,
+ *  - a new inode is taken from the map and cleared before a directory
+ *    entry names it, and the entry is written before n_dir counts it,
+ *  - a shrinking file loses its size first, an unlinked file its directory
+ *    entry first, and only then are its blocks and inode put back.
+ * An update stopped at any step leaves no entry or inode pointing at 
+ * free or foreign blocks, at worst blocks or an inode marked used that 
+ * nothing uses. state is FS_DIRTY while an update runs, and an image 
+ * not left FS_CLEAN gets its maps rebuilt from the directory entries 
+ * when it is mounted, which frees those again.
+ *
+ * @reference:
+ * Ganger, Gregory R. and Patt, Yale N., Metadata Update Performance in File Systems (soft updates)
+ *
+ */
+
 #include <drivers/fs.h>
+#include <drivers/blkdev.h>
 #include <pro/process.h>
+#include <pro/workqueue.h>
+#include <pro/mutex.h>
 #include <access.h>
 #include <kmalloc.h>
 #include <errno.h>
@@ -9,9 +85,78 @@
 
 fs_t *fs;        /* Stores the file system. */
 
+static work_t sync_work;            /* fs_sync() in the worker thread */
+
+/* how block_data() gets a data block */
+#define BLK_READ    0               /* to read it */
+#define BLK_WRITE   1               /* to change part of it */
+#define BLK_NEW     2               /* to overwrite all of it */
+
 
 static int32_t validate_inode(uint32_t inode);
 static int32_t validate_fname(const int8_t *fname);
+static uint32_t name_hash(const int8_t *name);
+static int32_t lookup(const int8_t *fname);
+static uint32_t dir_count(uint32_t dir);
+static dentry_t *dir_entry(uint32_t dir, uint32_t i);
+static int32_t dir_ok(uint32_t dir);
+static void __stat(const dentry_t *dentry, stat_t *st);
+static int32_t lookup_in(uint32_t dir, const int8_t *name);
+static int32_t walk(const int8_t *path, uint32_t cwd, dentry_t *dentry, uint32_t *parent, int8_t *last);
+static int32_t add_entry(uint32_t dir, dentry_t *d);
+static void remove_entry(uint32_t dir, uint32_t i);
+static void shrink(inode_t *file, uint32_t length);
+static int32_t fs_rebuild_maps(void);
+static int32_t alloc_inode(void);
+static int32_t alloc_block(void);
+static void free_inode(uint32_t inode);
+static int32_t __read_data(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length);
+static int32_t __read_disk(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length);
+static int32_t __write_data(inode_t *file, uint32_t offset, const uint8_t *buf, uint32_t length);
+static int32_t fs_setup(void);
+static uint32_t meta_blocks(boot_block *boot);
+static int32_t image_ok(boot_block *boot, uint32_t nblocks);
+static int8_t *block_data(uint32_t b, uint32_t how);
+static void readahead(inode_t *file, uint32_t n, uint32_t end);
+static int32_t sync_blocks(uint32_t first, uint32_t n, uint32_t marker);
+static int32_t fs_mark_dirty(blkdev_t *dev);
+static void fs_sync_work(work_t *work);
+
+static DEFINE_MUTEX(fs_mutex);      /* held by the operations that may go to the disk */
+static DEFINE_SPINLOCK(fs_lock);    /* protects the maps, inodes and directory entries */
+
+/* take both locks, or let both go */
+#define fs_enter(flags)                         \
+do {                                            \
+    mutex_lock(&fs_mutex);                      \
+    spin_lock_irqsave(&fs_lock, flags);         \
+} while (0)
+
+#define fs_leave(flags)                         \
+do {                                            \
+    spin_unlock_irqrestore(&fs_lock, flags);    \
+    mutex_unlock(&fs_mutex);                    \
+} while (0)
+
+/* the steps of an update reach the image in program order */
+#define fs_barrier()        asm volatile("" : : : "memory")
+
+#define map_test(map, i)    ((map)[(i) >> 3] & (1 << ((i) & 7)))
+#define map_set(map, i)     ((map)[(i) >> 3] |= (1 << ((i) & 7)))
+#define map_clear(map, i)   ((map)[(i) >> 3] &= ~(1 << ((i) & 7)))
+
+/* bytes and blocks of a map of n bits */
+#define map_bytes(n)        (((n) + 7) / 8)
+#define map_blocks(n)       (((n) + MAP_BITS - 1) / MAP_BITS)
+
+/* the maps are in blocks of their own */
+#define has_maps(boot)      ((boot)->state && (boot)->maps.ext.magic == FS_MAPS)
+
+/* number of data blocks holding size bytes */
+#define size_blocks(size)   (((size) + BLOCK_SIZE - 1) / BLOCK_SIZE)
+
+/* "." and ".." */
+#define is_dot(name)        ((name)[0] == '.' && (!(name)[1] || ((name)[1] == '.' && !(name)[2])))
 
 
 /**
@@ -24,8 +169,262 @@ void fs_init(uint32_t start_addr) {
     boot_block *addr = (boot_block *)start_addr;
     fs->boot = addr++;                           /* Load the boot block. */
     fs->inodes = (inode_t *)addr;                /* Load the inodes blocks. */
-    addr += fs->boot->n_inode;                   /* Get the address of the first data block. */
-    fs->data_block_addr = (data_block *)addr;    /* Load the data blocks. */
+    fs->data_start = meta_blocks(fs->boot);      /* Skip the inodes and the maps. */
+    fs->data_block_addr = (data_block *)start_addr + fs->data_start;    /* Load the data blocks. */
+    fs->dev = NULL;
+    fs->shadow = NULL;
+
+    fs_setup();
+}
+
+
+/**
+ * @brief Mount the file system image at the start of a disk. The boot
+ * block, the inodes and the maps are kept in memory, with a copy of them
+ * as they are on the disk, the data blocks are used through the buffer
+ * cache.
+ * 
+ * @param dev : The disk.
+ * @return int32_t : 0 on success, -EINVAL if the disk holds no image,
+ *                   negative values denote an error condition
+ */
+int32_t fs_mount(blkdev_t *dev) {
+    uint32_t blocks[RA_BLOCKS];
+    uint32_t i, j, n, order;
+    int8_t *meta;
+    buf_t *b;
+
+    if (!(b = bread(dev, 0)))
+        return -EIO;
+    if (!image_ok((boot_block *)b->data, dev->nblocks)) {
+        brelse(b);
+        return -EINVAL;
+    }
+    n = meta_blocks((boot_block *)b->data);
+    brelse(b);
+
+    for (order = 0; (1U << order) < 2 * n; ++order)
+        ;
+    if (!(meta = get_page(order)))
+        return -ENOMEM;
+
+    for (i = 0; i < n; ++i) {
+        for (j = 0; j < RA_BLOCKS && i + j < n; ++j)
+            blocks[j] = i + j;
+        breada(dev, blocks, j);
+
+        if (!(b = bread(dev, i))) {
+            free_page(meta, order);
+            return -EIO;
+        }
+        memcpy(meta + i * BLOCK_SIZE, b->data, BLOCK_SIZE);
+        brelse(b);
+    }
+    memcpy(meta + n * BLOCK_SIZE, meta, n * BLOCK_SIZE);
+
+    if (!(fs = kmalloc(sizeof(fs_t)))) {
+        free_page(meta, order);
+        return -ENOMEM;
+    }
+    fs->boot = (boot_block *)meta;
+    fs->inodes = (inode_t *)(meta + BLOCK_SIZE);
+    fs->data_block_addr = NULL;
+    fs->dev = dev;
+    fs->data_start = n;
+    fs->shadow = (boot_block *)(meta + n * BLOCK_SIZE);
+
+    if (fs_setup() < 0) {
+        kfree(fs);
+        fs = NULL;
+        free_page(meta, order);
+        return -ENOMEM;
+    }
+
+    INIT_WORK(&sync_work, fs_sync_work);
+    dev->pre_evict = fs_mark_dirty;
+    return 0;
+}
+
+
+/**
+ * @brief Mount the image on a disk given by name.
+ * 
+ * @param name : The name of the disk, "hda" to "hdd".
+ * @return int32_t : 0 on success, -ENODEV if there is no such disk,
+ *                   negative values denote an error condition
+ */
+int32_t fs_mount_disk(const int8_t *name) {
+    blkdev_t *dev;
+    uint32_t i;
+
+    for (i = 0; (dev = blkdev_get(i)); ++i)
+        if (!strncmp(dev->name, name, sizeof(dev->name)))
+            return fs_mount(dev);
+
+    return -ENODEV;
+}
+
+
+/**
+ * @brief Write the changes to a mounted disk: the data blocks in the 
+ * cache, then the inode and map blocks and the boot block that differ 
+ * from the disk. While those are written the boot block on the disk says
+ * FS_DIRTY, so that the maps are rebuilt if they do not all get there.
+ * Without such changes only data blocks are written, no entry or inode
+ * on the disk refers to them differently.
+ * 
+ * @return int32_t : 0 on success, -EIO on a write error
+ */
+int32_t fs_sync(void) {
+    uint32_t flags, n, i;
+    int32_t errno;
+
+    if (!fs->dev)
+        return 0;
+
+    fs_enter(flags);
+
+    n = fs->data_start;
+    for (i = 0; i < n; ++i)
+        if (memcmp((int8_t *)fs->boot + i * BLOCK_SIZE, (int8_t *)fs->shadow + i * BLOCK_SIZE, BLOCK_SIZE))
+            break;
+
+    if (i == n) {
+        spin_unlock(&fs_lock);
+        errno = bsync(fs->dev);
+        spin_lock(&fs_lock);
+    } else if (!(errno = sync_blocks(0, 1, 1))) {
+        spin_unlock(&fs_lock);
+        errno = bsync(fs->dev);
+        spin_lock(&fs_lock);
+
+        if (!errno && !(errno = sync_blocks(1, n - 1, 0)))
+            errno = sync_blocks(0, 1, 0);
+    }
+
+    fs_leave(flags);
+    return errno;
+}
+
+
+/**
+ * @brief Have the worker thread write the changes back to the disk,
+ * called by the timer interrupt every WRITEBACK_TICKS.
+ */
+void fs_writeback(void) {
+    if (fs && fs->dev)
+        schedule_work(&sync_work);
+}
+
+
+/**
+ * @brief The state of the file system kept only in memory, the same for
+ * an image in memory and on a disk, where the blocks before the data 
+ * are at fs->boot as they are in the image.
+ * 
+ * @return int32_t : 0 on success, -ENOMEM if the per-inode state does not fit
+ */
+static int32_t fs_setup(void) {
+    boot_block *boot = fs->boot;
+
+    if (has_maps(boot)) {
+        fs->inode_map = (uint8_t *)boot + boot->maps.ext.start * BLOCK_SIZE;
+        fs->block_map = fs->inode_map + map_blocks(boot->n_inode) * BLOCK_SIZE;
+        fs->max_inode = boot->n_inode;
+        fs->max_datab = boot->n_datab;
+    } else {
+        fs->inode_map = boot->maps.legacy.inode_map;
+        fs->block_map = boot->maps.legacy.block_map;
+        fs->max_inode = (boot->n_inode < INODES_MAX) ? boot->n_inode : INODES_MAX;
+        fs->max_datab = (boot->n_datab < DATAB_MAX) ? boot->n_datab : DATAB_MAX;
+    }
+
+    fs->iref = kmalloc(fs->max_inode);
+    fs->orphan = kmalloc(fs->max_inode);
+    fs->mapped = kmalloc(fs->max_inode);
+    fs->ra_pos = kmalloc(fs->max_inode * sizeof(uint32_t));
+
+    /* an update was cut short, or the image has no maps yet */
+    if (!fs->iref || !fs->orphan || !fs->mapped || !fs->ra_pos ||
+        (boot->state != FS_CLEAN && fs_rebuild_maps() < 0)) {
+        kfree(fs->iref);
+        kfree(fs->orphan);
+        kfree(fs->mapped);
+        kfree(fs->ra_pos);
+        return -ENOMEM;
+    }
+
+    memset(fs->iref, 0, fs->max_inode);
+    memset(fs->orphan, 0, fs->max_inode);
+    memset(fs->mapped, 0, fs->max_inode);
+    memset(fs->dcache, -1, sizeof(fs->dcache));
+    memset(fs->ra_pos, 0, fs->max_inode * sizeof(uint32_t));
+    fs_hash_init();
+    return 0;
+}
+
+
+/**
+ * @brief Number of blocks before the data blocks of an image: the boot
+ * block, the inodes and the maps.
+ * 
+ * @param boot : The boot block.
+ * @return uint32_t : The block of data block 0.
+ */
+static uint32_t meta_blocks(boot_block *boot) {
+    if (has_maps(boot))
+        return boot->maps.ext.start + boot->maps.ext.blocks;
+    return 1 + boot->n_inode;
+}
+
+
+/**
+ * @brief Check that a block looks like the boot block of an image.
+ * 
+ * @param boot : The block.
+ * @param nblocks : Size of the disk in blocks.
+ * @return int32_t : 1 if it does, 0 otherwise
+ */
+static int32_t image_ok(boot_block *boot, uint32_t nblocks) {
+    if (boot->n_dir > FILES_MAX || !boot->n_inode || !boot->n_datab ||
+        (boot->state && boot->state != FS_CLEAN && boot->state != FS_DIRTY))
+        return 0;
+
+    /* the maps follow the inodes */
+    if (has_maps(boot))
+        return boot->n_inode < nblocks && boot->maps.ext.start > boot->n_inode &&
+               boot->maps.ext.start < nblocks &&
+               boot->maps.ext.blocks == map_blocks(boot->n_inode) + map_blocks(boot->n_datab) &&
+               boot->maps.ext.blocks <= nblocks - boot->maps.ext.start &&
+               boot->n_datab <= nblocks - boot->maps.ext.start - boot->maps.ext.blocks;
+
+    return boot->n_inode <= INODES_MAX && 1 + boot->n_inode + boot->n_datab <= nblocks;
+}
+
+
+/**
+ * @brief Build the hash table of the file names, so that a lookup by
+ * name compares with the few entries of one bucket instead of every 
+ * entry of the boot block.
+ */
+void fs_hash_init(void) {
+    int i;
+    uint32_t n_dir = fs->boot->n_dir;
+    uint32_t b;
+
+    if (n_dir > FILES_MAX)
+        n_dir = FILES_MAX;
+
+    memset(fs->dhash, -1, sizeof(fs->dhash));
+
+    /* insert backwards so that each chain is in boot block order,
+     * the first of two equal names is found as before */
+    for (i = n_dir - 1; i >= 0; --i) {
+        fs->dhval[i] = name_hash((int8_t *)fs->boot->dirs[i].fname);
+        b = fs->dhval[i] & (DHASH_SIZE - 1);
+        fs->dnext[i] = fs->dhash[b];
+        fs->dhash[b] = i;
+    }
 }
 
 
@@ -33,27 +432,232 @@ void fs_init(uint32_t start_addr) {
  * @brief Fill in the dentry block with the file name, file
  * type, and inode number for the file.
  * 
- * @param fname : A filename.
+ * @param fname : A filename, or a path from the root directory.
  * @param dentry : A pointer to the directory entry structure.
  * @return int32_t : -1 on failure (non-existent file or invalid index),
  *                    0 on success.
  */
 int32_t read_dentry_by_name(const int8_t *fname, dentry_t *dentry) {
-    if (!dentry) {
+    if (!dentry || !fname) {
         return -1;
     }
-    int i;    
-    for (i = 0; i < fs->boot->n_dir; ++i) {
 
-        /* The current file name stored in the boot block. */
-        int8_t *_fname = (int8_t *)(fs->boot->dirs[i].fname);
-        if (!strncmp(fname, _fname, NAMESIZE)) {
+    return (namei(fname, ROOT_INO, dentry) < 0) ? -1 : 0;
+}
 
-            /* Two file names are equal. */
-            return read_dentry_by_index(i, dentry);
+
+/**
+ * @brief Find the directory entry a path names.
+ * 
+ * @param path : A path, from the root if it starts with '/', 
+ *               from cwd otherwise.
+ * @param cwd : The current directory.
+ * @param dentry : Filled with the directory entry, the root is 
+ *                 {".", DIRECTORY, ROOT_INO}.
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t namei(const int8_t *path, uint32_t cwd, dentry_t *dentry) {
+    uint32_t flags;
+    int32_t ret;
+
+    if (!path || !*path || !dentry)
+        return -ENOENT;
+
+    fs_enter(flags);
+    ret = walk(path, cwd, dentry, NULL, NULL);
+    fs_leave(flags);
+
+    return ret;
+}
+
+
+/**
+ * @brief Change a current directory to the directory a path names.
+ * The directory is looked up and set under fs_mutex, so fs_rmdir 
+ * cannot remove it in between.
+ * 
+ * @param path : A path, from the root if it starts with '/', 
+ *               from *cwd otherwise.
+ * @param cwd : The current directory, set to the new one on success.
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t fs_chdir(const int8_t *path, uint32_t *cwd) {
+    dentry_t d;
+    uint32_t flags;
+    int32_t ret;
+
+    if (!path || !*path || !cwd)
+        return -ENOENT;
+
+    fs_enter(flags);
+    if (!(ret = walk(path, *cwd, &d, NULL, NULL))) {
+        if (d.type == DIRECTORY)
+            *cwd = d.inode;
+        else
+            ret = -ENOTDIR;
+    }
+    fs_leave(flags);
+
+    return ret;
+}
+
+
+/**
+ * @brief Find the directory holding the last name of a path.
+ * 
+ * @param path : A path, from the root if it starts with '/', 
+ *               from cwd otherwise.
+ * @param cwd : The current directory.
+ * @param dir : Set to the inode of the directory.
+ * @param name : Set to the last name of the path, NAMESIZE + 1 bytes.
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t fs_parent(const int8_t *path, uint32_t cwd, uint32_t *dir, int8_t *name) {
+    dentry_t d;
+    uint32_t flags;
+    int32_t ret;
+
+    if (!path || !*path)
+        return -ENOENT;
+
+    fs_enter(flags);
+    ret = walk(path, cwd, &d, dir, name);
+    fs_leave(flags);
+
+    return ret;
+}
+
+
+/**
+ * @brief Read the entry at index of a directory.
+ * 
+ * @param dir : The inode of the directory.
+ * @param index : The entry index.
+ * @param dentry : Filled with the entry.
+ * @return int32_t : 0 on success, -1 past the last entry
+ */
+int32_t dir_read(uint32_t dir, uint32_t index, dentry_t *dentry) {
+    uint32_t flags;
+    int32_t ret = -1;
+
+    fs_enter(flags);
+    if (dir_ok(dir) && index < dir_count(dir)) {
+        *dentry = *dir_entry(dir, index);
+        ret = 0;
+    }
+    fs_leave(flags);
+
+    return ret;
+}
+
+
+/**
+ * @brief Read the entry at index of a directory and stat the file it 
+ * names, in one go.
+ * 
+ * @param dir : The inode of the directory.
+ * @param index : The entry index.
+ * @param dentry : Filled with the entry.
+ * @param st : Filled with the inode, type, size and blocks of the file.
+ * @return int32_t : 0 on success, -1 past the last entry
+ */
+int32_t fs_readdir(uint32_t dir, uint32_t index, dentry_t *dentry, stat_t *st) {
+    uint32_t flags;
+    int32_t ret = -1;
+
+    fs_enter(flags);
+    if (dir_ok(dir) && index < dir_count(dir)) {
+        *dentry = *dir_entry(dir, index);
+        __stat(dentry, st);
+        ret = 0;
+    }
+    fs_leave(flags);
+
+    return ret;
+}
+
+
+/**
+ * @brief Get the inode, type, size and blocks of a file.
+ * 
+ * @param dentry : The entry of the file, from namei or an open file.
+ * @param st : Filled with the information.
+ */
+void fs_stat(const dentry_t *dentry, stat_t *st) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&fs_lock, flags);
+    __stat(dentry, st);
+    spin_unlock_irqrestore(&fs_lock, flags);
+}
+
+
+/**
+ * @brief Build the path of a directory from the root, by following ".."
+ * and looking up the name of each directory in its parent.
+ * 
+ * @param cwd : The inode of the directory.
+ * @param buf : Filled with the path.
+ * @param size : The size of buf.
+ * @return int32_t : length of the path, -ERANGE if buf is too small,
+ *                   negative values denote an error condition
+ */
+int32_t fs_getcwd(uint32_t cwd, int8_t *buf, uint32_t size) {
+    int8_t path[PATH_MAX];
+    uint32_t flags, pos = PATH_MAX - 1, cur = cwd, parent, n, len, depth;
+    int32_t i, ret = 0;
+    dentry_t *d;
+
+    path[pos] = '\0';
+
+    fs_enter(flags);
+
+    for (depth = 0; cur != ROOT_INO && depth < fs->max_inode; ++depth) {
+        if (!dir_ok(cur) || (i = lookup_in(cur, "..")) < 0) {
+            ret = -ENOENT;
+            break;
         }
+        parent = dir_entry(cur, i)->inode;
+
+        /* the entry of cur in its parent */
+        for (n = 0; n < dir_count(parent); ++n) {
+            d = dir_entry(parent, n);
+            if (d->type == DIRECTORY && d->inode == cur && !is_dot(d->fname))
+                break;
+        }
+        if (n == dir_count(parent)) {
+            ret = -ENOENT;
+            break;
+        }
+
+        len = strlen(d->fname);
+        if (len > NAMESIZE)
+            len = NAMESIZE;
+        if (pos < len + 1) {
+            ret = -ERANGE;
+            break;
+        }
+        pos -= len;
+        memcpy(path + pos, d->fname, len);
+        path[--pos] = '/';
+
+        cur = parent;
     }
-    return -1;  /* Not found, return an error. */
+
+    fs_leave(flags);
+
+    if (ret < 0)
+        return ret;
+
+    if (pos == PATH_MAX - 1)
+        path[--pos] = '/';
+
+    len = PATH_MAX - 1 - pos;
+    if (len + 1 > size)
+        return -ERANGE;
+
+    memcpy(buf, path + pos, len + 1);
+    return len;
 }
 
 
@@ -94,6 +698,35 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t *dentry) {
  *                    number of bytes read on success.
  */
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length) {
+    uint32_t flags;
+    int32_t errno;
+
+    if ((errno = validate_inode(inode)) < 0) return errno;
+
+    if (!buf) return -1;
+
+    if (!fs->dev)
+        return __read_data(inode, offset, buf, length);
+
+    fs_enter(flags);
+    errno = __read_disk(inode, offset, buf, length);
+    fs_leave(flags);
+
+    return errno;
+}
+
+
+/**
+ * @brief Read data from the image in memory.
+ * 
+ * @param inode : A valid inode number
+ * @param offset : The offset of the file in bytes to read.
+ * @param buf : A buffer array that copys the content from the file.
+ * @param length : The number of bytes to read from the file.
+ * @return int32_t : -1 on failure (a bad data block), 
+ *                    number of bytes read on success.
+ */
+static int32_t __read_data(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length) {
     virtual_pos vir_pos;            /* The virtual position of the file to read*/
     int phy_pos;                    /* The physical position of the file to read. */
     int nread_needed;               /* Number of bytes need to read. */
@@ -101,12 +734,7 @@ int32_t read_data(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length
     int nb_left;                    /* Number of bytes left in the data block. */
     inode_t *file;                  /* The file inode. */
     int8_t *data_ptr;               /* The actuall data address to read within a data block. */
-    int32_t errno;
 
-    if ((errno = validate_inode(inode)) < 0) return errno;
-
-    if (!buf) return -1;
-    
     file = &fs->inodes[inode];            /* Get the file inode. */
         
     if (offset >= file->size) return 0;
@@ -165,58 +793,504 @@ int32_t read_data(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length
 }
 
 /**
- * @brief Get the file size.
+ * @brief Read data from a disk through the buffer cache, with fs_mutex
+ * and fs_lock held. A block missing from the cache is read together with
+ * the next ones of the request, and RA_BLOCKS more if the read starts 
+ * where the last read of the file ended.
  * 
- * @param index The index of the dentry.
- * @return uint32_t : file size.
+ * @param inode : A valid inode number
+ * @param offset : The offset of the file in bytes to read.
+ * @param buf : A buffer array that copys the content from the file.
+ * @param length : The number of bytes to read from the file.
+ * @return int32_t : -1 on failure (a bad data block or a read error), 
+ *                    number of bytes read on success.
  */
-uint32_t get_size(uint32_t index) {
-    dentry_t dentry;
-    read_dentry_by_index(index, &dentry);
-    if (dentry.type < 2) 
+static int32_t __read_disk(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length) {
+    inode_t *file = &fs->inodes[inode];
+    uint32_t end, ra_end, pos, chunk;
+    int8_t *data;
+
+    if (offset >= file->size)
         return 0;
-    return fs->inodes[dentry.inode].size;
+    if (length > file->size - offset)
+        length = file->size - offset;
+    end = offset + length;
+
+    ra_end = size_blocks(end);
+    if (offset == fs->ra_pos[inode])
+        ra_end += RA_BLOCKS;
+    if (ra_end > size_blocks(file->size))
+        ra_end = size_blocks(file->size);
+    fs->ra_pos[inode] = end;
+
+    for (pos = offset; pos < end; pos += chunk) {
+        chunk = BLOCK_SIZE - pos % BLOCK_SIZE;
+        if (chunk > end - pos)
+            chunk = end - pos;
+
+        readahead(file, pos / BLOCK_SIZE, ra_end);
+
+        if (!(data = block_data(file->data_block[pos / BLOCK_SIZE], BLK_READ)))
+            return (pos > offset) ? pos - offset : -1;
+
+        memcpy(buf + (pos - offset), data + pos % BLOCK_SIZE, chunk);
+    }
+
+    return length;
 }
 
 
 /**
- * @brief Load program image into user vitural address space
+ * @brief Write length bytes of buf at position offset in the file with 
+ * inode number inode, the file grows if needed.
  * 
- * @param fname file name of the program
- * @param EIP: the address of the user program eip register
- * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ * @param inode : A inode number
+ * @param offset : The offset of the file in bytes to write.
+ * @param buf : The data to write.
+ * @param length : The number of bytes to write to the file.
+ * @return int32_t : number of bytes written, less than length if the 
+ *                   image is full, negative values denote an error condition
  */
-int32_t pro_loader(const int8_t *fname, uint32_t *EIP, thread_t* curr) {
-    int i;
-    int32_t errno;
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t *buf, uint32_t length) {
+    uint32_t flags;
+    int32_t n;
+
+    if (validate_inode(inode) < 0 || !buf)
+        return -1;
+
+    fs_enter(flags);
+    n = __write_data(&fs->inodes[inode], offset, buf, length);
+    fs_leave(flags);
+
+    return n;
+}
+
+
+/**
+ * @brief Create an empty regular file or directory.
+ * 
+ * @param dir : The inode of the directory to create it in.
+ * @param name : The name of the new file.
+ * @param type : REGULAR or DIRECTORY.
+ * @param dentry : Filled with the directory entry of the new file.
+ * @return int32_t : 0 on success, -EEXIST if the name is taken,
+ *                   negative values denote an error condition
+ */
+int32_t fs_create(uint32_t dir, const int8_t *name, file_type_t type, dentry_t *dentry) {
+    uint32_t flags;
     int32_t inode;
-    inode_t file;
-    uint8_t header[40];
-    uint8_t eip_buf[4];
-    uint8_t magic_number[4] = { 0x7f, 0x45, 0x4c, 0x46 };
+    dentry_t d, dots[2];
 
-    /* check if the file is a user-level executable file */
-    if ((inode = validate_fname(fname)) < 0)
-        return inode;
-    
-    /* get the file inode */
-    file = fs->inodes[inode];            /* Get the file inode. */
+    if (!name || !*name || !dentry || is_dot(name))
+        return -ENOENT;
+    if (strlen(name) > NAMESIZE)
+        return -ENAMETOOLONG;
+    if (strchr(name, '/') || (type != REGULAR && type != DIRECTORY))
+        return -EINVAL;
 
-    /* read header from the program image */
-    if ((errno = read_data(inode, 0, header, 40)) < 0)
-        return errno;
+    fs_enter(flags);
 
-    /* check magic number */
-    for (i = 0; i < 4; ++i) {
-        if (header[i] != magic_number[i])
-            return -1;
-        eip_buf[i] = header[i + 24];
+    if (!dir_ok(dir)) {
+        fs_leave(flags);
+        return -ENOENT;
+    }
+
+    if (lookup_in(dir, name) >= 0) {
+        fs_leave(flags);
+        return -EEXIST;
+    }
+
+    if ((inode = alloc_inode()) < 0) {
+        fs_leave(flags);
+        return -ENOSPC;
+    }
+
+    fs->boot->state = FS_DIRTY;
+    fs_barrier();
+
+    fs->inodes[inode].size = 0;
+    fs_barrier();
+
+    /* a directory is complete before it is linked */
+    if (type == DIRECTORY) {
+        memset(dots, 0, sizeof(dots));
+        strcpy(dots[0].fname, ".");
+        dots[0].type = DIRECTORY;
+        dots[0].inode = inode;
+        strcpy(dots[1].fname, "..");
+        dots[1].type = DIRECTORY;
+        dots[1].inode = dir;
+
+        if (__write_data(&fs->inodes[inode], 0, (uint8_t *)dots, sizeof(dots)) != sizeof(dots)) {
+            free_inode(inode);
+            fs->boot->state = FS_CLEAN;
+            fs_leave(flags);
+            return -ENOSPC;
+        }
+    }
+
+    memset(&d, 0, sizeof(dentry_t));
+    strncpy(d.fname, name, NAMESIZE);
+    d.type = type;
+    d.inode = inode;
+
+    /* the file exists once the entry is in the directory */
+    if (add_entry(dir, &d) < 0) {
+        free_inode(inode);
+        fs->boot->state = FS_CLEAN;
+        fs_leave(flags);
+        return -ENOSPC;
+    }
+    fs_barrier();
+
+    fs->boot->state = FS_CLEAN;
+    *dentry = d;
+
+    fs_leave(flags);
+    return 0;
+}
+
+
+/**
+ * @brief Set the size of a file, the data past length is dropped and 
+ * a file that grows is filled with zeros.
+ * 
+ * @param inode : A inode number
+ * @param length : The new size in bytes.
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t fs_truncate(uint32_t inode, uint32_t length) {
+    uint32_t flags, size;
+    inode_t *file;
+    int32_t ret = 0;
+
+    if (validate_inode(inode) < 0)
+        return -1;
+    if (length > FILE_BLOCKS * BLOCK_SIZE)
+        return -EFBIG;
+
+    fs_enter(flags);
+
+    file = &fs->inodes[inode];
+    size = file->size;
+
+    if (length > size) {
+        if (__write_data(file, size, NULL, length - size) != length - size)
+            ret = -ENOSPC;
+    } else if (length < size && inode < fs->max_inode && fs->mapped[inode]) {
+        ret = -EBUSY;
+    } else if (length < size) {
+        fs->boot->state = FS_DIRTY;
+        fs_barrier();
+
+        shrink(file, length);
+        fs_barrier();
+
+        fs->boot->state = FS_CLEAN;
+    }
+
+    fs_leave(flags);
+    return ret;
+}
+
+
+/**
+ * @brief Remove a regular file. If it is open, its inode and data stay
+ * until the last close.
+ * 
+ * @param dir : The inode of the directory holding the file.
+ * @param name : A file name.
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t fs_unlink(uint32_t dir, const int8_t *name) {
+    uint32_t flags, inode;
+    int32_t i, type;
+
+    if (!name)
+        return -ENOENT;
+
+    fs_enter(flags);
+
+    if (!dir_ok(dir) || (i = lookup_in(dir, name)) < 0) {
+        fs_leave(flags);
+        return -ENOENT;
+    }
+
+    if ((type = dir_entry(dir, i)->type) != REGULAR) {
+        fs_leave(flags);
+        return (type == DIRECTORY) ? -EISDIR : -EPERM;
+    }
+
+    inode = dir_entry(dir, i)->inode;
+
+    fs->boot->state = FS_DIRTY;
+    fs_barrier();
+
+    remove_entry(dir, i);
+    fs_barrier();
+
+    if (fs->iref[inode])
+        fs->orphan[inode] = 1;
+    else
+        free_inode(inode);
+    fs_barrier();
+
+    fs->boot->state = FS_CLEAN;
+
+    fs_leave(flags);
+    return 0;
+}
+
+
+/**
+ * @brief Remove an empty directory. The current directory of a task 
+ * cannot be removed: its inode could be reused for another directory,
+ * and the task's relative paths would be looked up there.
+ * 
+ * @param dir : The inode of the directory holding it.
+ * @param name : The name of the directory to remove.
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t fs_rmdir(uint32_t dir, const int8_t *name) {
+    uint32_t flags, inode;
+    int32_t i;
+
+    if (!name || is_dot(name))
+        return -EINVAL;
+
+    fs_enter(flags);
+
+    if (!dir_ok(dir) || (i = lookup_in(dir, name)) < 0) {
+        fs_leave(flags);
+        return -ENOENT;
+    }
+
+    inode = dir_entry(dir, i)->inode;
+    if (dir_entry(dir, i)->type != DIRECTORY || inode == ROOT_INO) {
+        fs_leave(flags);
+        return -ENOTDIR;
+    }
+
+    /* only "." and ".." left */
+    if (dir_count(inode) > 2) {
+        fs_leave(flags);
+        return -ENOTEMPTY;
+    }
+
+    /* fs_chdir sets a cwd under fs_mutex, so no task can enter 
+     * it between this check and the removal */
+    if (cwd_in_use(inode)) {
+        fs_leave(flags);
+        return -EBUSY;
+    }
+
+    fs->boot->state = FS_DIRTY;
+    fs_barrier();
+
+    remove_entry(dir, i);
+    fs_barrier();
+
+    free_inode(inode);
+    fs_barrier();
+
+    fs->boot->state = FS_CLEAN;
+
+    fs_leave(flags);
+    return 0;
+}
+
+
+/**
+ * @brief A file was opened on inode.
+ * 
+ * @param inode : A inode number
+ */
+void fs_iget(uint32_t inode) {
+    uint32_t flags;
+
+    if (validate_inode(inode) < 0 || inode >= fs->max_inode)
+        return;
+
+    spin_lock_irqsave(&fs_lock, flags);
+    fs->iref[inode]++;
+    spin_unlock_irqrestore(&fs_lock, flags);
+}
+
+
+/**
+ * @brief A file opened on inode was closed, the inode of an unlinked
+ * file is freed on the last close.
+ * 
+ * @param inode : A inode number
+ */
+void fs_iput(uint32_t inode) {
+    uint32_t flags, state;
+
+    if (validate_inode(inode) < 0 || inode >= fs->max_inode)
+        return;
+
+    spin_lock_irqsave(&fs_lock, flags);
+
+    /* an operation waiting on the disk may be in the middle of an update */
+    if (!--fs->iref[inode] && fs->orphan[inode]) {
+        fs->orphan[inode] = 0;
+        state = fs->boot->state;
+        fs->boot->state = FS_DIRTY;
+        fs_barrier();
+        free_inode(inode);
+        fs_barrier();
+        fs->boot->state = state;
+    }
+
+    spin_unlock_irqrestore(&fs_lock, flags);
+}
+
+
+/**
+ * @brief A mapping of inode was made, the inode stays until it is 
+ * unmapped and the file cannot be cut.
+ * 
+ * @param inode : The inode of a regular file.
+ */
+void fs_mget(uint32_t inode) {
+    uint32_t flags;
+
+    if (validate_inode(inode) < 0 || inode >= fs->max_inode)
+        return;
+
+    fs_iget(inode);
+
+    spin_lock_irqsave(&fs_lock, flags);
+    fs->mapped[inode]++;
+    spin_unlock_irqrestore(&fs_lock, flags);
+}
+
+
+/**
+ * @brief A mapping of inode was removed.
+ * 
+ * @param inode : The inode of a regular file.
+ */
+void fs_mput(uint32_t inode) {
+    uint32_t flags;
+
+    if (validate_inode(inode) < 0 || inode >= fs->max_inode)
+        return;
+
+    spin_lock_irqsave(&fs_lock, flags);
+    fs->mapped[inode]--;
+    spin_unlock_irqrestore(&fs_lock, flags);
+
+    fs_iput(inode);
+}
+
+
+/**
+ * @brief Address of the data block holding the nth page of a file.
+ * 
+ * @param inode : The inode of a regular file.
+ * @param n : Page (block) index in the file.
+ * @return uint32_t : Address of the block, 0 if n is past the end of the file
+ */
+uint32_t fs_block_addr(uint32_t inode, uint32_t n) {
+    uint32_t b, size;
+
+    if (validate_inode(inode) < 0 || fs->dev)
+        return 0;
+
+    /* no fs_lock: this runs in the page fault handler, which write_data
+     * enters with fs_lock held when it copies from a mapping. The blocks
+     * of a mapped file do not change, and a growing file sets a block 
+     * before its size covers it. */
+    size = fs->inodes[inode].size;
+    fs_barrier();
+
+    if (n < size_blocks(size) && n < FILE_BLOCKS &&
+        (b = fs->inodes[inode].data_block[n]) < fs->boot->n_datab)
+        return (uint32_t)fs->data_block_addr[b].data;
+
+    return 0;
+}
+
+
+/**
+ * @brief Get the file size.
+ * 
+ * @param index The index of the dentry.
+ * @return uint32_t : file size.
+ */
+uint32_t get_size(uint32_t index) {
+    dentry_t dentry;
+    stat_t st;
+
+    if (read_dentry_by_index(index, &dentry) < 0 || dentry.type != REGULAR)
+        return 0;
+    fs_stat(&dentry, &st);
+    return st.st_size;
+}
+
+
+/**
+ * @brief Check that a file is a user-level executable: read its header,
+ * check the magic number and get the entry point. The address space 
+ * is not touched, so exec can fail here and return to the old program.
+ * 
+ * @param fname file name of the program
+ * @param EIP: the address of the user program eip register
+ * @return int32_t : the inode of the program, negative values denote an error condition
+ */
+int32_t pro_check(const int8_t *fname, uint32_t *EIP) {
+    int i;
+    int32_t errno;
+    int32_t inode;
+    uint8_t header[40];
+    uint8_t eip_buf[4];
+    uint8_t magic_number[4] = { 0x7f, 0x45, 0x4c, 0x46 };
+
+    if ((inode = validate_fname(fname)) < 0)
+        return inode;
+
+    /* read header from the program image */
+    if ((errno = read_data(inode, 0, header, 40)) < 0)
+        return errno;
+    if (errno < 40)
+        return -ENOEXEC;
+
+    /* check magic number */
+    for (i = 0; i < 4; ++i) {
+        if (header[i] != magic_number[i])
+            return -ENOEXEC;
+        eip_buf[i] = header[i + 24];
     }
 
     *EIP = *(uint32_t*)eip_buf;
 
-    curr->vm.file_length = (file.size + PAGE_SIZE - 1) / PAGE_SIZE;
-    vmalloc(curr->vm.map_list, curr->vm.file_length * PAGE_SIZE, PTE_RW | PTE_US);
+    return inode;
+}
+
+
+/**
+ * @brief Load program image into user vitural address space
+ * 
+ * @param fname file name of the program
+ * @param EIP: the address of the user program eip register
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+int32_t pro_loader(const int8_t *fname, uint32_t *EIP, thread_t* curr) {
+    int32_t errno;
+    int32_t inode;
+    inode_t file;
+
+    /* check if the file is a user-level executable file */
+    if ((inode = pro_check(fname, EIP)) < 0)
+        return inode;
+    
+    /* get the file inode */
+    file = fs->inodes[inode];            /* Get the file inode. */
+
+    curr->vm->file_length = (file.size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (vmalloc(curr->vm->map_list, curr->vm->file_length * PAGE_SIZE, PTE_RW | PTE_US) < 0)
+        return -ENOMEM;
     /* map the virtual memory space to to child */
     
 
@@ -255,3 +1329,660 @@ static int32_t validate_inode(uint32_t inode) {
         return -1;
     return 0;
 }
+
+
+/**
+ * @brief FNV-1a hash of a file name, over at most NAMESIZE bytes like 
+ * the name comparison (names of NAMESIZE bytes have no '\0')
+ * 
+ * @param name : A file name.
+ * @return uint32_t : The hash value.
+ */
+static uint32_t name_hash(const int8_t *name) {
+    uint32_t h = 2166136261U;
+    int i;
+
+    for (i = 0; i < NAMESIZE && name[i]; ++i) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+
+/**
+ * @brief Find a file name in the hash table, with fs_lock held.
+ * 
+ * @param fname : A file name.
+ * @return int32_t : index of the directory entry, -1 if there is none
+ */
+static int32_t lookup(const int8_t *fname) {
+    uint32_t h = name_hash(fname);
+    int32_t i;
+
+    for (i = fs->dhash[h & (DHASH_SIZE - 1)]; i >= 0; i = fs->dnext[i]) {
+
+        /* The current file name stored in the boot block. */
+        int8_t *_fname = (int8_t *)(fs->boot->dirs[i].fname);
+        if (fs->dhval[i] == h && !strncmp(fname, _fname, NAMESIZE)) {
+
+            /* Two file names are equal. */
+            return i;
+        }
+    }
+    return -1;  /* Not found. */
+}
+
+
+/**
+ * @brief Mark the inodes and data blocks used by the directory entries,
+ * everything else is free. Directories are walked from the root, an 
+ * inode already marked is not walked again.
+ * 
+ * @return int32_t : 0 on success, -ENOMEM if there is no room for the queue
+ */
+static int32_t fs_rebuild_maps(void) {
+    uint32_t head = 0, tail = 0, dir, i, n, inode;
+    uint32_t *queue;
+    dentry_t *d;
+
+    if (!(queue = kmalloc(fs->max_inode * sizeof(uint32_t))))
+        return -ENOMEM;
+
+    memset(fs->inode_map, 0, map_bytes(fs->max_inode));
+    memset(fs->block_map, 0, map_bytes(fs->max_datab));
+
+    /* inode 0 is the root directory, "." of the root and the devices */
+    map_set(fs->inode_map, ROOT_INO);
+    queue[tail++] = ROOT_INO;
+
+    while (head < tail) {
+        dir = queue[head++];
+
+        for (i = 0; i < dir_count(dir); ++i) {
+            d = dir_entry(dir, i);
+            inode = d->inode;
+            if ((d->type != REGULAR && d->type != DIRECTORY) || is_dot(d->fname) ||
+                inode >= fs->max_inode || map_test(fs->inode_map, inode))
+                continue;
+
+            map_set(fs->inode_map, inode);
+            for (n = 0; n < size_blocks(fs->inodes[inode].size) && n < FILE_BLOCKS; ++n)
+                if (fs->inodes[inode].data_block[n] < fs->max_datab)
+                    map_set(fs->block_map, fs->inodes[inode].data_block[n]);
+
+            if (d->type == DIRECTORY && tail < fs->max_inode)
+                queue[tail++] = inode;
+        }
+    }
+
+    kfree(queue);
+    fs->boot->state = FS_CLEAN;
+    return 0;
+}
+
+
+/**
+ * @brief Take a free inode from the inode map.
+ * 
+ * @return int32_t : the inode number, -ENOSPC if there is none
+ */
+static int32_t alloc_inode(void) {
+    uint32_t i;
+
+    for (i = 1; i < fs->max_inode; ++i) {
+        if (!map_test(fs->inode_map, i)) {
+            map_set(fs->inode_map, i);
+            return i;
+        }
+    }
+    return -ENOSPC;
+}
+
+
+/**
+ * @brief Take a free data block from the block map and clear it.
+ * 
+ * @return int32_t : the data block index, -ENOSPC if there is none
+ */
+static int32_t alloc_block(void) {
+    int8_t *data;
+    uint32_t i;
+
+    for (i = 0; i < fs->max_datab; ++i) {
+        if (!map_test(fs->block_map, i)) {
+            if (!(data = block_data(i, BLK_NEW)))
+                return -EIO;
+            map_set(fs->block_map, i);
+            memset(data, 0, BLOCK_SIZE);
+            return i;
+        }
+    }
+    return -ENOSPC;
+}
+
+
+/**
+ * @brief Put the data blocks and the inode of a file that no directory 
+ * entry names back in the maps, with fs_lock held.
+ * 
+ * @param inode : A inode number
+ */
+static void free_inode(uint32_t inode) {
+    inode_t *file = &fs->inodes[inode];
+    uint32_t n;
+
+    for (n = 0; n < size_blocks(file->size); ++n)
+        if (file->data_block[n] < fs->max_datab)
+            map_clear(fs->block_map, file->data_block[n]);
+
+    file->size = 0;
+    map_clear(fs->inode_map, inode);
+}
+
+
+/**
+ * @brief Write into a file, with fs_lock held.
+ * 
+ * @param file : The file inode.
+ * @param offset : The offset of the file in bytes to write.
+ * @param buf : The data to write, NULL to write zeros.
+ * @param length : The number of bytes to write to the file.
+ * @return int32_t : number of bytes written, negative values denote an error condition
+ */
+static int32_t __write_data(inode_t *file, uint32_t offset, const uint8_t *buf, uint32_t length) {
+    uint32_t end, pos, n, have, need, chunk, old;
+    int32_t b;
+    int8_t *data;
+
+    if (offset >= FILE_BLOCKS * BLOCK_SIZE)
+        return -EFBIG;
+    if (length > FILE_BLOCKS * BLOCK_SIZE - offset)
+        length = FILE_BLOCKS * BLOCK_SIZE - offset;
+    if (!length)
+        return 0;
+
+    end = offset + length;
+    old = file->size;
+    have = size_blocks(old);
+    need = size_blocks(end);
+
+    fs->boot->state = FS_DIRTY;
+    fs_barrier();
+
+    /* new blocks are past the size, nothing sees them yet */
+    for (n = have; n < need; ++n) {
+        if ((b = alloc_block()) < 0) {
+            need = n;
+            break;
+        }
+        file->data_block[n] = b;
+    }
+
+    if (need * BLOCK_SIZE < end)
+        end = need * BLOCK_SIZE;
+    if (end <= offset) {
+        fs->boot->state = FS_CLEAN;
+        return -ENOSPC;
+    }
+
+    /* the tail of the last old block may hold data of a truncated file */
+    if (offset > old && old % BLOCK_SIZE) {
+        chunk = (offset < have * BLOCK_SIZE) ? offset : have * BLOCK_SIZE;
+        if ((data = block_data(file->data_block[have - 1], BLK_WRITE)))
+            memset(data + old % BLOCK_SIZE, 0, chunk - old);
+    }
+
+    for (pos = offset; pos < end; pos += chunk) {
+        chunk = BLOCK_SIZE - pos % BLOCK_SIZE;
+        if (chunk > end - pos)
+            chunk = end - pos;
+
+        data = block_data(file->data_block[pos / BLOCK_SIZE], (chunk == BLOCK_SIZE) ? BLK_NEW : BLK_WRITE);
+        if (!data) {
+            end = pos;
+            break;
+        }
+        data += pos % BLOCK_SIZE;
+        if (buf)
+            memcpy(data, buf + (pos - offset), chunk);
+        else
+            memset(data, 0, chunk);
+    }
+    fs_barrier();
+
+    /* the new data is part of the file from here on */
+    if (end > old)
+        file->size = end;
+    fs_barrier();
+
+    fs->boot->state = FS_CLEAN;
+    return end - offset;
+}
+
+
+/**
+ * @brief Number of entries of a directory, with fs_lock held.
+ * 
+ * @param dir : The inode of the directory.
+ * @return uint32_t : The number of entries.
+ */
+static uint32_t dir_count(uint32_t dir) {
+    uint32_t n;
+
+    if (dir == ROOT_INO)
+        return (fs->boot->n_dir < FILES_MAX) ? fs->boot->n_dir : FILES_MAX;
+
+    n = fs->inodes[dir].size / sizeof(dentry_t);
+
+    /* a block out of the image ends the directory */
+    if (n > FILE_BLOCKS * DIR_ENTRIES)
+        n = FILE_BLOCKS * DIR_ENTRIES;
+    return n;
+}
+
+
+/**
+ * @brief An entry of a directory, with fs_lock held.
+ * 
+ * @param dir : The inode of the directory.
+ * @param i : The entry index, less than dir_count(dir).
+ * @return dentry_t* : The entry in the image or the cache, a zeroed 
+ *                     entry if its block cannot be read.
+ */
+static dentry_t *dir_entry(uint32_t dir, uint32_t i) {
+    static dentry_t none;               /* stands for an entry that cannot be read */
+    int8_t *data;
+
+    if (dir == ROOT_INO)
+        return &fs->boot->dirs[i];
+
+    if (!(data = block_data(fs->inodes[dir].data_block[i / DIR_ENTRIES], BLK_READ))) {
+        memset(&none, 0, sizeof(none));
+        return &none;
+    }
+    return (dentry_t *)data + i % DIR_ENTRIES;
+}
+
+
+/**
+ * @brief Check that an inode is a directory in use, with fs_lock held.
+ * 
+ * @param dir : An inode number.
+ * @return int32_t : 1 if it is, 0 otherwise
+ */
+static int32_t dir_ok(uint32_t dir) {
+    return dir == ROOT_INO || (dir < fs->max_inode && map_test(fs->inode_map, dir));
+}
+
+
+/**
+ * @brief Fill st for the file of an entry, with fs_lock held. Only
+ * regular files and directories have an inode, the root directory has
+ * its entries in the boot block and no data blocks.
+ * 
+ * @param dentry : The entry of the file.
+ * @param st : Filled with the inode, type, size and blocks of the file.
+ */
+static void __stat(const dentry_t *dentry, stat_t *st) {
+    st->st_ino = 0;
+    st->st_type = dentry->type;
+    st->st_size = 0;
+    st->st_blocks = 0;
+
+    if (dentry->type == DIRECTORY && dir_ok(dentry->inode)) {
+        st->st_ino = dentry->inode;
+        st->st_size = dir_count(dentry->inode) * sizeof(dentry_t);
+        if (dentry->inode != ROOT_INO)
+            st->st_blocks = (st->st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    } else if (dentry->type == REGULAR && !validate_inode(dentry->inode)) {
+        st->st_ino = dentry->inode;
+        st->st_size = fs->inodes[dentry->inode].size;
+        st->st_blocks = (st->st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+}
+
+
+/**
+ * @brief Find a name in a directory, with fs_lock held. The root is 
+ * searched through the name hash, other directories through the dentry
+ * cache, which a scan of the directory fills on a miss. A cached index 
+ * is checked against the entry, as entries move when one is removed.
+ * 
+ * @param dir : The inode of the directory.
+ * @param name : A file name.
+ * @return int32_t : index of the entry, -1 if there is none
+ */
+static int32_t lookup_in(uint32_t dir, const int8_t *name) {
+    uint32_t h, n, i;
+    dcache_t *c;
+
+    if (dir == ROOT_INO)
+        return lookup(name);
+
+    h = name_hash(name);
+    c = &fs->dcache[(h ^ (dir * 0x9e3779b9U)) & (DCACHE_SIZE - 1)];
+    n = dir_count(dir);
+
+    if (c->dir == dir && c->hash == h && c->index < n &&
+        !strncmp(name, dir_entry(dir, c->index)->fname, NAMESIZE))
+        return c->index;
+
+    for (i = 0; i < n; ++i) {
+        if (!strncmp(name, dir_entry(dir, i)->fname, NAMESIZE)) {
+            c->dir = dir;
+            c->hash = h;
+            c->index = i;
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Walk a path, with fs_lock held.
+ * 
+ * @param path : A path, from the root if it starts with '/', 
+ *               from cwd otherwise.
+ * @param cwd : The current directory.
+ * @param dentry : Filled with the entry of the path.
+ * @param parent : NULL, or set to the directory of the last name, 
+ *                 which is then not looked up.
+ * @param last : Set to the last name if parent is not NULL.
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+static int32_t walk(const int8_t *path, uint32_t cwd, dentry_t *dentry, uint32_t *parent, int8_t *last) {
+    int8_t name[NAMESIZE + 1];
+    uint32_t cur, len;
+    int32_t i;
+    dentry_t d;
+
+    cur = (*path == '/') ? ROOT_INO : cwd;
+    if (!dir_ok(cur))
+        return -ENOENT;
+
+    memset(&d, 0, sizeof(dentry_t));
+    strcpy(d.fname, ".");
+    d.type = DIRECTORY;
+    d.inode = cur;
+
+    while (1) {
+        while (*path == '/')
+            ++path;
+        if (!*path)
+            break;
+
+        for (len = 0; path[len] && path[len] != '/'; ++len)
+            ;
+
+        /* names compare over NAMESIZE bytes */
+        memcpy(name, path, (len < NAMESIZE) ? len : NAMESIZE);
+        name[(len < NAMESIZE) ? len : NAMESIZE] = '\0';
+        path += len;
+
+        if (d.type != DIRECTORY)
+            return -ENOTDIR;
+
+        if (parent) {
+            for (i = 0; path[i] == '/'; ++i)
+                ;
+            if (!path[i]) {
+                if (len > NAMESIZE)
+                    return -ENAMETOOLONG;
+                *parent = cur;
+                strcpy(last, name);
+                return 0;
+            }
+        }
+
+        /* ".." of the root is the root */
+        if (cur == ROOT_INO && !strcmp(name, ".."))
+            continue;
+
+        if ((i = lookup_in(cur, name)) < 0)
+            return -ENOENT;
+
+        d = *dir_entry(cur, i);
+        if (d.type == DIRECTORY) {
+            cur = d.inode;
+            if (!dir_ok(cur))
+                return -ENOENT;
+        }
+    }
+
+    /* a path without a last name ("/", "dir/.") */
+    if (parent)
+        return -EEXIST;
+
+    *dentry = d;
+    return 0;
+}
+
+
+/**
+ * @brief Add an entry at the end of a directory, with fs_lock held. The
+ * entry is written before the count of entries covers it.
+ * 
+ * @param dir : The inode of the directory.
+ * @param d : The new entry.
+ * @return int32_t : 0 on success, -ENOSPC if the directory is full
+ */
+static int32_t add_entry(uint32_t dir, dentry_t *d) {
+    if (dir == ROOT_INO) {
+        if (fs->boot->n_dir >= FILES_MAX)
+            return -ENOSPC;
+
+        fs->boot->dirs[fs->boot->n_dir] = *d;
+        fs_barrier();
+
+        fs->boot->n_dir++;
+        fs_hash_init();
+        return 0;
+    }
+
+    /* entries never cross a block, so this is all or nothing */
+    if (__write_data(&fs->inodes[dir], fs->inodes[dir].size, (uint8_t *)d, sizeof(dentry_t)) != sizeof(dentry_t))
+        return -ENOSPC;
+
+    return 0;
+}
+
+
+/**
+ * @brief Remove an entry from a directory, with fs_lock held. The last 
+ * entry takes its place, it is listed twice until the count of entries
+ * drops.
+ * 
+ * @param dir : The inode of the directory.
+ * @param i : The entry index.
+ */
+static void remove_entry(uint32_t dir, uint32_t i) {
+    uint32_t last = dir_count(dir) - 1;
+    dentry_t d;
+
+    if (i != last) {
+        d = *dir_entry(dir, last);
+        if (dir == ROOT_INO)
+            fs->boot->dirs[i] = d;
+        else
+            __write_data(&fs->inodes[dir], i * sizeof(dentry_t), (uint8_t *)&d, sizeof(dentry_t));
+    }
+    fs_barrier();
+
+    if (dir == ROOT_INO) {
+        fs->boot->n_dir--;
+        fs_hash_init();
+    } else {
+        shrink(&fs->inodes[dir], last * sizeof(dentry_t));
+    }
+}
+
+
+/**
+ * @brief Cut a file to length bytes, with fs_lock held. The size drops
+ * before the blocks past it are freed.
+ * 
+ * @param file : The file inode.
+ * @param length : The new size, at most the current one.
+ */
+static void shrink(inode_t *file, uint32_t length) {
+    uint32_t n, size = file->size;
+
+    file->size = length;
+    fs_barrier();
+
+    for (n = size_blocks(length); n < size_blocks(size); ++n)
+        if (file->data_block[n] < fs->max_datab)
+            map_clear(fs->block_map, file->data_block[n]);
+}
+
+
+/**
+ * @brief The data of a data block, with fs_mutex and fs_lock held. On a
+ * disk fs_lock is dropped while the cache is used, and the buffer is let
+ * go before returning: the pointer stays valid until fs_mutex is dropped,
+ * since all use of the cache for the file system is under fs_mutex and
+ * the LRU list reuses a buffer only after NBUF others.
+ * 
+ * @param b : The data block number.
+ * @param how : BLK_READ, BLK_WRITE (the block is marked dirty) or BLK_NEW
+ *              (the caller overwrites all of it, it is not read).
+ * @return int8_t* : The data, NULL for a bad block or a read error.
+ */
+static int8_t *block_data(uint32_t b, uint32_t how) {
+    int8_t *data;
+    buf_t *bh;
+
+    if (b >= fs->boot->n_datab)
+        return NULL;
+
+    if (!fs->dev)
+        return fs->data_block_addr[b].data;
+
+    spin_unlock(&fs_lock);
+
+    data = NULL;
+    bh = (how == BLK_NEW) ? bget(fs->dev, fs->data_start + b) : bread(fs->dev, fs->data_start + b);
+    if (bh) {
+        if (how != BLK_READ)
+            bdirty(bh);
+        data = bh->data;
+        brelse(bh);
+    }
+
+    spin_lock(&fs_lock);
+    return data;
+}
+
+
+/**
+ * @brief Read the blocks n to end - 1 of a file ahead, with fs_mutex and
+ * fs_lock held, fs_lock is dropped while they are read. The cache does
+ * nothing if block n is there already.
+ * 
+ * @param file : The file inode.
+ * @param n : The block of the file about to be read.
+ * @param end : The block of the file to stop at.
+ */
+static void readahead(inode_t *file, uint32_t n, uint32_t end) {
+    uint32_t blocks[RA_BLOCKS];
+    uint32_t i;
+
+    for (i = 0; i < RA_BLOCKS && n + i < end; ++i) {
+        if (file->data_block[n + i] >= fs->boot->n_datab)
+            break;
+        blocks[i] = fs->data_start + file->data_block[n + i];
+    }
+
+    spin_unlock(&fs_lock);
+    breada(fs->dev, blocks, i);
+    spin_lock(&fs_lock);
+}
+
+
+/**
+ * @brief Write the boot block or the blocks after it that differ from the copy
+ * of the disk, with fs_mutex and fs_lock held, fs_lock is dropped while
+ * the cache is used. Only these blocks are written and flushed. The copy
+ * follows what was written, or is spoiled on an error so that the blocks
+ * are written again.
+ * 
+ * @param first : The first block, 0 for the boot block.
+ * @param n : The number of blocks.
+ * @param marker : 1 to write the boot block with the state FS_DIRTY.
+ * @return int32_t : 0 on success, -EIO on a write error
+ */
+static int32_t sync_blocks(uint32_t first, uint32_t n, uint32_t marker) {
+    int8_t *mem = (int8_t *)fs->boot + first * BLOCK_SIZE;
+    int8_t *disk = (int8_t *)fs->shadow + first * BLOCK_SIZE;
+    int32_t errno;
+    uint32_t i;
+    buf_t *b;
+
+    for (i = 0; i < n; ++i) {
+        if (!marker && !memcmp(mem + i * BLOCK_SIZE, disk + i * BLOCK_SIZE, BLOCK_SIZE))
+            continue;
+
+        spin_unlock(&fs_lock);
+        b = bget(fs->dev, first + i);
+        spin_lock(&fs_lock);
+        if (!b)
+            return -EIO;
+
+        memcpy(b->data, mem + i * BLOCK_SIZE, BLOCK_SIZE);
+        if (marker)
+            ((boot_block *)b->data)->state = FS_DIRTY;
+        memcpy(disk + i * BLOCK_SIZE, b->data, BLOCK_SIZE);
+
+        bdirty(b);
+        brelse(b);
+    }
+
+    spin_unlock(&fs_lock);
+    errno = bsync_blocks(fs->dev, first, n);
+    spin_lock(&fs_lock);
+
+    if (errno < 0) {
+        memset(disk, 0xFF, n * BLOCK_SIZE);
+        return -EIO;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Mark the boot block on the disk FS_DIRTY before the cache writes
+ * a block back on its own (pre_evict of the disk), with fs_mutex held: 
+ * the block may get there before the inodes and maps that go with it. 
+ * The boot block is written as the copy of the disk with the new state,
+ * not through the cache, which is in the middle of a reuse.
+ * 
+ * @param dev : The disk mounted.
+ * @return int32_t : 0 on success, -EIO on a write error
+ */
+static int32_t fs_mark_dirty(blkdev_t *dev) {
+    int8_t *boot = (int8_t *)fs->shadow;
+
+    if (fs->shadow->state == FS_DIRTY)
+        return 0;
+
+    fs->shadow->state = FS_DIRTY;
+    if (dev->write(dev, 0, 1, &boot) < 0 || (dev->flush && dev->flush(dev) < 0)) {
+        /* written again at the next fs_sync() */
+        memset(boot, 0xFF, BLOCK_SIZE);
+        return -EIO;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief The work of fs_writeback().
+ * 
+ * @param work : sync_work.
+ */
+static void fs_sync_work(work_t *work) {
+    fs_sync();
+}
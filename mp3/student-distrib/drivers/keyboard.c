@@ -1,6 +1,8 @@
 #include <drivers/keyboard.h>
 #include <drivers/terminal.h>
 #include <pro/process.h>
+#include <pro/workqueue.h>
+#include <spinlock.h>
 #include <boot/i8259.h>
 #include <lib.h>
 #include <io.h>
@@ -25,35 +27,81 @@ const char scancodes[KEYBOARD_SIZE][2] =
 
 
 
+/* scancodes read by the interrupt handler, consumed by keyboard_work */
+static uint8_t kbd_buf[KBD_BUF_SIZE];
+static volatile uint32_t kbd_head;          /* next scancode to handle */
+static volatile uint32_t kbd_tail;          /* next free slot */
+static DEFINE_SPINLOCK(kbd_lock);           /* protects kbd_buf, kbd_head and kbd_tail */
+static work_t kbd_work;
+
+
+static void keyboard_bh(work_t *work);
+
+
 /**
  * @brief Initialize the keyboard and enable the interrput.
  */
 void keyboard_init(void) {
+    kbd_head = kbd_tail = 0;
+    INIT_WORK(&kbd_work, keyboard_bh);
     enable_irq(KEYBOARD_IRQ);
 }
 
 
 /**
  * @brief Interrupt handler for the keyboard device.
+ * Only reads the scancode; decoding and echoing it to the 
+ * terminal is deferred to keyboard_bh in the worker thread.
  */
 void do_keyboard(void) {
-    terminal_t *terminal;
     uint32_t scancode;
 
-    /* Critical section begins. */
-    cli();
+    /* Critical section begins. (interrupts are already off in the handler) */
+    spin_lock(&kbd_lock);
 
     scancode = inb(KEYBOARD_PORT);              /* Read one byte from stdin. */
 
     send_eoi(KEYBOARD_IRQ);                     /* Send End of interrupt to the PIC. */
 
-    terminal = current->task->terminal;
-
-    if (scancode < SCANCODES_SIZE)              /* key press (make) */
-        key_press(scancode, terminal);
-    else                                        /* key release (break) */
-        key_release(scancode - SCANCODES_SIZE, terminal);
+    /* drop the key if the bottom half is too far behind */
+    if (kbd_tail - kbd_head < KBD_BUF_SIZE) {
+        kbd_buf[kbd_tail & (KBD_BUF_SIZE - 1)] = (uint8_t)scancode;
+        kbd_tail++;
+        schedule_work(&kbd_work);
+    }
 
     /* Critical section ends. */
-    sti();
+    spin_unlock(&kbd_lock);
+}
+
+
+/**
+ * @brief Bottom half of the keyboard interrupt: handle all buffered scancodes.
+ * 
+ * @param work : kbd_work
+ */
+static void keyboard_bh(work_t *work) {
+    terminal_t *terminal;
+    uint32_t scancode;
+    uint32_t flags;
+
+    while (kbd_head != kbd_tail) {
+        spin_lock_irqsave(&kbd_lock, flags);
+        scancode = kbd_buf[kbd_head & (KBD_BUF_SIZE - 1)];
+        kbd_head++;
+        spin_unlock_irqrestore(&kbd_lock, flags);
+
+        /* terminal and console state is shared with the terminal driver,
+         * so one key is handled at a time under the terminal lock */
+        spin_lock_irqsave(&term_lock, flags);
+
+        terminal = current->task->terminal;
+
+        if (scancode < SCANCODES_SIZE)          /* key press (make) */
+            key_press(scancode, terminal);
+        else                                    /* key release (break) */
+            key_release(scancode - SCANCODES_SIZE, terminal);
+
+        spin_unlock_irqrestore(&term_lock, flags);
+    }
 }
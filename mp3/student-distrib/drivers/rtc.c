@@ -2,9 +2,12 @@
 #include <boot/i8259.h>
 #include <vfs/file.h>
 #include <vfs/vfs.h>
+#include <vfs/poll.h>
 #include <pro/process.h>
 #include <drivers/fs.h>
 #include <access.h>
+#include <spinlock.h>
+#include <errno.h>
 #include <lib.h>
 #include <io.h>
 
@@ -12,16 +15,29 @@
 /* Claimed as volatile to let it change base on interrupts. */
 volatile int global_interrupt_flag;
 
+/* protects the CMOS index/data port pair */
+static DEFINE_SPINLOCK(rtc_lock);
+
+/* the rate of the periodic interrupt, in Hz */
+static int32_t rtc_freq;
+
+/* readers waiting for the next interrupt, under rtc_lock */
+static DECLARE_WAIT_QUEUE_HEAD(rtc_wait);
+
 /* local helper functions*/
 static void set_rtc_freq(int32_t frequency);
+static int32_t check_freq(int32_t frequency);
 static char log2_of(int32_t frequency);
+static uint8_t cmos_read(uint8_t reg);
 
 /* RTC operation. */
-static file_op rtc_op = {
+static const file_op rtc_op = {
     .open = rtc_open,
     .close = rtc_close,
     .read = rtc_read,
-    .write = rtc_write
+    .write = rtc_write,
+    .ioctl = rtc_ioctl,
+    .poll = rtc_poll
 };
 
 /**
@@ -29,13 +45,16 @@ static file_op rtc_op = {
  * 
  */
 void rtc_init() {
-    /* Reference from https://wiki.osdev.org/RTC#Turning_on_IRQ_8 and Linux source code.
-     * might neeed to turn off interrupts if multiprocessor involved
-     */
+    uint32_t flags;
+    char prev;
+
+    /* Reference from https://wiki.osdev.org/RTC#Turning_on_IRQ_8 and Linux source code. */
+    spin_lock_irqsave(&rtc_lock, flags);
     outb(RTC_B_reg, RTC_CMD_port);	    /* Select register B, and disable NMI. */
-    char prev = inb(RTC_DATA_port);	    /* Read the current value of register B */
+    prev = inb(RTC_DATA_port);	        /* Read the current value of register B */
     outb(RTC_B_reg, RTC_CMD_port);	    /* Set the index again (a read will reset the index to register D) */
     outb(prev | 0x40, RTC_DATA_port);   /* Write the previous value ORed with 0x40. This turns on bit 6 of register B */
+    spin_unlock_irqrestore(&rtc_lock, flags);
     enable_irq(RTC_IRQ);
     set_rtc_freq(RTC_MAX_freq);
     global_interrupt_flag = 0;
@@ -46,14 +65,17 @@ void rtc_init() {
  * 
  */
 void do_rtc() {
-    cli();
+    /* interrupts are already off in the handler, and are turned
+     * back on by iret, not here */
+    spin_lock(&rtc_lock);
     global_interrupt_flag = 1;
+    wake_up(&rtc_wait);
     send_eoi(RTC_IRQ);
 
     outb(RTC_C_reg, RTC_CMD_port);     /* read from register C and ensure all interrupts are properly generated */
 
     inb(RTC_DATA_port);                /* discard the value for now. */
-    sti();
+    spin_unlock(&rtc_lock);
 }
 
 /**
@@ -68,7 +90,7 @@ int32_t rtc_open(const int8_t* filename) {
     /* initialize the RTC and set initial frequency to 2 as instructed */
     rtc_init();
     set_rtc_freq(2);
-    return __open(2, filename, RTC, &rtc_op, curr);
+    return __open(2, filename, RTC, 0, &rtc_op, curr);
 }
 
 /**
@@ -88,17 +110,53 @@ int32_t rtc_close(int32_t fd) {
  * @param buffer : address of the target frequency.
  * @param nbytes : number of bytes.
  * 
- * @return int32_t : 0 on success, -1 otherwise.
+ * @return int32_t : 0 on success, -EINTR if a signal came first.
  * 
 */
 int32_t rtc_read(int32_t fd, void* buffer, int32_t nbytes) {
-    /* wait on interrupt generation */
-    while(!global_interrupt_flag);
+    thread_t *curr;
+    uint32_t flags;
+
+    GETPRO(curr);
+
+    /* sleep until the next interrupt */
+    spin_lock_irqsave(&rtc_lock, flags);
+    while (!global_interrupt_flag) {
+        if (signal_pending(curr)) {
+            spin_unlock_irqrestore(&rtc_lock, flags);
+            return -EINTR;
+        }
+        sleep_on(&rtc_wait, &rtc_lock);
+    }
     global_interrupt_flag = 0;
+    spin_unlock_irqrestore(&rtc_lock, flags);
+
     return 0;
 }
 
 
+/**
+ * @brief Events ready on the RTC.
+ * 
+ * @param fd : The file descriptor.
+ * @param pt : poll table, the caller waits for the next interrupt.
+ * 
+ * @return uint32_t : POLLIN if an interrupt came since the last read, POLLOUT always.
+ * 
+*/
+uint32_t rtc_poll(int32_t fd, struct poll_table *pt) {
+    uint32_t flags, mask = POLLOUT;
+
+    spin_lock_irqsave(&rtc_lock, flags);
+    poll_wait(&rtc_wait, &rtc_lock, pt);
+    if (global_interrupt_flag)
+        mask |= POLLIN;
+    spin_unlock_irqrestore(&rtc_lock, flags);
+
+    return mask;
+}
+
+
 /**
  * @brief Set the RTC frequency based on buffer
  * 
@@ -115,12 +173,7 @@ int32_t rtc_write(int32_t fd, const void* buffer, int32_t nbytes){
         return -1;
     }
     int32_t new_freq = *(int32_t*) buffer;
-    /* check if the new frequency is out of bound*/
-    if (new_freq > RTC_MAX_freq || new_freq < RTC_MIN_freq) {
-        return -1;                      
-    }
-    /* check if the new frequency is power of 2*/
-    if (new_freq & 0x1) {
+    if (check_freq(new_freq) < 0) {
         return -1;
     }
 
@@ -129,6 +182,48 @@ int32_t rtc_write(int32_t fd, const void* buffer, int32_t nbytes){
 }
 
 
+/**
+ * @brief Control the RTC: the same frequency change as rtc_write,
+ * without the 4 byte buffer, and reading the frequency back.
+ * 
+ * @param fd : The file descriptor.
+ * @param cmd : RTC_IRQP_SET or RTC_IRQP_READ.
+ * @param arg : the new frequency for RTC_IRQP_SET, unused otherwise.
+ * 
+ * @return int32_t : 0 (RTC_IRQP_SET) or the frequency (RTC_IRQP_READ) on success,
+ *                   -EINVAL for a bad frequency, -ENOTTY for an unknown command.
+ * 
+*/
+int32_t rtc_ioctl(int32_t fd, uint32_t cmd, uint32_t arg) {
+    switch (cmd) {
+    case RTC_IRQP_SET:
+        if (check_freq(arg) < 0)
+            return -EINVAL;
+        set_rtc_freq(arg);
+        return 0;
+
+    case RTC_IRQP_READ:
+        return rtc_freq;
+
+    default:
+        return -ENOTTY;
+    }
+}
+
+
+/**
+ * @brief Local helper function that checks a frequency is a power of 2
+ * between RTC_MIN_freq and RTC_MAX_freq.
+*/
+static int32_t check_freq(int32_t frequency) {
+    if (frequency > RTC_MAX_freq || frequency < RTC_MIN_freq)
+        return -EINVAL;
+    if (frequency & (frequency - 1))
+        return -EINVAL;
+    return 0;
+}
+
+
 
 /**
  * @brief Local helper function that set the RTC frequency to the given value.
@@ -142,12 +237,13 @@ static void set_rtc_freq(int32_t frequency) {
         return;
     }
     uint32_t interrupt_flag;
-    cli_and_save(interrupt_flag);       /* Disable interrupts and store flags into local variable. */
+    spin_lock_irqsave(&rtc_lock, interrupt_flag);   /* the RTC interrupt handler uses the ports too */
     outb(RTC_A_reg, RTC_CMD_port);
 	char prev = inb(RTC_DATA_port);
 	outb(RTC_A_reg, RTC_CMD_port);
 	outb((prev & prev_mask) | rate, RTC_DATA_port);
-    restore_flags(interrupt_flag);
+    rtc_freq = frequency;
+    spin_unlock_irqrestore(&rtc_lock, interrupt_flag);
 }
 
 
@@ -161,10 +257,69 @@ static char log2_of(int32_t frequency) {
 }
 
 
+/**
+ * @brief Read the wall clock kept by the CMOS.
+ * The RTC has no century register we can rely on, years are taken as 20xx.
+ * 
+ * @return uint32_t : seconds since midnight of January 1 1970 (UTC)
+ */
+uint32_t rtc_get_time(void) {
+    uint32_t flags;
+    uint32_t sec, min, hour, day, mon, year, days;
+    uint8_t regb, pm;
 
+    spin_lock_irqsave(&rtc_lock, flags);
 
+    /* the registers are not consistent while the RTC updates them */
+    while (cmos_read(RTC_A_reg) & RTC_UIP);
 
+    sec  = cmos_read(RTC_SEC_reg);
+    min  = cmos_read(RTC_MIN_reg);
+    hour = cmos_read(RTC_HOUR_reg);
+    day  = cmos_read(RTC_DAY_reg);
+    mon  = cmos_read(RTC_MON_reg);
+    year = cmos_read(RTC_YEAR_reg);
+    regb = cmos_read(RTC_B_reg);
 
+    spin_unlock_irqrestore(&rtc_lock, flags);
 
+    pm = hour & RTC_PM;
+    hour &= ~RTC_PM;
+
+    if (!(regb & RTC_BINARY)) {
+#define BCD(x) (((x) >> 4) * 10 + ((x) & 0x0F))
+        sec  = BCD(sec);
+        min  = BCD(min);
+        hour = BCD(hour);
+        day  = BCD(day);
+        mon  = BCD(mon);
+        year = BCD(year);
+#undef BCD
+    }
 
+    if (!(regb & RTC_24H))
+        hour = (hour % 12) + (pm ? 12 : 0);
+
+    year += 2000;
+
+    /* days since 1970-01-01, counting March as the first month 
+     * so that the leap day is the last day of the year */
+    if (mon <= 2) {
+        mon += 12;
+        year--;
+    }
+    days = 365 * year + year / 4 - year / 100 + year / 400
+         + (153 * (mon - 3) + 2) / 5 + day - 1 - 719468;
 
+    return ((days * 24 + hour) * 60 + min) * 60 + sec;
+}
+
+
+/**
+ * @brief Local helper function that reads a CMOS register, 
+ * called with rtc_lock held.
+ */
+static uint8_t cmos_read(uint8_t reg) {
+    outb(reg, RTC_CMD_port);
+    return inb(RTC_DATA_port);
+}
@@ -1,14 +1,18 @@
 #include <drivers/terminal.h>
 #include <vfs/vfs.h>
+#include <vfs/poll.h>
 #include <pro/cfs.h>
 #include <pro/process.h>
 #include <kmalloc.h>
+#include <spinlock.h>
 #include <lib.h>
 #include <access.h>
 #include <drivers/vga.h>
 #include <io.h>
 #include <boot/x86_desc.h>
 #include <boot/page.h>
+#include <boot/smp.h>
+#include <errno.h>
 
 /* Local functions, see headers for descriptions. */
 
@@ -17,6 +21,7 @@ static void out(const void *buf, int32_t nbytes);
 static void out_tab(uint32_t n, terminal_t *terminal);
 static void backspace(terminal_t *terminal);
 static void bufcpy(void *dest, const void *src, uint32_t nbytes, uint8_t bufhd);
+static int32_t line_length(terminal_t *terminal);
 static int isletter(uint32_t scancode);
 static inline void terminal_switch(uint32_t scancode, terminal_t *terminal, int idx);
 
@@ -25,6 +30,13 @@ static inline void terminal_switch(uint32_t scancode, terminal_t *terminal, int
 /* 1 when terminal driver is booted */
 int8_t terminal_boot = 0;
 
+/* protects the line buffers and screens of all terminals and the
+ * visible console: a console switch touches all of them at once */
+DEFINE_SPINLOCK(term_lock);
+
+/* readers waiting for a line on any of the terminals, under term_lock */
+static DECLARE_WAIT_QUEUE_HEAD(term_wait);
+
 
 /**
  * @brief create and initialize the terminal.
@@ -42,8 +54,10 @@ terminal_t *terminal_create(void) {
     terminal->bufhd = 0;                        /* 0 characters read. */
     terminal->buftl = 0;                        /* 0 characters read. */
     terminal->size = 0;                         /* No character yet. */
-    terminal->exit = 0;                         /* \n is not read. */
     terminal->buffer = kmalloc(TERBUF_SIZE);    /* create buffer */
+    terminal->screen_x = 0;                     /* cursor at the top left */
+    terminal->screen_y = 0;
+    terminal->top = 0;                          /* screen not scrolled */
     // terminal->saved_vidmem = VIDEO_BUF_1 + i*TERBUF_SIZE;       /* create video memory */
     // terminal->vidmem = terminal->saved_vidmem;  /* save back up video memory */
     // memset((void*)terminal->buffer, 0, TERBUF_SIZE);
@@ -141,6 +155,22 @@ void key_press(uint32_t scancode, terminal_t *terminal) {
             }      
         }
         return;
+    case C:
+        if (terminal->ctrl) {                    /* If ctrl is hold and CTRL-C is pressed. */
+            /* drop the line being typed and interrupt the programs of the console */
+            terminal->size = 0;
+            terminal->bufhd = terminal->buftl;
+            out("^C\n", 3);
+            kill_console(current->id, INTERRUPT);
+        } else {
+            if (terminal->shift) {                   
+                in(scancode, 1 - (terminal->capslock & isletter(scancode)), terminal);
+            } else {
+                /* Otherwise, output in capslock from. */
+                in(scancode, (terminal->capslock & isletter(scancode)), terminal);
+            }      
+        }
+        return;
     default:
         if (terminal->shift) {                    /* If Shift is hold, output in capital form. */
             in(scancode, 1 - (terminal->capslock & isletter(scancode)), terminal);
@@ -155,14 +185,18 @@ void key_press(uint32_t scancode, terminal_t *terminal) {
 void switch_vidmap(int src, int dest)
 {
     thread_t *prev, *next;
+    uint32_t i;
     prev = consoles[src]->task;
     next = consoles[dest]->task;
 
-    vidmap_table[(VIDEO >> PDE_OFFSET_4KB) + src] = PTE_PRESENT | PTE_RW | PTE_US | ADDR_TO_PTE((uint32_t)consoles[src]->task->terminal->saved_vidmem);
-    vidmap_table[(VIDEO >> PDE_OFFSET_4KB) + dest] = PTE_PRESENT | PTE_RW | PTE_US | ADDR_TO_PTE(VIDEO);
-    
+    /* every CPU has its own copy of the vidmap table */
+    for (i = 0; i < ncpus; ++i) {
+        cpus[i].vidmap[(VIDEO >> PDE_OFFSET_4KB) + src] = PTE_PRESENT | PTE_RW | PTE_US | ADDR_TO_PTE((uint32_t)consoles[src]->task->terminal->saved_vidmem);
+        cpus[i].vidmap[(VIDEO >> PDE_OFFSET_4KB) + dest] = PTE_PRESENT | PTE_RW | PTE_US | ADDR_TO_PTE(VIDEO);
+    }
 
     flush_tlb();
+    smp_flush_tlb_others();
 
 }
 
@@ -178,28 +212,26 @@ static inline void terminal_switch(uint32_t scancode, terminal_t *terminal, int
     next_terminal = next->terminal;
 
     /* set its vidmem to back up */
-    memcpy((void*)terminal->saved_vidmem, (void*)video_mem, VIDMEM_SIZE);
+    vga_save(terminal->saved_vidmem, &terminal->top);
     terminal->vidmem = terminal->saved_vidmem;
 
     terminal->alt = 0;
     
-    memcpy((void*)video_mem, (void*)next_terminal->saved_vidmem, VIDMEM_SIZE);
+    vga_restore(next_terminal->saved_vidmem, &next_terminal->top);
 
     if (next->state == UNUSED) {
         next->state = RUNNABLE;
         sched_fork(next);
         activate_task(next);
-        vga_clear(video_mem);
+        vga_clear(video_mem, &next_terminal->top);
     } 
 
-    if (next->state == SLEEPING) {
-        next->state = RUNNABLE;
-        enqueue_task(next, 1);
-    }   
+    if (next->state == SLEEPING)
+        wake_up_process(next);
     
     next_terminal->vidmem = video_mem;
 
-    vga_update_cursor(next_terminal->screen_x, next_terminal->screen_y);
+    vga_update_cursor(next_terminal->top, next_terminal->screen_x, next_terminal->screen_y);
     
     switch_vidmap(current->id, idx);
         
@@ -253,6 +285,10 @@ static void in(uint32_t scancode, uint8_t caps, terminal_t *terminal) {
         if (terminal->size != TERBUF_SIZE)   
             terminal->size++;            
         /* otherwise the size does not change. (always as same as TERBUF_SIZE) */
+
+        /* a line is complete: wake up its reader */
+        if (character == '\n')
+            wake_up(&term_wait);
     }
 }
 
@@ -318,18 +354,22 @@ int32_t terminal_open(const int8_t *fname) {
 
 
 /**
- * @brief Clears any terminal specific variables. (do nothing for now.)
+ * @brief Close a descriptor of the terminal. stdin and stdout stay open,
+ * a copy of them made by dup or dup2 is closed like any file.
  * 
- * @param fd : 0 or 1.
- * @return int32_t : -1.
+ * @param fd : A file descriptor of the terminal.
+ * @return int32_t : 0 on success, -1 for stdin and stdout.
  */
 int32_t terminal_close(int32_t fd) {
-    return -1;
+    if (fd == stdin || fd == stdout)
+        return -1;
+    return file_close(fd);
 }
 
 
 /**
- * @brief Read data from the stdin.
+ * @brief Read data from the stdin, through any descriptor of a file
+ * opened for reading (stdin or a dup of it).
  * 
  * @param fd : The file descriptor of the file we want to read.
  * @param buf : A buffer array that copys the content from the file.
@@ -340,16 +380,17 @@ int32_t terminal_close(int32_t fd) {
 int32_t terminal_read(int32_t fd, void *buf, int32_t nbytes) {
     uint32_t intr_flag;
     int32_t nread;
-    uint8_t start = 0;
-    thread_t *curr;
+    thread_t *curr, *self;
     terminal_t *terminal;
+    file_t *file;
 
+    GETPRO(self);
     curr = current->task;
     terminal = curr->terminal;
 
     if (!terminal) return -1;
 
-    if (fd != stdin)
+    if (!(file = fd_file(fd)) || !(file->f_mode & FMODE_READ))
         return -1;
 
     if (nbytes < 0) 
@@ -361,30 +402,17 @@ int32_t terminal_read(int32_t fd, void *buf, int32_t nbytes) {
     if (nbytes > TERBUF_SIZE)
         nbytes = TERBUF_SIZE;
 
-    /* Init to zero. (read is not stopped) */
-    terminal->exit = 0;
-
-    while (!terminal->exit) {
+    /* Critical section begins: the keyboard adds to the buffer under the lock. */
+    spin_lock_irqsave(&term_lock, intr_flag);
 
-        /* sleep and waiting for an IO operation */
-        // sched_sleep(curr);
-
-        /* Waiting for intrrupt occurs... */
-
-        /* Critical section begins. */
-        cli_and_save(intr_flag);
-
-        for (nread = 0, start = terminal->bufhd; nread < terminal->size; nread++) {
-            if ((terminal->buffer[start] == '\n') || (terminal->buffer[start] == '\r')) {
-                nread++;
-                terminal->exit = 1;
-                break;
-            }
-            start = (start + 1) % TERBUF_SIZE;
+    /* sleep until a whole line is in the buffer */
+    while (!(nread = line_length(terminal))) {
+        /* CTRL+C: give up the read, the signal kills the reader */
+        if (signal_pending(self)) {
+            spin_unlock_irqrestore(&term_lock, intr_flag);
+            return -EINTR;
         }
-
-        /* Critical section ends. */
-        restore_flags(intr_flag);
+        sleep_on(&term_wait, &term_lock);
     }
 
     /* new-line character has been detected! */
@@ -402,13 +430,16 @@ int32_t terminal_read(int32_t fd, void *buf, int32_t nbytes) {
     /* change the bufhd points to next part. */
     terminal->bufhd = (terminal->bufhd + nread) % TERBUF_SIZE;
     terminal->size -= nread;
+
+    spin_unlock_irqrestore(&term_lock, intr_flag);
     return nread;
 }
 
 
 
 /**
- * @brief Write data to stdout.
+ * @brief Write data to stdout, through any descriptor of a file opened 
+ * for writing (stdout or a dup of it).
  * 
  * @param fd 
  * @param buf 
@@ -417,25 +448,74 @@ int32_t terminal_read(int32_t fd, void *buf, int32_t nbytes) {
  */
 int32_t terminal_write(int32_t fd, const void *buf, int32_t nbytes) {
     uint32_t intr_flag;
+    file_t *file;
+
     if (!buf)
         return -1;
 
-    if (fd != stdout)
+    if (!(file = fd_file(fd)) || !(file->f_mode & FMODE_WRITE))
         return -1;
     
     /* Critical section begins. */
-    cli_and_save(intr_flag);
+    spin_lock_irqsave(&term_lock, intr_flag);
 
     out(buf, nbytes);
 
     /* Critical section ends. */
-    restore_flags(intr_flag);
+    spin_unlock_irqrestore(&term_lock, intr_flag);
 
     return nbytes;
 }
 
 
 
+/**
+ * @brief Events ready on the terminal.
+ * 
+ * @param fd : 0 or 1.
+ * @param pt : poll table, the caller waits for a line on stdin.
+ * @return uint32_t : POLLIN if a whole line can be read, POLLOUT always.
+ */
+uint32_t terminal_poll(int32_t fd, struct poll_table *pt) {
+    uint32_t intr_flag, mask = POLLOUT;
+    terminal_t *terminal = current->task->terminal;
+
+    if (!terminal)
+        return POLLERR;
+
+    spin_lock_irqsave(&term_lock, intr_flag);
+
+    poll_wait(&term_wait, &term_lock, pt);
+    if (line_length(terminal))
+        mask |= POLLIN;
+
+    spin_unlock_irqrestore(&term_lock, intr_flag);
+    return mask;
+}
+
+
+
+/**
+ * @brief Length of the first line in the terminal buffer, with term_lock held.
+ * 
+ * @param terminal : The terminal.
+ * @return int32_t : Number of bytes up to and including the new-line character,
+ *                   0 if no line is complete.
+ */
+static int32_t line_length(terminal_t *terminal) {
+    int32_t n;
+    uint8_t start;
+
+    for (n = 0, start = terminal->bufhd; n < terminal->size; n++) {
+        if ((terminal->buffer[start] == '\n') || (terminal->buffer[start] == '\r'))
+            return n + 1;
+        start = (start + 1) % TERBUF_SIZE;
+    }
+
+    return 0;
+}
+
+
 /**
  * @brief Copy nbytes number of bytes from the terminal buffer into
  * the given dest.
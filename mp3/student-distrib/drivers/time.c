@@ -1,5 +1,9 @@
 #include <drivers/time.h>
+#include <drivers/rtc.h>
+#include <drivers/fs.h>
+#include <vfs/poll.h>
 #include <boot/i8259.h>
+#include <boot/vdso.h>
 #include <pro/process.h>
 #include <lib.h>
 #include <io.h>
@@ -14,8 +18,9 @@ timespec sys_clock;           /* current time and date */
  * 
  */
 void pit_init(void) {
-    /* init sys_time */
-    // TODO
+    /* init sys_time from the CMOS clock, the timer keeps it from now on */
+    sys_clock.tv_sec = rtc_get_time();
+    sys_clock.tv_nsec = 0;
 
     /* set up PIT*/
     outb_p(0x34, CMD_REG);                /* binary, mode 2, LSB/MSB, ch 0 */
@@ -33,16 +38,36 @@ void do_timer(void) {
     thread_t *current;
     uint32_t intr_flag;
 
-    cli_and_save(intr_flag);
+    spin_lock_irqsave(&rq_lock, intr_flag);
 
-    rq->clock +=  TICKUNIT;
+    sched_clock += TICKUNIT;
+
+    sys_ticks++;
+    sys_clock.tv_nsec += TICKUNIT;
+    if (sys_clock.tv_nsec >= NSEC_PER_SEC) {
+        sys_clock.tv_nsec -= NSEC_PER_SEC;
+        sys_clock.tv_sec++;
+    }
+    vdso_update_time();
 
     send_eoi(TIMER_IRQ);       
 
+    /* the other CPUs have no timer of their own */
+    smp_send_tick();
+
     GETPRO(current);
 
     /* update vruntime of current task and reschedule when needed */
     task_tick(current);
+    load_balance();
+
+    /* schedule() takes the lock again */
+    spin_unlock(&rq_lock);
+
+    if (!(sys_ticks % WRITEBACK_TICKS))
+        fs_writeback();
+
+    poll_timeout();
 
     if (current->flag == NEED_RESCHED) {
         schedule();
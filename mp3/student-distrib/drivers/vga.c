@@ -15,48 +15,173 @@ void vga_init(void) {
 }
 
 
+/*
+ * A screen is VGA_HEIGHT lines of VGA_WIDTH cells, a cell is a character
+ * and its attribute in one 16-bit word. The line shown on row 0 is top.
+ *
+ * The screen on display (video_mem) pans over the whole text memory: to
+ * scroll, top moves one line down and the CRTC start address follows, so
+ * no cell moves. Only when the screen reaches the end of text memory are
+ * its last lines copied back to the start, once every VGA_LINES -
+ * VGA_HEIGHT lines.
+ *
+ * A screen in a backup buffer (a terminal in the background) is a ring of
+ * VGA_HEIGHT lines: to scroll, the top line is blanked and becomes the
+ * bottom one.
+ */
+
+static void vga_set_start(uint8_t top);
+
+
+/**
+ * @brief address of a cell of a screen
+ *
+ * @param vidmem : video memory or backup buffer of the screen
+ * @param top : line shown on row 0
+ * @param x : col position
+ * @param y : row position
+ * @return uint16_t* : the cell
+ */
+static inline uint16_t *vga_cell(char *vidmem, uint8_t top, uint8_t x, uint8_t y) {
+    uint32_t line = top + y;
+
+    if (vidmem != video_mem && line >= VGA_HEIGHT)
+        line -= VGA_HEIGHT;
+
+    return (uint16_t *)vidmem + line * VGA_WIDTH + x;
+}
+
+
 /**
  * @brief write a char to the screen
  * 
+ * @param vidmem : video memory or backup buffer of the screen
+ * @param top : line shown on row 0
  * @param x : col position
  * @param y : row position
+ * @param c : the char
  */
-void vga_write(char *vidmem, uint8_t x, uint8_t y, int8_t c) {
-	*(uint8_t *)(vidmem + ((VGA_WIDTH * y + x) << 1)) = c;
-    *(uint8_t *)(vidmem + ((VGA_WIDTH * y + x) << 1) + 1) = ATTRIB;
+void vga_write(char *vidmem, uint8_t top, uint8_t x, uint8_t y, int8_t c) {
+    *vga_cell(vidmem, top, x, y) = (uint8_t)c | (ATTRIB << 8);
 }
 
 
 /**
- * @brief clear the screen
+ * @brief clear the screen, row 0 goes back to the start of the buffer
  * 
+ * @param vidmem : video memory or backup buffer of the screen
+ * @param top : line shown on row 0, set to 0
  */
-void vga_clear(char *vidmem) {
-	int32_t i;
-    for (i = 0; i < VGA_HEIGHT * VGA_WIDTH; i++) {
-        *(uint8_t *)(vidmem + (i << 1)) = ' ';
-        *(uint8_t *)(vidmem + (i << 1) + 1) = ATTRIB;
-    }
-}
+void vga_clear(char *vidmem, uint8_t *top) {
+    memset_word(vidmem, VGA_BLANK, VGA_HEIGHT * VGA_WIDTH);
+    *top = 0;
 
+    if (vidmem == video_mem)
+        vga_set_start(0);
+}
 
 
 /**
  * @brief vertical scrolling down the screen
  * 
+ * @param vidmem : video memory or backup buffer of the screen
+ * @param top : line shown on row 0, moves one line down
  */
-void vga_scrolling(char *vidmem) {
-	int32_t i;
+void vga_scrolling(char *vidmem, uint8_t *top) {
+    uint16_t *mem = (uint16_t *)vidmem;
+
+    if (vidmem != video_mem) {
+        /* the top line of the ring becomes the bottom one */
+        memset_word(mem + *top * VGA_WIDTH, VGA_BLANK, VGA_WIDTH);
+        if (++*top == VGA_HEIGHT)
+            *top = 0;
+        return;
+    }
 
-    for (i = 0; i < VGA_WIDTH * (VGA_HEIGHT - 1); ++i) {
-        *(uint8_t *)(vidmem + (i << 1)) = *(uint8_t *)(vidmem + ((i + VGA_WIDTH) << 1));
-        *(uint8_t *)(vidmem + (i << 1) + 1) = ATTRIB;
+    if (*top + VGA_HEIGHT == VGA_LINES) {
+        /* end of text memory, the lines kept go back to the start */
+        memcpy(mem, mem + (*top + 1) * VGA_WIDTH, (VGA_HEIGHT - 1) * VGA_WIDTH * 2);
+        *top = 0;
+    } else {
+        ++*top;
     }
 
-    for (i = VGA_WIDTH * (VGA_HEIGHT - 1); i < VGA_WIDTH * VGA_HEIGHT; ++i) {
-        *(uint8_t *)(vidmem + (i << 1)) = ' ';
-        *(uint8_t *)(vidmem + (i << 1) + 1) = ATTRIB;
+    memset_word(mem + (*top + VGA_HEIGHT - 1) * VGA_WIDTH, VGA_BLANK, VGA_WIDTH);
+    vga_set_start(*top);
+}
+
+
+/**
+ * @brief move row 0 of a screen back to the start of its buffer, for
+ * those who write the buffer directly (vidmap)
+ * 
+ * @param vidmem : video memory or backup buffer of the screen
+ * @param top : line shown on row 0, set to 0
+ */
+void vga_home(char *vidmem, uint8_t *top) {
+    static uint16_t tmp[VGA_HEIGHT * VGA_WIDTH];
+    uint16_t *mem = (uint16_t *)vidmem;
+
+    if (!*top)
+        return;
+
+    if (vidmem == video_mem) {
+        memmove(mem, mem + *top * VGA_WIDTH, VGA_HEIGHT * VGA_WIDTH * 2);
+        vga_set_start(0);
+    } else {
+        memcpy(tmp, mem + *top * VGA_WIDTH, (VGA_HEIGHT - *top) * VGA_WIDTH * 2);
+        memcpy(tmp + (VGA_HEIGHT - *top) * VGA_WIDTH, mem, *top * VGA_WIDTH * 2);
+        memcpy(mem, tmp, VGA_HEIGHT * VGA_WIDTH * 2);
     }
+
+    *top = 0;
+}
+
+
+/**
+ * @brief copy the screen on display to a backup buffer
+ * 
+ * @param buf : backup buffer
+ * @param top : line of video memory shown on row 0, set to 0 (row 0 of buf)
+ */
+void vga_save(char *buf, uint8_t *top) {
+    memcpy(buf, (uint16_t *)video_mem + *top * VGA_WIDTH, VGA_HEIGHT * VGA_WIDTH * 2);
+    *top = 0;
+}
+
+
+/**
+ * @brief display a screen from a backup buffer, from the start of video
+ * memory
+ * 
+ * @param buf : backup buffer, a ring of lines
+ * @param top : line of buf shown on row 0, set to 0 (row 0 of video memory)
+ */
+void vga_restore(const char *buf, uint8_t *top) {
+    uint16_t *mem = (uint16_t *)video_mem;
+    const uint16_t *src = (const uint16_t *)buf;
+
+    memcpy(mem, src + *top * VGA_WIDTH, (VGA_HEIGHT - *top) * VGA_WIDTH * 2);
+    memcpy(mem + (VGA_HEIGHT - *top) * VGA_WIDTH, src, *top * VGA_WIDTH * 2);
+    *top = 0;
+
+    vga_set_start(0);
+}
+
+
+/**
+ * @brief show video memory from a line on, through the start address
+ * registers of the CRT controller (Index 0Ch high, 0Dh low), in cells
+ * 
+ * @param top : line shown on row 0
+ */
+static void vga_set_start(uint8_t top) {
+    uint16_t pos = top * VGA_WIDTH;
+
+    outb(0x0C, 0x3D4);
+    outb((uint8_t) ((pos >> 8) & 0xFF), 0x3D5);
+    outb(0x0D, 0x3D4);
+    outb((uint8_t) (pos & 0xFF), 0x3D5);
 }
 
 /**
@@ -102,11 +227,12 @@ void vga_disable_cursor(void) {
 /**
  * @brief update cursor to row y and col y
  * 
+ * @param top : line of video memory shown on row 0
  * @param x : col position
  * @param y : row position
  */
-void vga_update_cursor(uint8_t x, uint8_t y) {
-	uint16_t pos = y * VGA_WIDTH + x;
+void vga_update_cursor(uint8_t top, uint8_t x, uint8_t y) {
+	uint16_t pos = (top + y) * VGA_WIDTH + x;
  
 	outb(0x0F, 0x3D4);
 	outb((uint8_t) (pos & 0xFF), 0x3D5);
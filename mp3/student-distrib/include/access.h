@@ -10,6 +10,8 @@
 #define USER_STACK_MAX    0x400000
 #define PROGRAM_IMG_BEGIN 0x08048000     
 #define VIR_MEM_BEGIN     0x08000000 
+#define FILE_MAP_START    0x0A000000        /* file mappings, between the heap and the stack */
+#define FILE_MAP_END      (0xC000000 - USER_STACK_MAX)
 
 #define GETPRO(p)                       \
 do {                                    \
@@ -0,0 +1,53 @@
+#ifndef _FPU_H
+#define _FPU_H
+
+#include <types.h>
+
+#define FXSAVE_SIZE         512             /* size of the FXSAVE/FXRSTOR image */
+#define FXSAVE_ALIGN        16              /* FXSAVE/FXRSTOR need a 16-byte aligned image */
+#define MXCSR_DEFAULT       0x1F80          /* all SIMD exceptions masked */
+
+#define CR0_MP              0x2             /* monitor coprocessor: WAIT honors TS */
+#define CR0_EM              0x4             /* emulation: no x87, all FPU ops trap */
+#define CR0_TS              0x8             /* task switched: next FPU op raises #NM */
+#define CR0_NE              0x20            /* report x87 errors as #MF, not IRQ 13 */
+#define CR4_OSFXSR          0x200           /* OS supports FXSAVE/FXRSTOR and SSE */
+#define CR4_OSXMMEXCPT      0x400           /* OS handles #XF */
+
+#define CPUID_FXSR          (1 << 24)       /* CPUID.1:EDX, FXSAVE/FXRSTOR */
+#define CPUID_SSE           (1 << 25)       /* CPUID.1:EDX, SSE */
+
+
+struct thread;
+
+/* the x87/MMX/SSE register image saved by FXSAVE */
+typedef struct {
+    uint8_t data[FXSAVE_SIZE];
+} __attribute__((aligned(FXSAVE_ALIGN))) fpu_state_t;
+
+
+/* clear CR0.TS, FPU instructions run normally */
+#define clts()                              \
+do {                                        \
+    asm volatile ("clts" : : : "memory");   \
+} while (0)
+
+/* set CR0.TS, the next FPU instruction raises #NM */
+#define stts()                              \
+do {                                        \
+    asm volatile (" movl %%cr0, %%eax   \n\t"   \
+                  " orl  %0, %%eax      \n\t"   \
+                  " movl %%eax, %%cr0   \n\t"   \
+                  : : "i"(CR0_TS) : "eax", "memory"); \
+} while (0)
+
+
+void fpu_init(void);
+void fpu_switch(struct thread *next);
+int32_t fpu_fork(struct thread *parent, struct thread *child);
+void fpu_exec(struct thread *curr);
+void fpu_release(struct thread *t);
+void fpu_migrate(struct thread *t);
+int32_t math_state_restore(void);
+
+#endif
@@ -4,11 +4,15 @@
 #define TIMER_INTR      0x20 
 #define KEYBOARD_INTR   0x21
 #define RTC_INTR        0x28
+#define ATA_PRIMARY_INTR    0x2E
+#define ATA_SECONDARY_INTR  0x2F
 
 
 void keyboard_handler(void);
 void rtc_handler(void);
 void timer_handler(void);
+void ata_primary_handler(void);
+void ata_secondary_handler(void);
 
 
 #endif /*_INTERRUPT_H_ */
@@ -8,6 +8,7 @@
 #define VA_OFFSET           12
 #define GETBIT_10           0x3FF
 #define VIDEO               0xB8000
+#define VIDEO_PAGES         8               /* text memory the screen pans over, 0xB8000-0xBFFFF */
 
 #define VIDEO_BUF_1         0xD0000
 #define VIDEO_BUF_2         0xD1000
@@ -20,6 +21,7 @@
 #define VIR_VID_MEM         0x8400000
 #define HEAP_START          0x8800000
 #define KERNEL_PAGES        16
+#define KMAP_ADDR           0x3FF000        /* last page of the first 4MB, kernel window onto any page */
 #define MAX_PHYS_PAGES      64
 
 
@@ -39,6 +41,7 @@
 #define VM_READ 0x04
 #define VM_HEAP 0x08
 #define VM_STACK 0x010
+#define VM_FILE 0x020
 
 #define PTE_ADDR(x) ((x) >> 12)
 #define PDE_MB_ADDR(x) ((x) >> 22)
@@ -60,7 +63,7 @@ typedef struct user_page_t {
 } user_page_t;
 
 void page_init();
-void enable_paging();
+void enable_paging(pde_t *dir);
 void flush_tlb();
 
 void do_mmap(int size);
@@ -70,6 +73,8 @@ int freemap(uint32_t va, int size);
 void free_uvmdir(int size);
 
 void process_vm_init(vmem_t* vm);
+vmem_t* vm_alloc(void);
+void put_vm(vmem_t* vm);
 int vmalloc(vm_area_t* vm, int incrsize, int flags);
 void vmdealloc(vm_area_t* vm, int decsize, int mapping);
 int vmcopy(vmem_t* dest, vmem_t* src);
@@ -81,11 +86,24 @@ uint32_t get_user_page(int order);
 void free_user_page(uint32_t addr, int order);
 void show_mmap(vmem_t* vm);
 
+int expand_stack(vmem_t* vm, uint32_t addr);
+uint32_t map_file(vmem_t* vm, uint32_t inode, uint32_t pgoff, uint32_t npages);
+int unmap_file(vmem_t* vm, uint32_t va);
+void unmap_files(vmem_t* vm);
+int file_fault(vmem_t* vm, uint32_t addr);
+uint32_t user_virt_to_phys(vmem_t* vm, uint32_t va, uint32_t vmflag);
+int user_access_ok(vmem_t* vm, uint32_t va, uint32_t len, uint32_t vmflag);
+void* kmap_atomic(uint32_t pa);
+void kunmap_atomic(void);
+
 typedef struct pg_descriptor_t {
     uint32_t flags;
     int count;
 }pd_descriptor_t;
 
+/* page table use counts of the BSP's page directory */
+extern pd_descriptor_t pdesc[ENTRY_NUM];
+
 
 
 #endif /* _PAGE_H */
@@ -0,0 +1,140 @@
+#ifndef _SMP_H
+#define _SMP_H
+
+#define NR_CPUS             8               /* max number of CPUs supported */
+#define TRAMPOLINE_ADDR     0x8000          /* AP boot code, 4KB aligned below 1MB */
+
+#ifndef ASM
+
+#include <types.h>
+#include <boot/x86_desc.h>
+
+#define GDT_ENTRIES         8               /* entries in the GDT of x86_desc.S */
+
+/* Local APIC registers (offsets from lapic base) */
+#define LAPIC_DEFAULT       0xFEE00000      /* default physical address */
+#define LAPIC_ID            0x020           /* ID */
+#define LAPIC_EOI           0x0B0           /* end of interrupt */
+#define LAPIC_SVR           0x0F0           /* spurious interrupt vector */
+#define LAPIC_ICRLO         0x300           /* interrupt command, bits 0-31 */
+#define LAPIC_ICRHI         0x310           /* interrupt command, bits 32-63 */
+
+#define LAPIC_SVR_ENABLE    0x100           /* software enable */
+#define ICR_INIT            0x500           /* INIT IPI */
+#define ICR_STARTUP         0x600           /* STARTUP IPI */
+#define ICR_PENDING         0x1000          /* delivery status: send pending */
+#define ICR_ASSERT          0x4000          /* level assert */
+#define ICR_LEVEL           0x8000          /* level triggered */
+
+/* interrupts between CPUs: one vector, the reason is in ipi_pending */
+#define IPI_VECTOR          0xF0            /* vector of the IPIs sent by smp.c */
+#define SPURIOUS_VECTOR     0xFF            /* local APIC spurious interrupts */
+#define IPI_RESCHEDULE      0x1             /* the running task should give up the CPU */
+#define IPI_TICK            0x2             /* a timer tick, sent by the BSP */
+#define IPI_FLUSH_TLB       0x4             /* a mapping shared by all CPUs changed */
+
+/* Intel MultiProcessor Specification v1.4 tables */
+#define MP_SIG              0x5F504D5F      /* "_MP_" */
+#define MPC_SIG             0x504D4350      /* "PCMP" */
+#define MP_PROC             0               /* processor entry */
+#define MP_PROC_ENABLED     0x1             /* processor is usable */
+#define MP_PROC_BSP         0x2             /* processor is the BSP */
+
+/* MP floating pointer structure */
+typedef struct __attribute__((packed)) {
+    uint32_t signature;         /* "_MP_" */
+    uint32_t physaddr;          /* address of the configuration table */
+    uint8_t  length;            /* in 16 bytes */
+    uint8_t  specrev;
+    uint8_t  checksum;          /* all bytes add up to 0 */
+    uint8_t  type;              /* default configuration if not 0 */
+    uint8_t  imcrp;
+    uint8_t  reserved[3];
+} mp_fp_t;
+
+/* MP configuration table header */
+typedef struct __attribute__((packed)) {
+    uint32_t signature;         /* "PCMP" */
+    uint16_t length;            /* length of the table with entries */
+    uint8_t  version;
+    uint8_t  checksum;          /* all bytes add up to 0 */
+    uint8_t  product[20];
+    uint32_t oemtable;
+    uint16_t oemlength;
+    uint16_t entry;             /* number of entries */
+    uint32_t lapicaddr;         /* address of the local APICs */
+    uint16_t xlength;
+    uint8_t  xchecksum;
+    uint8_t  reserved;
+} mp_conf_t;
+
+/* MP processor entry */
+typedef struct __attribute__((packed)) {
+    uint8_t  type;              /* MP_PROC */
+    uint8_t  apicid;            /* local APIC id */
+    uint8_t  version;
+    uint8_t  flags;             /* MP_PROC_ENABLED, MP_PROC_BSP */
+    uint32_t signature;
+    uint32_t feature;
+    uint8_t  reserved[8];
+} mp_proc_t;
+
+
+struct thread;
+struct pg_descriptor_t;
+
+/* per-CPU data */
+typedef struct cpu {
+    uint64_t          gdt[GDT_ENTRIES] __attribute__((aligned(8)));  /* own GDT, for its own TSS */
+    x86_desc_t        gdt_desc;     /* used as the gdtr */
+    tss_t             ap_tss;       /* TSS of an AP, the BSP uses the one of x86_desc.S */
+    tss_t             *tss;         /* kernel stack used on interrupts from user mode */
+    uint32_t          id;           /* logical id, 0 is the BSP */
+    uint8_t           apic_id;      /* local APIC id */
+    volatile uint8_t  online;       /* 1 once the CPU runs kernel code */
+    void              *stack;       /* 8KB kernel stack of an AP's idle task */
+    pde_t             *pgdir;       /* page directory, user pages of the running task */
+    pte_t             *vidmap;      /* page table of VIR_VID_MEM (video pages and vDSO) */
+    struct pg_descriptor_t *pdesc;  /* mapped pages in each user page table of pgdir */
+    struct thread     *idle;        /* process 0 of this CPU */
+    struct thread     *curr;        /* task running on this CPU */
+    struct thread     *fpu_owner;   /* thread whose registers are in the FPU now */
+    uint32_t          nr_tasks;     /* runnable tasks on this CPU, running one included */
+    uint32_t          last_balance; /* sys_ticks of the last load balancing */
+    volatile uint32_t ipi_pending;  /* IPI_* reasons not handled yet */
+} cpu_t;
+
+
+extern cpu_t cpus[NR_CPUS];
+extern uint32_t ncpus;
+
+/* AP boot code in trampoline.S, copied to TRAMPOLINE_ADDR */
+extern uint8_t trampoline_start[];
+extern uint8_t trampoline_end[];
+extern uint8_t trampoline_gdt[];
+extern uint8_t trampoline_stack[];
+extern uint8_t trampoline_entry[];
+
+
+void smp_init(void);
+void smp_start(void);
+void ap_start(void);
+cpu_t *this_cpu(void);
+uint32_t smp_processor_id(void);
+
+void lock_kernel(void);
+void unlock_kernel(void);
+void release_kernel_lock(struct thread *t);
+
+void do_ipi(void);
+void smp_send_reschedule(uint32_t cpu);
+void smp_send_tick(void);
+void smp_flush_tlb_others(void);
+
+/* implemented in handler.S */
+void ipi_handler(void);
+void spurious_handler(void);
+
+#endif /* ASM */
+
+#endif /* _SMP_H */
@@ -2,11 +2,22 @@
 #define _SYSCALL_H
 
 #include <types.h>
+#include <boot/x86_desc.h>
+#include <vfs/vfs.h>
+#include <vfs/poll.h>
 
 #define SYSCALL 0x80
 #define asmlinkage __attribute__((regparm(0)))
 
+/* SYSENTER fast system call */
+#define MSR_SYSENTER_CS     0x174       /* kernel code segment, SS is CS + 8 */
+#define MSR_SYSENTER_ESP    0x175       /* stack pointer on entry */
+#define MSR_SYSENTER_EIP    0x176       /* entry point */
+#define CPUID_SEP           (1 << 11)   /* SYSENTER/SYSEXIT supported */
+
 void syscall_handler();
+void sysenter_handler();
+void sysenter_init(tss_t *tss);
 
 /* Required by ECE391. */
 asmlinkage void sys_exit(uint8_t status);
@@ -18,14 +29,14 @@ asmlinkage int32_t sys_write(int32_t fd, const void *buf, uint32_t nbytes);
 asmlinkage int32_t sys_getargs(uint8_t *buf, int32_t nbytes);
 asmlinkage int32_t sys_vidmap(uint8_t **screen_start);
 asmlinkage int32_t sys_set_handler(int32_t signum, void *handler_addr);
-asmlinkage int32_t sys_sigreturn(void);
+asmlinkage int32_t sys_sigreturn(uint32_t ebx);
 
 
 /* Extra Credit */
 
 asmlinkage int32_t sys_restart(void);
 asmlinkage int32_t sys_fork(void);
-asmlinkage int32_t sys_execv(const int8_t *pathname, int8_t *const argv[]);
+asmlinkage int32_t sys_execv(const int8_t *pathname, int8_t *const argv[], int8_t *const envp[]);
 asmlinkage int32_t sys_getpid(void);
 asmlinkage int32_t sys_getppid(void);
 asmlinkage int32_t sts_wait(int *wstatus);
@@ -33,7 +44,36 @@ asmlinkage int32_t sys_waitpid(pid_t pid, int *wstatus);
 asmlinkage void   *sys_sbrk(uint32_t size);
 asmlinkage int32_t sys_mmap(void *addr, uint32_t size);
 asmlinkage int32_t sys_munmap(void *addr);
-asmlinkage int32_t sys_stat(int8_t *info[]);
+asmlinkage int32_t sys_procstat(int8_t *info[]);
+asmlinkage int32_t sys_nice(int32_t inc);
+asmlinkage int32_t sys_setpriority(int32_t which, int32_t who, int32_t prio);
+asmlinkage int32_t sys_getpriority(int32_t which, int32_t who);
+asmlinkage int32_t sys_sched_setscheduler(int32_t pid, int32_t policy, int32_t prio);
+asmlinkage int32_t sys_clone(uint32_t eip, uint32_t esp);
+asmlinkage int32_t sys_futex(int32_t *uaddr, int32_t op, int32_t val);
+asmlinkage int32_t sys_pipe(int32_t *fds);
+asmlinkage int32_t sys_dup2(int32_t oldfd, int32_t newfd);
+asmlinkage int32_t sys_vfork(void);
+asmlinkage int32_t sys_creat(const int8_t *filename);
+asmlinkage int32_t sys_unlink(const int8_t *filename);
+asmlinkage int32_t sys_ftruncate(int32_t fd, int32_t length);
+asmlinkage int32_t sys_mkdir(const int8_t *pathname);
+asmlinkage int32_t sys_chdir(const int8_t *pathname);
+asmlinkage int32_t sys_getcwd(int8_t *buf, uint32_t size);
+asmlinkage int32_t sys_rmdir(const int8_t *pathname);
+asmlinkage int32_t sys_mmap_file(int32_t fd, uint32_t offset, uint32_t length);
+asmlinkage int32_t sys_lseek(int32_t fd, int32_t offset, int32_t whence);
+asmlinkage int32_t sys_pread(int32_t fd, const iovec_t *iov, int32_t offset);
+asmlinkage int32_t sys_pwrite(int32_t fd, const iovec_t *iov, int32_t offset);
+asmlinkage int32_t sys_readv(int32_t fd, const iovec_t *iov, int32_t iovcnt);
+asmlinkage int32_t sys_writev(int32_t fd, const iovec_t *iov, int32_t iovcnt);
+asmlinkage int32_t sys_sync(void);
+asmlinkage int32_t sys_dup(int32_t oldfd);
+asmlinkage int32_t sys_ioctl(int32_t fd, uint32_t cmd, uint32_t arg);
+asmlinkage int32_t sys_poll(pollfd_t *fds, uint32_t nfds, int32_t timeout);
+asmlinkage int32_t sys_getdents(int32_t fd, dirent_t *dirp, uint32_t count);
+asmlinkage int32_t sys_stat(const int8_t *pathname, stat_t *st);
+asmlinkage int32_t sys_fstat(int32_t fd, stat_t *st);
 
 
 
@@ -91,8 +131,6 @@ asmlinkage int32_t sys_stat(int8_t *info[]);
 // int unlink(const char *pathname);
 
 // /* file information */
-// int stat(const char *pathname, struct stat *statbuf);
-// int fstat(int fd, struct stat *statbuf);
 // int lstat(const char *pathname, struct stat *statbuf);
 
 // /* devices control */
@@ -0,0 +1,41 @@
+#ifndef _VDSO_H
+#define _VDSO_H
+
+#include <types.h>
+#include <boot/x86_desc.h>
+#include <boot/page.h>
+#include <boot/smp.h>
+
+#define VDSO_ADDR           VIR_VID_MEM     /* user address of the page, first page of the vidmap table */
+
+
+/* Data the kernel keeps up to date for user code to read without a
+ * system call. Each CPU's page is mapped read-only into the processes 
+ * it runs. The
+ * user library mirrors this layout in unistd.h. 
+ *
+ * seq is odd while the kernel is updating the page: a reader copies
+ * the fields it needs and tries again if seq changed or was odd. */
+typedef struct {
+    volatile uint32_t seq;          /* update sequence number */
+    uint32_t pid;                   /* pid of the running task */
+    uint32_t ppid;                  /* pid of its parent */
+    uint32_t ticks;                 /* timer ticks since boot (sys_ticks) */
+    uint32_t clock_lo;              /* scheduler clock in ns (sched_clock), low half */
+    uint32_t clock_hi;              /* high half */
+    uint32_t tv_sec;                /* wall clock (sys_clock) */
+    uint32_t tv_nsec;
+} vdso_data_t;
+
+typedef union {
+    vdso_data_t data;
+    uint8_t     page[PAGE_SIZE];    /* nothing else shares the page with user space */
+} vdso_page_t;
+
+
+void vdso_init(void);
+void vdso_cpu_init(cpu_t *cpu);
+void vdso_update_task(thread_t *task);
+void vdso_update_time(void);
+
+#endif /* _VDSO_H */
@@ -0,0 +1,66 @@
+#ifndef _ATA_H
+#define _ATA_H
+
+#include <types.h>
+#include <drivers/blkdev.h>
+
+/* the two channels of the IDE controller: command block, device control */
+#define ATA_PRIMARY         0x1F0
+#define ATA_PRIMARY_CTL     0x3F6
+#define ATA_SECONDARY       0x170
+#define ATA_SECONDARY_CTL   0x376
+#define ATA_PRIMARY_IRQ     14
+#define ATA_SECONDARY_IRQ   15
+
+/* registers, from the command block */
+#define ATA_DATA            0
+#define ATA_ERROR           1
+#define ATA_NSECT           2
+#define ATA_LBA0            3
+#define ATA_LBA1            4
+#define ATA_LBA2            5
+#define ATA_DRIVE           6           /* 0xE0 | slave << 4 | LBA bits 24-27 */
+#define ATA_STATUS          7           /* read */
+#define ATA_COMMAND         7           /* write */
+
+/* status register */
+#define ATA_BSY             0x80        /* busy, the other bits are not valid */
+#define ATA_DRDY            0x40        /* ready for a command */
+#define ATA_DF              0x20        /* device fault */
+#define ATA_DRQ             0x08        /* a sector can be transferred */
+#define ATA_ERR             0x01        /* the command failed */
+
+/* device control register */
+#define ATA_NIEN            0x02        /* no interrupts, the driver polls (at boot) */
+
+/* commands */
+#define ATA_READ            0x20        /* READ SECTORS, LBA28, PIO */
+#define ATA_WRITE           0x30        /* WRITE SECTORS, LBA28, PIO */
+#define ATA_FLUSH           0xE7        /* FLUSH CACHE */
+#define ATA_IDENTIFY        0xEC        /* IDENTIFY DEVICE */
+
+#define ATA_SECTOR          512         /* Bytes in a sector. */
+#define ATA_BLOCK_SECT      (BLOCK_SIZE / ATA_SECTOR)
+#define ATA_LBA28_MAX       (1 << 28)   /* Sectors reachable with LBA28. */
+#define ATA_TIMEOUT         1000000     /* Status reads before a command is given up. */
+#define ATA_DRIVES          4           /* Master and slave of both channels. */
+#define ATA_CHANNELS        2           /* Primary and secondary. */
+
+
+/* A drive on one of the channels. */
+typedef struct {
+    uint16_t base;                      /* Command block of the channel. */
+    uint16_t ctl;                       /* Device control of the channel. */
+    uint8_t channel;                    /* 0 for the primary channel, 1 for the secondary. */
+    uint8_t slave;                      /* 0 for the master, 1 for the slave. */
+    blkdev_t dev;                       /* The drive as a block device. */
+} ata_drive_t;
+
+
+void ata_init(void);
+void ata_irq_init(void);
+void do_ata_primary(void);
+void do_ata_secondary(void);
+
+
+#endif /* _ATA_H */
@@ -0,0 +1,62 @@
+#ifndef _BLKDEV_H
+#define _BLKDEV_H
+
+#include <types.h>
+#include <list.h>
+#include <drivers/fs.h>
+
+#define BLKDEV_MAX  4           /* Disks that can be registered. */
+#define NBUF        64          /* Buffers in the cache (256 KB). */
+#define BHASH_SIZE  64          /* Buckets of the buffer hash, a power of 2. */
+#define BIO_MAX     32          /* Most blocks moved by one request. */
+
+#define B_VALID     0x1         /* The buffer holds the data of its block. */
+#define B_DIRTY     0x2         /* The data is newer than the disk. */
+#define B_BUSY      0x4         /* Being read or written, held until the request is over. */
+
+
+struct blkdev;
+
+/* Move count consecutive blocks, starting at block, between the disk
+ * and bufs[0..count-1] (one BLOCK_SIZE buffer per block).
+ * Returns 0, or -EIO. */
+typedef int32_t (*blk_rw_t)(struct blkdev *dev, uint32_t block, uint32_t count, int8_t **bufs);
+
+
+/* A disk, in blocks of BLOCK_SIZE bytes. */
+typedef struct blkdev {
+    int8_t name[8];                     /* "hda" to "hdd" */
+    uint32_t nblocks;                   /* Size of the disk in blocks. */
+    blk_rw_t read;                      /* Read blocks. */
+    blk_rw_t write;                     /* Write blocks. */
+    int32_t (*flush)(struct blkdev *);  /* Put the write cache of the disk on the media. */
+    int32_t (*pre_evict)(struct blkdev *);  /* Run before a dirty buffer is written back to be reused, NULL if none. */
+    void *private_data;                 /* The driver's own data. */
+} blkdev_t;
+
+
+/* A block of a disk in the buffer cache. */
+typedef struct buf {
+    blkdev_t *dev;                      /* The disk, NULL if the buffer is unused. */
+    uint32_t block;                     /* The block number on the disk. */
+    uint32_t flags;                     /* B_VALID, B_DIRTY, B_BUSY. */
+    uint32_t count;                     /* Users holding it, it is not reused while held. */
+    struct buf *hnext;                  /* Next buffer in the same hash bucket. */
+    list_head lru;                      /* Node in the LRU list, most recently used first. */
+    int8_t *data;                       /* BLOCK_SIZE bytes. */
+} buf_t;
+
+
+int32_t blkdev_register(blkdev_t *dev);
+blkdev_t *blkdev_get(uint32_t i);
+void bcache_init(void);
+buf_t *bread(blkdev_t *dev, uint32_t block);
+buf_t *bget(blkdev_t *dev, uint32_t block);
+void breada(blkdev_t *dev, const uint32_t *blocks, uint32_t n);
+void brelse(buf_t *b);
+void bdirty(buf_t *b);
+int32_t bsync(blkdev_t *dev);
+int32_t bsync_blocks(blkdev_t *dev, uint32_t first, uint32_t n);
+
+
+#endif /* _BLKDEV_H */
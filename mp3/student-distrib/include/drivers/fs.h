@@ -6,12 +6,34 @@
 #define FILES_MAX   63          /* Totally 63 files can be stored in this file system. */
 #define BLOCK_SIZE  4096        /* Each block is 4KB. */
 #define NAMESIZE    32          /* The file name of a file is up to 32 bytes. */
+#define DHASH_SIZE  128         /* Buckets of the name hash, a power of 2 above 2 * FILES_MAX. */
+#define INODES_MAX  64          /* Inodes covered by the inode map of the boot block (inode 0 is never used). */
+#define DATAB_MAX   320         /* Data blocks covered by the block map of the boot block (40 bytes). */
+#define MAP_BITS    (BLOCK_SIZE * 8)    /* Inodes or data blocks covered by a block of a map. */
+#define FILE_BLOCKS 1023        /* Data blocks of the largest file. */
+#define ROOT_INO    0           /* The root directory (the entries of the boot block). */
+#define DIR_ENTRIES (BLOCK_SIZE / 64)   /* Entries in a block of a directory. */
+#define DCACHE_SIZE 128         /* Slots of the dentry cache, a power of 2. */
+#define PATH_MAX    256         /* Bytes of a path, with the '\0'. */
+#define RA_BLOCKS   16          /* Blocks read ahead of a file read in order from a disk. */
+#define WRITEBACK_TICKS 5000    /* Timer ticks (ms) between write-backs to a disk. */
+
+/* boot_block.state: the maps are valid only if the image was left 
+ * FS_CLEAN, otherwise they are rebuilt from the directory entries */
+#define FS_CLEAN    0x4e4c4346  /* "FCLN" */
+#define FS_DIRTY    0x54524944  /* "DIRT" */
+
+/* boot_block.maps.ext.magic: the maps are in their own blocks. The first
+ * byte of an inode map in the boot block always has the root bit set, 
+ * which this one has not. */
+#define FS_MAPS     0x70616d66  /* "fmap" */
 
 typedef enum {
     RTC,                        /* Real-time clock. */
     DIRECTORY,                  /* Directory. */
     REGULAR,                    /* Regular file. */
-    TERMINAL                    /* Terminal. */
+    TERMINAL,                   /* Terminal. */
+    PIPE                        /* One end of a pipe. */
 } file_type_t;
 
 
@@ -20,7 +42,7 @@ typedef enum {
 typedef struct {
     int8_t fname[NAMESIZE];     /* File name. */
     file_type_t type;           /* File type. */
-    uint32_t inode;             /* The index of inode, only meaningful for regular files. */     
+    uint32_t inode;             /* The index of inode, only meaningful for regular files and directories. */     
     uint8_t reserved[24];       /* 24 bytes are reserved. */
 } dentry_t; 
 
@@ -31,7 +53,18 @@ typedef struct {
     uint32_t n_dir;             /* Number of the directory entries. */
     uint32_t n_inode;           /* Number of inodes. */
     uint32_t n_datab;           /* Number of data blocks. */
-    uint8_t  reserved[52];      /* 52 bytes are reserved. */
+    uint32_t state;             /* FS_CLEAN when the maps are valid. */
+    union {
+        struct {
+            uint8_t inode_map[INODES_MAX / 8];  /* Used inodes, one bit each. */
+            uint8_t block_map[DATAB_MAX / 8];   /* Used data blocks, one bit each. */
+        } legacy;               /* The maps, in the boot block (state 0 or no FS_MAPS). */
+        struct {
+            uint32_t magic;     /* FS_MAPS. */
+            uint32_t start;     /* First block of the inode map, the block map follows it. */
+            uint32_t blocks;    /* Blocks of both maps, the data blocks follow them. */
+        } ext;                  /* Where the maps are, in blocks of their own. */
+    } maps;
     dentry_t dirs[63];          /* 63 directory entries left. */
 } boot_block;
 
@@ -50,6 +83,15 @@ typedef struct {
 } data_block;
 
 
+/* What stat reports about a file. */
+typedef struct {
+    uint32_t st_ino;                    /* Inode, 0 for a device or a pipe. */
+    uint32_t st_type;                   /* file_type_t of the file. */
+    uint32_t st_size;                   /* Bytes, the entries of a directory times sizeof(dentry_t). */
+    uint32_t st_blocks;                 /* Data blocks in use. */
+} stat_t;
+
+
 typedef struct {
     int idx;                            /* The index we want to start at a given data block. */
     int nblock;                         /* The nth block to read. (NOT data block index) */
@@ -58,19 +100,66 @@ typedef struct {
 } virtual_pos;
 
 
+/* A slot of the dentry cache: where a name was found in a directory. */
+typedef struct {
+    uint32_t dir;                       /* Inode of the directory. */
+    uint32_t hash;                      /* Hash of the name. */
+    uint32_t index;                     /* Entry index in the directory. */
+} dcache_t;
+
+
+struct blkdev;
+
 typedef struct {
     boot_block *boot;                   /* The first block of the file system. */
     inode_t *inodes;                    /* The address of the statring of the inodes block, up to 63 inodes (1st is the '.' directory). */
     data_block *data_block_addr;        /* The address of the statring data block. */
+    int8_t dhash[DHASH_SIZE];           /* First dentry index of each hash bucket, -1 if empty. */
+    int8_t dnext[FILES_MAX];            /* Next dentry index in the same bucket, -1 at the end. */
+    uint32_t dhval[FILES_MAX];          /* Hash of each file name. */
+    uint8_t *inode_map;                 /* Used inodes, in the boot block or in its own blocks. */
+    uint8_t *block_map;                 /* Used data blocks, the same. */
+    uint32_t max_inode;                 /* Inodes covered by the inode map. */
+    uint32_t max_datab;                 /* Data blocks covered by the block map. */
+    uint8_t *iref;                      /* Open files of each inode. */
+    uint8_t *orphan;                    /* 1 if unlinked while open, freed on the last close. */
+    uint8_t *mapped;                    /* Mappings of each inode into programs. */
+    dcache_t dcache[DCACHE_SIZE];       /* Names found in directories other than the root. */
+    struct blkdev *dev;                 /* The disk mounted, NULL for the image in memory. */
+    uint32_t data_start;                /* Block of the image holding data block 0. */
+    boot_block *shadow;                 /* The blocks before the data as they are on the disk. */
+    uint32_t *ra_pos;                   /* Where the last read of each inode ended. */
 } fs_t;
 
 
 extern fs_t *fs;
 
 void fs_init(uint32_t start_addr);
+int32_t fs_mount(struct blkdev *dev);
+int32_t fs_mount_disk(const int8_t *name);
+int32_t fs_sync(void);
+void fs_writeback(void);
+void fs_hash_init(void);
 int32_t read_dentry_by_name(const int8_t *fname, dentry_t *dentry);
 int32_t read_dentry_by_index(uint32_t index, dentry_t *dentry);
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t length);
 uint32_t get_size(uint32_t index);
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t *buf, uint32_t length);
+int32_t namei(const int8_t *path, uint32_t cwd, dentry_t *dentry);
+int32_t fs_chdir(const int8_t *path, uint32_t *cwd);
+int32_t fs_parent(const int8_t *path, uint32_t cwd, uint32_t *dir, int8_t *name);
+int32_t dir_read(uint32_t dir, uint32_t index, dentry_t *dentry);
+int32_t fs_readdir(uint32_t dir, uint32_t index, dentry_t *dentry, stat_t *st);
+void fs_stat(const dentry_t *dentry, stat_t *st);
+int32_t fs_getcwd(uint32_t cwd, int8_t *buf, uint32_t size);
+int32_t fs_create(uint32_t dir, const int8_t *name, file_type_t type, dentry_t *dentry);
+int32_t fs_truncate(uint32_t inode, uint32_t length);
+int32_t fs_unlink(uint32_t dir, const int8_t *name);
+int32_t fs_rmdir(uint32_t dir, const int8_t *name);
+void fs_iget(uint32_t inode);
+void fs_iput(uint32_t inode);
+void fs_mget(uint32_t inode);
+void fs_mput(uint32_t inode);
+uint32_t fs_block_addr(uint32_t inode, uint32_t n);
 
 #endif /* _FS_H */
@@ -25,6 +25,8 @@
 #define L               0x26                /* L key */
 #define D               0x20                /* D key */
 #define Z               0x2c                /* C key */     
+#define C               0x2e                /* C key */
+#define KBD_BUF_SIZE    64                  /* scancodes waiting for the bottom half (power of 2) */
 
 
 extern const char scancodes[KEYBOARD_SIZE][2];
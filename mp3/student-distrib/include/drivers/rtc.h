@@ -9,6 +9,19 @@
 #define RTC_B_reg 0x8B
 #define RTC_C_reg 0x8C
 
+/* time and date registers (NMI disabled) */
+#define RTC_SEC_reg   0x80
+#define RTC_MIN_reg   0x82
+#define RTC_HOUR_reg  0x84
+#define RTC_DAY_reg   0x87
+#define RTC_MON_reg   0x88
+#define RTC_YEAR_reg  0x89
+
+#define RTC_UIP       0x80      /* register A: update in progress */
+#define RTC_BINARY    0x04      /* register B: binary, not BCD */
+#define RTC_24H       0x02      /* register B: 24 hour mode */
+#define RTC_PM        0x80      /* hour register: PM in 12 hour mode */
+
 
 #define RTC_MAX_freq 1024
 #define RTC_MIN_freq 2
@@ -17,6 +30,10 @@
 
 #define RTC_IRQ 8
 
+/* ioctl commands, the same numbers in the user headers */
+#define RTC_IRQP_SET  1         /* set the frequency of the periodic interrupt */
+#define RTC_IRQP_READ 2         /* get the frequency of the periodic interrupt */
+
 #include <types.h>
 
 
@@ -24,6 +41,7 @@ void rtc_init();
 void do_rtc();
 int32_t rtc_open(const int8_t* filename);
 int32_t rtc_close(int32_t fd);
+uint32_t rtc_get_time(void);
 
 /*
  * RTC_read(int32_t fd, const void* buffer, int32_t nbytes)
@@ -31,7 +49,7 @@ int32_t rtc_close(int32_t fd);
  * Input: int32_t fd -- file descriptor
  *        const void* buffer -- address of the target frequency
  *        int32_t nbytes -- number of bytes, should be 4
- * Output: 0 on success, -1 otherwise
+ * Output: 0 on success, -EINTR if a signal came first
 */
 int32_t rtc_read(int32_t fd, void* buffer, int32_t nbytes);
 
@@ -45,4 +63,24 @@ int32_t rtc_read(int32_t fd, void* buffer, int32_t nbytes);
 */
 int32_t rtc_write(int32_t fd, const void* buffer, int32_t nbytes);
 
+/*
+ * rtc_ioctl(int32_t fd, uint32_t cmd, uint32_t arg)
+ * Function: set (RTC_IRQP_SET) or get (RTC_IRQP_READ) the RTC frequency
+ * Input: int32_t fd -- file descriptor
+ *        uint32_t cmd -- the command
+ *        uint32_t arg -- the new frequency for RTC_IRQP_SET
+ * Output: 0 or the frequency on success, negative errno otherwise
+*/
+int32_t rtc_ioctl(int32_t fd, uint32_t cmd, uint32_t arg);
+
+/*
+ * rtc_poll(int32_t fd, struct poll_table *pt)
+ * Function: events ready on the RTC, the caller waits for the next interrupt
+ * Input: int32_t fd -- file descriptor
+ *        struct poll_table *pt -- poll table
+ * Output: POLLIN if an interrupt came since the last read, POLLOUT always
+*/
+struct poll_table;
+uint32_t rtc_poll(int32_t fd, struct poll_table *pt);
+
 #endif /* _RTC_H */
@@ -2,6 +2,7 @@
 #define _TERMAINL_H
 
 #include <drivers/keyboard.h>
+#include <spinlock.h>
 
 #define TERBUF_SIZE 128                 /* max buffer size */
 #define VIDMEM_SIZE 4096                /* video memory size */
@@ -15,14 +16,17 @@ typedef struct {
     uint8_t buftl;                      /* The bottom position of the buffer. */
     uint8_t size;                       /* The current size of the buffer. */
     uint8_t *buffer;                    /* Line buffer input. */
-    uint8_t exit;                       /* A flag for stdin, 1 if \n is detected. */
     uint8_t screen_x;                   /* cursor column index */
     uint8_t screen_y;                   /* cursor row index */
+    uint8_t top;                        /* line of vidmem shown on row 0 */
     char *vidmem;                    /* 4KB video memory for this terminal */ 
     char *saved_vidmem;              /* saved video memory address for backing up */
 } terminal_t;
 
 extern int8_t terminal_boot;
+extern spinlock_t term_lock;
+
+struct poll_table;
 
 
 void key_press(uint32_t scancode, terminal_t *terminal);
@@ -33,6 +37,7 @@ int32_t terminal_open(const int8_t *fname);
 int32_t terminal_close(int32_t fd);
 int32_t terminal_read(int32_t fd, void *buf, int32_t nbytes);
 int32_t terminal_write(int32_t fd, const void *buf, int32_t nbytes);
+uint32_t terminal_poll(int32_t fd, struct poll_table *pt);
 
 
 #endif /*_TERMAINL_H */
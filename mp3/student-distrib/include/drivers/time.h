@@ -8,6 +8,9 @@
 #define CMD_REG 0x43
 #define TIMER_CHANNEL   0x40
 #define TIMER_IRQ       0
+#define NSEC_PER_SEC    1000000000UL
+
+#include <types.h>
 
 
 /* timer object */
@@ -28,13 +31,17 @@ typedef struct {
 
 typedef struct {
     /* stores the number of seconds that have elsaped since midnight of January 1 1970 (UTC) */
-    // tv_sec;
+    uint32_t tv_sec;
 
     /* stores the number of nanoseconds that have elapsed within the last second */
-    // tv_nsec;
+    uint32_t tv_nsec;
 } timespec;
 
 
+extern volatile uint32_t sys_ticks;
+extern timespec sys_clock;
+
+
 void pit_init(void);
 void do_timer(void);
 
@@ -12,15 +12,21 @@
 
 #define VGA_WIDTH   80
 #define VGA_HEIGHT  25
+#define VGA_MEM_SIZE    0x8000                          /* text memory, 0xB8000-0xBFFFF */
+#define VGA_LINES       (VGA_MEM_SIZE / (VGA_WIDTH << 1))   /* lines the screen can pan over */
+#define VGA_BLANK       (' ' | (ATTRIB << 8))           /* an empty cell */
 
 extern char *video_mem;
 
 void vga_init(void);
-void vga_write(char *vidmem, uint8_t x, uint8_t y, int8_t c);
-void vga_clear(char *vidmem);
-void vga_scrolling(char *vidmem);
+void vga_write(char *vidmem, uint8_t top, uint8_t x, uint8_t y, int8_t c);
+void vga_clear(char *vidmem, uint8_t *top);
+void vga_scrolling(char *vidmem, uint8_t *top);
+void vga_home(char *vidmem, uint8_t *top);
+void vga_save(char *buf, uint8_t *top);
+void vga_restore(const char *buf, uint8_t *top);
 void vga_enable_cursor(uint8_t cursor_start, uint8_t cursor_end);
 void vga_disable_cursor(void);
-void vga_update_cursor(uint8_t x, uint8_t y);
+void vga_update_cursor(uint8_t top, uint8_t x, uint8_t y);
 
 #endif /* _VGA_H_ */
@@ -16,6 +16,7 @@ void* memset_word(void* s, int32_t c, uint32_t n);
 void* memset_dword(void* s, int32_t c, uint32_t n);
 void* memcpy(void* dest, const void* src, uint32_t n);
 void* memmove(void* dest, const void* src, uint32_t n);
+int32_t memcmp(const void* s1, const void* s2, uint32_t n);
 int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n);
 int8_t* strcpy(int8_t* dest, const int8_t*src);
 int8_t* strncpy(int8_t* dest, const int8_t*src, uint32_t n);
@@ -117,6 +118,40 @@ do {                                    \
     );                                  \
 } while (0)
 
+/* Reads count words from a port into buf (a disk sector) */
+#define insw(port, buf, count)          \
+do {                                    \
+    uint32_t __buf = (uint32_t)(buf);   \
+    uint32_t __count = (count);         \
+    asm volatile ("cld; rep insw"       \
+            : "+D"(__buf), "+c"(__count) \
+            : "d"(port)                 \
+            : "memory", "cc"            \
+    );                                  \
+} while (0)
+
+/* Writes count words from buf to a port */
+#define outsw(port, buf, count)         \
+do {                                    \
+    uint32_t __buf = (uint32_t)(buf);   \
+    uint32_t __count = (count);         \
+    asm volatile ("cld; rep outsw"      \
+            : "+S"(__buf), "+c"(__count) \
+            : "d"(port)                 \
+            : "memory", "cc"            \
+    );                                  \
+} while (0)
+
+/* Writes a 32-bit value to a model specific register (high half 0) */
+#define wrmsr(msr, data)                \
+do {                                    \
+    asm volatile ("wrmsr"               \
+            :                           \
+            : "c"(msr), "a"(data), "d"(0) \
+            : "memory"                  \
+    );                                  \
+} while (0)
+
 /* Clear interrupt flag - disables interrupts on this processor */
 #define cli()                           \
 do {                                    \
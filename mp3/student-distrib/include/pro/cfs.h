@@ -4,6 +4,8 @@
 #include <types.h>
 #include <list.h>
 #include <rbtree.h>
+#include <spinlock.h>
+#include <boot/smp.h>
 
 /* sets a target for is approximation of the "infinitely small" 
  * scheduling duration in perfect multitasking */
@@ -16,6 +18,9 @@
 
 #define NICE_0_LOAD         1024            /* the weight for process has nice value 0 */
 
+#define MIN_NICE            -20             /* the highest priority a task can ask for */
+#define MAX_NICE            19              /* the lowest priority a task can ask for */
+
 /* minimum guanularity running time for each task */
 #define MIN_GRANULARITY     1000000ULL      /* 1 ms */
 
@@ -24,8 +29,11 @@
 #define WMULT_IDLE          1431655765      /* the inv_weight for process 0 */
 
 #define WMULT_SHIFT         32               
+#define WMULT_CONST         (~0U)           /* 2^32 - 1, used to invert a summed load weight */
+
+#define BALANCE_TICKS       20              /* 20 ms between two load balancing runs of a CPU */
 
-/* walk up scheduling entities hierarchy (NOT USED IN THIS VERSION) */
+/* walk up scheduling entities hierarchy: task -> group -> NULL */
 #define for_each_sched(se) \
 		for (; se; se = se->parent)
 
@@ -41,8 +49,10 @@ typedef struct {
 } weight_t;
 
 
-/* sched process info */
-typedef struct {
+struct cfs_rq;
+
+/* sched process info (a task, or a group of tasks) */
+typedef struct sched {
     rb_node  node;              /* a red-block tree node for this thread */
     list_head wait_node;        /* use linked list of nodes to store waiting tasks*/
     weight_t load;              /* calculated load weight of each particle combined into one entity */
@@ -51,6 +61,9 @@ typedef struct {
     uint64_t sum_exec_time;     /* time the process has been running in total */
     uint64_t prev_sum_exec_time;/* used for storing the previous run time of a process */
     int8_t   on_rq;             /* does the process on runqueue now? */
+    struct sched  *parent;      /* group entity this entity is queued under (NULL at the root) */
+    struct cfs_rq *cfs_rq;      /* run queue this entity is queued on */
+    struct cfs_rq *my_q;        /* run queue owned by this entity (NULL for a task) */
 } sched_t;
 
 
@@ -71,19 +84,41 @@ typedef struct {
  * it is the leftmost element, because the tree is sorted based on 
  * vruntime of processes (smaller vruntime means sooner execution).
  */
-typedef struct {
+typedef struct cfs_rq {
     weight_t load;          /* sum of weights of all tasks in the queue */
     uint32_t nr_running;    /* number of runnable tasks in the queue */
     uint64_t min_vruntime;  /* current min vruntime in the queue */
-    uint64_t clock;         /* time clock in nanosecond */
     rb_root rb_tree;        /* root of the red-black tree*/
     rb_node *left_most;     /* current leftmost red-black tree node */
     sched_t *current;       /* current running task's sched info (NULL when no process is running) */
 } cfs_rq;
 
 
+/* Group scheduling:
+ *
+ * Each console owns a task group. The group entity is queued on the 
+ * root run queue like a task with nice 0, and the tasks of the console 
+ * are queued on the group's own run queue. Picking walks down from the 
+ * root: first the group with the smallest vruntime, then the task with 
+ * the smallest vruntime inside it. So a console running ten CPU hogs 
+ * gets the same CPU time as a console running one.
+ *
+ * Each CPU has its own root run queue, so a group has one entity and 
+ * one run queue per CPU, for the tasks of the console on that CPU.
+ */
+typedef struct {
+    sched_t se[NR_CPUS];    /* entity of this group on the root run queue of each CPU */
+    cfs_rq  cfs[NR_CPUS];   /* run queue of the tasks in this group on each CPU */
+} task_group_t;
+
+
+/* root run queue of a CPU */
+#define cpu_rq(cpu)     (&runqueues[cpu])
+
 
-extern cfs_rq *rq;
+extern cfs_rq runqueues[NR_CPUS];
+extern uint64_t sched_clock;
+extern spinlock_t rq_lock;
 extern const uint32_t sched_prio_to_weight[40];
 extern const uint32_t sched_prio_to_wmult[40];
 
@@ -91,7 +126,7 @@ extern const uint32_t sched_prio_to_wmult[40];
 void sched_init(void);
 void schedule(void);
 void pause(void);
- void enqueue_entity(sched_t *s, int8_t wakeup);
+task_group_t *sched_create_group(void);
 
 
 #endif /* _CFS_H_ */
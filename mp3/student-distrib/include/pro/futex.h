@@ -0,0 +1,25 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+#include <types.h>
+#include <list.h>
+
+#define FUTEX_WAIT          0               /* sleep if *uaddr == val */
+#define FUTEX_WAKE          1               /* wake up at most val waiters on uaddr */
+
+
+struct thread;
+struct vmem;
+
+/* a thread sleeping on a futex, lives on the waiter's kernel stack */
+typedef struct {
+    list_head      node;        /* node in the futex wait list */
+    struct thread  *task;       /* waiting thread, NULL once woken up */
+    struct vmem    *vm;         /* address space of uaddr */
+    uint32_t       uaddr;       /* user address of the futex word */
+} futex_q_t;
+
+
+int32_t do_futex(uint32_t uaddr, int32_t op, int32_t val);
+
+#endif /* _FUTEX_H_ */
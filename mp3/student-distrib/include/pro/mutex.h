@@ -0,0 +1,27 @@
+#ifndef _MUTEX_H_
+#define _MUTEX_H_
+
+#include <types.h>
+#include <spinlock.h>
+#include <pro/wait.h>
+
+
+/* a lock whose waiters sleep instead of spinning, for code that sleeps
+ * while holding it (disk I/O). Never taken by an interrupt handler. */
+typedef struct {
+    spinlock_t          lock;       /* protects locked and wait */
+    uint32_t            locked;     /* 1 while held */
+    wait_queue_head_t   wait;       /* threads waiting for it */
+} mutex_t;
+
+
+#define DEFINE_MUTEX(name)                                  \
+    mutex_t name = { __SPIN_LOCK_UNLOCKED(name), 0,         \
+                     { LIST_HEAD_INIT(name.wait.task_list) } }
+
+
+void mutex_lock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+
+#endif /* _MUTEX_H_ */
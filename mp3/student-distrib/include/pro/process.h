@@ -5,19 +5,29 @@
 #include <drivers/terminal.h>
 #include <access.h>
 #include <pro/cfs.h>
+#include <pro/rt.h>
+#include <pro/signal.h>
+#include <pro/wait.h>
+#include <boot/fpu.h>
 #include <list.h>
 
 
-#define ARGSIZE         33              /* max size of a command argument*/           
-#define MAXARGS         10              /* max number of arguments */
+#define COMM_LEN        33              /* max size of a program name, with the NUL */
+#define ARG_MAX         4096            /* max size of the argument and environment strings */
 #define SHELL           "shell"         /* shell program */
+#define BSH             "bsh"           /* fork/exec shell program */
 #define INIT            "init"          /* init program */
 #define IDLE            "idle"          /* idle program */
 #define TASKSTART       2               /* user tasks starts from 2 */
 #define NICE_INIT       19              /* nice value for init process */
 #define NICE_SHELL      5              /* nice value for shell process */
 #define NICE_NORMAL     0               /* nice value for default process */
+#define PRIO_PROCESS    0               /* setpriority/getpriority target is a process */
+#define PRIO_PGRP       1               /* target is a process group (unsupported) */
+#define PRIO_USER       2               /* target is a user (unsupported) */
+#define PRIO_BIAS       20              /* getpriority returns PRIO_BIAS - nice */
 #define NTERMINAL       3               /* max number of terminals supported */
+#define NO_CONSOLE      NTERMINAL       /* console id of kernel threads */
 #define MAXCHILDREN     100             /* default max number of children for a process */
 #define STACK           2042            /* CPU pushs user registers on stack starting at this offset */
 #define USEREIP         2042            /* CPU pre-pushed user eip needed to be copied */
@@ -25,6 +35,7 @@
 #define KSTACK_SIZE     2048            /* 2048 word */
 
 #define task_of(ptr)  container_of(ptr, thread_t, sched_info)
+#define rt_task(t)    ((t)->policy != SCHED_NORMAL)
 
 #define NEED_RESCHED    1               /* flag used for rescheduling */
 #define WAKEUP          2               /* flag used for waking up */
@@ -80,6 +91,8 @@ typedef struct vm_area {
     uint32_t            vmstart;
     uint32_t            vmend;
     uint32_t            vmflag;
+    uint32_t            inode;      /* VM_FILE: the file mapped */
+    uint32_t            pgoff;      /* VM_FILE: page of the file at vmstart */
     struct vm_area      *next;
 } vm_area_t;
 
@@ -89,7 +102,7 @@ typedef struct vmem {
     uint32_t            file_length;
     uint32_t            start_brk;
     uint32_t            brk;
-    int                 count;
+    int                 count;      /* number of threads sharing it */
 } vmem_t;
 
 /* define a thread that run as a process */
@@ -99,10 +112,16 @@ typedef struct thread {
     list_head          run_node;        /* a list of all runnable tasks */
     volatile uint32_t  count;           /* time slice for a task */
     sched_t            sched_info;      /* info used for scheduler */
+    rt_sched_t         rt_info;         /* info used for real-time scheduler */
+    uint32_t           policy;          /* SCHED_NORMAL, SCHED_FIFO or SCHED_RR */
+    uint32_t           rt_priority;     /* real-time priority [1, 99], 0 for SCHED_NORMAL */
     volatile pro_state state;	        /* process state */
     volatile uint8_t   flag;            /* process flag */
-    int32_t            argc;            /* number of arguments */
-    int8_t             **argv;          /* user command line argument */
+    int8_t             comm[COMM_LEN];  /* program name (argv[0]) */
+    uint32_t           arg_start;       /* argument strings on the user stack */
+    uint32_t           arg_end;
+    uint32_t           env_start;       /* environment strings on the user stack */
+    uint32_t           env_end;
     pid_t              pid;             /* process id number */
     struct thread      *parent;         /* parent process addr */
     struct thread      **children;      /* child process addr */
@@ -111,13 +130,26 @@ typedef struct thread {
     context_t          *context;        /* hardware context */
     uint32_t           usreip;          /* user eip */
     uint32_t           usresp;          /* user esp */
-    vmem_t             vm;              /* user virtual memory info */
+    vmem_t             *vm;             /* user virtual memory info, shared by threads */
     files              *fds;            /* opened file descritors */
     uint8_t            kthread;         /* 1 if this thread is belong to the kernel */
     terminal_t         *terminal;       /* terminal for this thread */
     uint32_t           console_id;      /* console for this thread */
     int32_t            nice;            /* nice value */
+    fpu_state_t        *fpu;            /* saved FPU/SSE registers, 16-byte aligned in fpu_buf */
+    void               *fpu_buf;        /* memory allocated for fpu */
+    uint8_t            used_math;       /* 1 if fpu holds the registers of this program */
     uint8_t            **user_vidmap;
+    uint32_t           sigpending;      /* signals sent, not delivered yet */
+    uint32_t           sigblocked;      /* signals held back (handler running) */
+    void               *sighand[NSIG];  /* user handlers, SIG_DFL for the default action */
+    volatile uint8_t   sigsleep;        /* 1 while in a sleep a signal can interrupt */
+    volatile uint32_t  *vfork_done;     /* set while a vfork child borrows the parent's memory */
+    uint32_t           cwd;             /* inode of the current directory */
+    wait_queue_head_t  wait_chldexit;   /* the thread sleeping in waitpid for a child */
+    uint32_t           exit_code;       /* status given to exit, read by waitpid */
+    uint32_t           cpu;             /* CPU whose run queues hold the task */
+    int32_t            lock_depth;      /* times the task took the kernel lock, 0 if not held */
 } thread_t;
 
 
@@ -128,6 +160,7 @@ typedef struct {
     thread_t *task;
     uint8_t* vidmap;
     uint32_t intr_flag;       /* interrupt CLI/STI flag */
+    task_group_t *tg;         /* scheduling group of the tasks on this console */
 } console_t;
 
 
@@ -151,18 +184,28 @@ void inline context_switch(thread_t *prev, thread_t *next);
 void process_free(thread_t *current);
 
 void do_exit(uint32_t status);
-int32_t do_execv(thread_t *curr, const int8_t *pathname, int8_t *const argv[]);
+int32_t do_waitpid(pid_t pid, int32_t *wstatus);
+int32_t do_execv(thread_t *curr, const int8_t *pathname, int8_t *const argv[], int8_t *const envp[]);
+int32_t do_getargs(uint8_t *buf, int32_t nbytes);
 int32_t do_fork(thread_t *parent, uint8_t kthread);
+int32_t do_clone(thread_t *parent, uint32_t eip, uint32_t esp);
+int32_t do_vfork(thread_t *parent, volatile uint32_t *done);
 int32_t do_execute(thread_t *parent, const int8_t *cmd);
 pid_t do_getpid(void);
+thread_t *find_task_by_pid(pid_t pid);
+int32_t cwd_in_use(uint32_t inode);
+int32_t do_setpriority(int32_t which, pid_t who, int32_t nice);
+int32_t do_getpriority(int32_t which, pid_t who);
+int32_t do_sched_setscheduler(pid_t pid, int32_t policy, int32_t prio);
+pid_t kernel_thread(int32_t (*fn)(void *), void *arg, const int8_t *name);
 void *do_sbrk(uint32_t size);
 
 uint32_t get_esp0(thread_t *curr);
-int32_t file_init(int32_t fd, file_t *file, dentry_t *dentry, file_op *op, thread_t *curr);
 thread_t **children_create(void);
 
 /* implemented in fs.c */
 
+int32_t pro_check(const int8_t *fname, uint32_t *EIP);
 int32_t pro_loader(const int8_t *fname, uint32_t *EIP, thread_t* curr);
 
 /* implemented in switch.S */
@@ -179,11 +222,12 @@ void free_vm(thread_t* t);
 /* implemented in vfs.c */
 
 int32_t fd_init(thread_t *curr);
-int32_t __open(int32_t fd, const int8_t *fname, file_type_t type, file_op *op, thread_t *curr);
+void put_files(thread_t *curr);
+int32_t __open(int32_t fd, const int8_t *fname, file_type_t type, uint32_t mode, const file_op *op, thread_t *curr);
 
 /* implemented in file.c */
 
-int32_t file_init(int32_t fd, file_t *file, dentry_t *dentry, file_op *op, thread_t *curr);
+int32_t file_init(int32_t fd, file_t *file, dentry_t *dentry, const file_op *op, thread_t *curr);
 
 /* implemented in sched.c */
 
@@ -194,7 +238,20 @@ void sched_wakeup(thread_t *from, thread_t *task);
 void enqueue_task(thread_t *new, int8_t wakeup);
 void sched_exit(thread_t *child, thread_t *parent);
 void activate_task(thread_t *task);
+void set_user_nice(thread_t *task, int32_t nice);
+void set_curr_task(thread_t *task);
+void wake_up_process(thread_t *task);
+void sched_setscheduler(thread_t *task, int32_t policy, int32_t prio);
+void enqueue_task_rt(thread_t *task);
+void dequeue_task_rt(thread_t *task);
+thread_t *pick_next_task_rt(void);
+thread_t *__pick_next_task_rt(void);
+void check_preempt_curr_rt(thread_t *task);
+void task_tick_rt(thread_t *curr);
+void update_rt_period(void);
 void wakeup_preempt(thread_t *task);
 void task_tick(thread_t *curr);
+void resched_cpu(uint32_t cpu);
+void load_balance(void);
 
 #endif /* _PROCESS_H_ */
@@ -0,0 +1,62 @@
+#ifndef _RT_H_
+#define _RT_H_
+
+#include <types.h>
+#include <list.h>
+#include <boot/smp.h>
+
+/* scheduling policies */
+#define SCHED_NORMAL        0               /* CFS */
+#define SCHED_FIFO          1               /* real-time: run until block or yield */
+#define SCHED_RR            2               /* real-time: round robin inside a priority */
+
+#define MAX_RT_PRIO         100             /* rt_priority ranges from 1 (lowest) to 99 (highest) */
+#define RT_BITMAP_SIZE      ((MAX_RT_PRIO + 31) / 32)   /* words in the active priority bitmap */
+
+#define RR_TIMESLICE        100             /* 100 ms time slice for SCHED_RR */
+
+/* RT throttling: real-time tasks may use at most RT_RUNTIME
+ * of every RT_PERIOD, the rest is left to CFS (the shells) */
+#define RT_PERIOD           1000000000ULL   /* 1 s */
+#define RT_RUNTIME          950000000ULL    /* 0.95 s */
+
+/* get thread from its real-time sched info */
+#define rt_task_of(ptr)     container_of(ptr, thread_t, rt_info)
+
+
+/* real-time sched info */
+typedef struct {
+    list_head run_list;         /* node in the queue of its priority */
+    uint32_t  time_slice;       /* ticks left for SCHED_RR */
+    int8_t    on_rq;            /* does the task on runqueue now? */
+} rt_sched_t;
+
+
+/* Real-time run queue:
+ *
+ * one FIFO queue per priority, and a bitmap of the non-empty queues.
+ * Picking the next task is finding the first set bit and taking the
+ * head of that queue, which does not depend on the number of tasks.
+ * Bit 0 is the highest priority (rt_priority 99).
+ */
+typedef struct {
+    uint32_t  bitmap[RT_BITMAP_SIZE];   /* active priorities */
+    list_head queue[MAX_RT_PRIO];       /* runnable tasks of each priority */
+    uint32_t  nr_running;               /* number of runnable real-time tasks */
+    uint64_t  rt_time;                  /* time used by real-time tasks in this period */
+    uint64_t  period_start;             /* clock when this period started */
+    int8_t    rt_throttled;             /* real-time tasks ran out of runtime */
+} rt_rq_t;
+
+
+/* real-time run queue of a CPU */
+#define cpu_rt_rq(cpu)  (&rt_runqueues[cpu])
+
+
+extern rt_rq_t rt_runqueues[NR_CPUS];
+
+
+void init_rt_rq(rt_rq_t *q);
+
+
+#endif /* _RT_H_ */
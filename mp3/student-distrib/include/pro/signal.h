@@ -0,0 +1,72 @@
+#ifndef _SIGNAL_H_
+#define _SIGNAL_H_
+
+#include <types.h>
+#include <boot/syscall.h>
+
+
+/* signal numbers (ECE391 numbering) */
+#define DIV_ZERO        0               /* divide error, FPU/SIMD error */
+#define SEGFAULT        1               /* any other exception in user mode */
+#define INTERRUPT       2               /* CTRL+C on the console */
+#define ALARM           3               /* timer alarm */
+#define USER1           4               /* user defined */
+#define NSIG            5               /* number of signals */
+
+#define sigmask(sig)    (1U << (sig))
+
+#define SIG_DFL         ((void *)0)     /* default action */
+#define NR_SIGRETURN    10              /* system call number of sigreturn */
+
+/* registers saved on the kernel stack on entry from user mode,
+ * in the order handler.S pushes them */
+typedef struct {
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t ebp;
+    uint32_t eax;
+    uint32_t ds;
+    uint32_t es;
+    int32_t  orig_eax;          /* system call number, -1 otherwise */
+    uint32_t eip;               /* pushed by the CPU */
+    uint32_t cs;
+    uint32_t eflags;
+    uint32_t esp;
+    uint32_t ss;
+} pt_regs_t;
+
+#define user_mode(regs)     ((regs)->cs & 3)
+
+/* the user registers of t, at the top of its kernel stack */
+#define task_pt_regs(t)     (((pt_regs_t *)get_esp0(t)) - 1)
+
+/* frame pushed on the user stack to run a handler: the handler is
+ * called as handler(signum) and returns into code, which calls
+ * sigreturn with the saved registers on top of the stack */
+typedef struct {
+    uint32_t    ret;            /* return address of the handler: code */
+    uint32_t    signum;         /* argument of the handler */
+    pt_regs_t   regs;           /* registers of the interrupted program */
+    uint32_t    blocked;        /* mask to restore */
+    uint8_t     code[8];        /* movl $NR_SIGRETURN, %eax; int $0x80 */
+} sigframe_t;
+
+
+struct thread;
+
+void signal_init(struct thread *t, struct thread *parent);
+void flush_signal_handlers(struct thread *t);
+int32_t send_sig(int32_t sig, struct thread *t);
+int32_t force_sig(int32_t sig, struct thread *t);
+int32_t signal_pending(struct thread *t);
+void kill_console(uint32_t id, int32_t sig);
+
+asmlinkage void do_signal(pt_regs_t *regs);
+int32_t do_set_handler(int32_t signum, void *handler);
+int32_t do_sigreturn(pt_regs_t *regs);
+
+
+#endif /* _SIGNAL_H_ */
@@ -0,0 +1,40 @@
+#ifndef _WAIT_H_
+#define _WAIT_H_
+
+#include <types.h>
+#include <list.h>
+#include <spinlock.h>
+
+
+struct thread;
+
+/* a list of threads sleeping until something happens to an object,
+ * protected by the lock of that object */
+typedef struct {
+    list_head          task_list;   /* wait_queue_t entries */
+} wait_queue_head_t;
+
+/* a thread sleeping on a wait queue, lives on the waiter's kernel stack */
+typedef struct {
+    list_head          node;        /* node in the wait queue */
+    struct thread      *task;       /* waiting thread, NULL once woken up */
+} wait_queue_t;
+
+
+#define DECLARE_WAIT_QUEUE_HEAD(name)   \
+    wait_queue_head_t name = { LIST_HEAD_INIT(name.task_list) }
+
+/* set up a wait queue that is not defined with DECLARE_WAIT_QUEUE_HEAD */
+#define init_waitqueue_head(q)                      \
+do {                                                \
+    (q)->task_list.next = &(q)->task_list;          \
+    (q)->task_list.prev = &(q)->task_list;          \
+} while (0)
+
+
+void sleep_on(wait_queue_head_t *q, spinlock_t *lock);
+void sleep_on_uninterruptible(wait_queue_head_t *q, spinlock_t *lock);
+void wake_up(wait_queue_head_t *q);
+
+
+#endif /* _WAIT_H_ */
@@ -0,0 +1,36 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+#include <types.h>
+#include <list.h>
+
+#define KWORKER             "kworker"       /* name of the worker kernel thread */
+
+
+struct work;
+typedef void (*work_func_t)(struct work *work);
+
+
+/* a piece of work deferred from an interrupt handler */
+typedef struct work {
+    list_head          entry;       /* node in the worker's list */
+    work_func_t        func;        /* function to run in the worker thread */
+    volatile uint8_t   pending;     /* 1 if queued and not started yet */
+} work_t;
+
+
+/* set up a work item before it is scheduled */
+#define INIT_WORK(w, f)             \
+do {                                \
+    (w)->entry.next = &(w)->entry;  \
+    (w)->entry.prev = &(w)->entry;  \
+    (w)->func = (f);                \
+    (w)->pending = 0;               \
+} while (0)
+
+
+void workqueue_init(void);
+int32_t schedule_work(work_t *work);
+
+
+#endif /* _WORKQUEUE_H_ */
@@ -0,0 +1,124 @@
+/* spinlock.h - Spinlocks and reader-writer locks
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include <types.h>
+#include <lib.h>
+
+/* Lock debugging: catch a thread taking a lock it already holds
+ * (which would spin forever), unlocking a free lock, and keep the
+ * longest time each lock was held, in TSC cycles. */
+#define SPINLOCK_DEBUG      1
+
+struct thread;
+
+typedef struct {
+    volatile uint32_t   slock;          /* 0 if free, 1 if held */
+#if SPINLOCK_DEBUG
+    const int8_t        *name;          /* name of the lock, for reports */
+    struct thread       *owner;         /* thread holding the lock */
+    uint32_t            start;          /* TSC when the lock was taken */
+    uint32_t            max_hold;       /* longest hold time seen */
+    uint32_t            contended;      /* number of times a CPU had to spin */
+#endif
+} spinlock_t;
+
+
+/* A reader-writer lock lets any number of readers in at the same
+ * time, or a single writer. count is the number of readers holding
+ * the lock, or RW_WRITER when a writer holds it. Writers can be
+ * starved by a steady stream of readers. */
+#define RW_WRITER           (-1)
+
+typedef struct {
+    volatile int32_t    count;          /* readers, or RW_WRITER */
+#if SPINLOCK_DEBUG
+    const int8_t        *name;          /* name of the lock, for reports */
+    struct thread       *owner;         /* writer holding the lock */
+#endif
+} rwlock_t;
+
+
+/* atomically store v in *p and return the old value */
+static inline uint32_t xchg(volatile uint32_t *p, uint32_t v) {
+    asm volatile ("xchgl %0, %1"
+                : "+r"(v), "+m"(*p)
+                :
+                : "memory");
+    return v;
+}
+
+/* tell the CPU we are in a spin-wait loop */
+static inline void cpu_relax(void) {
+    asm volatile ("pause" : : : "memory");
+}
+
+
+#if SPINLOCK_DEBUG
+#define __SPIN_LOCK_UNLOCKED(n)     { .slock = 0, .name = #n }
+#define __RW_LOCK_UNLOCKED(n)       { .count = 0, .name = #n }
+#else
+#define __SPIN_LOCK_UNLOCKED(n)     { .slock = 0 }
+#define __RW_LOCK_UNLOCKED(n)       { .count = 0 }
+#endif
+
+#define DEFINE_SPINLOCK(n)          spinlock_t n = __SPIN_LOCK_UNLOCKED(n)
+#define DEFINE_RWLOCK(n)            rwlock_t n = __RW_LOCK_UNLOCKED(n)
+
+
+void spin_lock_init(spinlock_t *lock, const int8_t *name);
+void spin_lock(spinlock_t *lock);
+int32_t spin_trylock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+
+void rwlock_init(rwlock_t *lock, const int8_t *name);
+void read_lock(rwlock_t *lock);
+void read_unlock(rwlock_t *lock);
+void write_lock(rwlock_t *lock);
+void write_unlock(rwlock_t *lock);
+
+
+/* The irq variants also turn off interrupts on this CPU. They must be
+ * used for any lock that an interrupt handler takes, otherwise the
+ * handler can spin forever on a lock held by the code it interrupted. */
+#define spin_lock_irqsave(lock, flags)          \
+do {                                            \
+    cli_and_save(flags);                        \
+    spin_lock(lock);                            \
+} while (0)
+
+#define spin_unlock_irqrestore(lock, flags)     \
+do {                                            \
+    spin_unlock(lock);                          \
+    restore_flags(flags);                       \
+} while (0)
+
+#define read_lock_irqsave(lock, flags)          \
+do {                                            \
+    cli_and_save(flags);                        \
+    read_lock(lock);                            \
+} while (0)
+
+#define read_unlock_irqrestore(lock, flags)     \
+do {                                            \
+    read_unlock(lock);                          \
+    restore_flags(flags);                       \
+} while (0)
+
+#define write_lock_irqsave(lock, flags)         \
+do {                                            \
+    cli_and_save(flags);                        \
+    write_lock(lock);                           \
+} while (0)
+
+#define write_unlock_irqrestore(lock, flags)    \
+do {                                            \
+    write_unlock(lock);                         \
+    restore_flags(flags);                       \
+} while (0)
+
+
+#endif /* _SPINLOCK_H */
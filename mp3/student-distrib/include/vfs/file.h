@@ -4,23 +4,43 @@
 #include <types.h>
 #include <drivers/fs.h>
 
+#define FMODE_READ  0x1         /* The file was opened for reading. */
+#define FMODE_WRITE 0x2         /* The file was opened for writing. */
+
+/* events reported by the poll operation */
+#define POLLIN      0x001       /* A read would not block. */
+#define POLLOUT     0x004       /* A write would not block. */
+#define POLLERR     0x008       /* An error condition (a pipe without readers). */
+#define POLLHUP     0x010       /* The other end is gone (a pipe without writers). */
+#define POLLNVAL    0x020       /* The file descriptor is not open. */
+
+struct poll_table;
+
+/* The operations of a type of file. Each type has one static const
+ * table, and an open file points to it: a call is one indirect jump. */
 typedef struct {
     int32_t (*open)(const int8_t *);
     int32_t (*close)(int32_t);
     int32_t (*read)(int32_t, void *, int32_t);
     int32_t (*write)(int32_t, const void *, int32_t);
+    int32_t (*lseek)(int32_t, int32_t, int32_t);   /* NULL if the file cannot seek */
+    int32_t (*ioctl)(int32_t, uint32_t, uint32_t); /* NULL if the file takes no commands */
+    uint32_t (*poll)(int32_t, struct poll_table *);/* NULL if the file is always ready */
 } file_op;
 
 
 /* A file stores information about the interaction 
  * between an open file and a process. The information
  * exists only in kernel memory during the period when
- * a process has the file open. */
+ * a process has the file open. File descriptors made
+ * by dup, dup2 and fork share it. */
 typedef struct {
     dentry_t f_dentry;      /* The dentry for this file. */
-    file_op  f_op;          /* Pointer to the file operation table. */
-    uint32_t f_count;       /* File object's reference count. */
+    const file_op *f_op;    /* Pointer to the file operation table. */
+    uint32_t f_count;       /* File descriptors and system calls using the file. */
     uint32_t f_pos;         /* Current file offset (file pointer). */
+    uint32_t f_mode;        /* FMODE_READ and/or FMODE_WRITE (pipes and the terminal). */
+    void *private_data;     /* Object behind the file (the pipe). */
 } file_t;
 
 
@@ -0,0 +1,50 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+#include <types.h>
+#include <spinlock.h>
+#include <pro/wait.h>
+
+#define PIPE_SIZE   4096            /* A pipe buffers up to one page. */
+#define PIPE_BUF    512             /* Writes up to PIPE_BUF bytes are not interleaved. */
+
+
+struct vmem;
+struct poll_table;
+
+/* A reader sleeping on an empty pipe with a large buffer, a large write
+ * copies straight into it. Lives on the reader's kernel stack. */
+typedef struct {
+    struct vmem *vm;                /* Address space of buf. */
+    uint32_t buf;                   /* User buffer of the reader. */
+    uint32_t len;                   /* Size of buf. */
+    uint32_t done;                  /* Bytes copied in by the writer. */
+} pipe_reader_t;
+
+/* A pipe is a ring buffer in a kernel page. head and tail count all 
+ * bytes ever written and read, head - tail bytes are in the buffer. */
+typedef struct {
+    spinlock_t lock;                /* Protects everything below. */
+    uint8_t *buf;                   /* PIPE_SIZE bytes. */
+    uint32_t head;                  /* Bytes written. */
+    uint32_t tail;                  /* Bytes read. */
+    uint32_t readers;               /* Open read ends. */
+    uint32_t writers;               /* Open write ends. */
+    pipe_reader_t *direct;          /* Reader waiting for a direct copy. */
+    wait_queue_head_t rwait;        /* Readers waiting for data. */
+    wait_queue_head_t wwait;        /* Writers waiting for space. */
+} pipe_t;
+
+
+pipe_t *pipe_alloc(void);
+void pipe_free(pipe_t *pipe);
+void pipe_release(pipe_t *pipe, uint32_t mode);
+
+int32_t pipe_open(const int8_t *fname);
+int32_t pipe_close(int32_t fd);
+int32_t pipe_read(int32_t fd, void *buf, int32_t nbytes);
+int32_t pipe_write(int32_t fd, const void *buf, int32_t nbytes);
+uint32_t pipe_poll(int32_t fd, struct poll_table *pt);
+
+
+#endif /* _PIPE_H_ */
@@ -0,0 +1,46 @@
+#ifndef _POLL_H_
+#define _POLL_H_
+
+#include <types.h>
+#include <list.h>
+#include <spinlock.h>
+#include <pro/wait.h>
+#include <vfs/file.h>
+
+#define POLL_WAITS      2           /* Wait queues a file registers on at most. */
+
+
+struct thread;
+
+/* One file descriptor to poll, as laid out in user memory. */
+typedef struct {
+    int32_t fd;                     /* File descriptor, ignored if negative. */
+    int16_t events;                 /* Events to wait for. */
+    int16_t revents;                /* Events that happened, set by poll. */
+} pollfd_t;
+
+/* The poller on one wait queue of a file. */
+typedef struct {
+    wait_queue_t wait;              /* Entry on the queue. */
+    wait_queue_head_t *head;        /* The queue. */
+    spinlock_t *lock;               /* Lock of the object the queue belongs to. */
+} poll_entry_t;
+
+/* The wait queues a poller sleeps on, filled by the poll operations of
+ * the files. Lives on the poller's kernel stack. */
+typedef struct poll_table {
+    struct thread *task;            /* The poller. */
+    poll_entry_t *entries;          /* POLL_WAITS for each file descriptor. */
+    uint32_t n;                     /* Entries in use. */
+    uint32_t max;                   /* Size of entries. */
+    list_head node;                 /* Node in the list of pollers with a timeout. */
+    uint32_t expires;               /* sys_ticks when the timeout runs out. */
+} poll_table_t;
+
+
+void poll_wait(wait_queue_head_t *q, spinlock_t *lock, poll_table_t *pt);
+void poll_timeout(void);
+int32_t do_poll(pollfd_t *fds, uint32_t nfds, int32_t timeout);
+
+
+#endif /* _POLL_H_ */
@@ -2,20 +2,51 @@
 #define _VFS_H_
 
 
-#define OPEN_MAX    8               /* Each task can have up to 8 open files. */
+#define OPEN_MAX    1024            /* Most file descriptors of a task. */
+#define NR_OPEN_DEFAULT 32          /* File descriptors of a new table (one bitmap word). */
 #define stdin       0               /* Standard input from the terminal. */
 #define stdout      1               /* Standard output to the terminal. */
+#define IOV_MAX     64              /* Most segments in one readv or writev. */
+
+#define SEEK_SET    0               /* lseek from the start of the file */
+#define SEEK_CUR    1               /* lseek from the file pointer */
+#define SEEK_END    2               /* lseek from the end of the file */
 
 #include <vfs/file.h>
+#include <spinlock.h>
 
 
 typedef struct {
     uint32_t count;         /* Number of processes sharing this table */
-    uint32_t max_fd;        /* Current maximun number of file objects */
-    file_t fd[OPEN_MAX];    /* Pointers to array of file object pointers */
+    uint32_t max_fd;        /* Current size of fd and open_fds, a multiple of 32 up to OPEN_MAX */
+    rwlock_t file_lock;     /* Lookups read, open and close write (the table is shared by threads) */
+    file_t **fd;            /* Open file of each descriptor, NULL if it is free */
+    uint32_t *open_fds;     /* Bitmap of the descriptors in use */
+    file_t *fd_array[NR_OPEN_DEFAULT];              /* fd of a small table */
+    uint32_t open_fds_init[NR_OPEN_DEFAULT / 32];   /* open_fds of a small table */
 } files;
 
 
+/* A record of getdents, records follow each other at d_reclen bytes. */
+typedef struct {
+    uint32_t d_ino;         /* Inode of the file, 0 for a device */
+    uint32_t d_size;        /* Size of the file in bytes */
+    uint16_t d_reclen;      /* Length of this record, a multiple of 4 */
+    uint8_t  d_type;        /* file_type_t of the file */
+    int8_t   d_name[1];     /* Name, '\0' terminated, up to NAMESIZE bytes */
+} dirent_t;
+
+#define DIRENT_NAME         11      /* Offset of d_name in a record */
+#define DIRENT_LEN(len)     ((DIRENT_NAME + (len) + 1 + 3) & ~3)
+
+
+/* One buffer of a readv or writev. */
+typedef struct {
+    void *iov_base;         /* Start of the buffer, in user memory */
+    uint32_t iov_len;       /* Size of the buffer in bytes */
+} iovec_t;
+
+
 int32_t file_open(const int8_t *fname);
 int32_t file_close(int32_t fd);
 int32_t file_read(int32_t fd, void *buf, int32_t nbytes);
@@ -24,11 +55,41 @@ int32_t directory_open(const int8_t *fname);
 int32_t directory_close(int32_t fd);
 int32_t directory_read(int32_t fd, void *buf, int32_t nbytes);
 int32_t directory_write(int32_t fd, const void *buf, int32_t nbytes);
+int32_t file_lseek(int32_t fd, int32_t offset, int32_t whence);
+int32_t directory_lseek(int32_t fd, int32_t offset, int32_t whence);
 int32_t do_open(const int8_t *filename);
 int32_t do_close(int32_t fd);
 int32_t do_read(int32_t fd, void *buf, uint32_t nbytes);
 int32_t do_write(int32_t fd, const void *buf, uint32_t nbytes);
-void fdcopy(void);
+int32_t do_lseek(int32_t fd, int32_t offset, int32_t whence);
+int32_t do_pread(int32_t fd, const iovec_t *iov, int32_t offset);
+int32_t do_pwrite(int32_t fd, const iovec_t *iov, int32_t offset);
+int32_t do_readv(int32_t fd, const iovec_t *iov, int32_t iovcnt);
+int32_t do_writev(int32_t fd, const iovec_t *iov, int32_t iovcnt);
+int32_t do_pipe(int32_t *fds);
+int32_t do_dup2(int32_t oldfd, int32_t newfd);
+int32_t do_creat(const int8_t *filename);
+int32_t do_unlink(const int8_t *filename);
+int32_t do_mkdir(const int8_t *pathname);
+int32_t do_rmdir(const int8_t *pathname);
+int32_t do_chdir(const int8_t *pathname);
+int32_t do_getcwd(int8_t *buf, uint32_t size);
+int32_t do_ftruncate(int32_t fd, int32_t length);
+int32_t do_mmap_file(int32_t fd, uint32_t offset, uint32_t length);
+int32_t do_sync(void);
+int32_t do_dup(int32_t oldfd);
+int32_t do_ioctl(int32_t fd, uint32_t cmd, uint32_t arg);
+int32_t do_getdents(int32_t fd, dirent_t *dirp, uint32_t count);
+int32_t do_stat(const int8_t *pathname, stat_t *st);
+int32_t do_fstat(int32_t fd, stat_t *st);
+files *copy_files(files *src);
+void files_init(files *fds);
+file_t *fget(int32_t fd);
+void fput(file_t *file);
+file_t *fcheck(files *fds, int32_t fd);
+file_t *fd_file(int32_t fd);
+file_t *fd_uninstall(int32_t fd);
+int32_t fd_dup(int32_t oldfd, int32_t newfd);
 
 
 #endif /* _VFS_H_ */
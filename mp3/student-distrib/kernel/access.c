@@ -16,6 +16,8 @@
  * @param to : dest process
  */
 void __umap(thread_t *from, thread_t *to) {
+    if (from->vm == to->vm)     /* threads of the same program */
+        return;
     if (from != init)     /* only unmap if it's not the init process */
         user_mem_unmap(from);
     if (to != init)
@@ -26,7 +28,8 @@ void __umap(thread_t *from, thread_t *to) {
 int _user_mem_mmap(vm_area_t* vm) {
     int va, rtn = 0, i = 0;
     for(va = vm->vmstart; va < vm->vmend; va += PAGE_SIZE) {
-        rtn += mmap(va, ADDR_TO_PTE(vm->mmap[i]), PAGE_SIZE, GETBIT_12(vm->mmap[i]));
+        if(vm->mmap[i] & PTE_PRESENT)   /* file pages are mapped on the first fault */
+            rtn += mmap(va, ADDR_TO_PTE(vm->mmap[i]), PAGE_SIZE, GETBIT_12(vm->mmap[i]));
         i ++;
     }  
     return rtn;
@@ -37,9 +40,9 @@ void create_vm(thread_t* t)
 {
     int rtn = 0, length;
     vm_area_t* area;
-    if(t->vm.size == 0) {
-        t->vm.size = 1;
-        area = t->vm.map_list;
+    if(t->vm->size == 0) {
+        t->vm->size = 1;
+        area = t->vm->map_list;
 
         while(area != 0) {
             length = area->vmend - area->vmstart;
@@ -61,7 +64,7 @@ void free_vm(thread_t* t)
     vm_area_t* area, *temp;
     int length;
 
-    area = t->vm.map_list;
+    area = t->vm->map_list;
     while(area != 0) {
         length = area->vmend - area->vmstart;
         vmdealloc(area, length, 0);
@@ -80,12 +83,12 @@ void free_vm(thread_t* t)
 void user_mem_map(thread_t* t) {
     int rtn = 0;
     vm_area_t* area;
-    if(t->vm.size == 0) {
+    if(t->vm->size == 0) {
         create_vm(t);
         return;
     }
 
-    area = t->vm.map_list;
+    area = t->vm->map_list;
     while(area != 0) {
         rtn += _user_mem_mmap(area);
         area = area->next;
@@ -117,7 +120,7 @@ void user_mem_map(thread_t* t) {
  */
 void user_mem_unmap(thread_t* t) {
     int rtn;
-    vm_area_t *area = t->vm.map_list;
+    vm_area_t *area = t->vm->map_list;
     while(area != 0){
         rtn = freemap(area->vmstart, area->vmend - area->vmstart);
         area = area->next;
@@ -20,6 +20,11 @@
  * multi-tasking CPU described above.  In practice, the virtual runtime of a task
  * is its actual runtime normalized to the total number of running tasks.
  * 
+ * Each CPU has its own run queues and picks its tasks from them. A new
+ * task goes to the CPU with the fewest runnable tasks, and every
+ * BALANCE_TICKS a CPU that has at least two more tasks than another one
+ * pushes one of its queued tasks over there (load_balance()).
+ * 
  * @reference:
  * Operating Systems: Three Easy Pieces by Remzi H. Arpaci-Dusseau and Andrea C. Arpaci-Dusseau.
  * https://pages.cs.wisc.edu/~remzi/OSTEP/cpu-sched-lottery.pdf
@@ -45,9 +50,14 @@
  */
 
 #include <pro/cfs.h>
+#include <pro/rt.h>
 #include <pro/process.h>
+#include <boot/page.h>
 #include <access.h>
 #include <kmalloc.h>
+#include <boot/smp.h>
+#include <drivers/time.h>
+#include <spinlock.h>
 #include <lib.h>
 
 /*
@@ -95,37 +105,56 @@ const uint32_t sched_prio_to_wmult[40] = {
 };
 
 
-/* the running queue containing all runable threads */
-cfs_rq *rq;
+/* the root run queues of each CPU, containing all its runnable threads */
+cfs_rq runqueues[NR_CPUS];
+
+/* time clock in nanosecond, advanced by the timer of the BSP */
+uint64_t sched_clock;
+
+/* protects the run queues (CFS, groups and real-time) of every CPU and
+ * the scheduler state of every task. The scheduler always runs under 
+ * the kernel lock (smp.c), so one lock for all CPUs costs nothing */
+DEFINE_SPINLOCK(rq_lock);
 
 
-static thread_t *pick_next_task(sched_t *curr);
-static sched_t *pick_next_entity(void);
+static thread_t *pick_next_task(thread_t *prev);
+static sched_t *pick_next_entity(cfs_rq *q);
+static void set_next_entity(cfs_rq *q, sched_t *s);
 static void put_prev_task(sched_t *prev);
 static void dequeue_task(thread_t *prev);
-static void dequeue_entity(sched_t *prev);
-static void __dequeue_entity(sched_t *s);
-// static void enqueue_task(thread_t *new, int8_t wakeup);
-// static void enqueue_entity(sched_t *s, int8_t wakeup);
-static void __enqueue_entity(sched_t *s);
+static void dequeue_entity(cfs_rq *q, sched_t *prev);
+static void __dequeue_entity(cfs_rq *q, sched_t *s);
+static void enqueue_entity(cfs_rq *q, sched_t *s, int8_t wakeup);
+static void __enqueue_entity(cfs_rq *q, sched_t *s);
 static uint64_t sched_key(sched_t *s);
 static int32_t check_preempt_new(sched_t *curr, sched_t *new);
-static int32_t check_preempt_tick(sched_t *curr);
-static void update_curr(void);
-static void update_min_vruntime(void);
+static int32_t check_preempt_tick(cfs_rq *q, sched_t *curr);
+static sched_t *curr_entity(cfs_rq *root);
+static void find_matching_se(sched_t **se, sched_t **pse);
+static inline int32_t sched_depth(sched_t *s);
+static void update_curr(cfs_rq *q);
+static void update_min_vruntime(cfs_rq *q);
 static inline uint64_t calc_delta_vruntime(uint64_t delta, sched_t *s);
 static uint64_t __calc_delta_vruntime(uint64_t delta, uint32_t weight, weight_t *load);
 static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift);
 static inline uint64_t max_vruntime(uint64_t min_vruntime, uint64_t vruntime);
 static inline uint64_t min_vruntime(uint64_t min_vruntime, uint64_t vruntime);
 static inline void set_load_weight(sched_t *s, int32_t nice);
-static void place_entity(sched_t *s, int8_t new_task);
+static void reweight_entity(sched_t *s, int32_t nice);
+static void place_entity(cfs_rq *q, sched_t *s, int8_t new_task);
 static uint64_t vtimeslice(sched_t *s);
 static uint64_t timeslice(sched_t *s);
 static uint64_t sched_period(uint32_t nr_running);
 static inline void add_load(weight_t *from, weight_t *to);
 static inline void sub_load(weight_t *from, weight_t *to);
 static inline int32_t nice_to_index(int32_t nice);
+static void init_cfs_rq(cfs_rq *q);
+static void init_idle(thread_t *t, uint32_t cpu);
+static void set_task_rq(thread_t *task);
+static uint32_t select_task_cpu(thread_t *task);
+static thread_t *find_migration_task(uint32_t cpu);
+static void migrate_task(thread_t *t, uint32_t dest);
+
 
 
 /**
@@ -136,18 +165,19 @@ void sched_init(void) {
     /* allocate memory spaces for kernel threads */
     process_t *idlep = (process_t *) alloc_kstack();
     process_t *initp = (process_t *) alloc_kstack();
+    uint32_t i;
 
     /* set up process 0 */
     idle = &idlep->thread;
-    idle->pid = 0;
+    init_idle(idle, 0);
     idle->state = RUNNABLE;
-    idle->parent = NULL;
-    idle->kthread = 1;
-    idle->argc = 1;
-    idle->argv = kmalloc(sizeof(int8_t*));
-    idle->argv[0] = kmalloc(5);
-    strcpy(idle->argv[0], IDLE);
-    idle->context = kmalloc(sizeof(context_t));
+
+    /* the first switch to process 0 starts swapper() on its own stack,
+     * inside the kernel lock like any task switched to */
+    idle->context->eip = (uint32_t)swapper;
+    idle->context->esp = get_esp0(idle);
+    idle->context->ebp = 0;
+    idle->lock_depth = 1;
     
     /* set up process 1 */
     init = &initp->thread;
@@ -159,11 +189,15 @@ void sched_init(void) {
     init->max_children = MAXCHILDREN;
     init->nice = NICE_INIT;
     init->kthread = 1;
-    init->argc = 1;
-    init->argv = kmalloc(sizeof(int8_t*));
-    init->argv[0] = kmalloc(5);
-    strcpy(init->argv[0], INIT);
+    init->cwd = ROOT_INO;
+    init_waitqueue_head(&init->wait_chldexit);
+    strcpy(init->comm, INIT);
+    init->arg_start = init->arg_end = 0;
+    init->env_start = init->env_end = 0;
+    flush_signal_handlers(init);
     init->context = kmalloc(sizeof(context_t));
+    init->cpu = 0;
+    init->lock_depth = 0;
 
     /* create console queue */
     consoles = kmalloc(NTERMINAL * sizeof(console_t));
@@ -173,18 +207,37 @@ void sched_init(void) {
     task_queue.next = &task_queue;
     task_queue.prev = &task_queue;
 
-    /* create run queue */
-    rq = kmalloc(sizeof(cfs_rq));
-    rq->nr_running = 0;
-    rq->current = NULL;
-    rq->left_most = NULL;
-    rq->rb_tree.rb_node = NULL;
+    /* create the run queues of each CPU */
+    for (i = 0; i < ncpus; ++i) {
+        init_cfs_rq(cpu_rq(i));
+        init_rt_rq(cpu_rt_rq(i));
+    }
+    sched_clock = 0;
+
+    /* the APs already run their process 0 (ap_start) */
+    for (i = 1; i < ncpus; ++i)
+        init_idle(cpus[i].idle, i);
+
+    cpus[0].idle = idle;
+    cpus[0].curr = init;
     
+    /* kernel threads are scheduled on the root run queue */
+    memset(&init->sched_info, 0, sizeof(sched_t));
+    init->sched_info.cfs_rq = cpu_rq(0);
+    set_load_weight(&init->sched_info, init->nice);
+    init->policy = SCHED_NORMAL;
+    init->rt_priority = 0;
+    init->rt_info.on_rq = 0;
+
+    /* kernel threads never use the FPU */
+    init->fpu = NULL;
+    init->fpu_buf = NULL;
+    init->used_math = 0;
 
     /* add init process to the run queue */
     // sched_fork(init);
 
-    rq->min_vruntime = init->sched_info.vruntime;
+    cpu_rq(0)->min_vruntime = init->sched_info.vruntime;
 
     /* start running init */
     init->context->esp = get_esp0(init);
@@ -194,14 +247,145 @@ void sched_init(void) {
                 : [init_esp] "rm"(init->context->esp)
                 : "memory" 
     );
-    rq->current = &init->sched_info;
+    cpu_rq(0)->current = &init->sched_info;
     init->state = RUNNING;
+
+    /* the APs start picking tasks too */
+    smp_start();
     
     /* init should be the only process running so go to its task */
     init_task();
 }
 
 
+/**
+ * @brief set up process 0 of a CPU: it is not on the run queues, 
+ * and runs swapper() when the CPU has no other task to run
+ *
+ * @param t : idle task
+ * @param cpu : its CPU
+ */
+static void init_idle(thread_t *t, uint32_t cpu) {
+    t->pid = 0;
+    t->parent = NULL;
+    t->kthread = 1;
+    t->cwd = ROOT_INO;
+    init_waitqueue_head(&t->wait_chldexit);
+    t->flag = 0;
+    t->console_id = NO_CONSOLE;
+    t->terminal = NULL;
+    t->fds = NULL;
+    t->vm = vm_alloc();
+    t->arg_start = t->arg_end = 0;
+    t->env_start = t->env_end = 0;
+    strcpy(t->comm, IDLE);
+    t->context = kmalloc(sizeof(context_t));
+    t->cpu = cpu;
+
+    memset(&t->sched_info, 0, sizeof(sched_t));
+    t->sched_info.cfs_rq = cpu_rq(cpu);
+    t->policy = SCHED_NORMAL;
+    t->rt_priority = 0;
+    t->rt_info.on_rq = 0;
+
+    /* kernel threads never use the FPU */
+    t->fpu = NULL;
+    t->fpu_buf = NULL;
+    t->used_math = 0;
+}
+
+
+/**
+ * @brief create a task group: on each CPU, a group run queue with a 
+ * sched entity that represents the whole group on the root run queue. 
+ * Every group has the weight of a nice 0 task, so CPU time is first 
+ * split equally between groups and then between the tasks inside each 
+ * group.
+ *
+ * @return task_group_t* : the new group, NULL if out of memory
+ */
+task_group_t *sched_create_group(void) {
+    task_group_t *tg;
+    sched_t *se;
+    uint32_t i;
+
+    if (!(tg = kmalloc(sizeof(task_group_t))))
+        return NULL;
+
+    for (i = 0; i < ncpus; ++i) {
+        init_cfs_rq(&tg->cfs[i]);
+
+        se = &tg->se[i];
+        memset(se, 0, sizeof(sched_t));
+        set_load_weight(se, NICE_NORMAL);
+        se->vruntime = cpu_rq(i)->min_vruntime;
+        se->parent = NULL;
+        se->cfs_rq = cpu_rq(i);
+        se->my_q = &tg->cfs[i];
+    }
+
+    return tg;
+}
+
+
+/**
+ * @brief init an empty cfs run queue
+ *
+ * @param q : run queue
+ */
+static void init_cfs_rq(cfs_rq *q) {
+    q->nr_running = 0;
+    q->load.weight = 0;
+    q->load.inv_weight = 0;
+    q->min_vruntime = 0;
+    q->current = NULL;
+    q->left_most = NULL;
+    q->rb_tree.rb_node = NULL;
+}
+
+
+/**
+ * @brief attach a task to the run queue of its console's group,
+ * or to the root run queue if it has no console yet, on its CPU
+ *
+ * @param task : task info
+ */
+static void set_task_rq(thread_t *task) {
+    sched_t *s = &task->sched_info;
+
+    /* consoles are only valid after console_init sets current */
+    if (current && task->pid >= TASKSTART && task->console_id < NTERMINAL) {
+        s->parent = &consoles[task->console_id]->tg->se[task->cpu];
+        s->cfs_rq = s->parent->my_q;
+    } else {
+        s->parent = NULL;
+        s->cfs_rq = cpu_rq(task->cpu);
+    }
+}
+
+
+/**
+ * @brief choose the CPU of a new task: the one with the fewest runnable
+ * tasks. Kernel threads stay on the CPU of their parent, and so do 
+ * threads sharing an address space: a change to the mappings is only 
+ * made in the page directory of the CPU that makes it.
+ *
+ * @param task : new task, on the CPU of its parent
+ * @return uint32_t : the CPU
+ */
+static uint32_t select_task_cpu(thread_t *task) {
+    uint32_t i, best = task->cpu;
+
+    if (task->kthread || task->vm->count > 1)
+        return best;
+
+    for (i = 0; i < ncpus; ++i) {
+        if (cpus[i].nr_tasks < cpus[best].nr_tasks)
+            best = i;
+    }
+
+    return best;
+}
     
 
 /**
@@ -210,37 +394,154 @@ void sched_init(void) {
  * @param new : new task thread info
  */
 void sched_fork(thread_t *task) {
-    sched_t *curr = rq->current;
+    sched_t *curr;
     sched_t *new = &task->sched_info;
+    cfs_rq *q;
+    uint32_t flags;
+
+    spin_lock_irqsave(&rq_lock, flags);
+
+    /* kernel stacks are not cleared when allocated */
+    new->on_rq = 0;
+    new->my_q = NULL;
+    new->vruntime = 0;
+    new->sum_exec_time = 0;
+    new->prev_sum_exec_time = 0;
+    task->rt_info.on_rq = 0;
+    task->rt_info.time_slice = 0;
+
+    task->cpu = select_task_cpu(task);
+    set_task_rq(task);
+    q = new->cfs_rq;
+    curr = q->current;
 
     /* set weights */
     set_load_weight(new, task->nice);
 
     if (curr) {
         /* update vruntime of the current process */
-        update_curr();
+        update_curr(q);
 
         /* new task first get vruntime from its parent */
         new->vruntime = curr->vruntime;  
     }
 
     /* set vruntime for new task */
-    place_entity(new, 1);
+    place_entity(q, new, 1);
 
     /* new task become runnable */
     task->state = RUNNABLE;
+
+    spin_unlock_irqrestore(&rq_lock, flags);
 }
 
 
 void activate_task(thread_t *task) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&rq_lock, flags);
+
     /* enqueue task to runqueue */
     enqueue_task(task, 0);
+
+    /* a new task placed on another CPU may wake it up */
+    if (task->cpu != smp_processor_id())
+        wakeup_preempt(task);
+
+    spin_unlock_irqrestore(&rq_lock, flags);
 }
 
 
+/**
+ * @brief preempt the task running on the CPU of task if task
+ * should run first
+ *
+ * @param task : a task that became runnable
+ */
 void wakeup_preempt(thread_t *task) {
+    cpu_t *cpu = &cpus[task->cpu];
+    sched_t *se = curr_entity(cpu_rq(task->cpu));
+    sched_t *pse = &task->sched_info;
+
+    /* process 0 gives the CPU to any task */
+    if (cpu->curr == cpu->idle) {
+        resched_cpu(task->cpu);
+        return;
+    }
+
+    if (!se || se == pse) return;
+
+    /* compare the entities that compete on the same run queue */
+    find_matching_se(&se, &pse);
+
     /* check if reschedling is needed */
-    if (check_preempt_new(rq->current, &task->sched_info) == 1) task->flag = NEED_RESCHED;
+    if (check_preempt_new(se, pse) == 1) resched_cpu(task->cpu);
+}
+
+
+/**
+ * @brief set NEED_RESCHED on the task running on a CPU, 
+ * with an IPI if it is another CPU
+ *
+ * @param cpu : the CPU
+ */
+void resched_cpu(uint32_t cpu) {
+    cpus[cpu].curr->flag = NEED_RESCHED;
+    smp_send_reschedule(cpu);
+}
+
+
+/**
+ * @brief wake up a sleeping task: put it back on the run queue 
+ * and preempt the running task if it should run first
+ * 
+ * @param task : task to wake up
+ */
+void wake_up_process(thread_t *task) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&rq_lock, flags);
+
+    if (task->state == SLEEPING) {
+        task->state = RUNNABLE;
+        enqueue_task(task, 1);
+
+        /* real-time tasks are checked when they are queued */
+        if (!rt_task(task))
+            wakeup_preempt(task);
+    }
+
+    spin_unlock_irqrestore(&rq_lock, flags);
+}
+
+
+/**
+ * @brief make task the running entity of the run queues on its path
+ * without going through pick_next_task (used once at boot, when the
+ * first shell takes over from init)
+ *
+ * @param task : task info
+ */
+void set_curr_task(thread_t *task) {
+    sched_t *s = &task->sched_info;
+    uint32_t flags;
+
+    spin_lock_irqsave(&rq_lock, flags);
+
+    cpus[task->cpu].curr = task;
+
+    for_each_sched(s) {
+        if (s->cfs_rq->current == s) continue;
+
+        if (s->on_rq)
+            __dequeue_entity(s->cfs_rq, s);
+
+        s->cfs_rq->current = s;
+        s->exec_start = sched_clock;
+        s->prev_sum_exec_time = s->sum_exec_time;
+    }
+
+    spin_unlock_irqrestore(&rq_lock, flags);
 }
 
 
@@ -251,11 +552,16 @@ void wakeup_preempt(thread_t *task) {
  * @param to : wakeup process 
  */
 void sched_wakeup(thread_t *from, thread_t *task) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&rq_lock, flags);
     task->flag = WAKEUP;
     if (task == current->task) {
         task->state = RUNNABLE;
         enqueue_task(task, 1);
     }
+    spin_unlock_irqrestore(&rq_lock, flags);
+
     __schedule(from);
 }
 
@@ -267,8 +573,13 @@ void sched_wakeup(thread_t *from, thread_t *task) {
  * @param parent : its parent
  */
 void sched_exit(thread_t *child, thread_t *parent) {
-    child->sched_info.on_rq = 0;
+    uint32_t flags;
+
+    spin_lock_irqsave(&rq_lock, flags);
+    dequeue_task(child);
     child->state = EXITED;
+    spin_unlock_irqrestore(&rq_lock, flags);
+
     sched_wakeup(child, parent);
 }
 
@@ -279,8 +590,13 @@ void sched_exit(thread_t *child, thread_t *parent) {
  * @param task : task info 
  */
 void sched_sleep(thread_t *task) {
-    task->sched_info.on_rq = 0;
+    uint32_t flags;
+
+    spin_lock_irqsave(&rq_lock, flags);
+    dequeue_task(task);
     task->state = SLEEPING;
+    spin_unlock_irqrestore(&rq_lock, flags);
+
     __schedule(task);
 }
 
@@ -316,18 +632,14 @@ void schedule(void) {
  * 
  */
 void __schedule(thread_t *curr) {
-    sched_t *sched;
     thread_t *next;
     uint32_t flags;
 
     /* avoid preemption */
-    cli_and_save(flags);
-
-    /* get sched info of the current task */
-    sched = &curr->sched_info;
+    spin_lock_irqsave(&rq_lock, flags);
 
     /* find the next task to run */
-    next = pick_next_task(sched);
+    next = pick_next_task(curr);
 
     /* switch to the next task*/
 	if (likely(curr != next)) {
@@ -336,44 +648,59 @@ void __schedule(thread_t *curr) {
             curr->state = RUNNABLE;
 
         next->state = RUNNING;
-        rq->current = &next->sched_info;
+        cpus[curr->cpu].curr = next;
+
         /* update current console's task */
         if (curr->console_id == next->console_id)
             current->task = next;
+
+        /* next does not always resume in __schedule (new tasks start
+         * elsewhere), so the lock is dropped before the switch and
+         * only interrupts stay off */
+        spin_unlock(&rq_lock);
         context_switch(curr, next);
+        restore_flags(flags);
+        return;
     }
-    restore_flags(flags);
+    spin_unlock_irqrestore(&rq_lock, flags);
 }
 
 
 
 /**
- * @brief pick the task with the smallest vruntime
+ * @brief pick the highest priority real-time task if there is one,
+ * otherwise the task with the smallest vruntime, walking down
+ * from the root run queue through the group run queues
  * 
- * @param curr : the current running thread 
+ * @param prev : the current running thread 
  * @return sched_t* : the pointer to next runable thread
  */
-static thread_t *pick_next_task(sched_t *curr) {
+static thread_t *pick_next_task(thread_t *prev) {
     sched_t *next;
-
-    /* if no task can be scheduled */
-    if (unlikely(!rq->nr_running))
-        swapper();  /* pause the CPU */
-
-    /* store the current task back to the run queue only if curr is present */
-    put_prev_task(curr);
-    
-    /* get next sched entity */
-    next = pick_next_entity();
-
-    /* remove the picked task from the run queue */
-    __dequeue_entity(next);
-
-    rq->current = next;
-
-    next->exec_start = rq->clock;
-
-    next->prev_sum_exec_time = next->sum_exec_time;
+    thread_t *rt_next;
+    cpu_t *cpu = this_cpu();
+    cfs_rq *q = cpu_rq(cpu->id);
+
+    /* store the current task back to the run queue only if curr is present 
+     * (a real-time task is never the current entity of a cfs_rq) */
+    put_prev_task(&prev->sched_info);
+
+    /* real-time tasks always run before normal tasks */
+    if ((rt_next = pick_next_task_rt()))
+        return rt_next;
+
+    /* no normal task can run: the throttled real-time tasks get the 
+     * time CFS does not use, or process 0 halts the CPU until an 
+     * interrupt makes a task runnable (never halt here: rq_lock is held) */
+    if (unlikely(!q->nr_running))
+        return (rt_next = __pick_next_task_rt()) ? rt_next : cpu->idle;
+
+    /* pick the left most entity on each level until reaching a task */
+    do {
+        next = pick_next_entity(q);
+        set_next_entity(q, next);
+        q = next->my_q;
+    } while (q);
     
     /* return the thread */
     return task_of(next);
@@ -385,10 +712,11 @@ static thread_t *pick_next_task(sched_t *curr) {
  * and (if possible) cached the next next rbnode into rq->left_most
  * and its vruntime into rq->min_vruntime
  * 
+ * @param q : run queue
  * @return sched_t* : picked sched info
  */
-static sched_t *pick_next_entity(void) {
-    rb_node *__left_most = rq->left_most;
+static sched_t *pick_next_entity(cfs_rq *q) {
+    rb_node *__left_most = q->left_most;
 
     if (unlikely(!__left_most)) return NULL;
 
@@ -397,36 +725,80 @@ static sched_t *pick_next_entity(void) {
 
 
 /**
- * @brief restore task into runqueue
+ * @brief make s the running entity of q
+ *
+ * @param q : run queue
+ * @param s : sched info picked from q
+ */
+static void set_next_entity(cfs_rq *q, sched_t *s) {
+    /* remove the picked task from the run queue */
+    __dequeue_entity(q, s);
+
+    q->current = s;
+
+    s->exec_start = sched_clock;
+
+    s->prev_sum_exec_time = s->sum_exec_time;
+}
+
+
+/**
+ * @brief restore task (and the groups it runs in) into runqueue
  * 
  * @param prev : sched info
  */
 static void put_prev_task(sched_t *prev) {
+    cfs_rq *q;
 
-    /* If the prev process is still on the run queue, it is very likely 
-     * that the prev process is preempted. Before giving up the cpu, it 
-     * is necessary to update the process runtime and other information. 
-     */
-    if (prev->on_rq) {
-        update_curr();
-        /* cache the next entity which has the min_vruntime if have any */
-        __enqueue_entity(prev);
-    }
+    for_each_sched(prev) {
+        q = prev->cfs_rq;
+
+        if (q->current != prev) continue;
+
+        /* If the prev process is still on the run queue, it is very likely
+         * that the prev process is preempted. Before giving up the cpu, it
+         * is necessary to update the process runtime and other information.
+         */
+        if (prev->on_rq) {
+            update_curr(q);
+            /* cache the next entity which has the min_vruntime if have any */
+            __enqueue_entity(q, prev);
+        }
 
-    rq->current = NULL;
+        q->current = NULL;
+    }
 }
 
 
 /**
- * @brief remove a prev task from runqueue
+ * @brief remove a prev task from runqueue, and its groups once
+ * they have no runnable task left
  * 
  * @param new : prev task thread info
  */
 static void dequeue_task(thread_t *prev) {
     sched_t *s = &prev->sched_info;
-    dequeue_entity(s);
-    rq->current = NULL;
-    s->on_rq = 0;
+    cfs_rq *q;
+
+    if (rt_task(prev)) {
+        if (prev->rt_info.on_rq)
+            cpus[prev->cpu].nr_tasks--;
+        dequeue_task_rt(prev);
+        return;
+    }
+
+    /* the task has already left the run queue */
+    if (!s->on_rq) return;
+
+    cpus[prev->cpu].nr_tasks--;
+
+    for_each_sched(s) {
+        q = s->cfs_rq;
+        dequeue_entity(q, s);
+
+        /* the group still has runnable tasks: keep it queued */
+        if (q->load.weight) break;
+    }
 }
 
 
@@ -435,55 +807,76 @@ static void dequeue_task(thread_t *prev) {
  * It remove the scheduling entity (task) from the red-black 
  * tree and decrements the nr_running variable.
  * 
- * @param s : a scheduling entity
- * @param sleep : does the process just sleep?
+ * @param q : run queue
+ * @param prev : a scheduling entity
  */
-static void dequeue_entity(sched_t *prev) {
-    update_curr();
+static void dequeue_entity(cfs_rq *q, sched_t *prev) {
+    update_curr(q);
 
-    if (prev != rq->current)
-        __dequeue_entity(prev);
+    if (prev != q->current)
+        __dequeue_entity(q, prev);
+    else
+        q->current = NULL;
     
-    sub_load(&prev->load, &rq->load);
+    sub_load(&prev->load, &q->load);
+
+    prev->on_rq = 0;
 }
 
 
 /**
  * @brief remove s from rea-black tree
  * 
+ * @param q : run queue
  * @param s : sched info to remove
  */
-static void __dequeue_entity(sched_t *s) {
+static void __dequeue_entity(cfs_rq *q, sched_t *s) {
     /* s is the left most node */
-    if (rq->left_most == &s->node) {
+    if (q->left_most == &s->node) {
 
         /* get the second left most */
         rb_node *next = rb_next(&s->node);
 
         /* update new left most */
-        rq->left_most = next;
+        q->left_most = next;
     }
 
-    rq->nr_running--;
+    q->nr_running--;
 
     /* remove from red-black tree */
-    rb_erase(&s->node, &rq->rb_tree);
+    rb_erase(&s->node, &q->rb_tree);
 }
 
 
 
 /**
- * @brief add a new task (or wakeup task) to runqueue
+ * @brief add a new task (or wakeup task) to runqueue, and its
+ * groups if they were not runnable
  * 
  * @param new : new task thread info
  * @param wakeup : does the process just wake up?
  */
 void enqueue_task(thread_t *new, int8_t wakeup) {
     sched_t *s = &new->sched_info;
+
+    if (rt_task(new)) {
+        if (!new->rt_info.on_rq)
+            cpus[new->cpu].nr_tasks++;
+        enqueue_task_rt(new);
+        return;
+    }
+
+    if (!s->on_rq)
+        cpus[new->cpu].nr_tasks++;
     
-    if (s->on_rq) return;
+    for_each_sched(s) {
+        if (s->on_rq) break;
+
+        enqueue_entity(s->cfs_rq, s, wakeup);
 
-    enqueue_entity(s, wakeup);
+        /* an idle group comes back like a sleeping task */
+        wakeup = 1;
+    }
 }
 
 
@@ -492,34 +885,38 @@ void enqueue_task(thread_t *new, int8_t wakeup) {
  * It puts the scheduling entity (task) into the red-black 
  * tree and increments the nr_running variable.
  * 
+ * @param q : run queue
  * @param s : a scheduling entity
  * @param wakeup : does the task just wake up?
  */
-void enqueue_entity(sched_t *s, int8_t wakeup) {
-    update_curr();
+static void enqueue_entity(cfs_rq *q, sched_t *s, int8_t wakeup) {
+    update_curr(q);
 
     /* update sum of all runnable tasks' load weights */
-    add_load(&s->load, &rq->load);
+    add_load(&s->load, &q->load);
 
     if (wakeup) {    
         /* adjust vruntime */
-        place_entity(s, 0);
+        place_entity(q, s, 0);
     }
 
     /* add to run queue */
-    if (rq->current != s) {
-        __enqueue_entity(s);
+    if (q->current != s) {
+        __enqueue_entity(q, s);
     }
+
+    s->on_rq = 1;
 }
 
 
 /**
  * @brief add s to rea-black tree using its vruntime as key
  * 
+ * @param q : run queue
  * @param s : sched info to add
  */
-static void __enqueue_entity(sched_t *s) {
-    rb_node **link = &rq->rb_tree.rb_node;
+static void __enqueue_entity(cfs_rq *q, sched_t *s) {
+    rb_node **link = &q->rb_tree.rb_node;
     rb_node *parent = NULL;
     sched_t *entry;
     uint64_t key = sched_key(s);
@@ -541,13 +938,13 @@ static void __enqueue_entity(sched_t *s) {
 
     /* maintain a cache of leftmost tree entries which is frequently used */
     if (left_most) /* this node is now the left_most one */
-        rq->left_most = &s->node;
+        q->left_most = &s->node;
 
     /* insert new node, rebalance, and coloring the red-black tree */
     rb_link_node(&s->node, parent, link);
-    rb_insert_color(&s->node, &rq->rb_tree);
+    rb_insert_color(&s->node, &q->rb_tree);
     s->on_rq = 1;
-    rq->nr_running++;
+    q->nr_running++;
 }
 
 
@@ -583,21 +980,102 @@ static int32_t check_preempt_new(sched_t *curr, sched_t *new) {
 }
 
 
+/**
+ * @brief get the sched info of the running task by walking
+ * down the current entities from the root run queue
+ *
+ * @param root : root run queue of a CPU
+ * @return sched_t* : sched info of the running task, NULL if none
+ */
+static sched_t *curr_entity(cfs_rq *root) {
+    sched_t *s = root->current;
+
+    while (s && s->my_q)
+        s = s->my_q->current;
+
+    return s;
+}
+
+
+/**
+ * @brief move se and pse up to their ancestors that are
+ * queued on the same run queue, so they can be compared
+ *
+ * @param se : sched info of the running task
+ * @param pse : sched info of the task to check
+ */
+static void find_matching_se(sched_t **se, sched_t **pse) {
+    int32_t se_depth = sched_depth(*se);
+    int32_t pse_depth = sched_depth(*pse);
+
+    while (se_depth > pse_depth) {
+        se_depth--;
+        *se = (*se)->parent;
+    }
+
+    while (pse_depth > se_depth) {
+        pse_depth--;
+        *pse = (*pse)->parent;
+    }
+
+    while ((*se)->cfs_rq != (*pse)->cfs_rq) {
+        *se = (*se)->parent;
+        *pse = (*pse)->parent;
+    }
+}
+
+
+/**
+ * @brief number of groups above s
+ *
+ * @param s : sched info
+ * @return int32_t : depth (0 for the root run queue)
+ */
+static inline int32_t sched_depth(sched_t *s) {
+    int32_t depth = -1;
+
+    for_each_sched(s)
+        depth++;
+
+    return depth;
+}
+
+
 /**
  * @brief called everytime when a timer interrupt is fired
  * 
- * @param curr : current sched info
+ * @param curr : current task
  */
 void task_tick(thread_t *curr) {
     sched_t *sched = &curr->sched_info;
+    cfs_rq *q;
 
-    /* update vruntime of the current task */
-    update_curr();
-    
-    /* only try to reschedule when there are more than 1 runnable task */
-    if (rq->nr_running) {
-        if (check_preempt_tick(sched) == 1) {
+    /* refill the real-time runtime once per period */
+    update_rt_period();
+
+    /* process 0 is not on the run queues */
+    if (curr == cpus[curr->cpu].idle) {
+        if (cpu_rq(curr->cpu)->nr_running || __pick_next_task_rt())
             curr->flag = NEED_RESCHED;
+        return;
+    }
+
+    if (rt_task(curr)) {
+        task_tick_rt(curr);
+        return;
+    }
+
+    for_each_sched(sched) {
+        q = sched->cfs_rq;
+    
+        /* update vruntime of the current entity on this level */
+        update_curr(q);
+
+        /* only try to reschedule when there are more than 1 runnable entity */
+        if (q->nr_running) {
+            if (check_preempt_tick(q, sched) == 1) {
+                curr->flag = NEED_RESCHED;
+            }
         }
     }
 }
@@ -606,10 +1084,11 @@ void task_tick(thread_t *curr) {
 /**
  * @brief check if there is a task can preempt the curren task
  * 
+ * @param q : run queue of curr
  * @param curr : current task sched info
  * @return int32_t : 1 to reschedule, 0 otherwise
  */
-static int32_t check_preempt_tick(sched_t *curr) {
+static int32_t check_preempt_tick(cfs_rq *q, sched_t *curr) {
     uint64_t ideal = timeslice(curr);
     uint64_t delta = curr->sum_exec_time - curr->prev_sum_exec_time;
 
@@ -625,7 +1104,7 @@ static int32_t check_preempt_tick(sched_t *curr) {
     if (delta < MIN_GRANULARITY)
         return 0;
     
-	delta = curr->vruntime - rq->min_vruntime;
+	delta = curr->vruntime - q->min_vruntime;
  
     /* vruntime of the current process is still smaller than the vruntime 
      * of the leftmost scheduling entity in the red-black tree */
@@ -646,12 +1125,13 @@ static int32_t check_preempt_tick(sched_t *curr) {
 
 
 /**
- * @brief update the current process's vruntime 
+ * @brief update the vruntime of the current entity of q
  * 
+ * @param q : run queue
  */
-static void update_curr(void) {
-    sched_t *curr = rq->current;
-    uint64_t now = rq->clock;
+static void update_curr(cfs_rq *q) {
+    sched_t *curr = q->current;
+    uint64_t now = sched_clock;
     uint64_t delta;
 
     if (unlikely(!curr)) return;    
@@ -671,35 +1151,37 @@ static void update_curr(void) {
     curr->vruntime += calc_delta_vruntime(delta, curr);  
 
     /* update min_vruntime */
-    update_min_vruntime();
+    update_min_vruntime(q);
 }
 
 
 /**
  * @brief update current min_vruntime
  * 
+ * @param q : run queue
  */
-static void update_min_vruntime(void) {
+static void update_min_vruntime(cfs_rq *q) {
     sched_t *s;
-    uint64_t vruntime = rq->min_vruntime;
+    uint64_t vruntime = q->min_vruntime;
     
-    if (rq->current) vruntime = rq->current->vruntime;
+    if (q->current) vruntime = q->current->vruntime;
 
     /* if there is a cached left most node in the queue */
-    if (rq->left_most) {
+    if (q->left_most) {
         /* get the sched info of the node */
-        s = sched_of(rq->left_most);
+        s = sched_of(q->left_most);
 
         /* update min_vruntime */
-        if (!rq->current) vruntime = s->vruntime;
+        if (!q->current) vruntime = s->vruntime;
         else vruntime = min_vruntime(vruntime, s->vruntime);
     }
 
     /* ensure we never gain time by being placed backwards */
-    rq->min_vruntime = max_vruntime(rq->min_vruntime, vruntime);
+    q->min_vruntime = max_vruntime(q->min_vruntime, vruntime);
 }
 
 
+
 /**
  * @brief map real runtime to virtual runtime
  * 
@@ -825,14 +1307,110 @@ static inline void set_load_weight(sched_t *s, int32_t nice) {
 }
 
 
+/**
+ * @brief change the nice value of a task, and move its weight 
+ * on the runqueue from the old value to the new one
+ * 
+ * @param task : task to reweight
+ * @param nice : new nice value (clamped into [MIN_NICE, MAX_NICE])
+ */
+void set_user_nice(thread_t *task, int32_t nice) {
+    sched_t *s = &task->sched_info;
+    uint32_t flags;
+
+    if (nice < MIN_NICE) nice = MIN_NICE;
+    if (nice > MAX_NICE) nice = MAX_NICE;
+
+    spin_lock_irqsave(&rq_lock, flags);
+
+    task->nice = nice;
+    reweight_entity(s, nice);
+
+    /* a queued task that got heavier may now deserve the CPU */
+    if (s->on_rq)
+        wakeup_preempt(task);
+
+    spin_unlock_irqrestore(&rq_lock, flags);
+}
+
+
+/**
+ * @brief change the scheduling policy of a task, moving it
+ * between the real-time and the CFS run queues
+ * 
+ * @param task : task to change
+ * @param policy : SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+ * @param prio : real-time priority [1, 99], 0 for SCHED_NORMAL
+ */
+void sched_setscheduler(thread_t *task, int32_t policy, int32_t prio) {
+    uint32_t flags;
+    int8_t queued;
+
+    spin_lock_irqsave(&rq_lock, flags);
+
+    queued = rt_task(task) ? task->rt_info.on_rq : task->sched_info.on_rq;
+
+    if (queued)
+        dequeue_task(task);
+
+    task->policy = policy;
+    task->rt_priority = prio;
+    task->rt_info.time_slice = RR_TIMESLICE;
+
+    if (queued) {
+        /* a task coming back to CFS is placed like a waking task */
+        enqueue_task(task, 1);
+
+        /* the running task may not be the right one anymore */
+        resched_cpu(task->cpu);
+    }
+
+    spin_unlock_irqrestore(&rq_lock, flags);
+}
+
+
+/**
+ * @brief set a new load weight for s. If s is on the runqueue, it is 
+ * taken off the tree and its old weight is removed from its queue's load first, 
+ * so that the tree and the sum of weights never see a half-updated entity.
+ * 
+ * @param s : sched info
+ * @param nice : new nice value
+ */
+static void reweight_entity(sched_t *s, int32_t nice) {
+    cfs_rq *q = s->cfs_rq;
+
+    if (s->on_rq) {
+        /* charge the runtime so far with the old weight */
+        update_curr(q);
+
+        /* the running task is not kept in the tree */
+        if (q->current != s)
+            __dequeue_entity(q, s);
+
+        sub_load(&s->load, &q->load);
+    }
+
+    set_load_weight(s, nice);
+
+    if (s->on_rq) {
+        add_load(&s->load, &q->load);
+
+        if (q->current != s)
+            __enqueue_entity(q, s);
+    }
+}
+
+
 /**
  * @brief adjust vruntime for the task
  * 
+ * @param q : run queue s is placed on
  * @param s : sched info
  * @param new_task : is the task a new task?
  */
-static void place_entity(sched_t *s, int8_t new_task) {
-    uint64_t vruntime = rq->min_vruntime;
+static void place_entity(cfs_rq *q, sched_t *s, int8_t new_task) {
+    uint64_t vruntime = q->min_vruntime;
 
     if (new_task) {
         /* punish new task */
@@ -868,25 +1446,32 @@ static uint64_t vtimeslice(sched_t *s) {
  * @return uint64_t : real time slice
  */
 static uint64_t timeslice(sched_t *s) {
-	uint64_t slice = sched_period(rq->nr_running + !s->on_rq);
-    weight_t load = rq->load;
-
-    /* get the current sum of weights */
-    weight_t *rq_load = &rq->load;
+	uint64_t slice = sched_period(s->cfs_rq->nr_running + !s->on_rq);
+    weight_t load;
+    weight_t *rq_load;
+
+    /* a group entity gets its share of the period on the level above, 
+     * and the tasks in the group split that share between them */
+    for_each_sched(s) {
+        /* get the current sum of weights */
+        load = s->cfs_rq->load;
+        rq_load = &s->cfs_rq->load;
+
+        if (unlikely(!s->on_rq)) {
+            /* if (unlikely) s is not on the runqueue
+             * use a new load to include s */
+            add_load(&s->load, &load);
+            rq_load = &load;
+        }
 
-	if (unlikely(!s->on_rq)) {
-        /* if (unlikely) s is not on the runqueue
-         * use a new load to include s */
-        add_load(&s->load, &load);
-        rq_load = &load;
+        /* calculate the proportion of the weight of the scheduling entity se 
+         * to the weight of the entire ready queue, and then multiply it by 
+         * the scheduling cycle time to get the time that the current scheduling 
+         * entity should run. */
+        slice = __calc_delta_vruntime(slice, s->load.weight, rq_load);
     }
 
-    /* calculate the proportion of the weight of the scheduling entity se 
-     * to the weight of the entire ready queue, and then multiply it by 
-     * the scheduling cycle time to get the time that the current scheduling 
-     * entity should run. */
-    return __calc_delta_vruntime(slice, s->load.weight, rq_load);
-
+    return slice;
 }
 
 
@@ -917,7 +1502,9 @@ static uint64_t sched_period(uint32_t nr_running) {
  */
 static inline void add_load(weight_t *from, weight_t *to) {
     to->weight += from->weight;
-    to->inv_weight += from->inv_weight;
+
+    /* inverses do not add up: recompute it from the new sum */
+    to->inv_weight = WMULT_CONST / to->weight;
 }
 
 
@@ -929,7 +1516,7 @@ static inline void add_load(weight_t *from, weight_t *to) {
  */
 static inline void sub_load(weight_t *from, weight_t *to) {
     to->weight -= from->weight;
-    to->inv_weight -= from->inv_weight;
+    to->inv_weight = to->weight ? WMULT_CONST / to->weight : 0;
 }
 
 
@@ -945,6 +1532,92 @@ static inline int32_t nice_to_index(int32_t nice) {
 
 
 
+/**
+ * @brief called on every tick of a CPU with rq_lock held. Every 
+ * BALANCE_TICKS, a CPU with at least two runnable tasks more than 
+ * the least loaded CPU pushes one of its queued tasks over there.
+ * 
+ */
+void load_balance(void) {
+    cpu_t *cpu = this_cpu();
+    uint32_t i, dest = cpu->id;
+    thread_t *t;
+
+    if (sys_ticks - cpu->last_balance < BALANCE_TICKS) return;
+
+    cpu->last_balance = sys_ticks;
+
+    for (i = 0; i < ncpus; ++i) {
+        if (cpus[i].nr_tasks < cpus[dest].nr_tasks)
+            dest = i;
+    }
+
+    /* with one task more, moving it would only move the imbalance */
+    if (cpu->nr_tasks < cpus[dest].nr_tasks + 2) return;
+
+    if ((t = find_migration_task(cpu->id)))
+        migrate_task(t, dest);
+}
+
+
+/**
+ * @brief find a task that can leave a CPU: queued but not running,
+ * not a kernel thread and not sharing its address space (see 
+ * select_task_cpu()). The last task of a group's tree is taken, it 
+ * has the longest wait ahead of it on this CPU.
+ * 
+ * @param cpu : the CPU
+ * @return thread_t* : the task, NULL if there is none
+ */
+static thread_t *find_migration_task(uint32_t cpu) {
+    rb_node *node;
+    sched_t *s;
+    thread_t *t;
+    int i;
+
+    for (i = 0; i < NTERMINAL; ++i) {
+        node = rb_last(&consoles[i]->tg->cfs[cpu].rb_tree);
+
+        for (; node; node = rb_prev(node)) {
+            s = sched_of(node);
+            t = task_of(s);
+
+            if (!t->kthread && t->vm->count == 1)
+                return t;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief move a queued task to the run queues of another CPU. 
+ * vruntime is kept relative to min_vruntime, so the task keeps
+ * its place in line rather than its value.
+ * 
+ * @param t : queued task of this CPU
+ * @param dest : the other CPU
+ */
+static void migrate_task(thread_t *t, uint32_t dest) {
+    sched_t *s = &t->sched_info;
+
+    dequeue_task(t);
+    s->vruntime -= s->cfs_rq->min_vruntime;
+
+    /* its FPU registers may still be in this CPU */
+    fpu_migrate(t);
+
+    t->cpu = dest;
+    set_task_rq(t);
+
+    s->vruntime += s->cfs_rq->min_vruntime;
+    enqueue_task(t, 0);
+
+    wakeup_preempt(t);
+}
+
+
 /**
  * @brief halts the central processing unit (CPU) until 
  * the next external interrupt is fired.
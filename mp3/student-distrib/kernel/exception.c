@@ -5,6 +5,10 @@
 #include <boot/page.h>
 #include <io.h>
 #include <kmalloc.h>
+#include <boot/fpu.h>
+
+
+#define PF_PROT     0x1     /* page fault error code: protection violation */
 
 
 /* According to IA32 page 6, we define the name for first 20 exceptions */
@@ -45,142 +49,146 @@ static void exp_to_usr(int idx) {
 }
 
 
+/**
+ * @brief An exception in user mode sends a signal to the program, which
+ * kills it unless it set a handler. An exception in kernel mode while 
+ * running for a user program (a bad pointer passed to a system call) 
+ * kills that program, anywhere else the kernel cannot go on.
+ * 
+ * @param idx : The index of the exception.
+ * @param sig : The signal sent to a user program.
+ * @param regs : The registers saved on entry.
+ */
+static void exp_signal(int idx, int32_t sig, pt_regs_t *regs) {
+    thread_t *curr;
+
+    GETPRO(curr);
+
+    if (user_mode(regs)) {
+        force_sig(sig, curr);
+        return;
+    }
+
+    exp_to_usr(idx);
+    printf("eip: %x  eflags: %x\n", regs->eip, regs->eflags);
+
+    if (curr->pid < TASKSTART || curr->console_id == NO_CONSOLE)
+        panic("exception in kernel mode");
+
+    cli();
+    do_exit(256);
+}
+
+
 /* Exception handlers */
 
-void do_divide_error() {
-    exp_to_usr(DIVIDE_ERROR);
-    //printf("d");
+void do_divide_error(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(DIVIDE_ERROR, DIV_ZERO, regs);
 }
 
-void do_debug() {
-    exp_to_usr(DEBUG);
+void do_debug(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(DEBUG, SEGFAULT, regs);
 }
 
-void do_nmi() {
+void do_nmi(pt_regs_t *regs, uint32_t error_code) {
     exp_to_usr(NMI);
 }
 
-void do_int3() {
-    exp_to_usr(BREAKPOINT);
+void do_int3(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(BREAKPOINT, SEGFAULT, regs);
 }
 
-void do_overflow() {
-    exp_to_usr(OVERFLOW);
+void do_overflow(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(OVERFLOW, SEGFAULT, regs);
 }
 
-void do_bounds() {
-    exp_to_usr(BOUNDS_CHECK);
+void do_bounds(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(BOUNDS_CHECK, SEGFAULT, regs);
 }
 
-void do_invalid_op() {
-    exp_to_usr(INVALID_OPCODE);
+void do_invalid_op(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(INVALID_OPCODE, SEGFAULT, regs);
 }
 
-void do_device_not_available() {
-    exp_to_usr(DEVICE_NOT_AVAILIAVLE);
+/**
+ * @brief #NM is raised by the first FPU/SSE instruction after a
+ * context switch (CR0.TS is set), load the FPU registers of the
+ * current task and retry the instruction.
+ * 
+ */
+void do_device_not_available(pt_regs_t *regs, uint32_t error_code) {
+    if (math_state_restore() < 0)
+        exp_signal(DEVICE_NOT_AVAILIAVLE, SEGFAULT, regs);
 }
 
-void do_double_fault() {
+void do_double_fault(pt_regs_t *regs, uint32_t error_code) {
     exp_to_usr(DOUBLE_FAULT);
+    panic("double fault");
 }
 
-void do_coprocessor_segment_overrun() {
-    exp_to_usr(COPROCESSOR_OVERRUN);
+void do_coprocessor_segment_overrun(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(COPROCESSOR_OVERRUN, SEGFAULT, regs);
 }
 
-void do_invalid_TSS() {
-    exp_to_usr(INVALID_TSS);
+void do_invalid_TSS(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(INVALID_TSS, SEGFAULT, regs);
 }
 
-void do_segment_not_present() {
-    exp_to_usr(SEGMENT_NOT_PRESENT);
+void do_segment_not_present(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(SEGMENT_NOT_PRESENT, SEGFAULT, regs);
 }
 
-void do_stack_segment() {
-    exp_to_usr(STACK_SEGMENT_FAULT);
+void do_stack_segment(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(STACK_SEGMENT_FAULT, SEGFAULT, regs);
 }
 
-void do_general_protection() {
-    exp_to_usr(GENRAL_PROTECTION);
+void do_general_protection(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(GENRAL_PROTECTION, SEGFAULT, regs);
 }
 
 /**
  * @brief If the address of the page fault is within the allowed
- *        user stack range, expand the user stack by 4KB for the user.
+ *        user stack range, expand the user stack down to it.
+ *        Any other fault sends SEGFAULT to the program.
  * 
- * @param errcode   
- * @param addr      Address of page fault.
+ * @param regs      Registers saved on entry.
+ * @param errcode   Error code pushed by the CPU.
  */
 void 
-do_page_fault(int errcode, int addr) 
+do_page_fault(pt_regs_t *regs, uint32_t errcode) 
 {   
+    thread_t* t;
+    uint32_t addr;
 
-    if(addr < USER_STACK_ADDR && addr > (USER_STACK_ADDR - USER_STACK_MAX)) {
-        thread_t* t;
-        vm_area_t* area;
-        uint32_t pa, length, va;
-        uint32_t* temp;
-
-        GETPRO(t);
-        
-        // printf("handling page fault.. getting more stack!\n Your process = %d, ", t->pid);
-        // printf("your address: %x\n", addr);
-
-        area = t->vm.map_list;
-        while(area != 0) {
-            if(area->vmflag & VM_STACK) {
-                //TODO
-                //vmdealloc(area, (area->vmend-area->vmstart), 1);
-                length = (area->vmend - area->vmstart) / PAGE_SIZE + 1;
-
-                area->vmstart = area->vmstart - PAGE_SIZE;
-                pa = get_user_page(0);                      /* Alloc physical memory. */
-
-                temp = kmalloc(sizeof(uint32_t*) * length);
-                if(length > 1) {
-                    memcpy((char*)(temp + sizeof(uint32_t*)), (char*)area->mmap, sizeof(uint32_t*) * length);
-                    kfree(area->mmap);
-                }
-                
-                area->mmap = temp;
-
-                va = area->vmstart;
-                mmap(va, pa, PAGE_SIZE, PTE_RW | PTE_US);   /* Create mmap. */
-
-                area->mmap[0] = ADDR_TO_PTE(pa) | PTE_PRESENT | PTE_RW | PTE_US;
-                // printf("------------------------------------------------------------\n");
-                // printf("PAGE FAULT HANDLER: Succeed! Your new stack start: 0x%x.\n", area->vmstart);
-                // printf("------------------------------------------------------------\n");
-                // int i;
-                // for(i = 0; i < length; i++) {
-                //     printf("mmap: %x", area->mmap[i]);
-                // }
-                
-                return;
-            }
-            area = area->next;
-        }
-        printf("ERROR: NO STACK?\n");
-        while(1);
-    }
+    /* the faulting address */
+    asm volatile ("movl %%cr2, %0" : "=r"(addr));
+
+    GETPRO(t);
+
+    /* a page that is not present (not a protection fault) below the stack,
+     * or a page of a mapped file */
+    if (!(errcode & PF_PROT) && t->vm && (expand_stack(t->vm, addr & ~(PAGE_SIZE - 1)) == 0 ||
+                                          file_fault(t->vm, addr) == 0))
+        return;
 
-    printf("PAGE FAULT! ERROR ADDRESS: %x\n", addr);
-    while(1);
-    exp_to_usr(PAGE_FAULT);
+    if (!user_mode(regs))
+        printf("PAGE FAULT! ERROR ADDRESS: %x\n", addr);
+    exp_signal(PAGE_FAULT, SEGFAULT, regs);
 }
 
-void do_coprocessor_error() {
-    exp_to_usr(FLOATING_POINT_ERROR);
+void do_coprocessor_error(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(FLOATING_POINT_ERROR, DIV_ZERO, regs);
 }
 
-void do_alignment_check() {
-    exp_to_usr(ALIGHMENT_CHECK);
+void do_alignment_check(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(ALIGHMENT_CHECK, SEGFAULT, regs);
 }
 
-void do_machine_check() {
+void do_machine_check(pt_regs_t *regs, uint32_t error_code) {
     exp_to_usr(MACHINE_CHECK);
+    panic("machine check");
 }
 
-void do_simd_coprocessor_error() {
-    exp_to_usr(SIMD_FLOATING_POINT);
+void do_simd_coprocessor_error(pt_regs_t *regs, uint32_t error_code) {
+    exp_signal(SIMD_FLOATING_POINT, DIV_ZERO, regs);
 }
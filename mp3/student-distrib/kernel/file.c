@@ -1,32 +1,447 @@
+/**
+ * @file file.c
+ * @brief Open files and file descriptor tables.
+ * @overview:
+ * An open file (file_t) is made by open, creat, pipe and the rtc, and
+ * is shared: dup, dup2, fork and threads make more file descriptors for
+ * the same file, which then share its file pointer. f_count counts the
+ * descriptors, in any table, and the last fput() releases the object
+ * behind the file (the inode, the end of a pipe) and frees it.
+ *
+ * A table starts with NR_OPEN_DEFAULT descriptors in the table itself
+ * and doubles, up to OPEN_MAX, when a descriptor past its end is
+ * needed. A bitmap marks the descriptors in use, and the lowest free one
+ * is found one word at a time with bsf.
+ *
+ * @reference:
+ * Bovet, Daniel P. and Cesati, Marco, Understanding the Linux Kernel (Chapter 12, Files Associated with a Process)
+ *
+ */
+
 #include <vfs/file.h>
 #include <vfs/vfs.h>
+#include <vfs/pipe.h>
+#include <kmalloc.h>
+#include <errno.h>
 #include <lib.h>
 #include <pro/process.h>
 #include <io.h>
 
+
+static DEFINE_SPINLOCK(f_count_lock);   /* protects f_count of every file */
+
+#define fd_set(map, fd)     ((map)[(fd) >> 5] |= 1U << ((fd) & 31))
+#define fd_clear(map, fd)   ((map)[(fd) >> 5] &= ~(1U << ((fd) & 31)))
+
+
+static int32_t find_fd(files *fds, uint32_t start);
+static int32_t expand_files(files *fds, uint32_t nr);
+static void file_free(file_t *file);
+
+
+/* index of the lowest set bit, word must not be 0 */
+static inline uint32_t __ffs(uint32_t word) {
+    asm ("bsfl %1, %0" : "=r"(word) : "rm"(word));
+    return word;
+}
+
+
 /**
- * @brief Initialize the file object.
- * 
- * @param fd : A starting file descriptor. 
- * @param file : A file object that to be set.
+ * @brief Make a new open file and install it in the lowest free file
+ * descriptor from fd on.
+ *
+ * @param fd : A starting file descriptor.
+ * @param file : f_mode and private_data of the new file.
  * @param dentry : A descriptor entry taht will be included in the file object.
  * @param op : A file operation list that will be included in the file object.
- * @return int32_t : A file descriptor on success, -1 on failure.
+ * @return int32_t : A file descriptor on success, -EMFILE if the table
+ *                   is full, -ENOMEM if out of memory.
+ */
+int32_t file_init(int32_t fd, file_t *file, dentry_t *dentry, const file_op *op, thread_t *curr) {
+    file_t *f;
+
+    if (!curr->fds)
+        return -EBADF;
+
+    if (!(f = kmalloc(sizeof(file_t))))
+        return -ENOMEM;
+
+    memcpy((void*)(&(f->f_dentry)), (void*)dentry, sizeof(dentry_t));
+    f->f_op = op;
+    f->f_count = 1;
+    f->f_pos = 0;
+    f->f_mode = file->f_mode;
+    f->private_data = file->private_data;
+
+    /* another thread sharing the table could pick the same slot */
+    write_lock(&curr->fds->file_lock);
+
+    if ((fd = find_fd(curr->fds, fd)) >= 0) {
+        curr->fds->fd[fd] = f;
+        fd_set(curr->fds->open_fds, fd);
+    }
+
+    write_unlock(&curr->fds->file_lock);
+
+    if (fd < 0)
+        kfree(f);
+    return fd;
+}
+
+
+/**
+ * @brief The open file of a file descriptor of the current process,
+ * with a reference that keeps it open until fput().
+ *
+ * @param fd : A file descriptor.
+ * @return file_t* : The file, NULL if fd is not open.
+ */
+file_t *fget(int32_t fd) {
+    thread_t *curr;
+    file_t *file;
+    uint32_t flags;
+
+    GETPRO(curr);
+
+    if (!curr->fds)
+        return NULL;
+
+    read_lock(&curr->fds->file_lock);
+
+    if ((file = fcheck(curr->fds, fd))) {
+        spin_lock_irqsave(&f_count_lock, flags);
+        file->f_count++;
+        spin_unlock_irqrestore(&f_count_lock, flags);
+    }
+
+    read_unlock(&curr->fds->file_lock);
+    return file;
+}
+
+
+/**
+ * @brief Drop a reference to an open file, the last one releases the
+ * object behind it and frees the file.
+ *
+ * @param file : The file.
+ */
+void fput(file_t *file) {
+    uint32_t flags, count;
+
+    spin_lock_irqsave(&f_count_lock, flags);
+    count = --file->f_count;
+    spin_unlock_irqrestore(&f_count_lock, flags);
+
+    if (!count)
+        file_free(file);
+}
+
+
+/**
+ * @brief The open file of a file descriptor, without a reference, with
+ * the file_lock of the table held.
+ *
+ * @param fds : A file descriptor table.
+ * @param fd : A file descriptor.
+ * @return file_t* : The file, NULL if fd is not open.
+ */
+file_t *fcheck(files *fds, int32_t fd) {
+    if (fd < 0 || fd >= fds->max_fd)
+        return NULL;
+
+    return fds->fd[fd];
+}
+
+
+/**
+ * @brief The open file of a file descriptor of the current process, for
+ * the file operations, called while the system call holds a reference
+ * to the file.
+ *
+ * @param fd : A file descriptor.
+ * @return file_t* : The file, NULL if fd is not open.
+ */
+file_t *fd_file(int32_t fd) {
+    thread_t *curr;
+    file_t *file;
+
+    GETPRO(curr);
+
+    if (!curr->fds)
+        return NULL;
+
+    read_lock(&curr->fds->file_lock);
+    file = fcheck(curr->fds, fd);
+    read_unlock(&curr->fds->file_lock);
+
+    return file;
+}
+
+
+/**
+ * @brief Take an open file out of a file descriptor of the current
+ * process, the caller puts the reference of the descriptor.
+ *
+ * @param fd : A file descriptor.
+ * @return file_t* : The file, NULL if fd is not open.
+ */
+file_t *fd_uninstall(int32_t fd) {
+    thread_t *curr;
+    file_t *file;
+
+    GETPRO(curr);
+
+    if (!curr->fds)
+        return NULL;
+
+    write_lock(&curr->fds->file_lock);
+
+    if ((file = fcheck(curr->fds, fd))) {
+        curr->fds->fd[fd] = NULL;
+        fd_clear(curr->fds->open_fds, fd);
+    }
+
+    write_unlock(&curr->fds->file_lock);
+    return file;
+}
+
+
+/**
+ * @brief Make a file descriptor refer to the open file of another one, or
+ * to the lowest free descriptor if newfd is -1.
+ *
+ * @param oldfd : An open file descriptor.
+ * @param newfd : The file descriptor to set, closed first if it is open,
+ *                or -1.
+ * @return int32_t : The new file descriptor, -EBADF if oldfd is not open
+ *                   or newfd is out of range, -EMFILE if the table is full,
+ *                   -ENOMEM if out of memory.
  */
-int32_t file_init(int32_t fd, file_t *file, dentry_t *dentry, file_op *op, thread_t *curr) {
+int32_t fd_dup(int32_t oldfd, int32_t newfd) {
+    thread_t *curr;
+    file_t *file, *old = NULL;
+    uint32_t flags;
+    int32_t errno;
+
+    GETPRO(curr);
+
+    if (!curr->fds || newfd < -1 || newfd >= OPEN_MAX)
+        return -EBADF;
+
+    write_lock(&curr->fds->file_lock);
+
+    if (!(file = fcheck(curr->fds, oldfd))) {
+        write_unlock(&curr->fds->file_lock);
+        return -EBADF;
+    }
+
+    if (newfd == oldfd) {
+        write_unlock(&curr->fds->file_lock);
+        return newfd;
+    }
+
+    if (newfd < 0)
+        newfd = find_fd(curr->fds, 0);
+    else if (newfd >= curr->fds->max_fd && (errno = expand_files(curr->fds, newfd + 1)) < 0)
+        newfd = errno;
+
+    if (newfd >= 0) {
+        old = curr->fds->fd[newfd];
+        curr->fds->fd[newfd] = file;
+        fd_set(curr->fds->open_fds, newfd);
+
+        spin_lock_irqsave(&f_count_lock, flags);
+        file->f_count++;
+        spin_unlock_irqrestore(&f_count_lock, flags);
+    }
+
+    write_unlock(&curr->fds->file_lock);
+
+    /* the file replaced in newfd */
+    if (old)
+        fput(old);
+
+    return newfd;
+}
+
+
+/**
+ * @brief Set up an empty file descriptor table of NR_OPEN_DEFAULT
+ * descriptors, with one user.
+ *
+ * @param fds : The table.
+ */
+void files_init(files *fds) {
+    fds->count = 1;
+    fds->max_fd = NR_OPEN_DEFAULT;
+    fds->fd = fds->fd_array;
+    fds->open_fds = fds->open_fds_init;
+    memset(fds->fd_array, 0, sizeof(fds->fd_array));
+    memset(fds->open_fds_init, 0, sizeof(fds->open_fds_init));
+    rwlock_init(&fds->file_lock, "file_lock");
+}
+
+
+/**
+ * @brief copy a file descriptor table, the files in it get one more
+ * descriptor each and are shared with the source
+ *
+ * @param src : table to copy
+ * @return files* : the copy, NULL if out of memory
+ */
+files *copy_files(files *src) {
+    files *fds;
+    uint32_t flags;
     int i;
 
-    for (i = fd; i < OPEN_MAX; ++i) {
-        /* If there is an unused file object. */
-        if (!curr->fds->fd[i].f_count) {
-            /* Copy data to the new file object. */
-            memcpy((void*)(&(file->f_dentry)), (void*)dentry, sizeof(dentry_t));
-            file->f_op = *op;
-            file->f_count = 1;
-            file->f_pos = 0;
-            return i;   /* Return the file descriptor. */
+    if (!(fds = kmalloc(sizeof(files))))
+        return NULL;
+
+    files_init(fds);
+
+    read_lock(&src->file_lock);
+
+    if (src->max_fd > fds->max_fd && expand_files(fds, src->max_fd) < 0) {
+        read_unlock(&src->file_lock);
+        kfree(fds);
+        return NULL;
+    }
+
+    memcpy(fds->open_fds, src->open_fds, src->max_fd / 8);
+    memcpy(fds->fd, src->fd, src->max_fd * sizeof(file_t *));
+
+    spin_lock_irqsave(&f_count_lock, flags);
+    for (i = 0; i < src->max_fd; ++i) {
+        if (fds->fd[i])
+            fds->fd[i]->f_count++;
+    }
+    spin_unlock_irqrestore(&f_count_lock, flags);
+
+    read_unlock(&src->file_lock);
+    return fds;
+}
+
+
+/**
+ * @brief drop a reference to the file descriptor table,
+ * the last thread using it closes the files and frees it
+ *
+ * @param curr : thread giving up its table
+ */
+void put_files(thread_t *curr) {
+    files *fds = curr->fds;
+    uint32_t count;
+    int i;
+
+    if (fds) {
+        write_lock(&fds->file_lock);
+        count = --fds->count;
+        write_unlock(&fds->file_lock);
+
+        if (!count) {
+            for (i = 0; i < fds->max_fd; ++i) {
+                if (fds->fd[i])
+                    fput(fds->fd[i]);
+            }
+            if (fds->fd != fds->fd_array) {
+                kfree(fds->fd);
+                kfree(fds->open_fds);
+            }
+            kfree(fds);
         }
     }
-    
-    return -1;
+
+    curr->fds = NULL;
+}
+
+
+/**
+ * @brief The lowest free file descriptor from start on, the table grows
+ * if they are all in use. With the file_lock of the table held.
+ *
+ * @param fds : A file descriptor table.
+ * @param start : The lowest file descriptor to give.
+ * @return int32_t : The file descriptor, -EMFILE if there are OPEN_MAX
+ *                   already, -ENOMEM if the table cannot grow.
+ */
+static int32_t find_fd(files *fds, uint32_t start) {
+    uint32_t i, word;
+    int32_t errno;
+
+    for (i = start / 32; i < fds->max_fd / 32; ++i) {
+        word = ~fds->open_fds[i];
+        if (i == start / 32)
+            word &= ~0U << (start % 32);
+        if (word)
+            return i * 32 + __ffs(word);
+    }
+
+    if (start < fds->max_fd)
+        start = fds->max_fd;
+    if ((errno = expand_files(fds, start + 1)) < 0)
+        return errno;
+
+    return start;
+}
+
+
+/**
+ * @brief Grow a table to at least nr file descriptors, doubling its size.
+ * With the file_lock of the table held.
+ *
+ * @param fds : A file descriptor table.
+ * @param nr : The number of file descriptors needed.
+ * @return int32_t : 0 on success, -EMFILE if nr is over OPEN_MAX,
+ *                   -ENOMEM if out of memory.
+ */
+static int32_t expand_files(files *fds, uint32_t nr) {
+    uint32_t max = fds->max_fd;
+    uint32_t *open_fds;
+    file_t **fd;
+
+    if (nr <= max)
+        return 0;
+    if (nr > OPEN_MAX)
+        return -EMFILE;
+
+    while (max < nr)
+        max *= 2;
+
+    if (!(fd = kmalloc(max * sizeof(file_t *))))
+        return -ENOMEM;
+    if (!(open_fds = kmalloc(max / 8))) {
+        kfree(fd);
+        return -ENOMEM;
+    }
+
+    memcpy(fd, fds->fd, fds->max_fd * sizeof(file_t *));
+    memset(fd + fds->max_fd, 0, (max - fds->max_fd) * sizeof(file_t *));
+    memcpy(open_fds, fds->open_fds, fds->max_fd / 8);
+    memset((int8_t *)open_fds + fds->max_fd / 8, 0, (max - fds->max_fd) / 8);
+
+    if (fds->fd != fds->fd_array) {
+        kfree(fds->fd);
+        kfree(fds->open_fds);
+    }
+
+    fds->fd = fd;
+    fds->open_fds = open_fds;
+    fds->max_fd = max;
+    return 0;
+}
+
+
+/**
+ * @brief Release the object behind an open file that nobody refers to
+ * anymore, and free the file.
+ *
+ * @param file : The file.
+ */
+static void file_free(file_t *file) {
+    if (file->f_dentry.type == PIPE)
+        pipe_release(file->private_data, file->f_mode);
+    if (file->f_dentry.type == REGULAR)
+        fs_iput(file->f_dentry.inode);
+
+    kfree(file);
 }
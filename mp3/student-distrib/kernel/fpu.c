@@ -0,0 +1,297 @@
+/**
+ * @file fpu.c
+ * @brief Lazy x87/SSE context switching.
+ * @overview:
+ * The FPU and SSE registers are 512 bytes and most tasks never touch them,
+ * so they are not saved on every context switch. Instead the registers stay
+ * in the CPU for the last task that used them (fpu_owner), and the switch
+ * only sets CR0.TS when the next task is not the owner. The first FPU
+ * instruction of that task raises #NM, and math_state_restore() saves the
+ * owner's registers into its save area, loads the task's own registers,
+ * and makes it the new owner.
+ *
+ * Each CPU has its own FPU and its own owner (cpu_t.fpu_owner). A task
+ * moved to another CPU while its registers are live in the FPU of the
+ * old one has them saved first (fpu_migrate()).
+ *
+ * A task gets its save area on its first FPU instruction, a task that
+ * never uses the FPU costs nothing.
+ *
+ * The kernel itself does not use floating point.
+ *
+ * @reference:
+ * Intel 64 and IA-32 Architectures Software Developer's Manual, Vol. 3A
+ * (Section 13.4, Designing OS Facilities for Saving x87 FPU, SSE and Extended States
+ * on Task or Context Switches)
+ *
+ */
+
+#include <boot/fpu.h>
+#include <pro/process.h>
+#include <boot/smp.h>
+#include <kmalloc.h>
+#include <lib.h>
+#include <errno.h>
+
+
+static uint8_t has_fxsr;            /* does the CPU support FXSAVE/FXRSTOR? */
+
+
+static fpu_state_t *alloc_fpu_state(thread_t *t);
+static inline void fxsave(fpu_state_t *fpu);
+static inline void fxrstor(fpu_state_t *fpu);
+
+
+/**
+ * @brief enable the FPU and SSE, called once at boot on each CPU
+ *
+ */
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t cr0, cr4;
+
+    asm volatile("cpuid"
+                 : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                 : "a"(1));
+
+    has_fxsr = (edx & CPUID_FXSR) ? 1 : 0;
+
+    /* use the FPU instead of emulating it, report errors as #MF */
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP | CR0_NE;
+    asm volatile("movl %0, %%cr0" : : "r"(cr0));
+
+    /* tell the CPU we save SSE state with FXSAVE and handle #XF */
+    if (has_fxsr) {
+        asm volatile("movl %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_OSFXSR;
+        if (edx & CPUID_SSE)
+            cr4 |= CR4_OSXMMEXCPT;
+        asm volatile("movl %0, %%cr4" : : "r"(cr4));
+    }
+
+    asm volatile("fninit");
+
+    /* nobody owns the FPU yet */
+    stts();
+}
+
+
+/**
+ * @brief called on every context switch, trap the next FPU instruction
+ * unless next already has its registers in the FPU
+ *
+ * @param next : the task switched to
+ */
+void fpu_switch(thread_t *next) {
+    if (next == this_cpu()->fpu_owner)
+        clts();
+    else
+        stts();
+}
+
+
+/**
+ * @brief the #NM handler: give the FPU to the current task
+ *
+ * @return int32_t : 0 on success, -ENOMEM if the save area cannot be allocated
+ */
+int32_t math_state_restore(void) {
+    thread_t *curr, *owner;
+    uint32_t flags;
+
+    GETPRO(curr);
+
+    cli_and_save(flags);
+
+    owner = this_cpu()->fpu_owner;
+
+    if (!curr->fpu && !alloc_fpu_state(curr)) {
+        restore_flags(flags);
+        return -ENOMEM;
+    }
+
+    clts();
+
+    if (owner != curr) {
+        /* the registers still belong to someone else */
+        if (owner)
+            fxsave(owner->fpu);
+
+        if (curr->used_math) {
+            fxrstor(curr->fpu);
+        } else {
+            /* first FPU instruction of this program */
+            asm volatile("fninit");
+            if (has_fxsr) {
+                uint32_t mxcsr = MXCSR_DEFAULT;
+                asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+            }
+            curr->used_math = 1;
+        }
+
+        this_cpu()->fpu_owner = curr;
+    }
+
+    restore_flags(flags);
+    return 0;
+}
+
+
+/**
+ * @brief the child starts with a copy of the parent's FPU registers
+ *
+ * @param parent : current task
+ * @param child : new task
+ * @return int32_t : 0 on success, -ENOMEM on failure
+ */
+int32_t fpu_fork(thread_t *parent, thread_t *child) {
+    uint32_t flags;
+
+    child->fpu = NULL;
+    child->fpu_buf = NULL;
+    child->used_math = 0;
+
+    if (!parent->used_math)
+        return 0;
+
+    if (!alloc_fpu_state(child))
+        return -ENOMEM;
+
+    cli_and_save(flags);
+
+    if (this_cpu()->fpu_owner == parent) {
+        /* the parent's latest registers are in the FPU */
+        clts();
+        fxsave(child->fpu);
+        /* FNSAVE would reset the FPU, FXSAVE does not, keep the parent's copy live */
+        if (!has_fxsr) fxrstor(child->fpu);
+    } else {
+        memcpy(child->fpu, parent->fpu, sizeof(fpu_state_t));
+    }
+
+    child->used_math = 1;
+
+    restore_flags(flags);
+    return 0;
+}
+
+
+/**
+ * @brief a new program starts with a clean FPU
+ *
+ * @param curr : task calling execute
+ */
+void fpu_exec(thread_t *curr) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    curr->used_math = 0;
+
+    if (this_cpu()->fpu_owner == curr) {
+        this_cpu()->fpu_owner = NULL;
+        stts();
+    }
+
+    restore_flags(flags);
+}
+
+
+/**
+ * @brief free the save area of a task that is being freed
+ *
+ * @param t : task info
+ */
+void fpu_release(thread_t *t) {
+    uint32_t flags, i;
+
+    cli_and_save(flags);
+
+    /* the task may have last run on any CPU */
+    for (i = 0; i < ncpus; ++i) {
+        if (cpus[i].fpu_owner == t)
+            cpus[i].fpu_owner = NULL;
+    }
+
+    kfree(t->fpu_buf);
+    t->fpu_buf = NULL;
+    t->fpu = NULL;
+    t->used_math = 0;
+
+    restore_flags(flags);
+}
+
+
+/**
+ * @brief a task leaves this CPU for another one: save its registers
+ * if they are still in this FPU, the other CPU will load them from
+ * the save area on the task's next FPU instruction
+ *
+ * @param t : task being moved, not running
+ */
+void fpu_migrate(thread_t *t) {
+    cpu_t *cpu = this_cpu();
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    if (cpu->fpu_owner == t) {
+        /* t is not running, so TS is set */
+        clts();
+        fxsave(t->fpu);
+        cpu->fpu_owner = NULL;
+        stts();
+    }
+
+    restore_flags(flags);
+}
+
+
+/**
+ * @brief allocate the save area of a task, kmalloc gives no
+ * alignment guarantee so we round up inside a larger buffer
+ *
+ * @param t : task info
+ * @return fpu_state_t* : save area, NULL if out of memory
+ */
+static fpu_state_t *alloc_fpu_state(thread_t *t) {
+    uint32_t addr;
+
+    if (!(t->fpu_buf = kmalloc(sizeof(fpu_state_t) + FXSAVE_ALIGN - 1)))
+        return NULL;
+
+    addr = ((uint32_t)t->fpu_buf + FXSAVE_ALIGN - 1) & ~(FXSAVE_ALIGN - 1);
+    t->fpu = (fpu_state_t *)addr;
+
+    memset(t->fpu, 0, sizeof(fpu_state_t));
+
+    return t->fpu;
+}
+
+
+/**
+ * @brief save x87/MMX/SSE registers, FNSAVE on CPUs without FXSR
+ *
+ * @param fpu : 16-byte aligned save area
+ */
+static inline void fxsave(fpu_state_t *fpu) {
+    if (has_fxsr)
+        asm volatile("fxsave %0" : "=m"(*fpu));
+    else
+        asm volatile("fnsave %0; fwait" : "=m"(*fpu));
+}
+
+
+/**
+ * @brief load x87/MMX/SSE registers, FRSTOR on CPUs without FXSR
+ *
+ * @param fpu : 16-byte aligned save area
+ */
+static inline void fxrstor(fpu_state_t *fpu) {
+    if (has_fxsr)
+        asm volatile("fxrstor %0" : : "m"(*fpu));
+    else
+        asm volatile("frstor %0" : : "m"(*fpu));
+}
@@ -0,0 +1,157 @@
+/**
+ * @file futex.c
+ * @brief Fast user-space locking.
+ * @overview:
+ * A futex is an int in memory shared by the threads of a program. Locks
+ * are taken and released in user space with atomic instructions, and the
+ * kernel is only entered when a thread has to wait:
+ *
+ * FUTEX_WAIT puts the caller to sleep if the word still holds the value
+ * the caller saw, otherwise it returns -EAGAIN at once so the caller can
+ * try again. The check and the queueing are done under futex_lock, and
+ * interrupts stay off until the caller is asleep, so a FUTEX_WAKE cannot
+ * slip in between.
+ *
+ * FUTEX_WAKE wakes up at most val threads waiting on the same word.
+ *
+ * A futex is identified by its address space and user address.
+ *
+ * @reference:
+ * Drepper, Ulrich, Futexes Are Tricky
+ * https://www.akkadia.org/drepper/futex.pdf
+ *
+ */
+
+#include <pro/futex.h>
+#include <pro/process.h>
+#include <boot/page.h>
+#include <access.h>
+#include <spinlock.h>
+#include <errno.h>
+#include <lib.h>
+
+
+static LIST_HEAD(futex_queue);      /* threads sleeping on a futex */
+static DEFINE_SPINLOCK(futex_lock); /* protects futex_queue */
+
+
+static int32_t futex_wait(thread_t *curr, uint32_t uaddr, int32_t val);
+static int32_t futex_wake(thread_t *curr, uint32_t uaddr, int32_t nr);
+
+
+/**
+ * @brief futex service routine
+ *
+ * @param uaddr : user address of the futex word, 4-byte aligned
+ * @param op : FUTEX_WAIT or FUTEX_WAKE
+ * @param val : expected value for FUTEX_WAIT, max number of
+ * threads to wake up for FUTEX_WAKE
+ * @return int32_t : FUTEX_WAIT - 0 when woken up, -EINTR on a signal
+ *                   FUTEX_WAKE - number of threads woken up
+ *                   negative values denote an error condition
+ */
+int32_t do_futex(uint32_t uaddr, int32_t op, int32_t val) {
+    thread_t *curr;
+
+    GETPRO(curr);
+
+    /* the word must be in user memory */
+    if ((uaddr & 3) || uaddr < VIR_MEM_BEGIN || uaddr > USER_STACK_ADDR - sizeof(int32_t))
+        return -EFAULT;
+
+    switch (op) {
+    case FUTEX_WAIT:
+        return futex_wait(curr, uaddr, val);
+    case FUTEX_WAKE:
+        return futex_wake(curr, uaddr, val);
+    default:
+        return -EINVAL;
+    }
+}
+
+
+/**
+ * @brief sleep until woken up by FUTEX_WAKE, if *uaddr == val
+ *
+ * @param curr : current thread
+ * @param uaddr : user address of the futex word
+ * @param val : value the caller expects
+ * @return int32_t : 0 when woken up, -EAGAIN if *uaddr != val,
+ *                   -EINTR if a signal came first, -EFAULT if uaddr is
+ *                   not mapped
+ */
+static int32_t futex_wait(thread_t *curr, uint32_t uaddr, int32_t val) {
+    futex_q_t q;
+    uint32_t flags;
+
+    /* the word is read with futex_lock held, it must not fault */
+    if (!user_virt_to_phys(curr->vm, uaddr, VM_READ))
+        return -EFAULT;
+
+    spin_lock_irqsave(&futex_lock, flags);
+
+    if (*(volatile int32_t *)uaddr != val) {
+        spin_unlock_irqrestore(&futex_lock, flags);
+        return -EAGAIN;
+    }
+
+    q.task = curr;
+    q.vm = curr->vm;
+    q.uaddr = uaddr;
+    list_add_tail(&q.node, &futex_queue);
+
+    /* futex_wake clears q.task before waking us up */
+    while (q.task) {
+        /* a signal: leave the queue */
+        if (signal_pending(curr)) {
+            list_del(&q.node);
+            spin_unlock_irqrestore(&futex_lock, flags);
+            return -EINTR;
+        }
+
+        spin_unlock(&futex_lock);
+        curr->sigsleep = 1;
+        sched_sleep(curr);
+        curr->sigsleep = 0;
+        spin_lock(&futex_lock);
+    }
+
+    spin_unlock_irqrestore(&futex_lock, flags);
+    return 0;
+}
+
+
+/**
+ * @brief wake up at most nr threads sleeping on uaddr
+ *
+ * @param curr : current thread
+ * @param uaddr : user address of the futex word
+ * @param nr : max number of threads to wake up
+ * @return int32_t : number of threads woken up
+ */
+static int32_t futex_wake(thread_t *curr, uint32_t uaddr, int32_t nr) {
+    list_head *node, *next;
+    futex_q_t *q;
+    thread_t *task;
+    int32_t woken = 0;
+    uint32_t flags;
+
+    spin_lock_irqsave(&futex_lock, flags);
+
+    for (node = futex_queue.next; node != &futex_queue && woken < nr; node = next) {
+        next = node->next;
+        q = list_entry(node, futex_q_t, node);
+
+        if (q->vm != curr->vm || q->uaddr != uaddr)
+            continue;
+
+        list_del(&q->node);
+        task = q->task;
+        q->task = NULL;
+        wake_up_process(task);
+        woken++;
+    }
+
+    spin_unlock_irqrestore(&futex_lock, flags);
+    return woken;
+}
@@ -4,6 +4,7 @@
 #include <boot/exception.h>
 #include <boot/interrupt.h>
 #include <boot/syscall.h>
+#include <boot/smp.h>
 #include <lib.h>
 #include <io.h>
 
@@ -95,6 +96,30 @@ void trap_init() {
 }
 
 
+/**
+ * @brief Set up the SYSENTER entry point on this CPU, 
+ * if the CPU has one. int $0x80 keeps working either way.
+ * 
+ * @param tss : TSS of this CPU. SYSENTER does not switch to 
+ * the task's kernel stack like a gate does, so the entry stub 
+ * starts on the TSS and loads esp0 from it.
+ */
+void sysenter_init(tss_t *tss) {
+    uint32_t eax, ebx, ecx, edx;
+
+    asm volatile("cpuid"
+                 : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                 : "a"(1));
+
+    if (!(edx & CPUID_SEP))
+        return;
+
+    wrmsr(MSR_SYSENTER_CS, KERNEL_CS);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)tss);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)&sysenter_handler);
+}
+
+
 /**
  * @brief Initialize interrupt handlers 
  * from device drivers.
@@ -103,6 +128,10 @@ void intr_init() {
     set_intr_gate(TIMER_INTR, &timer_handler);
     set_intr_gate(KEYBOARD_INTR, &keyboard_handler);
     set_intr_gate(RTC_INTR, &rtc_handler);
+    set_intr_gate(ATA_PRIMARY_INTR, &ata_primary_handler);
+    set_intr_gate(ATA_SECONDARY_INTR, &ata_secondary_handler);
+    set_intr_gate(IPI_VECTOR, &ipi_handler);
+    set_intr_gate(SPURIOUS_VECTOR, &spurious_handler);
 }
 
 
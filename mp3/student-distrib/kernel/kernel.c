@@ -7,10 +7,16 @@
 #include <boot/page.h>
 #include <boot/idt.h>
 #include <boot/i8259.h>
+#include <boot/fpu.h>
+#include <boot/smp.h>
+#include <boot/syscall.h>
+#include <boot/vdso.h>
 #include <drivers/keyboard.h>
 #include <drivers/terminal.h>
 #include <drivers/rtc.h>
 #include <drivers/fs.h>
+#include <drivers/ata.h>
+#include <drivers/blkdev.h>
 #include <drivers/time.h>
 #include <drivers/vga.h>
 #include <vfs/vfs.h>
@@ -30,11 +36,38 @@
 #define CHECK_FLAG(flags, bit)   ((flags) & (1 << (bit)))
 
 
+/* Copy the value of the root= option of the command line (the disk to
+   mount the file system from, "root=hdb") into BUF of SIZE bytes.
+   Return BUF, or NULL if there is no such option. */
+static int8_t *root_option(multiboot_info_t *mbi, int8_t *buf, uint32_t size) {
+    const int8_t *cmdline, *p;
+    uint32_t n;
+
+    if (!CHECK_FLAG(mbi->flags, 2))
+        return NULL;
+
+    cmdline = (const int8_t *)mbi->cmdline;
+    for (p = cmdline; *p; ++p) {
+        /* an option starts the line or follows a space */
+        if ((p == cmdline || p[-1] == ' ') && !strncmp(p, "root=", 5)) {
+            p += 5;
+            for (n = 0; n + 1 < size && p[n] && p[n] != ' '; ++n)
+                buf[n] = p[n];
+            buf[n] = '\0';
+            return buf;
+        }
+    }
+
+    return NULL;
+}
+
+
 /* Check if MAGIC is valid and print the Multiboot information structure
    pointed by ADDR. */
 void entry(unsigned long magic, unsigned long addr) {
 
     multiboot_info_t *mbi;
+    int8_t root[8];
 
     /* Clear the screen. */
     clear();
@@ -154,15 +187,21 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Boot */
     idt_init();                     /* Initialize the IDT. */
     trap_init();                    /* Initialize the exception handlers for IDT. */
+    sysenter_init(&tss);            /* Fast system call entry */
     intr_init();                    /* Initialize the interrupt handlers for IDT. */
     i8259_init();                   /* Initialize the PIC */
+    fpu_init();                     /* Enable the FPU and SSE */
 
     /* Dynamic Memory Allocation */
     kmalloc_init();
 
     /* File System */
+    ata_init();                     /* Find the disks. */
+    bcache_init();                  /* Allocate the buffer cache. */
     module_t *mod = (module_t *)mbi->mods_addr;
-    fs_init(mod->mod_start);        /* Initialize the file system driver. */ 
+    if (!root_option(mbi, root, sizeof(root)) ||
+        fs_mount_disk(root) < 0)    /* The image on the disk of root=, or the module. */
+        fs_init(mod->mod_start);    /* Initialize the file system driver. */ 
 
     /* Virtual Memory */
     user_mem_init();
@@ -174,9 +213,13 @@ void entry(unsigned long magic, unsigned long addr) {
     rtc_init();                     /* Initialize the RTC driver. */
     pit_init();                     /* Initialize the PIT driver */
     vga_init();                     /* Initialize the VGA driver */
+    vdso_init();                    /* Map the vDSO page */
 
 
     clear();
+
+    /* Multiprocessor */
+    smp_init();                     /* Start the application processors. */
     
     /* Process management Unit */
     sched_init();
@@ -0,0 +1,52 @@
+/**
+ * @file mutex.c
+ * @brief Sleeping locks.
+ * @overview:
+ * A spinlock cannot be held across a sleep: on one CPU, the next thread
+ * that wants it spins forever, since the holder never runs again. A
+ * mutex is held across disk requests instead, the threads that find it
+ * taken sleep on its wait queue until mutex_unlock() wakes them up, and
+ * take it in turn.
+ *
+ * The sleep is not ended by a signal, as the callers (the file system
+ * and the disks) have no way to give up half way. A woken thread finds
+ * the mutex free unless another one got there first, then it sleeps
+ * again.
+ *
+ * @reference:
+ * Love, Robert, Linux Kernel Development (Chapter 10, Mutexes)
+ *
+ */
+
+#include <pro/mutex.h>
+
+
+/**
+ * @brief take m, sleeping while another thread holds it
+ *
+ * @param m : mutex
+ */
+void mutex_lock(mutex_t *m) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&m->lock, flags);
+    while (m->locked)
+        sleep_on_uninterruptible(&m->wait, &m->lock);
+    m->locked = 1;
+    spin_unlock_irqrestore(&m->lock, flags);
+}
+
+
+/**
+ * @brief release m and wake up the threads waiting for it
+ *
+ * @param m : mutex, held by the caller
+ */
+void mutex_unlock(mutex_t *m) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&m->lock, flags);
+    m->locked = 0;
+    wake_up(&m->wait);
+    spin_unlock_irqrestore(&m->lock, flags);
+}
@@ -0,0 +1,386 @@
+/**
+ * @file pipe.c
+ * @brief Pipes between processes.
+ * @overview:
+ * A pipe is a one-page ring buffer with a read end and a write end,
+ * each an open file. A reader sleeps while the pipe is empty and a
+ * writer sleeps while it is full. When the last write end is closed,
+ * readers get 0 (end of file) once the buffer is drained, when the last
+ * read end is closed, writers get -EPIPE.
+ *
+ * Writes of at most PIPE_BUF bytes go into the buffer in one piece, so
+ * the output of several writers is not interleaved inside them.
+ *
+ * Going through the buffer costs two copies: from the writer into the
+ * page, and from the page to the reader. For a large write, when a
+ * reader is already asleep on the empty pipe with a large buffer, the
+ * writer copies straight into the physical pages of the reader's buffer
+ * through the kmap window (the reader's pages are not mapped while the
+ * writer runs), which saves one copy and a switch per page of data.
+ *
+ * poll() puts the caller on the same queues: rwait for a read end,
+ * which is ready once there is data or no writer, and wwait for a write
+ * end, which is ready once a write of PIPE_BUF bytes would not block.
+ *
+ * @reference:
+ * Bovet, Daniel P. and Cesati, Marco, Understanding the Linux Kernel (Chapter 19, Pipes)
+ *
+ */
+
+#include <vfs/pipe.h>
+#include <vfs/poll.h>
+#include <vfs/vfs.h>
+#include <boot/x86_desc.h>
+#include <boot/page.h>
+#include <pro/process.h>
+#include <kmalloc.h>
+#include <access.h>
+#include <errno.h>
+#include <lib.h>
+
+
+static pipe_t *get_pipe(int32_t fd, uint32_t mode, thread_t *curr);
+static uint32_t pipe_direct(pipe_reader_t *r, const uint8_t *buf, uint32_t n);
+
+
+/**
+ * @brief allocate a pipe with one read end and one write end
+ *
+ * @return pipe_t* : the pipe, NULL if out of memory
+ */
+pipe_t *pipe_alloc(void) {
+    pipe_t *pipe;
+
+    if (!(pipe = kmalloc(sizeof(pipe_t))))
+        return NULL;
+
+    if (!(pipe->buf = get_page(0))) {
+        kfree(pipe);
+        return NULL;
+    }
+
+    spin_lock_init(&pipe->lock, "pipe_lock");
+    pipe->head = pipe->tail = 0;
+    pipe->readers = pipe->writers = 1;
+    pipe->direct = NULL;
+    init_waitqueue_head(&pipe->rwait);
+    init_waitqueue_head(&pipe->wwait);
+
+    return pipe;
+}
+
+
+/**
+ * @brief free a pipe that has no open ends
+ *
+ * @param pipe : the pipe
+ */
+void pipe_free(pipe_t *pipe) {
+    free_page(pipe->buf, 0);
+    kfree(pipe);
+}
+
+
+/**
+ * @brief drop a reference to one end of a pipe, the pipe is freed
+ * when both ends are closed
+ *
+ * Sleepers are woken up so that they see the end of file or the
+ * broken pipe.
+ *
+ * @param pipe : the pipe
+ * @param mode : FMODE_READ for the read end, FMODE_WRITE for the write end
+ */
+void pipe_release(pipe_t *pipe, uint32_t mode) {
+    uint32_t flags;
+    int32_t unused;
+
+    spin_lock_irqsave(&pipe->lock, flags);
+
+    if (mode & FMODE_READ)
+        pipe->readers--;
+    if (mode & FMODE_WRITE)
+        pipe->writers--;
+
+    wake_up(&pipe->rwait);
+    wake_up(&pipe->wwait);
+
+    unused = !pipe->readers && !pipe->writers;
+
+    spin_unlock_irqrestore(&pipe->lock, flags);
+
+    if (unused)
+        pipe_free(pipe);
+}
+
+
+/**
+ * @brief Pipes have no name and cannot be opened.
+ *
+ * @return int32_t : -1.
+ */
+int32_t pipe_open(const int8_t *fname) {
+    return -1;
+}
+
+
+/**
+ * @brief Close one end of a pipe.
+ *
+ * @param fd : The file descriptor of the pipe end.
+ * @return int32_t 0 on success, -1 on failure.
+ */
+int32_t pipe_close(int32_t fd) {
+    /* the end is released with the last descriptor of the file */
+    return file_close(fd);
+}
+
+
+/**
+ * @brief Read from a pipe, sleep while it is empty.
+ *
+ * @param fd : The file descriptor of the read end.
+ * @param buf : A buffer array that copys the content from the pipe.
+ * @param nbytes The number of bytes to read.
+ * @return int32_t : number of bytes read, 0 at end of file,
+ *                   -EINTR if a signal came before any data,
+ *                   negative values denote an error condition
+ */
+int32_t pipe_read(int32_t fd, void *buf, int32_t nbytes) {
+    thread_t *curr;
+    pipe_t *pipe;
+    pipe_reader_t r;
+    uint32_t flags, n, off, first;
+
+    GETPRO(curr);
+
+    if (!(pipe = get_pipe(fd, FMODE_READ, curr)))
+        return -EBADF;
+    if (nbytes <= 0)
+        return nbytes ? -EINVAL : 0;
+
+    /* buf is written with the pipe lock held, it must not fault */
+    if (!user_access_ok(curr->vm, (uint32_t)buf, nbytes, VM_WRITE))
+        return -EFAULT;
+
+    r.done = 0;
+
+    spin_lock_irqsave(&pipe->lock, flags);
+
+    while (pipe->head == pipe->tail) {
+        if (!pipe->writers) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            return 0;
+        }
+
+        /* let a large write copy straight into buf */
+        if (nbytes > PIPE_BUF && !pipe->direct) {
+            r.vm = curr->vm;
+            r.buf = (uint32_t)buf;
+            r.len = nbytes;
+            pipe->direct = &r;
+        }
+
+        sleep_on(&pipe->rwait, &pipe->lock);
+
+        if (pipe->direct == &r)
+            pipe->direct = NULL;
+
+        if (r.done) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            return r.done;
+        }
+
+        if (signal_pending(curr) && pipe->head == pipe->tail) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            return -EINTR;
+        }
+    }
+
+    n = pipe->head - pipe->tail;
+    if (n > nbytes)
+        n = nbytes;
+
+    /* the data can wrap around the end of the page */
+    off = pipe->tail % PIPE_SIZE;
+    first = (n < PIPE_SIZE - off) ? n : PIPE_SIZE - off;
+    memcpy(buf, pipe->buf + off, first);
+    memcpy((uint8_t*)buf + first, pipe->buf, n - first);
+    pipe->tail += n;
+
+    wake_up(&pipe->wwait);
+
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    return n;
+}
+
+
+/**
+ * @brief Write to a pipe, sleep while it is full.
+ *
+ * @param fd : The file descriptor of the write end.
+ * @param buf : A buffer array that copys the content to the pipe.
+ * @param nbytes The number of bytes to write.
+ * @return int32_t : number of bytes written, -EPIPE if there is no reader,
+ *                   -EINTR if a signal came before any data was written,
+ *                   negative values denote an error condition
+ */
+int32_t pipe_write(int32_t fd, const void *buf, int32_t nbytes) {
+    thread_t *curr;
+    pipe_t *pipe;
+    pipe_reader_t *r;
+    const uint8_t *src = buf;
+    uint32_t flags, n, off, first, space, left, written = 0;
+
+    GETPRO(curr);
+
+    if (!(pipe = get_pipe(fd, FMODE_WRITE, curr)))
+        return -EBADF;
+    if (nbytes <= 0)
+        return nbytes ? -EINVAL : 0;
+
+    /* buf is read with the pipe lock held, it must not fault */
+    if (!user_access_ok(curr->vm, (uint32_t)buf, nbytes, VM_READ))
+        return -EFAULT;
+
+    spin_lock_irqsave(&pipe->lock, flags);
+
+    while (written < nbytes) {
+        if (!pipe->readers) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            return written ? written : -EPIPE;
+        }
+
+        left = nbytes - written;
+
+        /* large write and a reader waiting on the empty pipe:
+         * skip the buffer and copy into the reader */
+        if (nbytes > PIPE_BUF && pipe->direct && pipe->head == pipe->tail) {
+            r = pipe->direct;
+            pipe->direct = NULL;
+            r->done = pipe_direct(r, src + written, left);
+            written += r->done;
+            wake_up(&pipe->rwait);
+            continue;
+        }
+
+        space = PIPE_SIZE - (pipe->head - pipe->tail);
+
+        /* a small write goes in in one piece */
+        if (!space || (nbytes <= PIPE_BUF && space < left)) {
+            if (signal_pending(curr)) {
+                spin_unlock_irqrestore(&pipe->lock, flags);
+                return written ? written : -EINTR;
+            }
+            sleep_on(&pipe->wwait, &pipe->lock);
+            continue;
+        }
+
+        n = (left < space) ? left : space;
+        off = pipe->head % PIPE_SIZE;
+        first = (n < PIPE_SIZE - off) ? n : PIPE_SIZE - off;
+        memcpy(pipe->buf + off, src + written, first);
+        memcpy(pipe->buf, src + written + first, n - first);
+        pipe->head += n;
+        written += n;
+
+        wake_up(&pipe->rwait);
+    }
+
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    return written;
+}
+
+
+/**
+ * @brief Events ready on one end of a pipe.
+ *
+ * @param fd : The file descriptor of the pipe end.
+ * @param pt : poll table, the caller waits on rwait or wwait
+ * @return uint32_t : POLLIN if there is data, POLLHUP if there is no writer
+ *                    (read end), POLLOUT if PIPE_BUF bytes fit, POLLERR if
+ *                    there is no reader (write end)
+ */
+uint32_t pipe_poll(int32_t fd, poll_table_t *pt) {
+    file_t *file;
+    pipe_t *pipe;
+    uint32_t flags, mask = 0;
+
+    if (!(file = fd_file(fd)))
+        return POLLNVAL;
+    pipe = file->private_data;
+
+    spin_lock_irqsave(&pipe->lock, flags);
+
+    if (file->f_mode & FMODE_READ) {
+        poll_wait(&pipe->rwait, &pipe->lock, pt);
+        if (pipe->head != pipe->tail)
+            mask |= POLLIN;
+        if (!pipe->writers)
+            mask |= POLLHUP;
+    }
+
+    if (file->f_mode & FMODE_WRITE) {
+        poll_wait(&pipe->wwait, &pipe->lock, pt);
+        if (PIPE_SIZE - (pipe->head - pipe->tail) >= PIPE_BUF)
+            mask |= POLLOUT;
+        if (!pipe->readers)
+            mask |= POLLERR;
+    }
+
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    return mask;
+}
+
+
+/**
+ * @brief get the pipe behind fd, if fd is an end of a pipe opened in mode
+ *
+ * @param fd : a file descriptor
+ * @param mode : FMODE_READ or FMODE_WRITE
+ * @param curr : current thread
+ * @return pipe_t* : the pipe, NULL if fd is not open in mode
+ */
+static pipe_t *get_pipe(int32_t fd, uint32_t mode, thread_t *curr) {
+    file_t *file;
+
+    if ((file = fd_file(fd)) && (file->f_mode & mode))
+        return file->private_data;
+
+    return NULL;
+}
+
+
+/**
+ * @brief copy from the writer into the buffer of a sleeping reader,
+ * one physical page at a time
+ *
+ * Interrupts are off (pipe lock held), as kmap_atomic() needs.
+ *
+ * @param r : the reader
+ * @param buf : writer's data, in the current address space
+ * @param n : bytes to copy
+ * @return uint32_t : bytes copied, at most r->len
+ */
+static uint32_t pipe_direct(pipe_reader_t *r, const uint8_t *buf, uint32_t n) {
+    uint32_t pa, chunk, copied = 0;
+
+    if (n > r->len)
+        n = r->len;
+
+    while (copied < n) {
+        if (!(pa = user_virt_to_phys(r->vm, r->buf + copied, VM_WRITE)))
+            break;
+
+        chunk = PAGE_SIZE - GETBIT_12(pa);
+        if (chunk > n - copied)
+            chunk = n - copied;
+
+        memcpy(kmap_atomic(pa), buf + copied, chunk);
+        kunmap_atomic();
+
+        copied += chunk;
+    }
+
+    return copied;
+}
@@ -0,0 +1,232 @@
+/**
+ * @file poll.c
+ * @brief Waiting on several files at once.
+ * @overview:
+ * poll() asks the poll operation of each file which events are ready
+ * (POLLIN, POLLOUT, ...). A file that can make the caller wait hands
+ * its wait queues to poll_wait(), which puts the caller on each of
+ * them. If nothing is ready, the caller goes to sleep once, on all the
+ * queues together; whichever object changes first wakes it up, it
+ * leaves every queue and asks the files again.
+ *
+ * A file without a poll operation (a regular file, a directory) is
+ * always ready for reading and writing.
+ *
+ * Interrupts stay off from the first question to the sleep, so an event
+ * between them cannot be lost, the same rule as sleep_on(). A poller
+ * with a timeout is also on poll_timers, and the timer interrupt wakes
+ * it up when its time runs out. A signal ends the sleep with -EINTR.
+ *
+ * @reference:
+ * Bovet, Daniel P. and Cesati, Marco, Understanding the Linux Kernel (Chapter 18, The poll() and select() System Calls)
+ * Love, Robert, Linux Kernel Development (Chapter 4, Sleeping and Waking Up)
+ *
+ */
+
+#include <vfs/poll.h>
+#include <vfs/vfs.h>
+#include <drivers/time.h>
+#include <pro/process.h>
+#include <boot/page.h>
+#include <kmalloc.h>
+#include <access.h>
+#include <errno.h>
+#include <lib.h>
+
+
+static LIST_HEAD(poll_timers);          /* pollers sleeping with a timeout */
+static DEFINE_SPINLOCK(poll_lock);      /* protects poll_timers */
+
+
+static uint32_t poll_files(pollfd_t *fds, uint32_t nfds, file_t **filp, poll_table_t *pt);
+static void poll_freewait(poll_table_t *pt);
+
+
+/**
+ * @brief put the poller on a wait queue of a file, called by the poll
+ * operation of the file with the lock of the queue held
+ *
+ * @param q : wait queue, woken up when the state of the file changes
+ * @param lock : lock protecting q
+ * @param pt : poll table, NULL if the poller will not sleep
+ */
+void poll_wait(wait_queue_head_t *q, spinlock_t *lock, poll_table_t *pt) {
+    poll_entry_t *e;
+
+    if (!pt || pt->n == pt->max)
+        return;
+
+    e = &pt->entries[pt->n++];
+    e->wait.task = pt->task;
+    e->head = q;
+    e->lock = lock;
+    list_add_tail(&e->wait.node, &q->task_list);
+}
+
+
+/**
+ * @brief wake up the pollers whose timeout ran out, called by the timer
+ * interrupt
+ *
+ */
+void poll_timeout(void) {
+    list_head *node;
+    poll_table_t *pt;
+
+    if (list_empty(&poll_timers))
+        return;
+
+    spin_lock(&poll_lock);
+
+    list_for_each(node, &poll_timers) {
+        pt = list_entry(node, poll_table_t, node);
+        if ((int32_t)(sys_ticks - pt->expires) >= 0)
+            wake_up_process(pt->task);
+    }
+
+    spin_unlock(&poll_lock);
+}
+
+
+/**
+ * @brief wait until one of a set of files is ready
+ *
+ * @param fds : the file descriptors and the events to wait for, in user
+ *              memory; revents is set for each of them
+ * @param nfds : number of entries in fds, at most OPEN_MAX
+ * @param timeout : ms to wait at most, 0 to return at once, negative to
+ *                  wait without a limit
+ * @return int32_t : number of entries with revents set, 0 on timeout,
+ *                   -EINTR if a signal came first, -EFAULT if fds is not
+ *                   writable user memory, negative values denote an error
+ *                   condition
+ */
+int32_t do_poll(pollfd_t *fds, uint32_t nfds, int32_t timeout) {
+    poll_table_t table, *pt = NULL;
+    file_t **filp = NULL;
+    thread_t *curr;
+    uint32_t flags, i, count;
+
+    GETPRO(curr);
+
+    if (nfds > OPEN_MAX)
+        return -EINVAL;
+    if (nfds && !user_access_ok(curr->vm, (uint32_t)fds, nfds * sizeof(pollfd_t), VM_READ | VM_WRITE))
+        return -EFAULT;
+
+    /* the files are held for the whole call, so their queues stay */
+    if (nfds && !(filp = kmalloc(nfds * (sizeof(file_t *) + POLL_WAITS * sizeof(poll_entry_t)))))
+        return -ENOMEM;
+
+    for (i = 0; i < nfds; ++i)
+        filp[i] = (fds[i].fd >= 0) ? fget(fds[i].fd) : NULL;
+
+    if (timeout) {
+        pt = &table;
+        pt->task = curr;
+        pt->entries = (poll_entry_t *)(filp + nfds);
+        pt->n = 0;
+        pt->max = nfds * POLL_WAITS;
+        pt->expires = sys_ticks + timeout;
+    }
+
+    cli_and_save(flags);
+
+    while (!(count = poll_files(fds, nfds, filp, pt)) && timeout) {
+        if (signal_pending(curr))
+            break;
+        if (timeout > 0 && (int32_t)(sys_ticks - pt->expires) >= 0)
+            break;
+
+        if (timeout > 0) {
+            spin_lock(&poll_lock);
+            list_add_tail(&pt->node, &poll_timers);
+            spin_unlock(&poll_lock);
+        }
+
+        curr->sigsleep = 1;
+        sched_sleep(curr);
+        curr->sigsleep = 0;
+
+        if (timeout > 0) {
+            spin_lock(&poll_lock);
+            list_del(&pt->node);
+            spin_unlock(&poll_lock);
+        }
+
+        poll_freewait(pt);
+    }
+
+    if (pt)
+        poll_freewait(pt);
+
+    restore_flags(flags);
+
+    for (i = 0; i < nfds; ++i)
+        if (filp[i])
+            fput(filp[i]);
+    kfree(filp);
+
+    if (!count && timeout && signal_pending(curr))
+        return -EINTR;
+
+    return count;
+}
+
+
+/**
+ * @brief ask each file which events are ready, with interrupts off
+ *
+ * @param fds : the file descriptors, revents is set
+ * @param nfds : number of entries in fds
+ * @param filp : the file of each entry, NULL if it is not open
+ * @param pt : poll table to put the poller on the queues, NULL if it will not sleep
+ * @return uint32_t : number of entries with revents set
+ */
+static uint32_t poll_files(pollfd_t *fds, uint32_t nfds, file_t **filp, poll_table_t *pt) {
+    uint32_t i, mask, count = 0;
+
+    for (i = 0; i < nfds; ++i) {
+        mask = 0;
+
+        if (fds[i].fd >= 0) {
+            if (!filp[i])
+                mask = POLLNVAL;
+            else if (filp[i]->f_op->poll)
+                mask = filp[i]->f_op->poll(fds[i].fd, pt);
+            else
+                mask = POLLIN | POLLOUT;
+
+            /* errors are reported even if they were not asked for */
+            mask &= fds[i].events | POLLERR | POLLHUP | POLLNVAL;
+        }
+
+        fds[i].revents = mask;
+        if (mask)
+            count++;
+    }
+
+    return count;
+}
+
+
+/**
+ * @brief take the poller off the queues it is still on (those that did
+ * not wake it up)
+ *
+ * @param pt : poll table
+ */
+static void poll_freewait(poll_table_t *pt) {
+    poll_entry_t *e;
+    uint32_t i;
+
+    for (i = 0; i < pt->n; ++i) {
+        e = &pt->entries[i];
+        spin_lock(e->lock);
+        if (e->wait.task)
+            list_del(&e->wait.node);
+        spin_unlock(e->lock);
+    }
+
+    pt->n = 0;
+}
@@ -9,6 +9,13 @@
  *            -> sched_fork -> enqueue_task -> check_preempt_new
  *            -> return child's pid
  * 
+ * @vfork:
+ * vfork -> sys_vfork ->
+ *    do_vfork -> process_create
+ *             -> share the address space, copy the open files
+ *             -> parent sleeps until the child calls execv or exits
+ *                (vfork_release)
+ * 
  * @execute:
  * 
  * @exit:
@@ -24,17 +31,21 @@
 
 #include <pro/process.h>
 #include <boot/page.h>
+#include <boot/vdso.h>
 // #include <pro/sched.h>
 #include <pro/cfs.h>
 #include <drivers/keyboard.h>
 #include <boot/x86_desc.h>
+#include <boot/smp.h>
 #include <pro/pid.h>
 #include <lib.h>
 #include <drivers/fs.h>
+#include <drivers/ata.h>
 #include <drivers/vga.h>
 #include <kmalloc.h>
 #include <access.h>
 #include <errno.h>
+#include <pro/workqueue.h>
 
 
 thread_t *idle;                 /* process 0 (idle process) */
@@ -44,25 +55,70 @@ console_t **consoles;           /* array of consoles containing one running task
 console_t *current;             /* current console */
 LIST_HEAD(task_queue);          /* list of all tasks (idle -> init -> {user task}) */
 LIST_HEAD(wait_queue);          /* list of sleeping tasks (idle -> {sleeping user task || init}) */
+static DEFINE_SPINLOCK(wait_lock);  /* protects wait_chldexit of every task */
+
+/* strings of a new program (argv then envp), collected in one page 
+ * while the old address space is still there */
+typedef struct {
+    int8_t   *page;             /* the strings, each NUL terminated */
+    uint32_t len;               /* bytes used in page */
+    int32_t  argc;              /* number of arguments */
+    int32_t  envc;              /* number of environment strings */
+} exec_args_t;
+
+/* a user pointer passed to exec */
+#define user_ptr_ok(p)  ((uint32_t)(p) >= VIR_MEM_BEGIN && (uint32_t)(p) < USER_STACK_ADDR)
 
 /* local helper functions */
 static int32_t __exec(thread_t *current, const int8_t *cmd, uint8_t kthread);
 static int32_t process_create(thread_t *current, uint8_t kthread);
 static int32_t process_clone(thread_t *parent, thread_t *child);
-static int32_t parse_arg(int8_t *cmd, int8_t *argv[]);
+static int32_t process_share(thread_t *parent, thread_t *child);
+static void copy_thread(thread_t *parent, thread_t *child);
+static int32_t parse_arg(int8_t *cmd, exec_args_t *args);
+static int32_t args_init(exec_args_t *args);
+static void args_free(exec_args_t *args);
+static int32_t args_add(exec_args_t *args, const int8_t *str, uint32_t n);
+static int32_t copy_strings(exec_args_t *args, int8_t *const v[], int32_t *count);
+static int32_t copy_env(thread_t *from, exec_args_t *args);
+static uint32_t setup_arg_stack(thread_t *t, exec_args_t *args);
 static inline void switch_to_user(thread_t *curr);
 static void console_init(void);
 static inline void update_tss(thread_t *curr);
 static inline void place_children(thread_t *task);
 static inline void overflow_children(thread_t *task);
+static void kthread_start(int32_t (*fn)(void *), void *arg);
+static void vfork_release(thread_t *t);
 
 
 /**
- * @brief the task of the system process 0
+ * @brief the task of the system process 0, run when no other task
+ * can: halt until an interrupt, and give the CPU to the task it made
+ * runnable. Each CPU has its own process 0.
  * 
  */
 void swapper(void) { 
-    pause();    
+    thread_t *self;
+
+    GETPRO(self);
+
+    while (1) {
+        cli();
+
+        if (self->flag == NEED_RESCHED) {
+            schedule();
+            continue;
+        }
+
+        /* the other CPUs may use the kernel while this one sleeps */
+        unlock_kernel();
+
+        /* sti takes effect after the next instruction, so an interrupt
+         * between the test and hlt still ends the hlt */
+        asm volatile ("sti; hlt" : : : "memory");
+
+        lock_kernel();
+    }
 }
 
 
@@ -76,6 +132,9 @@ void init_task(void) {
     pidmap_init();
     console_init();
 
+    /* the shells are loaded, disk requests sleep from now on */
+    ata_irq_init();
+
     /* clock starts to tick */
     sti();
 
@@ -102,9 +161,15 @@ void init_task(void) {
 void inline context_switch(thread_t *prev, thread_t *next) {
     __umap(prev, next);
 
+    /* getpid() in user space reads the running task from the vDSO page */
+    vdso_update_task(next);
+
     if (next != init)
         update_tss(next);
 
+    /* FPU registers are switched lazily on the first FPU instruction */
+    fpu_switch(next);
+
     swtch(prev->context, next->context);
 }
 
@@ -141,6 +206,8 @@ int32_t do_fork(thread_t *parent, uint8_t kthread) {
 
     /* set up terminal for process */
     child->terminal = parent->terminal;
+
+    child->console_id = parent->console_id;
         
     /* set up sched info for child */
     sched_fork(child); 
@@ -158,6 +225,212 @@ int32_t do_fork(thread_t *parent, uint8_t kthread) {
 }
 
 
+/**
+ * @brief create a new thread sharing the address space, open files
+ * and terminal of the current one
+ * 
+ * The new thread returns to user mode at eip with its user stack 
+ * at esp, the caller is responsible for setting up the stack.
+ * 
+ * @param parent : current thread
+ * @param eip : user entry point of the new thread
+ * @param esp : top of the user stack of the new thread
+ * @return int32_t : 0 - to child
+ *                 < 0 - error number
+ *                 > 0 - pid of the new thread
+ */
+int32_t do_clone(thread_t *parent, uint32_t eip, uint32_t esp) {
+    thread_t *child;
+    uint32_t *child_stack;
+    int32_t errno;
+
+    /* create child thread */
+    if ((errno = process_create(parent, 0)) < 0)
+        return errno;
+
+    child = parent->children[parent->n_children - 1];
+
+    if ((errno = process_share(parent, child)) < 0) {
+        process_free(child);
+        return errno;
+    }
+
+    /* return to user mode at the thread function */
+    child_stack = (uint32_t*)(&((process_t*)child)->stack);
+    child_stack[USEREIP] = child->usreip = eip;
+    child_stack[USERESP] = child->usresp = esp;
+
+    child->terminal = parent->terminal;
+
+    child->console_id = parent->console_id;
+
+    sched_fork(child);
+
+    activate_task(child);
+
+    ntask++;
+
+    child->context->eax = 0;
+
+    return child->pid;
+}
+
+
+/**
+ * @brief create a child process that borrows the address space of the
+ * parent until it calls execv or exits
+ * 
+ * Nothing is copied but the open files, so the child must not return
+ * from the function that called vfork or change the parent's data.
+ * The caller sleeps until *done is set by vfork_release().
+ * 
+ * @param parent : current thread
+ * @param done : set to 1 when the parent can run again
+ * @return int32_t : 0 - to child
+ *                 < 0 - error number
+ *                 > 0 - pid of the child process
+ */
+int32_t do_vfork(thread_t *parent, volatile uint32_t *done) {
+    thread_t *child;
+    int32_t errno;
+
+    if ((errno = process_create(parent, 0)) < 0)
+        return errno;
+
+    child = parent->children[parent->n_children - 1];
+
+    /* drop the empty address space from process_create */
+    put_vm(child->vm);
+    child->vm = parent->vm;
+    child->vm->count++;
+
+    copy_thread(parent, child);
+
+    /* the child sets up its own files (dup2, close) before execv */
+    if (parent->fds && !(child->fds = copy_files(parent->fds))) {
+        process_free(child);
+        return -ENOMEM;
+    }
+
+    if ((errno = fpu_fork(parent, child)) < 0) {
+        process_free(child);
+        return errno;
+    }
+
+    child->vfork_done = done;
+
+    child->terminal = parent->terminal;
+
+    child->console_id = parent->console_id;
+
+    sched_fork(child);
+
+    activate_task(child);
+
+    ntask++;
+
+    child->context->eax = 0;
+
+    return child->pid;
+}
+
+
+/**
+ * @brief give the address space back to the parent of a vfork child
+ * and let the parent run
+ * 
+ * @param t : current thread, about to exec or exit
+ */
+static void vfork_release(thread_t *t) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    if (t->vfork_done) {
+        *t->vfork_done = 1;
+        t->vfork_done = NULL;
+        wake_up_process(t->parent);
+    }
+
+    restore_flags(flags);
+}
+
+
+/**
+ * @brief create a kernel thread running fn(arg) as a child of init
+ * 
+ * The thread has no user space and no console. Its kernel stack is set 
+ * up like a call to kthread_start(fn, arg), so that the first switch to 
+ * it "returns" into kthread_start.
+ * 
+ * @param fn : function run by the thread, it should not return
+ * @param arg : argument passed to fn
+ * @param name : name shown by ps
+ * @return pid_t : pid of the thread, negative values denote an error condition
+ */
+pid_t kernel_thread(int32_t (*fn)(void *), void *arg, const int8_t *name) {
+    thread_t *t;
+    uint32_t *stack;
+    int32_t errno;
+
+    if ((errno = process_create(init, 1)) < 0)
+        return errno;
+
+    t = init->children[init->n_children - 1];
+
+    strncpy(t->comm, name, COMM_LEN - 1);
+    t->comm[COMM_LEN - 1] = '\0';
+    t->arg_start = t->arg_end = 0;
+    t->env_start = t->env_end = 0;
+
+    t->nice = NICE_NORMAL;
+    t->fds = NULL;
+    t->terminal = NULL;
+    t->console_id = NO_CONSOLE;
+    t->usreip = 0;
+    t->usresp = 0;
+
+    /* stack: fake return address, fn, arg */
+    stack = (uint32_t *)(get_esp0(t) - 2 * sizeof(uint32_t));
+    stack[0] = 0;
+    stack[1] = (uint32_t)fn;
+    stack[2] = (uint32_t)arg;
+
+    t->context->eip = (uint32_t)kthread_start;
+    t->context->esp = (uint32_t)stack;
+    t->context->ebp = 0;
+    t->context->eax = 0;
+
+    sched_fork(t);
+    activate_task(t);
+
+    ntask++;
+
+    return t->pid;
+}
+
+
+/**
+ * @brief first function run by a kernel thread
+ * 
+ * @param fn : function of the thread
+ * @param arg : argument of fn
+ */
+static void kthread_start(int32_t (*fn)(void *), void *arg) {
+    thread_t *self;
+
+    /* the thread starts inside __schedule with interrupts off */
+    sti();
+
+    (void) fn(arg);
+
+    /* kernel threads are not reaped: sleep forever */
+    GETPRO(self);
+    cli();
+    while (1)
+        sched_sleep(self);
+}
+
 
 /**
  * @brief clone parent's state into child
@@ -167,29 +440,80 @@ int32_t do_fork(thread_t *parent, uint8_t kthread) {
  * @return int32_t : positive or 0 denote success, negative values denote an error condition
  */
 static int32_t process_clone(thread_t *parent, thread_t *child) {
-    int i;
     int32_t errno;
-    uint32_t *parent_stack;
-    uint32_t *child_stack;
     
     /* copy physical memory */
-    if ((errno = vmcopy(&child->vm, &parent->vm)) < 0)
+    if ((errno = vmcopy(child->vm, parent->vm)) < 0)
         return errno;
     
-    /* copy arguments */
-    child->argc = parent->argc;
-    child->argv = kmalloc(MAXARGS * sizeof(int8_t*));
+    copy_thread(parent, child);
 
-    for (i = 0; i < MAXARGS; ++i)
-        child->argv[i] = kmalloc(ARGSIZE);    
+    /* copy the open files now, the parent may close some of them
+     * (the ends of a pipe) before the child runs */
+    if (parent->fds && !(child->fds = copy_files(parent->fds)))
+        return -ENOMEM;
+
+    /* copy FPU registers */
+    if ((errno = fpu_fork(parent, child)) < 0)
+        return errno;
+
+    return 0;
+}
 
-    for (i = 0; i < child->argc; ++i)
-        strcpy(child->argv[i], parent->argv[i]);
-    
-    child->nice = NICE_NORMAL;
 
-    /* child will get real copied when it tries to open a file */
-    child->fds = NULL;
+/**
+ * @brief share parent's address space and files with child, 
+ * the child is a new thread of the same program
+ * 
+ * @param parent : parent thread
+ * @param child : child thread
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+static int32_t process_share(thread_t *parent, thread_t *child) {
+    /* drop the empty address space from process_create */
+    put_vm(child->vm);
+    child->vm = parent->vm;
+    child->vm->count++;
+
+    if ((child->fds = parent->fds)) {
+        write_lock(&child->fds->file_lock);
+        child->fds->count++;
+        write_unlock(&child->fds->file_lock);
+    }
+
+    copy_thread(parent, child);
+
+    /* a new thread starts with a clean FPU */
+    child->used_math = 0;
+
+    return 0;
+}
+
+
+/**
+ * @brief copy the program name, nice value and the CPU pre-pushed
+ * user context from parent to child
+ * 
+ * @param parent : parent thread
+ * @param child : child thread
+ */
+static void copy_thread(thread_t *parent, thread_t *child) {
+    uint32_t *parent_stack;
+    uint32_t *child_stack;
+
+    /* the argument strings are on the user stack, copied (fork) 
+     * or shared (clone) with the rest of the address space */
+    strcpy(child->comm, parent->comm);
+    child->arg_start = parent->arg_start;
+    child->arg_end = parent->arg_end;
+    child->env_start = parent->env_start;
+    child->env_end = parent->env_end;
+    
+    /* children of a shell run at normal priority, others inherit it */
+    if (!strcmp(parent->comm, SHELL))
+        child->nice = NICE_NORMAL;
+    else
+        child->nice = parent->nice;
 
     /* copy CPU pre-pushed user context
      * stack[....] : general purpose registers 
@@ -207,8 +531,6 @@ static int32_t process_clone(thread_t *parent, thread_t *child) {
     child->usresp = parent_stack[USERESP];
     
     memcpy((void*)(child_stack + 1024), (void*)(parent_stack + 1024), PAGE_SIZE);
-
-    return 0;
 }
 
 
@@ -222,11 +544,14 @@ static int32_t process_clone(thread_t *parent, thread_t *child) {
 void do_exit(uint32_t status) {
     thread_t *child;
     thread_t *parent; 
+    uint32_t flags;
 
     GETPRO(child);  
 
+    vfork_release(child);
+
     /* check if the current process is running a system thread and it is a shell */
-    if ((child->kthread) && (!strcmp(child->argv[0], SHELL)))
+    if ((child->kthread) && (!strcmp(child->comm, SHELL)))
         switch_to_user(child);
     
     parent = child->parent;
@@ -238,17 +563,77 @@ void do_exit(uint32_t status) {
     }
     
     ntask--;
-    
-    /* when wait syscall is implement, the parent will get the exit status */
 
+    /* close the files, so that readers of a pipe see the end of file */
+    put_files(child);
+    
     parent->context->eax = status;
 
     consoles[parent->console_id]->task = parent;
 
+    /* wake up the parent if it waits for this child. Interrupts stay 
+     * off until sched_exit has marked it EXITED and left it, so the 
+     * parent cannot check its state in between */
+    spin_lock_irqsave(&wait_lock, flags);
+    child->exit_code = status;
+    wake_up(&parent->wait_chldexit);
+    spin_unlock(&wait_lock);
+
     sched_exit(child, parent);
 }
 
 
+/**
+ * @brief wait until a child of the calling thread exits
+ * 
+ * The child is not freed, an exited child stays EXITED as before, 
+ * so waiting for it again returns at once.
+ * 
+ * @param pid : pid of the child
+ * @param wstatus : set to the status given to exit if not NULL
+ * @return int32_t : pid of the child on success, negative values denote an error condition
+ */
+int32_t do_waitpid(pid_t pid, int32_t *wstatus) {
+    thread_t *curr;
+    thread_t *child = NULL;
+    uint32_t flags, i;
+
+    GETPRO(curr);
+
+    if (wstatus && !user_access_ok(curr->vm, (uint32_t)wstatus, sizeof(int32_t), VM_WRITE))
+        return -EFAULT;
+
+    spin_lock_irqsave(&wait_lock, flags);
+
+    for (i = 0; i < curr->n_children; ++i) {
+        if (curr->children[i]->pid == pid) {
+            child = curr->children[i];
+            break;
+        }
+    }
+
+    if (!child) {
+        spin_unlock_irqrestore(&wait_lock, flags);
+        return -ECHILD;
+    }
+
+    while (child->state != EXITED) {
+        if (signal_pending(curr)) {
+            spin_unlock_irqrestore(&wait_lock, flags);
+            return -EINTR;
+        }
+        sleep_on(&curr->wait_chldexit, &wait_lock);
+    }
+
+    spin_unlock_irqrestore(&wait_lock, flags);
+
+    if (wstatus)
+        *wstatus = child->exit_code;
+
+    return pid;
+}
+
+
 /**
  * @brief create a new process to execute a program
  * 
@@ -309,49 +694,90 @@ int32_t do_execute(thread_t *parent, const int8_t *cmd) {
 /**
  * @brief execute a program at the current process
  * 
+ * The arguments and the environment are copied into the kernel before 
+ * the old program goes away, and then onto the stack of the new one.
+ * 
  * @param curr : current thread
  * @param pathname : program name
- * @param argv : program arguments
+ * @param argv : program arguments, terminated by NULL
+ * @param envp : environment strings (NAME=value), terminated by NULL, 
+ * the environment is empty if envp is NULL
  * @return int32_t : positive or 0 denote success, negative values denote an error condition
  */
-int32_t do_execv(thread_t *curr, const int8_t *pathname, int8_t *const argv[]) {
-    int i;
+int32_t do_execv(thread_t *curr, const int8_t *pathname, int8_t *const argv[], int8_t *const envp[]) {
     int32_t errno;
-    uint32_t EIP_reg;
+    uint32_t EIP_reg, sp;
+    int8_t name[COMM_LEN];
+    exec_args_t args;
+    vmem_t *vm = NULL;
+
+    if (!user_ptr_ok(pathname) || !argv)
+        return -EFAULT;
+    if (strlen(pathname) >= COMM_LEN)
+        return -ENAMETOOLONG;
+    strcpy(name, pathname);
+
+    if ((errno = args_init(&args)) < 0)
+        return errno;
 
-    curr->argc = 0;
+    if ((errno = copy_strings(&args, argv, &args.argc)) < 0 ||
+        (errno = copy_strings(&args, envp, &args.envc)) < 0) {
+        args_free(&args);
+        return errno;
+    }
 
-    /* update argument lists */
-    for (i = 0; argv[i]; ++i) {
-        strcpy((char*)(curr->argv[i]), (char*)(argv[i]));
-        if (curr->argv[i][strlen(curr->argv[i]) - 1] == '\n')
-            curr->argv[i][strlen(curr->argv[i]) - 1] = '\0';
-        curr->argc++;
-    } 
+    /* everything that can fail is checked while the old program is
+     * still there to get the error */
+    if ((errno = pro_check(name, &EIP_reg)) < 0 ||
+        (curr->vm->count > 1 && !(vm = vm_alloc()))) {
+        args_free(&args);
+        return (errno < 0) ? errno : -ENOMEM;
+    }
 
-    /* set next byte to null */
-    if (curr->argc < MAXARGS) curr->argv[curr->argc] = NULL;
+    /* point of no return: other threads (or the parent of vfork) keep 
+     * running the old program in the old address space */
+    if (vm) {
+        user_mem_unmap(curr);
+        put_vm(curr->vm);
+        vfork_release(curr);
+        curr->vm = vm;
+        user_mem_map(curr);
+    } else {
+        /* mappings of files do not survive exec */
+        unmap_files(curr->vm);
+    }
 
-    /* executable check and load program image into user's memory */
-    if ((errno = pro_loader(curr->argv[0], &EIP_reg, curr)) < 0) {
-        return errno;
+    /* load program image into user's memory, then put the arguments 
+     * on its stack, a failure (I/O error, out of memory) kills the task */
+    if (pro_loader(name, &EIP_reg, curr) < 0 || !(sp = setup_arg_stack(curr, &args))) {
+        args_free(&args);
+        printf("execv: cannot load %s, pid %d killed\n", name, curr->pid);
+        cli();
+        do_exit(256);
     }
+    args_free(&args);
+
+    strcpy(curr->comm, name);
 
-    /* clear fds */
-    if (curr->fds) {
-        kfree(curr->fds);
-        fd_init(curr);
+    /* open files stay open across exec (a pipe set up by the shell),
+     * other threads keep the old table */
+    if (curr->fds && curr->fds->count > 1) {
+        files *fds = copy_files(curr->fds);
+        put_files(curr);
+        curr->fds = fds;
     }
 
-    /* update nice values */
-    if (!strcmp(argv[0], SHELL))
-        curr->nice = NICE_SHELL;
-    else
-        curr->nice = NICE_NORMAL;
+    /* the new program starts with a clean FPU and the default signal actions */
+    fpu_exec(curr);
+    flush_signal_handlers(curr);
+
+    /* a program keeps its nice value across exec, except for shells */
+    if (!strcmp(curr->comm, SHELL))
+        set_user_nice(curr, NICE_SHELL);
 
     /* store registers */
     curr->usreip = EIP_reg;
-    curr->usresp = USER_STACK_ADDR;
+    curr->usresp = sp;
 
     switch_to_user(curr);
     
@@ -368,45 +794,51 @@ int32_t do_execv(thread_t *curr, const int8_t *pathname, int8_t *const argv[]) {
  * @return int32_t : positive or 0 denote success, negative values denote an error condition
  */
 static int32_t __exec(thread_t *parent, const int8_t *cmd, uint8_t kthread) {
-    int i;
     thread_t *child;
     int32_t errno;
-    int32_t argc;
-    uint32_t EIP_reg;
+    uint32_t EIP_reg, sp;
+    exec_args_t args;
 
-    /* arguments array for child */
-    int8_t **argv = kmalloc(MAXARGS * sizeof(int8_t*));
-    for (i = 0; i < MAXARGS; ++i)
-        argv[i] = kmalloc(ARGSIZE);
+    if ((errno = args_init(&args)) < 0)
+        return errno;
 
-    /* parse arguments */
-    if ((argc = parse_arg((int8_t *)cmd, argv)) < 0) {
-        kfree(argv);
-        return argc;
+    /* parse arguments, the environment is inherited */
+    if ((errno = parse_arg((int8_t *)cmd, &args)) < 0 ||
+        (errno = copy_env(parent, &args)) < 0) {
+        args_free(&args);
+        return errno;
+    }
+
+    if (strlen(args.page) >= COMM_LEN) {
+        args_free(&args);
+        return -ENAMETOOLONG;
     }
 
     /* create process */
     if ((errno = process_create(parent, kthread)) < 0) {
-        kfree(argv);
+        args_free(&args);
         return errno;
     }
     
     /* get child thread */
     child = parent->children[parent->n_children - 1];
 
-    child->argc = argc;
-    child->argv = argv;
-
+    strcpy(child->comm, args.page);
 
     /* map the virtual memory space to to child */
     __umap(parent, child);
 
-    /* executable check and load program image into user's memory */
-    if ((errno = pro_loader(argv[0], &EIP_reg, child)) < 0) {
+    /* executable check and load program image into user's memory,
+     * then put the arguments on its stack */
+    if ((errno = pro_loader(child->comm, &EIP_reg, child)) < 0 ||
+        !(sp = setup_arg_stack(child, &args))) {
+        args_free(&args);
         process_free(child);
-        return errno;
+        return (errno < 0) ? errno : -ENOMEM;
     }
 
+    args_free(&args);
+
     /* unmap user space when creating kernel threads */
     if (kthread)
         user_mem_unmap(child);
@@ -417,12 +849,15 @@ static int32_t __exec(thread_t *parent, const int8_t *cmd, uint8_t kthread) {
         return errno;
     }
 
+    /* a new program starts with the default signal actions */
+    flush_signal_handlers(child);
+
     /* store registers */
     child->usreip = EIP_reg;
-    child->usresp = USER_STACK_ADDR;
+    child->usresp = sp;
 
     /* update nice values */
-    if (!strcmp(argv[0], SHELL))
+    if (!strcmp(child->comm, SHELL))
         child->nice = NICE_SHELL;
     else
         child->nice = NICE_NORMAL;
@@ -434,6 +869,47 @@ static int32_t __exec(thread_t *parent, const int8_t *cmd, uint8_t kthread) {
 }
 
 
+/**
+ * @brief Copy the arguments of the current program (without the program 
+ * name) into buf, separated by spaces
+ * 
+ * @param buf : a buffer from user
+ * @param nbytes : size of buf
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+int32_t do_getargs(uint8_t *buf, int32_t nbytes) {
+    thread_t *curr;
+    int8_t *arg, *end;
+    int32_t i, n;
+
+    GETPRO(curr);
+
+    if (!buf)
+        return -EFAULT;
+
+    /* skip the program name */
+    arg = (int8_t *)curr->arg_start;
+    end = (int8_t *)curr->arg_end;
+    if (arg == end)
+        return -EINVAL;
+    arg += strlen(arg) + 1;
+
+    /* no arguments */
+    if (arg >= end)
+        return -EINVAL;
+
+    /* the arguments and the terminating NUL must fit */
+    if ((n = end - arg) > nbytes)
+        return -E2BIG;
+
+    memcpy(buf, arg, n);
+    for (i = 0; i < n - 1; ++i)
+        if (!buf[i]) buf[i] = ' ';
+
+    return 0;
+}
+
+
 /**
  * @brief returns the process ID (PID) of the calling process
  * 
@@ -447,51 +923,338 @@ pid_t do_getpid(void) {
 
 
 /**
- * @brief parse the command line arguments 
+ * @brief find a task by its process id
  * 
- * @param cmd : command line
- * @param argv : array of strings to be set to the arguments
+ * @param pid : process id
+ * @return thread_t* : the task, or NULL if no such task
+ */
+thread_t *find_task_by_pid(pid_t pid) {
+    list_head *node;
+    thread_t *t;
+
+    list_for_each(node, &task_queue) {
+        t = list_entry(node, thread_t, task_node);
+        if (t->pid == pid && t->state != EXITED)
+            return t;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief check if a directory is the current directory of a task
  * 
+ * @param inode : inode of the directory
+ * @return int32_t : 1 if a task that has not exited is in it, 0 otherwise
+ */
+int32_t cwd_in_use(uint32_t inode) {
+    list_head *node;
+    thread_t *t;
+
+    list_for_each(node, &task_queue) {
+        t = list_entry(node, thread_t, task_node);
+        if (t->cwd == inode && t->state != EXITED && t->state != ZOMIBIE)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief set the nice value of a process
+ * 
+ * A process can only change the processes of its own console, and only
+ * a shell (or a child of it before execv) can lower a nice value.
+ * 
+ * @param which : PRIO_PROCESS (process groups and users are not supported)
+ * @param who : process id, 0 for the calling process
+ * @param nice : new nice value, clamped into [MIN_NICE, MAX_NICE]
  * @return int32_t : positive or 0 denote success, negative values denote an error condition
  */
-static int32_t parse_arg(int8_t *cmd, int8_t *argv[]) {
-    char *delim;                    /* points to the first space delimiter */
-    int argc;                       /* number of arguments */
-    int8_t buf[strlen(cmd) + 2];    /* buffer that contains command line */
+int32_t do_setpriority(int32_t which, pid_t who, int32_t nice) {
+    thread_t *curr;
+    thread_t *t;
 
-    if (!cmd) return -1;
+    if (which != PRIO_PROCESS)
+        return -EINVAL;
 
-    strcpy(buf, cmd);
-    cmd = buf;
+    GETPRO(curr);
 
-    /* replace trailing \n with space */
-    if ((cmd[strlen(cmd) - 1] == '\n') || (cmd[strlen(cmd) - 1] == '\r'))
-        cmd[strlen(cmd) - 1] = ' ';
-    else
-        cmd[strlen(cmd)] = ' ';
+    if (!who)
+        t = curr;
+    else if (!(t = find_task_by_pid(who)))
+        return -ESRCH;
+
+    /* idle, init and kernel threads keep the priority given by the kernel */
+    if (t->pid < TASKSTART || t->console_id == NO_CONSOLE)
+        return -EPERM;
+
+    /* the tasks of another console are not ours */
+    if (t->console_id != curr->console_id)
+        return -EPERM;
+
+    if (nice < MIN_NICE) nice = MIN_NICE;
+    if (nice > MAX_NICE) nice = MAX_NICE;
 
-    /* skipping leading spaces */
-    while (*cmd && (*cmd == ' ')) ++cmd;
+    /* more CPU time is only given by the user through a shell */
+    if (nice < t->nice && strcmp(curr->comm, SHELL) && strcmp(curr->comm, BSH))
+        return -EACCES;
 
-    /* build the argv list */
-    argc = 0;
-    while ((delim = strchr(cmd, ' '))) {
-        if (argc == MAXARGS) return -1;
-        /* copy argument */
-        *delim = '\0';
-        strcpy(argv[argc++], cmd);
-        cmd = delim + 1;
+    set_user_nice(t, nice);
+
+    return 0;
+}
+
+
+/**
+ * @brief get the nice value of a process
+ * 
+ * To not collide with error codes, the value returned is 20 - nice,
+ * in the range [1, 40]; the library converts it back.
+ * 
+ * @param which : PRIO_PROCESS (process groups and users are not supported)
+ * @param who : process id, 0 for the calling process
+ * @return int32_t : 20 - nice on success, negative values denote an error condition
+ */
+int32_t do_getpriority(int32_t which, pid_t who) {
+    thread_t *t;
+
+    if (which != PRIO_PROCESS)
+        return -EINVAL;
+
+    if (!who)
+        GETPRO(t);
+    else if (!(t = find_task_by_pid(who)))
+        return -ESRCH;
+
+    return PRIO_BIAS - t->nice;
+}
+
+
+/**
+ * @brief set the scheduling policy of a process
+ * 
+ * @param pid : process id, 0 for the calling process
+ * @param policy : SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+ * @param prio : real-time priority [1, 99] for SCHED_FIFO and SCHED_RR, 0 for SCHED_NORMAL
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+int32_t do_sched_setscheduler(pid_t pid, int32_t policy, int32_t prio) {
+    thread_t *t;
+
+    switch (policy) {
+        case SCHED_NORMAL:
+            if (prio) return -EINVAL;
+            break;
+        case SCHED_FIFO:
+        case SCHED_RR:
+            if (prio < 1 || prio > MAX_RT_PRIO - 1) return -EINVAL;
+            break;
+        default:
+            return -EINVAL;
+    }
 
+    if (!pid)
+        GETPRO(t);
+    else if (!(t = find_task_by_pid(pid)))
+        return -ESRCH;
+
+    /* idle and init keep the policy given by the kernel */
+    if (t->pid < TASKSTART)
+        return -EPERM;
+
+    sched_setscheduler(t, policy, prio);
+
+    return 0;
+}
+
+
+/**
+ * @brief set up the buffer collecting the strings of a new program
+ * 
+ * @param args : the buffer
+ * @return int32_t : 0 on success, -ENOMEM if out of memory
+ */
+static int32_t args_init(exec_args_t *args) {
+    if (!(args->page = get_page(0)))
+        return -ENOMEM;
+
+    args->len = 0;
+    args->argc = 0;
+    args->envc = 0;
+    return 0;
+}
+
+
+/**
+ * @brief free the buffer collecting the strings of a new program
+ * 
+ * @param args : the buffer
+ */
+static void args_free(exec_args_t *args) {
+    free_page(args->page, 0);
+}
+
+
+/**
+ * @brief append a string to the buffer
+ * 
+ * @param args : the buffer
+ * @param str : the string
+ * @param n : length of str, without the NUL
+ * @return int32_t : 0 on success, -E2BIG if the strings exceed ARG_MAX
+ */
+static int32_t args_add(exec_args_t *args, const int8_t *str, uint32_t n) {
+    if (args->len + n + 1 > ARG_MAX)
+        return -E2BIG;
+
+    memcpy(args->page + args->len, str, n);
+    args->page[args->len + n] = '\0';
+    args->len += n + 1;
+    return 0;
+}
+
+
+/**
+ * @brief append the strings of a user array (argv or envp) to the buffer
+ * 
+ * @param args : the buffer
+ * @param v : array of strings terminated by NULL, or NULL
+ * @param count : incremented for each string
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+static int32_t copy_strings(exec_args_t *args, int8_t *const v[], int32_t *count) {
+    int32_t errno;
+
+    if (!v)
+        return 0;
+    if (!user_ptr_ok(v))
+        return -EFAULT;
+
+    for (; *v; ++v) {
+        if (!user_ptr_ok(*v))
+            return -EFAULT;
+        if ((errno = args_add(args, *v, strlen(*v))) < 0)
+            return errno;
+        (*count)++;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief append the environment of a program to the buffer, its 
+ * address space must be the mapped one
+ * 
+ * @param from : thread whose environment is copied
+ * @param args : the buffer
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+static int32_t copy_env(thread_t *from, exec_args_t *args) {
+    int8_t *env;
+    uint32_t n;
+    int32_t errno;
+
+    for (env = (int8_t *)from->env_start; env < (int8_t *)from->env_end; env += n + 1) {
+        n = strlen(env);
+        if ((errno = args_add(args, env, n)) < 0)
+            return errno;
+        args->envc++;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief split a command line into arguments separated by spaces
+ * 
+ * @param cmd : command line
+ * @param args : buffer the arguments are appended to
+ * @return int32_t : number of arguments, negative values denote an error condition
+ */
+static int32_t parse_arg(int8_t *cmd, exec_args_t *args) {
+    uint32_t n;
+    int32_t errno;
+
+    if (!cmd) return -1;
+
+    while (*cmd) {
         /* skipping leading spaces */
-        while (*cmd && (*cmd == ' ')) ++cmd;
+        while (*cmd == ' ') ++cmd;
+
+        /* the line ends with a new line */
+        for (n = 0; cmd[n] && cmd[n] != ' ' && cmd[n] != '\n' && cmd[n] != '\r'; ++n)
+            ;
+        if (n) {
+            if ((errno = args_add(args, cmd, n)) < 0)
+                return errno;
+            args->argc++;
+        }
+
+        cmd += n;
+        if (*cmd == '\n' || *cmd == '\r')
+            break;
     }
 
     /* blank line */
-    if (!argc) return -1;
+    if (!args->argc) return -1;
 
-    argv[argc] = NULL;
-    
-    return argc;
+    return args->argc;
+}
+
+
+/**
+ * @brief lay out the arguments and the environment at the top of the 
+ * user stack of a new program, the address space of t must be the 
+ * mapped one:
+ * 
+ *     USER_STACK_ADDR ->  strings of argv, then of envp
+ *                         NULL
+ *                         envp[]
+ *                         NULL
+ *                         argv[]
+ *     esp             ->  argc
+ * 
+ * @param t : thread running the new program
+ * @param args : the strings
+ * @return uint32_t : the initial user esp, 0 if out of memory
+ */
+static uint32_t setup_arg_stack(thread_t *t, exec_args_t *args) {
+    uint32_t str, sp, *p;
+    int32_t i;
+
+    str = USER_STACK_ADDR - args->len;
+    sp = (str - (args->argc + args->envc + 3) * sizeof(uint32_t)) & ~0xF;
+
+    if (expand_stack(t->vm, sp) < 0)
+        return 0;
+
+    memcpy((void *)str, args->page, args->len);
+
+    p = (uint32_t *)sp;
+    *p++ = args->argc;
+
+    t->arg_start = str;
+    for (i = 0; i < args->argc; ++i) {
+        *p++ = str;
+        str += strlen((int8_t *)str) + 1;
+    }
+    *p++ = 0;
+    t->arg_end = str;
+
+    t->env_start = str;
+    for (i = 0; i < args->envc; ++i) {
+        *p++ = str;
+        str += strlen((int8_t *)str) + 1;
+    }
+    *p++ = 0;
+    t->env_end = str;
+
+    return sp;
 }
 
 
@@ -540,9 +1303,34 @@ static int32_t process_create(thread_t *current, uint8_t kthread) {
     /* not a kernel thread */
     t->kthread = kthread;
 
+    /* scheduling policy is inherited */
+    t->policy = current->policy;
+    t->rt_priority = current->rt_priority;
+
     t->state = UNUSED;
 
-    process_vm_init(&t->vm);
+    /* no FPU save area until the first FPU instruction */
+    t->fpu = NULL;
+    t->fpu_buf = NULL;
+    t->used_math = 0;
+
+    t->vfork_done = NULL;
+
+    /* it starts inside the kernel, where the lock is held, 
+     * on the CPU sched_fork() chooses */
+    t->lock_depth = 1;
+    t->cpu = current->cpu;
+
+    /* the current directory is inherited */
+    t->cwd = current->cwd;
+
+    init_waitqueue_head(&t->wait_chldexit);
+    t->exit_code = 0;
+
+    /* handlers and the blocked mask are inherited, nothing is pending */
+    signal_init(t, current);
+
+    t->vm = vm_alloc();
 
     list_add_tail(&t->task_node, &task_queue);
 
@@ -565,11 +1353,8 @@ void process_free(thread_t *current) {
 
     kill_pid(current->pid);
     kfree(current->context);
-    kfree(current->fds);
-
-    for (i = 0; i < MAXARGS; ++i)
-        kfree(current->argv[i]);
-    kfree(current->argv);
+    put_files(current);
+    fpu_release(current);
 
     if (current->children) {
         for (i = 0; i < current->max_children; ++i)
@@ -582,6 +1367,8 @@ void process_free(thread_t *current) {
         update_tss(parent);
     }
 
+    put_vm(current->vm);
+
     list_del(&current->task_node);
 
     free_kstack((void*)current);
@@ -606,6 +1393,11 @@ static inline void switch_to_user(thread_t *curr) {
     
     update_tss(curr);
 
+    /* the kernel stack is dropped, and the lock with it; 
+     * no interrupt until iret */
+    cli();
+    release_kernel_lock(curr);
+
     asm volatile ("                         \n\
                     andl  $0xFF,  %%eax     \n\
                     movw  %%ax,   %%ds      \n\
@@ -632,8 +1424,10 @@ static inline void switch_to_user(thread_t *curr) {
  * @param _pid : process id
  */
 static inline void update_tss(thread_t *curr) {
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = get_esp0(curr);
+    tss_t *t = this_cpu()->tss;
+
+    t->ss0 = KERNEL_DS;
+    t->esp0 = get_esp0(curr);
 }
 
 
@@ -672,6 +1466,7 @@ static void console_init(void) {
         console->fkey = keys[i];
         console->task = shell;
         console->vidmap = (uint8_t*)(VIR_VID_MEM + VIDEO + PAGE_SIZE * i);
+        console->tg = sched_create_group();
         consoles[i] = console;
         shell->console_id = console->id;
         shell->terminal = terminal_create();
@@ -680,18 +1475,23 @@ static void console_init(void) {
         memset(shell->terminal->saved_vidmem, 0, PAGE_SIZE);
     }
 
+    /* start the worker for deferred interrupt work */
+    workqueue_init();
+
     shell = init->children[0];
-    shell->sched_info.on_rq = 1;
     shell->state = RUNNABLE;
     current = consoles[0];
-    rq->current = &shell->sched_info;
 
 
-    /* give the first shell vga memory */
+    /* give the first shell vga memory, on an empty screen */
     shell->terminal->vidmem = video_mem;
+    vga_clear(video_mem, &shell->terminal->top);
 
     sched_fork(shell);
-    // activate_task(shell);
+    activate_task(shell);
+
+    /* shell takes over the CPU from init */
+    set_curr_task(shell);
 
     user_mem_map(shell);
 
@@ -0,0 +1,252 @@
+/**
+ * @file rt.c
+ * @brief Real-time scheduling class (SCHED_FIFO and SCHED_RR).
+ * @overview:
+ * Real-time tasks have a fixed priority from 1 to 99 and always run
+ * before CFS tasks. Tasks of the same priority are kept in a FIFO queue.
+ * A SCHED_FIFO task runs until it sleeps or a higher priority task wakes
+ * up, a SCHED_RR task also goes to the tail of its queue every RR_TIMESLICE.
+ *
+ * To keep a runaway real-time task from locking out the shells, real-time
+ * tasks can only run RT_RUNTIME out of every RT_PERIOD. When they used up
+ * their runtime, the class is throttled and CFS runs until the next period.
+ * A throttled task still runs when CFS has nothing to run, rather than
+ * leave the CPU to process 0.
+ *
+ * Each CPU has its own real-time run queue and throttling period, for
+ * the real-time tasks that sched_fork() put on it.
+ *
+ * @reference:
+ * Love, Robert, Linux Kernel Development (Chapter 4, Real-Time Scheduling Policies)
+ *
+ * Linux Documentation
+ * https://www.kernel.org/doc/Documentation/scheduler/sched-rt-group.txt
+ *
+ */
+
+#include <pro/rt.h>
+#include <pro/cfs.h>
+#include <pro/process.h>
+#include <drivers/time.h>
+#include <lib.h>
+
+
+/* the run queues containing the runnable real-time threads of each CPU */
+rt_rq_t rt_runqueues[NR_CPUS];
+
+
+static inline uint32_t rt_prio_index(thread_t *task);
+static inline int32_t sched_find_first_bit(const uint32_t *bitmap);
+
+
+/**
+ * @brief init a real-time run queue
+ *
+ * @param q : run queue
+ */
+void init_rt_rq(rt_rq_t *q) {
+    int i;
+
+    for (i = 0; i < RT_BITMAP_SIZE; ++i)
+        q->bitmap[i] = 0;
+
+    for (i = 0; i < MAX_RT_PRIO; ++i) {
+        q->queue[i].next = &q->queue[i];
+        q->queue[i].prev = &q->queue[i];
+    }
+
+    q->nr_running = 0;
+    q->rt_time = 0;
+    q->period_start = 0;
+    q->rt_throttled = 0;
+}
+
+
+/**
+ * @brief add a real-time task to the tail of the queue of its priority
+ *
+ * @param task : task info
+ */
+void enqueue_task_rt(thread_t *task) {
+    rt_rq_t *q = cpu_rt_rq(task->cpu);
+    rt_sched_t *rt = &task->rt_info;
+    uint32_t idx = rt_prio_index(task);
+
+    if (rt->on_rq) return;
+
+    list_add_tail(&rt->run_list, &q->queue[idx]);
+    q->bitmap[idx >> 5] |= (1U << (idx & 31));
+    q->nr_running++;
+    rt->on_rq = 1;
+
+    if (task->policy == SCHED_RR && !rt->time_slice)
+        rt->time_slice = RR_TIMESLICE;
+
+    /* a real-time task preempts normal tasks and lower priorities */
+    check_preempt_curr_rt(task);
+}
+
+
+/**
+ * @brief remove a real-time task from its queue
+ *
+ * @param task : task info
+ */
+void dequeue_task_rt(thread_t *task) {
+    rt_rq_t *q = cpu_rt_rq(task->cpu);
+    rt_sched_t *rt = &task->rt_info;
+    uint32_t idx = rt_prio_index(task);
+
+    if (!rt->on_rq) return;
+
+    list_del(&rt->run_list);
+
+    /* no more tasks of this priority */
+    if (list_empty(&q->queue[idx]))
+        q->bitmap[idx >> 5] &= ~(1U << (idx & 31));
+
+    q->nr_running--;
+    rt->on_rq = 0;
+}
+
+
+/**
+ * @brief pick the first task of the highest non-empty priority
+ * on this CPU
+ *
+ * @return thread_t* : next task, NULL if there is no real-time task
+ * to run or the real-time class is throttled
+ */
+thread_t *pick_next_task_rt(void) {
+    if (cpu_rt_rq(smp_processor_id())->rt_throttled)
+        return NULL;
+
+    return __pick_next_task_rt();
+}
+
+
+/**
+ * @brief pick the first task of the highest non-empty priority
+ * on this CPU, even if the real-time class is throttled
+ *
+ * @return thread_t* : next task, NULL if there is no real-time task
+ */
+thread_t *__pick_next_task_rt(void) {
+    rt_rq_t *q = cpu_rt_rq(smp_processor_id());
+    int32_t idx;
+
+    if (!q->nr_running)
+        return NULL;
+
+    if ((idx = sched_find_first_bit(q->bitmap)) < 0)
+        return NULL;
+
+    return rt_task_of(q->queue[idx].next);
+}
+
+
+/**
+ * @brief set NEED_RESCHED on the task running on the CPU of task
+ * if task should preempt it
+ *
+ * @param task : a real-time task that became runnable
+ */
+void check_preempt_curr_rt(thread_t *task) {
+    thread_t *curr = cpus[task->cpu].curr;
+
+    if (curr == task || cpu_rt_rq(task->cpu)->rt_throttled) return;
+
+    if (!rt_task(curr) || task->rt_priority > curr->rt_priority)
+        resched_cpu(task->cpu);
+}
+
+
+/**
+ * @brief called everytime when a timer interrupt is fired
+ * while a real-time task is running
+ *
+ * @param curr : current task
+ */
+void task_tick_rt(thread_t *curr) {
+    rt_rq_t *q = cpu_rt_rq(curr->cpu);
+    rt_sched_t *rt = &curr->rt_info;
+
+    /* charge the runtime to the real-time class */
+    q->rt_time += TICKUNIT;
+
+    if (q->rt_time > RT_RUNTIME) {
+        /* give the rest of the period to CFS */
+        q->rt_throttled = 1;
+        curr->flag = NEED_RESCHED;
+        return;
+    }
+
+    /* SCHED_FIFO tasks have no time slice */
+    if (curr->policy != SCHED_RR) return;
+
+    if (--rt->time_slice) return;
+
+    rt->time_slice = RR_TIMESLICE;
+
+    /* requeue to the tail if it is not the only task of its priority */
+    if (rt->run_list.prev != rt->run_list.next) {
+        list_del(&rt->run_list);
+        list_add_tail(&rt->run_list, &q->queue[rt_prio_index(curr)]);
+        curr->flag = NEED_RESCHED;
+    }
+}
+
+
+/**
+ * @brief start a new throttling period on this CPU when 
+ * the current one is over
+ *
+ */
+void update_rt_period(void) {
+    uint32_t cpu = smp_processor_id();
+    rt_rq_t *q = cpu_rt_rq(cpu);
+
+    if (sched_clock - q->period_start < RT_PERIOD) return;
+
+    q->period_start = sched_clock;
+    q->rt_time = 0;
+
+    if (q->rt_throttled) {
+        q->rt_throttled = 0;
+
+        /* let the waiting real-time tasks run again */
+        if (q->nr_running) resched_cpu(cpu);
+    }
+}
+
+
+/**
+ * @brief rt_priority[1, 99] => queue index[98, 0]
+ *
+ * @param task : real-time task
+ * @return uint32_t : index into rt_rq_t.queue and bit in rt_rq_t.bitmap
+ */
+static inline uint32_t rt_prio_index(thread_t *task) {
+    return MAX_RT_PRIO - 1 - task->rt_priority;
+}
+
+
+/**
+ * @brief find the first set bit of the priority bitmap
+ *
+ * @param bitmap : bitmap of RT_BITMAP_SIZE words
+ * @return int32_t : index of the bit, -1 if no bit is set
+ */
+static inline int32_t sched_find_first_bit(const uint32_t *bitmap) {
+    int i;
+    uint32_t bit;
+
+    for (i = 0; i < RT_BITMAP_SIZE; ++i) {
+        if (!bitmap[i]) continue;
+
+        asm volatile("bsfl %1, %0" : "=r"(bit) : "rm"(bitmap[i]));
+        return (i << 5) + bit;
+    }
+
+    return -1;
+}
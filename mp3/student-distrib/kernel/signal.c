@@ -0,0 +1,400 @@
+/**
+ * @file signal.c
+ * @brief Signals sent to user programs.
+ * @overview:
+ * A signal is a bit in the pending mask of the target thread. It is set
+ * by send_sig() (CTRL+C on the console) or force_sig() (an exception in
+ * user mode), and acted on by do_signal(), which handler.S calls every
+ * time the thread is about to return to user mode: at the end of a
+ * system call, an exception or an interrupt. A thread busy in user mode
+ * sees the signal at the next timer tick.
+ *
+ * If the program set a handler with set_handler(), a frame is pushed on
+ * the user stack and the thread returns to the handler instead:
+ *
+ *     user esp -> ret         : address of code below
+ *                 signum      : argument of the handler
+ *                 regs        : registers of the interrupted program
+ *                 blocked     : blocked mask to restore
+ *                 code        : movl $NR_SIGRETURN, %eax; int $0x80
+ *
+ * When the handler returns, the code calls sigreturn, which copies regs
+ * back to the kernel stack, so the program goes on where it was stopped.
+ * The signal is blocked while its handler runs. This is the layout the
+ * ECE391 sigtest program expects (eax is at &signum + 7).
+ *
+ * Otherwise the default action is taken: exceptions dump the registers
+ * and kill the program, CTRL+C kills it, the others are ignored. A
+ * killed program exits with status 256, as in ECE391 for exceptions.
+ *
+ * A thread sleeping in the kernel is only woken up by a signal if the
+ * sleep can be interrupted (pipes, futexes, terminal read), the sleep
+ * then returns -EINTR and the signal is acted on before the thread
+ * gets back to user mode.
+ *
+ * @reference:
+ * Bovet, Daniel P. and Cesati, Marco, Understanding the Linux Kernel (Chapter 11, Signals)
+ *
+ */
+
+#include <pro/signal.h>
+#include <pro/process.h>
+#include <boot/x86_desc.h>
+#include <boot/page.h>
+#include <access.h>
+#include <errno.h>
+#include <lib.h>
+
+
+#define SIG_KILL        0               /* default action: exit */
+#define SIG_DUMP        1               /* default action: dump registers, exit */
+#define SIG_IGNORE      2               /* default action: nothing */
+
+#define SIG_STATUS      256             /* exit status of a killed program */
+
+/* eflags bits a handler may change (CF PF AF ZF SF TF DF OF AC) */
+#define FIX_EFLAGS      0x40DD5
+#define DF_MASK         0x400
+
+static const uint8_t default_action[NSIG] = {
+    SIG_DUMP,       /* DIV_ZERO */
+    SIG_DUMP,       /* SEGFAULT */
+    SIG_KILL,       /* INTERRUPT */
+    SIG_IGNORE,     /* ALARM */
+    SIG_IGNORE      /* USER1 */
+};
+
+static const char *signal_name[NSIG] = {
+    "DIV_ZERO", "SEGFAULT", "INTERRUPT", "ALARM", "USER1"
+};
+
+/* movl $NR_SIGRETURN, %eax; int $0x80; nop */
+static const uint8_t sigreturn_code[8] = {
+    0xB8, NR_SIGRETURN, 0x00, 0x00, 0x00, 0xCD, 0x80, 0x90
+};
+
+
+static int32_t setup_frame(thread_t *curr, int32_t sig, pt_regs_t *regs);
+static void default_signal(thread_t *curr, int32_t sig, pt_regs_t *regs);
+static inline int32_t user_addr_ok(uint32_t addr);
+
+
+/* atomically set bit nr of *addr */
+static inline void set_bit(int32_t nr, volatile uint32_t *addr) {
+    asm volatile ("lock; btsl %1, %0" : "+m"(*addr) : "Ir"(nr) : "memory", "cc");
+}
+
+/* atomically clear bit nr of *addr, return its old value */
+static inline int32_t test_and_clear_bit(int32_t nr, volatile uint32_t *addr) {
+    int32_t old;
+    asm volatile ("lock; btrl %2, %1; sbbl %0, %0"
+                : "=r"(old), "+m"(*addr)
+                : "Ir"(nr)
+                : "memory", "cc");
+    return old;
+}
+
+/* index of the lowest set bit, word must not be 0 */
+static inline int32_t __ffs(uint32_t word) {
+    asm ("bsfl %1, %0" : "=r"(word) : "rm"(word));
+    return word;
+}
+
+
+/**
+ * @brief set up the signal state of a new thread: handlers and the
+ * blocked mask are inherited, nothing is pending
+ *
+ * @param t : new thread
+ * @param parent : thread it is created from
+ */
+void signal_init(thread_t *t, thread_t *parent) {
+    int i;
+
+    t->sigpending = 0;
+    t->sigsleep = 0;
+    t->sigblocked = parent->sigblocked;
+    for (i = 0; i < NSIG; ++i)
+        t->sighand[i] = parent->sighand[i];
+}
+
+
+/**
+ * @brief go back to the default actions (a new program is run), the
+ * handlers of the old program are not in memory anymore
+ *
+ * @param t : thread
+ */
+void flush_signal_handlers(thread_t *t) {
+    int i;
+
+    t->sigblocked = 0;
+    for (i = 0; i < NSIG; ++i)
+        t->sighand[i] = SIG_DFL;
+}
+
+
+/**
+ * @brief check if a signal is waiting to be acted on
+ *
+ * @param t : thread
+ * @return int32_t : non zero if a signal that is not blocked is pending
+ */
+int32_t signal_pending(thread_t *t) {
+    return t->sigpending & ~t->sigblocked;
+}
+
+
+/**
+ * @brief send a signal to a user thread
+ *
+ * The signal is acted on when t returns to user mode. If t is in an
+ * interruptible sleep, it is woken up.
+ *
+ * @param sig : signal number
+ * @param t : target thread
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+int32_t send_sig(int32_t sig, thread_t *t) {
+    if (sig < 0 || sig >= NSIG)
+        return -EINVAL;
+
+    /* idle, init and kernel threads never go back to user mode */
+    if (t->pid < TASKSTART || t->console_id == NO_CONSOLE)
+        return -EPERM;
+
+    /* nothing would happen */
+    if (!t->sighand[sig] && default_action[sig] == SIG_IGNORE)
+        return 0;
+
+    set_bit(sig, &t->sigpending);
+
+    if (t->sigsleep)
+        wake_up_process(t);
+
+    return 0;
+}
+
+
+/**
+ * @brief send a signal the thread cannot hold back (an exception): if
+ * the signal is blocked, its handler faulted, so the default action is
+ * taken instead
+ *
+ * @param sig : signal number
+ * @param t : target thread
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+int32_t force_sig(int32_t sig, thread_t *t) {
+    if (sig < 0 || sig >= NSIG)
+        return -EINVAL;
+
+    if (t->sigblocked & sigmask(sig)) {
+        t->sighand[sig] = SIG_DFL;
+        t->sigblocked &= ~sigmask(sig);
+    }
+
+    return send_sig(sig, t);
+}
+
+
+/**
+ * @brief send a signal to the programs running on a console, the
+ * shells are left alone so that CTRL+C gives the prompt back
+ *
+ * @param id : console id
+ * @param sig : signal number
+ */
+void kill_console(uint32_t id, int32_t sig) {
+    list_head *node;
+    thread_t *t;
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    list_for_each(node, &task_queue) {
+        t = list_entry(node, thread_t, task_node);
+
+        if (t->console_id != id || t->kthread || t->pid < TASKSTART)
+            continue;
+        if (t->state == UNUSED || t->state == EXITED || t->state == ZOMIBIE)
+            continue;
+        if (!strcmp(t->comm, SHELL) || !strcmp(t->comm, BSH))
+            continue;
+
+        send_sig(sig, t);
+    }
+
+    restore_flags(flags);
+}
+
+
+/**
+ * @brief act on the pending signals of the current thread, called by
+ * handler.S before returning to user mode
+ *
+ * At most one handler is set up at a time, the other signals are
+ * acted on when it returns through sigreturn.
+ *
+ * @param regs : user registers on the kernel stack
+ */
+asmlinkage void do_signal(pt_regs_t *regs) {
+    thread_t *curr;
+    uint32_t pending;
+    int32_t sig;
+
+    GETPRO(curr);
+
+    while ((pending = curr->sigpending & ~curr->sigblocked)) {
+        sig = __ffs(pending);
+
+        if (!test_and_clear_bit(sig, &curr->sigpending))
+            continue;
+
+        if (!curr->sighand[sig]) {
+            default_signal(curr, sig, regs);
+            continue;
+        }
+
+        /* no room for the frame: the stack is gone */
+        if (setup_frame(curr, sig, regs) < 0) {
+            curr->sighand[SEGFAULT] = SIG_DFL;
+            default_signal(curr, SEGFAULT, regs);
+        }
+        return;
+    }
+}
+
+
+/**
+ * @brief set the handler of a signal
+ *
+ * @param signum : signal number
+ * @param handler : user function called as handler(signum), NULL for
+ * the default action
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+int32_t do_set_handler(int32_t signum, void *handler) {
+    thread_t *curr;
+
+    if (signum < 0 || signum >= NSIG)
+        return -EINVAL;
+
+    if (handler && !user_addr_ok((uint32_t)handler))
+        return -EFAULT;
+
+    GETPRO(curr);
+    curr->sighand[signum] = handler;
+
+    return 0;
+}
+
+
+/**
+ * @brief return from a handler: restore the registers saved in the
+ * frame on the user stack
+ *
+ * @param regs : user registers on the kernel stack
+ * @return int32_t : eax of the interrupted program (the system call
+ * path stores the return value into eax)
+ */
+int32_t do_sigreturn(pt_regs_t *regs) {
+    thread_t *curr;
+    sigframe_t *frame;
+    uint32_t eflags;
+
+    GETPRO(curr);
+
+    /* the handler returned: ret was popped */
+    frame = (sigframe_t *)(regs->esp - sizeof(uint32_t));
+
+    /* a bad esp is the program's fault, not a kernel page fault */
+    if (!user_addr_ok((uint32_t)frame) ||
+        !user_access_ok(curr->vm, (uint32_t)frame, sizeof(sigframe_t), VM_READ)) {
+        force_sig(SEGFAULT, curr);
+        return -EFAULT;
+    }
+
+    /* the handler may change the registers, but not the privilege */
+    eflags = regs->eflags;
+    *regs = frame->regs;
+    regs->eflags = (eflags & ~FIX_EFLAGS) | (frame->regs.eflags & FIX_EFLAGS);
+    regs->cs = USER_CS;
+    regs->ss = regs->ds = regs->es = USER_DS;
+    regs->orig_eax = -1;
+
+    curr->sigblocked = frame->blocked;
+
+    return regs->eax;
+}
+
+
+/**
+ * @brief push a signal frame on the user stack and return to the handler
+ *
+ * @param curr : current thread
+ * @param sig : signal number
+ * @param regs : user registers on the kernel stack
+ * @return int32_t : 0 on success, -EFAULT if the user stack is not usable
+ */
+static int32_t setup_frame(thread_t *curr, int32_t sig, pt_regs_t *regs) {
+    sigframe_t *frame;
+
+    /* the handler starts like a called function: esp + 4 16-byte aligned */
+    frame = (sigframe_t *)(((regs->esp - sizeof(sigframe_t)) & ~0xF) - sizeof(uint32_t));
+
+    /* the pages must be there and writable (the stack may grow) */
+    if (!user_addr_ok((uint32_t)frame) ||
+        !user_access_ok(curr->vm, (uint32_t)frame, sizeof(sigframe_t), VM_WRITE))
+        return -EFAULT;
+
+    frame->ret = (uint32_t)frame->code;
+    frame->signum = sig;
+    frame->regs = *regs;
+    frame->blocked = curr->sigblocked;
+    memcpy(frame->code, sigreturn_code, sizeof(sigreturn_code));
+
+    curr->sigblocked |= sigmask(sig);
+
+    regs->esp = (uint32_t)frame;
+    regs->eip = (uint32_t)curr->sighand[sig];
+    regs->eflags &= ~DF_MASK;
+
+    return 0;
+}
+
+
+/**
+ * @brief take the default action of a signal
+ *
+ * @param curr : current thread
+ * @param sig : signal number
+ * @param regs : user registers on the kernel stack
+ */
+static void default_signal(thread_t *curr, int32_t sig, pt_regs_t *regs) {
+    switch (default_action[sig]) {
+    case SIG_DUMP:
+        printf("%s: pid %d (%s)\n", signal_name[sig], curr->pid, curr->comm);
+        printf("eip: %x  esp: %x  eflags: %x\n", regs->eip, regs->esp, regs->eflags);
+        printf("eax: %x  ebx: %x  ecx: %x  edx: %x\n", regs->eax, regs->ebx, regs->ecx, regs->edx);
+        printf("esi: %x  edi: %x  ebp: %x\n", regs->esi, regs->edi, regs->ebp);
+        /* fall through */
+    case SIG_KILL:
+        cli();
+        do_exit(SIG_STATUS);
+        break;
+    default:
+        break;
+    }
+}
+
+
+/**
+ * @brief check that addr is in the user part of the address space
+ *
+ * @param addr : user address
+ * @return int32_t : 1 if it is
+ */
+static inline int32_t user_addr_ok(uint32_t addr) {
+    return addr >= VIR_MEM_BEGIN && addr < USER_STACK_ADDR + sizeof(uint32_t);
+}
@@ -0,0 +1,659 @@
+/**
+ * @file smp.c
+ * @brief Bring up the application processors (APs).
+ * @overview:
+ * The BIOS starts only the bootstrap processor (BSP), the other CPUs wait
+ * for an INIT and two STARTUP IPIs from the local APIC of the BSP. The
+ * CPUs are listed in the MP configuration table, found through the MP
+ * floating pointer in the first KB of the EBDA, the last KB of base memory
+ * or the BIOS ROM.
+ *
+ * Each AP starts in real mode at TRAMPOLINE_ADDR (trampoline.S), switches
+ * to protected mode and enters ap_start() on its own 8KB kernel stack. It
+ * turns on paging with its own page directory, loads its own GDT (a copy
+ * of the BSP's with its own TSS) and the shared IDT, enables its local
+ * APIC and reports online. Once the scheduler is up it becomes process 0
+ * of its CPU and runs tasks from its own run queues.
+ *
+ * The kernel mappings are the same in every page directory (the entries
+ * below 64MB and the page tables they point to are shared). The user
+ * pages of a task are mapped by the CPU that runs it into its own page
+ * directory, so each CPU has its own copy of the VIR_VID_MEM page table,
+ * which also holds its own vDSO page.
+ *
+ * The kernel was written for one CPU, with cli() as its lock. Rather than
+ * audit every driver, only one CPU runs kernel code at a time: the kernel
+ * lock is taken on every entry from user mode (system calls, exceptions,
+ * interrupts) and released on the way back. A task may take it again
+ * while holding it (lock_depth counts), and keeps it across a context
+ * switch: the task switched to resumes inside the kernel, where it held
+ * the lock too. User code runs on all CPUs in parallel, which is what
+ * CPU-bound tasks need.
+ *
+ * Only the BSP gets the PIT and device interrupts. It sends every timer
+ * tick on to the APs with an IPI, which also carries reschedule requests
+ * and TLB flushes (one vector, the reasons are bits in ipi_pending).
+ *
+ * @reference:
+ * Intel MultiProcessor Specification, Version 1.4
+ * (Appendix B.4, Application Processor Startup)
+ *
+ * xv6, a simple Unix-like teaching operating system (mp.c, lapic.c)
+ *
+ */
+
+#include <boot/smp.h>
+#include <boot/x86_desc.h>
+#include <boot/page.h>
+#include <boot/idt.h>
+#include <boot/fpu.h>
+#include <boot/vdso.h>
+#include <pro/process.h>
+#include <access.h>
+#include <kmalloc.h>
+#include <spinlock.h>
+#include <errno.h>
+#include <lib.h>
+
+
+#define TRAMP(sym)      (TRAMPOLINE_ADDR + ((uint8_t *)(sym) - trampoline_start))
+#define BDA_EBDA        0x40E           /* BIOS data area: segment of the EBDA */
+#define BDA_BASEMEM     0x413           /* BIOS data area: KB of base memory */
+#define BIOS_ROM        0xF0000         /* BIOS ROM, 64KB */
+#define LOW_MEM_PAGES   256             /* pages below 1MB */
+#define AP_TIMEOUT      100000          /* us to wait for an AP to come online */
+
+
+/* per-CPU data, cpus[0] is the BSP, which uses the tables of x86_desc.S */
+cpu_t cpus[NR_CPUS] = {
+    [0] = {
+        .tss = &tss,
+        .pgdir = page_directory,
+        .vidmap = vidmap_table,
+        .pdesc = pdesc,
+        .online = 1,
+    },
+};
+uint32_t ncpus = 1;                     /* number of CPUs online, cpus[0, ncpus) */
+
+static volatile uint32_t *lapic;        /* local APIC registers */
+static cpu_t *booting;                  /* AP being started */
+static pte_t saved_low[LOW_MEM_PAGES];  /* page table entries below 1MB */
+static volatile uint32_t smp_ready;     /* the scheduler is up, the APs may use it */
+static volatile uint32_t kernel_flag;   /* the kernel lock: 1 while a CPU runs kernel code */
+
+
+static mp_conf_t *mp_config(void);
+static mp_fp_t *mp_search(uint32_t addr, uint32_t len);
+static uint8_t checksum(void *addr, uint32_t len);
+static int32_t boot_ap(cpu_t *cpu);
+static int32_t cpu_mm_init(cpu_t *cpu);
+static void load_cpu_desc(cpu_t *cpu);
+static void smp_send(uint32_t cpu, uint32_t reason);
+static void lapic_map(uint32_t addr);
+static void lapic_ipi(uint8_t apic_id, uint32_t icr);
+static inline uint32_t lapic_read(uint32_t reg);
+static inline void lapic_write(uint32_t reg, uint32_t val);
+static void low_mem_map(void);
+static void low_mem_unmap(void);
+static void udelay(uint32_t us);
+
+
+/**
+ * @brief find the other CPUs and start them, called once by the BSP
+ *
+ */
+void smp_init(void) {
+    mp_conf_t *conf;
+    mp_proc_t *proc;
+    uint8_t *p, *end;
+    uint32_t found = 1;
+
+    /* the MP tables and the AP boot code live below 1MB */
+    low_mem_map();
+
+    if (!(conf = mp_config())) {
+        low_mem_unmap();
+        printf("SMP: no MP configuration table, 1 CPU\n");
+        return;
+    }
+
+    lapic_map(conf->lapicaddr ? conf->lapicaddr : LAPIC_DEFAULT);
+    cpus[0].apic_id = lapic_read(LAPIC_ID) >> 24;
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+
+    /* copy the AP boot code and give it the kernel GDT and entry point */
+    memcpy((void *)TRAMPOLINE_ADDR, trampoline_start, trampoline_end - trampoline_start);
+    asm volatile("sgdt (%0)" : : "r"(TRAMP(trampoline_gdt)) : "memory");
+    *(uint32_t *)TRAMP(trampoline_entry) = (uint32_t)ap_start;
+
+    /* processor entries are 20 bytes, all other entries 8 bytes */
+    p = (uint8_t *)(conf + 1);
+    end = (uint8_t *)conf + conf->length;
+
+    while (p < end) {
+        if (*p != MP_PROC) {
+            p += 8;
+            continue;
+        }
+
+        proc = (mp_proc_t *)p;
+        p += sizeof(mp_proc_t);
+
+        if (!(proc->flags & MP_PROC_ENABLED) || proc->apicid == cpus[0].apic_id)
+            continue;
+
+        found++;
+
+        if (ncpus == NR_CPUS) {
+            printf("SMP: more than %d CPUs, ignoring APIC %d\n", NR_CPUS, proc->apicid);
+            continue;
+        }
+
+        /* a CPU that does not start leaves its slot to the next one */
+        cpus[ncpus].id = ncpus;
+        cpus[ncpus].apic_id = proc->apicid;
+
+        if (boot_ap(&cpus[ncpus]) < 0)
+            printf("SMP: APIC %d did not start\n", proc->apicid);
+        else
+            ncpus++;
+    }
+
+    low_mem_unmap();
+
+    printf("SMP: %d of %d CPUs online\n", ncpus, found);
+}
+
+
+/**
+ * @brief let the APs into the scheduler, called by process 1 once
+ * the run queues are set up. From here on kernel code runs under
+ * the kernel lock.
+ *
+ */
+void smp_start(void) {
+    lock_kernel();
+    smp_ready = 1;
+}
+
+
+/**
+ * @brief C entry point of an AP, called from trampoline.S
+ * with paging off on the AP's own stack
+ *
+ */
+void ap_start(void) {
+    cpu_t *cpu = booting;
+
+    enable_paging(cpu->pgdir);
+
+    load_cpu_desc(cpu);
+    sysenter_init(cpu->tss);
+    fpu_init();
+
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+
+    cpu->online = 1;
+
+    /* the idle task at the bottom of this stack becomes process 0
+     * of this CPU once the scheduler is up */
+    while (!smp_ready)
+        cpu_relax();
+
+    lock_kernel();
+    swapper();
+}
+
+
+/**
+ * @brief the CPU this code runs on
+ *
+ * @return cpu_t* : per-CPU data
+ */
+cpu_t *this_cpu(void) {
+    thread_t *curr;
+
+    /* the BSP runs on the boot stack until the scheduler is up */
+    if (!smp_ready)
+        return &cpus[0];
+
+    GETPRO(curr);
+    return &cpus[curr->cpu];
+}
+
+
+/**
+ * @brief logical id of the CPU this code runs on
+ *
+ * @return uint32_t : 0 for the BSP
+ */
+uint32_t smp_processor_id(void) {
+    return this_cpu()->id;
+}
+
+
+/**
+ * @brief take the kernel lock, or count one more level if the
+ * current task holds it already
+ *
+ */
+void lock_kernel(void) {
+    thread_t *curr;
+    uint32_t flags;
+
+    cli_and_save(flags);
+    GETPRO(curr);
+
+    if (!curr->lock_depth) {
+        while (xchg(&kernel_flag, 1)) {
+            while (kernel_flag)
+                cpu_relax();
+        }
+    }
+
+    curr->lock_depth++;
+
+    restore_flags(flags);
+}
+
+
+/**
+ * @brief drop one level of the kernel lock, and the lock itself
+ * when it was the last one
+ *
+ */
+void unlock_kernel(void) {
+    thread_t *curr;
+    uint32_t flags;
+
+    cli_and_save(flags);
+    GETPRO(curr);
+
+    if (!--curr->lock_depth) {
+        asm volatile ("" : : : "memory");
+        kernel_flag = 0;
+    }
+
+    restore_flags(flags);
+}
+
+
+/**
+ * @brief drop the kernel lock whatever the depth, for a task going 
+ * to user mode without unwinding its kernel stack (interrupts off)
+ *
+ * @param t : task going to user mode
+ */
+void release_kernel_lock(thread_t *t) {
+    t->lock_depth = 0;
+
+    asm volatile ("" : : : "memory");
+    kernel_flag = 0;
+}
+
+
+/**
+ * @brief the IPI handler
+ *
+ */
+void do_ipi(void) {
+    cpu_t *cpu = this_cpu();
+    thread_t *curr;
+    uint32_t reason, flags;
+
+    reason = xchg(&cpu->ipi_pending, 0);
+    lapic_write(LAPIC_EOI, 0);
+
+    /* does not need the kernel lock, so it is not held up by it */
+    if (reason & IPI_FLUSH_TLB)
+        flush_tlb();
+
+    lock_kernel();
+
+    GETPRO(curr);
+
+    if (reason & IPI_TICK) {
+        spin_lock_irqsave(&rq_lock, flags);
+        task_tick(curr);
+        load_balance();
+        spin_unlock_irqrestore(&rq_lock, flags);
+    }
+
+    /* IPI_RESCHEDULE: the sender has set NEED_RESCHED */
+    if (curr->flag == NEED_RESCHED)
+        schedule();
+}
+
+
+/**
+ * @brief make a CPU check for a task to preempt the running one
+ *
+ * @param cpu : the CPU, nothing is sent if it is the current one
+ */
+void smp_send_reschedule(uint32_t cpu) {
+    if (cpu != smp_processor_id())
+        smp_send(cpu, IPI_RESCHEDULE);
+}
+
+
+/**
+ * @brief pass a timer tick on to the other CPUs
+ *
+ */
+void smp_send_tick(void) {
+    uint32_t i, self = smp_processor_id();
+
+    for (i = 0; i < ncpus; ++i) {
+        if (i != self)
+            smp_send(i, IPI_TICK);
+    }
+}
+
+
+/**
+ * @brief make the other CPUs flush their TLB after a change to
+ * a mapping they share. They flush when they take the IPI, 
+ * without waiting for the kernel lock.
+ *
+ */
+void smp_flush_tlb_others(void) {
+    uint32_t i, self = smp_processor_id();
+
+    for (i = 0; i < ncpus; ++i) {
+        if (i != self)
+            smp_send(i, IPI_FLUSH_TLB);
+    }
+}
+
+
+/**
+ * @brief send the IPI to a CPU
+ *
+ * @param cpu : the CPU
+ * @param reason : IPI_* bit
+ */
+static void smp_send(uint32_t cpu, uint32_t reason) {
+    uint32_t flags;
+
+    /* the receiver clears the bits with xchg, without the kernel lock */
+    asm volatile ("lock; orl %1, %0" 
+                : "+m"(cpus[cpu].ipi_pending) 
+                : "r"(reason) 
+                : "memory");
+
+    cli_and_save(flags);
+    lapic_ipi(cpus[cpu].apic_id, IPI_VECTOR);
+    restore_flags(flags);
+}
+
+
+/**
+ * @brief start an AP with INIT-SIPI-SIPI and wait for it
+ *
+ * @param cpu : the AP
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+static int32_t boot_ap(cpu_t *cpu) {
+    thread_t *idle_thread;
+    uint32_t i;
+
+    if (!cpu->stack && !(cpu->stack = alloc_kstack()))
+        return -ENOMEM;
+
+    if (!cpu->pgdir && cpu_mm_init(cpu) < 0)
+        return -ENOMEM;
+
+    cpu->tss = &cpu->ap_tss;
+
+    /* GETPRO on the AP finds this idle thread at the bottom of its stack,
+     * sched_init() sets up the rest of it */
+    idle_thread = (thread_t *)cpu->stack;
+    memset(idle_thread, 0, sizeof(thread_t));
+    idle_thread->kthread = 1;
+    idle_thread->state = RUNNING;
+    idle_thread->console_id = NO_CONSOLE;
+    idle_thread->cpu = cpu->id;
+    cpu->idle = cpu->curr = idle_thread;
+
+    *(uint32_t *)TRAMP(trampoline_stack) = get_esp0(idle_thread);
+    booting = cpu;
+
+    /* INIT: reset the AP */
+    lapic_ipi(cpu->apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    udelay(200);
+    lapic_ipi(cpu->apic_id, ICR_INIT | ICR_LEVEL);
+    udelay(10000);
+
+    /* STARTUP twice: start at vector << 12 in real mode */
+    for (i = 0; i < 2 && !cpu->online; ++i) {
+        lapic_ipi(cpu->apic_id, ICR_STARTUP | (TRAMPOLINE_ADDR >> 12));
+        udelay(200);
+    }
+
+    for (i = 0; i < AP_TIMEOUT && !cpu->online; ++i)
+        udelay(1);
+
+    if (!cpu->online) {
+        /* hold it in reset, its slot goes to the next AP */
+        lapic_ipi(cpu->apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief give an AP its own page directory. The kernel entries point
+ * to the same page tables as the BSP's, except VIR_VID_MEM, whose page
+ * table holds the vDSO page of the CPU.
+ *
+ * @param cpu : the AP
+ * @return int32_t : 0 on success, -ENOMEM if out of memory
+ */
+static int32_t cpu_mm_init(cpu_t *cpu) {
+    if (!(cpu->pgdir = get_page(0)) || !(cpu->vidmap = get_page(0)) ||
+        !(cpu->pdesc = kmalloc(ENTRY_NUM * sizeof(pd_descriptor_t)))) {
+        cpu->pgdir = NULL;
+        return -ENOMEM;
+    }
+
+    memcpy(cpu->pgdir, page_directory, PAGE_SIZE);
+    memcpy(cpu->vidmap, vidmap_table, PAGE_SIZE);
+    memset(cpu->pdesc, 0, ENTRY_NUM * sizeof(pd_descriptor_t));
+
+    cpu->pgdir[PDE_MB_ADDR(VIR_VID_MEM)] = PTE_PRESENT | PTE_RW | PTE_US | ADDR_TO_PTE((uint32_t)cpu->vidmap);
+
+    vdso_cpu_init(cpu);
+
+    return 0;
+}
+
+
+/**
+ * @brief load the per-CPU GDT, TSS and the shared IDT and LDT
+ *
+ * @param cpu : current CPU
+ */
+static void load_cpu_desc(cpu_t *cpu) {
+    seg_desc_t tss_desc;
+    x86_desc_t bsp;
+
+    /* the BSP's GDT, with a TSS descriptor that is not busy */
+    asm volatile("sgdt (%0)" : : "r"(&bsp.size) : "memory");
+    memcpy(cpu->gdt, (void *)bsp.addr, bsp.size + 1);
+
+    tss_desc.val[0] = tss_desc.val[1] = 0;
+    tss_desc.seg_lim_19_16 = TSS_SIZE & 0x000F0000;
+    tss_desc.present       = 0x1;
+    tss_desc.dpl           = 0x0;
+    tss_desc.sys           = 0x0;
+    tss_desc.type          = 0x9;
+    tss_desc.seg_lim_15_00 = TSS_SIZE & 0x0000FFFF;
+    SET_TSS_PARAMS(tss_desc, cpu->tss, tss_size);
+    ((seg_desc_t *)cpu->gdt)[KERNEL_TSS >> 3] = tss_desc;
+
+    cpu->tss->ldt_segment_selector = KERNEL_LDT;
+    cpu->tss->ss0 = KERNEL_DS;
+    cpu->tss->esp0 = get_esp0((thread_t *)cpu->stack);
+
+    cpu->gdt_desc.size = bsp.size;
+    cpu->gdt_desc.addr = (uint32_t)cpu->gdt;
+
+    asm volatile("lgdt (%0)" : : "r"(&cpu->gdt_desc.size) : "memory");
+    asm volatile("lidt idt_desc_ptr" : : : "memory");
+    lldt(KERNEL_LDT);
+    ltr(KERNEL_TSS);
+}
+
+
+/**
+ * @brief find the MP configuration table
+ *
+ * @return mp_conf_t* : the table, NULL if there is none
+ */
+static mp_conf_t *mp_config(void) {
+    mp_fp_t *fp;
+    mp_conf_t *conf;
+    uint32_t ebda, basemem;
+
+    /* 1. first KB of the EBDA
+     * 2. last KB of base memory
+     * 3. the BIOS ROM */
+    ebda = *(uint16_t *)BDA_EBDA << 4;
+    basemem = *(uint16_t *)BDA_BASEMEM * 1024;
+
+    if (!(ebda && (fp = mp_search(ebda, 1024))) &&
+        !(fp = mp_search(basemem - 1024, 1024)) &&
+        !(fp = mp_search(BIOS_ROM, 0x10000)))
+        return NULL;
+
+    /* default configurations (no table) are not supported */
+    if (!fp->physaddr || fp->type)
+        return NULL;
+
+    conf = (mp_conf_t *)fp->physaddr;
+
+    if (conf->signature != MPC_SIG || checksum(conf, conf->length))
+        return NULL;
+
+    return conf;
+}
+
+
+/**
+ * @brief look for the MP floating pointer in [addr, addr + len)
+ *
+ * @param addr : start address, 16-byte aligned
+ * @param len : length in bytes
+ * @return mp_fp_t* : the floating pointer, NULL if not found
+ */
+static mp_fp_t *mp_search(uint32_t addr, uint32_t len) {
+    mp_fp_t *fp;
+
+    for (fp = (mp_fp_t *)addr; (uint32_t)fp < addr + len; ++fp) {
+        if (fp->signature == MP_SIG && !checksum(fp, sizeof(mp_fp_t)))
+            return fp;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief sum of len bytes at addr
+ *
+ * @param addr : start address
+ * @param len : length in bytes
+ * @return uint8_t : 0 if the table is valid
+ */
+static uint8_t checksum(void *addr, uint32_t len) {
+    uint8_t sum = 0;
+    uint8_t *p = addr;
+
+    while (len--)
+        sum += *p++;
+
+    return sum;
+}
+
+
+/**
+ * @brief map the local APIC registers, uncached
+ *
+ * @param addr : physical address of the local APIC
+ */
+static void lapic_map(uint32_t addr) {
+    /* before the APs copy the page directory */
+    page_directory[PDE_MB_ADDR(addr)] = ADDR_TO_4MB(addr) | PTE_PRESENT | PTE_RW | PDE_MB | PTE_CD | PTE_WT;
+    flush_tlb();
+
+    lapic = (volatile uint32_t *)addr;
+}
+
+
+/**
+ * @brief send an IPI to a CPU and wait until it is delivered
+ *
+ * @param apic_id : local APIC id of the target
+ * @param icr : delivery mode and vector
+ */
+static void lapic_ipi(uint8_t apic_id, uint32_t icr) {
+    lapic_write(LAPIC_ICRHI, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICRLO, icr);
+
+    while (lapic_read(LAPIC_ICRLO) & ICR_PENDING);
+}
+
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg >> 2];
+}
+
+
+static inline void lapic_write(uint32_t reg, uint32_t val) {
+    lapic[reg >> 2] = val;
+    (void) lapic[LAPIC_ID >> 2];    /* wait for the write to finish */
+}
+
+
+/**
+ * @brief identity map the first MB, keeping the old entries
+ *
+ */
+static void low_mem_map(void) {
+    int i;
+
+    for (i = 0; i < LOW_MEM_PAGES; ++i) {
+        saved_low[i] = page_table[i];
+        page_table[i] = PTE_PRESENT | PTE_RW | (i << PDE_OFFSET_4KB);
+    }
+
+    flush_tlb();
+}
+
+
+/**
+ * @brief restore the first MB (only video memory is mapped)
+ *
+ */
+static void low_mem_unmap(void) {
+    int i;
+
+    for (i = 0; i < LOW_MEM_PAGES; ++i)
+        page_table[i] = saved_low[i];
+
+    flush_tlb();
+}
+
+
+/**
+ * @brief busy wait, a write to port 0x80 takes about 1 us
+ *
+ * @param us : microseconds
+ */
+static void udelay(uint32_t us) {
+    while (us--)
+        outb(0, 0x80);
+}
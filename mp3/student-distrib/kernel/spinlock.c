@@ -0,0 +1,249 @@
+/**
+ * @file spinlock.c
+ * @brief Spinlocks and reader-writer locks.
+ * @overview:
+ * A spinlock protects data shared between CPUs: a CPU that finds the
+ * lock held spins until the holder releases it. It does not protect
+ * against interrupts on the same CPU, for that the lock is taken with
+ * spin_lock_irqsave(), which turns interrupts off first. On a single
+ * CPU the lock word is never found held by anybody else, so a lock
+ * taken with interrupts off costs one locked instruction over the
+ * old cli_and_save/restore_flags pair.
+ *
+ * The lock is taken with a locked xchg, and a waiting CPU only reads
+ * the lock word until it looks free, so the cache line is not bounced
+ * between CPUs while the lock is held (test-and-test-and-set).
+ *
+ * With SPINLOCK_DEBUG, each lock remembers its owner, so taking a lock
+ * twice in the same thread (including from an interrupt handler that
+ * interrupted the owner) is reported instead of hanging the machine.
+ * The longest hold time and the number of contended acquisitions are
+ * kept in the lock, and can be read from the debugger.
+ *
+ * @reference:
+ * Love, Robert, Linux Kernel Development (Chapter 10, Kernel Synchronization Methods)
+ *
+ */
+
+#include <spinlock.h>
+#include <pro/process.h>
+#include <access.h>
+#include <io.h>
+
+
+/* atomically store new in *p if it holds old, return the old value */
+static inline int32_t cmpxchg(volatile int32_t *p, int32_t old, int32_t new) {
+    int32_t prev;
+    asm volatile ("lock; cmpxchgl %2, %1"
+                : "=a"(prev), "+m"(*p)
+                : "r"(new), "0"(old)
+                : "memory", "cc");
+    return prev;
+}
+
+#if SPINLOCK_DEBUG
+
+/* low 32 bits of the time stamp counter */
+static inline uint32_t rdtsc_lo(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+static void lock_bug(const int8_t *name, const int8_t *msg) {
+    printf("BUG: lock %s: %s\n", name ? name : "?", msg);
+    panic("lock debugging");
+}
+
+static inline thread_t *lock_owner(void) {
+    thread_t *curr;
+    GETPRO(curr);
+    return curr;
+}
+
+#endif
+
+
+/**
+ * @brief set up a lock that is not defined with DEFINE_SPINLOCK
+ *
+ * @param lock : lock
+ * @param name : name used in debug reports
+ */
+void spin_lock_init(spinlock_t *lock, const int8_t *name) {
+    lock->slock = 0;
+#if SPINLOCK_DEBUG
+    lock->name = name;
+    lock->owner = NULL;
+    lock->start = 0;
+    lock->max_hold = 0;
+    lock->contended = 0;
+#endif
+}
+
+
+/**
+ * @brief take the lock, spinning until it is free
+ *
+ * @param lock : lock
+ */
+void spin_lock(spinlock_t *lock) {
+#if SPINLOCK_DEBUG
+    thread_t *curr = lock_owner();
+
+    if (lock->slock && lock->owner == curr)
+        lock_bug(lock->name, "recursive spin_lock");
+#endif
+
+    while (xchg(&lock->slock, 1)) {
+#if SPINLOCK_DEBUG
+        lock->contended++;
+#endif
+        while (lock->slock)
+            cpu_relax();
+    }
+
+#if SPINLOCK_DEBUG
+    lock->owner = curr;
+    lock->start = rdtsc_lo();
+#endif
+}
+
+
+/**
+ * @brief take the lock if it is free
+ *
+ * @param lock : lock
+ * @return int32_t : 1 if the lock was taken, 0 otherwise
+ */
+int32_t spin_trylock(spinlock_t *lock) {
+    if (xchg(&lock->slock, 1))
+        return 0;
+
+#if SPINLOCK_DEBUG
+    lock->owner = lock_owner();
+    lock->start = rdtsc_lo();
+#endif
+    return 1;
+}
+
+
+/**
+ * @brief release the lock
+ *
+ * @param lock : lock
+ */
+void spin_unlock(spinlock_t *lock) {
+#if SPINLOCK_DEBUG
+    uint32_t held;
+
+    if (!lock->slock)
+        lock_bug(lock->name, "spin_unlock of a free lock");
+
+    held = rdtsc_lo() - lock->start;
+    if (held > lock->max_hold)
+        lock->max_hold = held;
+
+    lock->owner = NULL;
+#endif
+
+    /* stores are not reordered with older stores on x86,
+     * so a plain store releases the lock */
+    asm volatile ("" : : : "memory");
+    lock->slock = 0;
+}
+
+
+/**
+ * @brief set up a lock that is not defined with DEFINE_RWLOCK
+ *
+ * @param lock : lock
+ * @param name : name used in debug reports
+ */
+void rwlock_init(rwlock_t *lock, const int8_t *name) {
+    lock->count = 0;
+#if SPINLOCK_DEBUG
+    lock->name = name;
+    lock->owner = NULL;
+#endif
+}
+
+
+/**
+ * @brief take the lock for reading, spinning while a writer holds it
+ *
+ * @param lock : lock
+ */
+void read_lock(rwlock_t *lock) {
+    int32_t count;
+
+#if SPINLOCK_DEBUG
+    if (lock->count == RW_WRITER && lock->owner == lock_owner())
+        lock_bug(lock->name, "read_lock while holding it for writing");
+#endif
+
+    while (1) {
+        count = lock->count;
+        if (count != RW_WRITER && cmpxchg(&lock->count, count, count + 1) == count)
+            return;
+        cpu_relax();
+    }
+}
+
+
+/**
+ * @brief release the lock taken for reading
+ *
+ * @param lock : lock
+ */
+void read_unlock(rwlock_t *lock) {
+#if SPINLOCK_DEBUG
+    if (lock->count <= 0)
+        lock_bug(lock->name, "read_unlock of a lock not held for reading");
+#endif
+
+    asm volatile ("lock; decl %0" : "+m"(lock->count) : : "memory", "cc");
+}
+
+
+/**
+ * @brief take the lock for writing, spinning until there are
+ * no readers and no writer
+ *
+ * @param lock : lock
+ */
+void write_lock(rwlock_t *lock) {
+#if SPINLOCK_DEBUG
+    thread_t *curr = lock_owner();
+
+    if (lock->count == RW_WRITER && lock->owner == curr)
+        lock_bug(lock->name, "recursive write_lock");
+#endif
+
+    while (cmpxchg(&lock->count, 0, RW_WRITER) != 0) {
+        while (lock->count)
+            cpu_relax();
+    }
+
+#if SPINLOCK_DEBUG
+    lock->owner = curr;
+#endif
+}
+
+
+/**
+ * @brief release the lock taken for writing
+ *
+ * @param lock : lock
+ */
+void write_unlock(rwlock_t *lock) {
+#if SPINLOCK_DEBUG
+    if (lock->count != RW_WRITER)
+        lock_bug(lock->name, "write_unlock of a lock not held for writing");
+
+    lock->owner = NULL;
+#endif
+
+    asm volatile ("" : : : "memory");
+    lock->count = 0;
+}
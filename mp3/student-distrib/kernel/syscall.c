@@ -10,6 +10,7 @@
 #include <list.h>
 #include <kmalloc.h>
 #include <drivers/time.h>
+#include <pro/futex.h>
 
 /**
  * @brief A system call service routine for exiting a process
@@ -71,14 +72,112 @@ asmlinkage int32_t sys_fork(void) {
 }
 
 
-asmlinkage int32_t sys_execv(const int8_t *pathname, int8_t *const argv[]) {
+/**
+ * @brief A system call service routine for creating a process that
+ * borrows the address space of the caller, the caller is suspended 
+ * until the child calls execv or exits
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @return int32_t : pid of the child to the parent, 0 to the child,
+ *                   negative values denote an error condition
+ */
+asmlinkage int32_t sys_vfork(void) {
+    pid_t pid;
+    thread_t *curr, *child;
+    uint32_t stack;
+    volatile uint32_t done = 0;
+
+    cli();
+
+    GETPRO(curr);
+
+    if ((pid = do_vfork(curr, &done)) < 0) {
+        sti();
+        return pid;
+    }
+
+    child = curr->children[curr->n_children-1];
+
+    /* the child leaves the kernel the same way as a forked child */
+    asm volatile("movl %%ebp, %0"
+                :
+                : "m"(child->context->ebp)       
+                : "memory" 
+    );
+    
+    child->context->eip = *(((uint32_t*)(child->context->ebp)) + 1);
+
+    stack = (get_esp0(curr) - (child->context->ebp) - 8);
+
+    child->context->esp = get_esp0(child) - stack;
+
+    /* the child runs on our user stack until it lets us go */
+    while (!done)
+        sched_sleep(curr);
+
+    sti();
+
+    return pid;
+}
+
+
+/**
+ * @brief A system call service routine for creating a thread that shares
+ * the address space, open files and terminal of the calling thread
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param eip : user address the new thread starts at
+ * @param esp : top of the user stack of the new thread
+ * @return int32_t : pid of the new thread, negative values denote an error condition
+ */
+asmlinkage int32_t sys_clone(uint32_t eip, uint32_t esp) {
+    pid_t pid;
+    thread_t *curr, *child;
+    uint32_t stack;
+
+    if (eip < VIR_MEM_BEGIN || esp < VIR_MEM_BEGIN || esp > USER_STACK_ADDR)
+        return -EFAULT;
+
+    cli();
+
+    GETPRO(curr);
+
+    if ((pid = do_clone(curr, eip, esp)) < 0) {
+        sti();
+        return pid;
+    }
+
+    child = curr->children[curr->n_children-1];
+
+    /* the new thread leaves the kernel the same way as a forked child */
+    asm volatile("movl %%ebp, %0"
+                :
+                : "m"(child->context->ebp)       
+                : "memory" 
+    );
+    
+    child->context->eip = *(((uint32_t*)(child->context->ebp)) + 1);
+
+    stack = (get_esp0(curr) - (child->context->ebp) - 8);
+
+    child->context->esp = get_esp0(child) - stack;
+
+    sti();
+
+    return pid;
+}
+
+
+asmlinkage int32_t sys_execv(const int8_t *pathname, int8_t *const argv[], int8_t *const envp[]) {
     thread_t *curr;
     int32_t status;
 
     cli();
     GETPRO(curr);
 
-    status = do_execv(curr, pathname, argv);
+    status = do_execv(curr, pathname, argv, envp);
     sti();
 
     return status;
@@ -100,6 +199,66 @@ asmlinkage int32_t sys_getppid(void) {
 }   
 
 
+/**
+ * @brief A system call service routine for changing the nice value
+ * of the calling process
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param inc : value added to the current nice value
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_nice(int32_t inc) {
+    thread_t *t;
+    GETPRO(t);
+    return do_setpriority(PRIO_PROCESS, 0, t->nice + inc);
+}
+
+
+/**
+ * @brief A system call service routine for setting the nice value of a process
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param which : PRIO_PROCESS
+ * @param who : process id, 0 for the calling process
+ * @param prio : new nice value
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_setpriority(int32_t which, int32_t who, int32_t prio) {
+    return do_setpriority(which, (pid_t)who, prio);
+}
+
+
+/**
+ * @brief A system call service routine for getting the nice value of a process
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param which : PRIO_PROCESS
+ * @param who : process id, 0 for the calling process
+ * @return int32_t : 20 - nice on success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_getpriority(int32_t which, int32_t who) {
+    return do_getpriority(which, (pid_t)who);
+}
+
+
+/**
+ * @brief A system call service routine for setting the scheduling policy of a process
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param pid : process id, 0 for the calling process
+ * @param policy : SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+ * @param prio : real-time priority [1, 99], 0 for SCHED_NORMAL
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_sched_setscheduler(int32_t pid, int32_t policy, int32_t prio) {
+    return do_sched_setscheduler((pid_t)pid, policy, prio);
+}
+
+
 /**
  * @brief A system call service routine for creating a process
  * The calling convation of this function is to use the
@@ -144,7 +303,6 @@ asmlinkage int32_t sys_execute(const int8_t *cmd) {
  * @return int32_t : positive or 0 denote success, negative values denote an error condition
  */
 asmlinkage int32_t sys_open(const int8_t *filename) {
-    fdcopy();
     return do_open(filename);
 }
 
@@ -157,7 +315,6 @@ asmlinkage int32_t sys_open(const int8_t *filename) {
  * @return int32_t : positive or 0 denote success, negative values denote an error condition
  */
 asmlinkage int32_t sys_close(int32_t fd) {
-    fdcopy();
     return do_close(fd);
 }
 
@@ -172,7 +329,6 @@ asmlinkage int32_t sys_close(int32_t fd) {
  * @return int32_t : positive or 0 denote success, negative values denote an error condition
  */
 asmlinkage int32_t sys_read(int32_t fd, void *buf, uint32_t nbytes) {
-    fdcopy();
     return do_read(fd, buf, nbytes);
 }
 
@@ -187,7 +343,6 @@ asmlinkage int32_t sys_read(int32_t fd, void *buf, uint32_t nbytes) {
  * @return int32_t : positive or 0 denote success, negative values denote an error condition
  */
 asmlinkage int32_t sys_write(int32_t fd, const void *buf, uint32_t nbytes) {
-    fdcopy();
     return do_write(fd, buf, nbytes);
 }
 
@@ -200,20 +355,7 @@ asmlinkage int32_t sys_write(int32_t fd, const void *buf, uint32_t nbytes) {
  * @return int32_t : positive or 0 denote success, negative values denote an error condition
  */
 asmlinkage int32_t sys_getargs(uint8_t *buf, int32_t nbytes) {
-    thread_t *curr;
-
-    GETPRO(curr);
-
-    /* no arguments */
-    if (curr->argc <= 1)
-        return -1;
-
-    /* buf is NULL */
-    if (!buf)
-        return -1;
-
-    strncpy((char *)buf, curr->argv[1], nbytes);
-    return 0;
+    return do_getargs(buf, nbytes);
 }
 
 /**
@@ -234,12 +376,30 @@ asmlinkage int32_t sys_restart(void) {
     return -1;
 }
 
+/**
+ * @brief A system call service routine for changing the action taken 
+ * when a signal is received
+ *
+ * @param signum : signal number
+ * @param handler_addr : user handler, NULL for the default action
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
 asmlinkage int32_t sys_set_handler(int32_t signum, void *handler_addr) {
-    return -1;
+    return do_set_handler(signum, handler_addr);
 }
 
-asmlinkage int32_t sys_sigreturn(void) {
-    return -1;
+/**
+ * @brief A system call service routine for returning from a signal 
+ * handler, called by the code on the signal frame
+ *
+ * The registers saved by the system call entry start at the first 
+ * argument, they are overwritten with the ones saved in the frame.
+ *
+ * @param ebx : first saved register of the pt_regs_t frame
+ * @return int32_t : eax of the interrupted program
+ */
+asmlinkage int32_t sys_sigreturn(uint32_t ebx) {
+    return do_sigreturn((pt_regs_t *)&ebx);
 }
 
 /**
@@ -259,8 +419,8 @@ asmlinkage void *sys_sbrk(uint32_t size) {
     int32_t brk;
     
     GETPRO(curr);
-    heap = curr->vm.map_list;
-    brk = curr->vm.brk;
+    heap = curr->vm->map_list;
+    brk = curr->vm->brk;
     
 
     if((brk % PAGE_SIZE == 0) || ((size + (brk % PAGE_SIZE)) > PAGE_SIZE)) {
@@ -270,15 +430,15 @@ asmlinkage void *sys_sbrk(uint32_t size) {
                 if (vmalloc(heap, PAGE_SIZE, PTE_RW | PTE_US) == -1)
                     return 0;
                 
-                curr->vm.brk += size;
-                show_mmap(&curr->vm);
+                curr->vm->brk += size;
+                show_mmap(curr->vm);
                 return (void*)brk;
             }
             heap = heap->next;
         }
     }
     else {
-        curr->vm.brk += size;
+        curr->vm->brk += size;
         return (void*)brk;
     }
 
@@ -317,11 +477,11 @@ asmlinkage int32_t sys_mmap(void *addr, uint32_t size) {
     
     vmalloc(area, pagesz, PTE_US | PTE_RW);
 
-    t = curr->vm.map_list;
+    t = curr->vm->map_list;
     if(t->vmstart > (uint32_t)addr) {
-        curr->vm.map_list = area;
+        curr->vm->map_list = area;
         area->next = t;
-        show_mmap(&curr->vm);
+        show_mmap(curr->vm);
         return 0;
     }
     while(t->next->vmstart < (uint32_t)addr && t->next->next != 0) {
@@ -331,7 +491,7 @@ asmlinkage int32_t sys_mmap(void *addr, uint32_t size) {
         return -1;
     area->next = t->next->next;
     t->next = area;
-    show_mmap(&curr->vm);
+    show_mmap(curr->vm);
     return 0;
 }
 
@@ -354,19 +514,23 @@ asmlinkage int32_t sys_munmap(void *addr) {
     
     GETPRO(curr);
 
-    prev = area = curr->vm.map_list;
+    /* a mapping of a file */
+    if (unmap_file(curr->vm, (uint32_t)addr) == 0)
+        return 0;
+
+    prev = area = curr->vm->map_list;
     
     while(area->next != 0) {
         if(area->vmstart == pageaddr)
             break;
         area = area->next;
-        if(area != curr->vm.map_list) prev = prev->next;
+        if(area != curr->vm->map_list) prev = prev->next;
     }
     if(area == 0)
         return -1;
         
     if(area == prev)
-        curr->vm.map_list = area->next;
+        curr->vm->map_list = area->next;
     else 
         prev->next = area->next;
 
@@ -374,7 +538,7 @@ asmlinkage int32_t sys_munmap(void *addr) {
     vmdealloc(area, size, 1);
     kfree(area);
     
-    show_mmap(&curr->vm);
+    show_mmap(curr->vm);
     return 0;
 }
 
@@ -384,12 +548,78 @@ asmlinkage int32_t sys_wait(int *wstatus) {
     return 0;
 }
 
+
+/**
+ * @brief A system call service routine for waiting until a child exits
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param pid : pid of the child
+ * @param wstatus : set to the exit status of the child if not NULL
+ * @return int32_t : pid of the child on success, negative values denote an error condition
+ */
 asmlinkage int32_t sys_waitpid(pid_t pid, int *wstatus) {
-    return 0;
+    return do_waitpid(pid, (int32_t *)wstatus);
+}
+
+
+/**
+ * @brief A system call service routine for waiting on and waking up futexes
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param uaddr : address of the futex word
+ * @param op : FUTEX_WAIT or FUTEX_WAKE
+ * @param val : expected value for FUTEX_WAIT, max number of threads to wake up for FUTEX_WAKE
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_futex(int32_t *uaddr, int32_t op, int32_t val) {
+    return do_futex((uint32_t)uaddr, op, val);
 }
 
 
-asmlinkage int32_t sys_stat(int8_t *info[]) {
+/**
+ * @brief A system call service routine for creating a pipe
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fds : fds[0] is set to the read end, fds[1] to the write end
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_pipe(int32_t *fds) {
+    return do_pipe(fds);
+}
+
+
+/**
+ * @brief A system call service routine for duplicating a file descriptor
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param oldfd : an open file descriptor
+ * @param newfd : the file descriptor to make refer to the same file
+ * @return int32_t : newfd on success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_dup2(int32_t oldfd, int32_t newfd) {
+    return do_dup2(oldfd, newfd);
+}
+
+
+/**
+ * @brief A system call service routine for duplicating a file descriptor
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param oldfd : an open file descriptor
+ * @return int32_t : the lowest free file descriptor, now referring to the
+ *                   same file, negative values denote an error condition
+ */
+asmlinkage int32_t sys_dup(int32_t oldfd) {
+    return do_dup(oldfd);
+}
+
+
+asmlinkage int32_t sys_procstat(int8_t *info[]) {
     thread_t *thread;
     list_head *node;
     int8_t buf[128];
@@ -405,7 +635,7 @@ asmlinkage int32_t sys_stat(int8_t *info[]) {
         strcat(*info, ",");
         strcat(*info, itoa(thread->parent->pid, buf, 10));
         strcat(*info, ",");
-        strcat(*info, thread->argv[0]);
+        strcat(*info, thread->comm);
         strcat(*info, ",");
         strcat(*info, itoa(thread->nice, buf, 10));
         strcat(*info, ",");
@@ -419,3 +649,277 @@ asmlinkage int32_t sys_stat(int8_t *info[]) {
     return count;
 }
 
+
+/**
+ * @brief A system call service routine for creating a regular file,
+ * or emptying an existing one, and opening it
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param filename : A file name
+ * @return int32_t : a file descriptor, negative values denote an error condition
+ */
+asmlinkage int32_t sys_creat(const int8_t *filename) {
+    return do_creat(filename);
+}
+
+
+/**
+ * @brief A system call service routine for removing a file
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param filename : A file name
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_unlink(const int8_t *filename) {
+    return do_unlink(filename);
+}
+
+
+/**
+ * @brief A system call service routine for setting the size of an open file
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fd : The file descriptor of the file
+ * @param length : the new size in bytes
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_ftruncate(int32_t fd, int32_t length) {
+    return do_ftruncate(fd, length);
+}
+
+
+/**
+ * @brief A system call service routine for creating a directory
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param pathname : A path
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_mkdir(const int8_t *pathname) {
+    return do_mkdir(pathname);
+}
+
+
+/**
+ * @brief A system call service routine for changing the current directory
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param pathname : A path
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_chdir(const int8_t *pathname) {
+    return do_chdir(pathname);
+}
+
+
+/**
+ * @brief A system call service routine for getting the current directory
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param buf : filled with the path
+ * @param size : size of buf
+ * @return int32_t : length of the path, negative values denote an error condition
+ */
+asmlinkage int32_t sys_getcwd(int8_t *buf, uint32_t size) {
+    return do_getcwd(buf, size);
+}
+
+
+/**
+ * @brief A system call service routine for removing an empty directory
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param pathname : A path
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_rmdir(const int8_t *pathname) {
+    return do_rmdir(pathname);
+}
+
+
+/**
+ * @brief A system call service routine for mapping an open file into memory
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fd : The file descriptor of the file
+ * @param offset : first byte to map, page aligned
+ * @param length : number of bytes to map
+ * @return int32_t : address of the mapping, negative values denote an error condition
+ */
+asmlinkage int32_t sys_mmap_file(int32_t fd, uint32_t offset, uint32_t length) {
+    return do_mmap_file(fd, offset, length);
+}
+
+
+/**
+ * @brief A system call service routine for moving the file pointer
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fd : The file descriptor of the file
+ * @param offset : offset from the point given by whence
+ * @param whence : SEEK_SET, SEEK_CUR or SEEK_END
+ * @return int32_t : the new file pointer, negative values denote an error condition
+ */
+asmlinkage int32_t sys_lseek(int32_t fd, int32_t offset, int32_t whence) {
+    return do_lseek(fd, offset, whence);
+}
+
+
+/**
+ * @brief A system call service routine for reading at an offset
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fd : The file descriptor of the file
+ * @param iov : the buffer to read into
+ * @param offset : first byte to read
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_pread(int32_t fd, const iovec_t *iov, int32_t offset) {
+    return do_pread(fd, iov, offset);
+}
+
+
+/**
+ * @brief A system call service routine for writing at an offset
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fd : The file descriptor of the file
+ * @param iov : the buffer to write
+ * @param offset : first byte to write
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_pwrite(int32_t fd, const iovec_t *iov, int32_t offset) {
+    return do_pwrite(fd, iov, offset);
+}
+
+
+/**
+ * @brief A system call service routine for reading into several buffers
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fd : The file descriptor of the file
+ * @param iov : array of buffers
+ * @param iovcnt : number of buffers
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_readv(int32_t fd, const iovec_t *iov, int32_t iovcnt) {
+    return do_readv(fd, iov, iovcnt);
+}
+
+
+/**
+ * @brief A system call service routine for writing several buffers
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fd : The file descriptor of the file
+ * @param iov : array of buffers
+ * @param iovcnt : number of buffers
+ * @return int32_t : positive or 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_writev(int32_t fd, const iovec_t *iov, int32_t iovcnt) {
+    return do_writev(fd, iov, iovcnt);
+}
+
+
+/**
+ * @brief A system call service routine for writing the changes of the
+ * file system to its disk
+ *
+ * @return int32_t : 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_sync(void) {
+    return do_sync();
+}
+
+
+/**
+ * @brief A system call service routine for giving a device specific
+ * command to an open file
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fd : The file descriptor of the file
+ * @param cmd : the command
+ * @param arg : the argument of the command
+ * @return int32_t : what the command returns, negative values denote an error condition
+ */
+asmlinkage int32_t sys_ioctl(int32_t fd, uint32_t cmd, uint32_t arg) {
+    return do_ioctl(fd, cmd, arg);
+}
+
+
+/**
+ * @brief A system call service routine for waiting until one of a set
+ * of files is ready
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fds : the file descriptors and the events to wait for
+ * @param nfds : number of entries in fds
+ * @param timeout : ms to wait at most, negative to wait without a limit
+ * @return int32_t : number of ready file descriptors, 0 on timeout,
+ *                   negative values denote an error condition
+ */
+asmlinkage int32_t sys_poll(pollfd_t *fds, uint32_t nfds, int32_t timeout) {
+    return do_poll(fds, nfds, timeout);
+}
+
+
+/**
+ * @brief A system call service routine for reading the entries of a
+ * directory, with the inode, type and size of each file
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fd : The file descriptor of the directory
+ * @param dirp : filled with dirent_t records
+ * @param count : size of dirp in bytes
+ * @return int32_t : number of bytes filled, 0 at the end of the directory,
+ *                   negative values denote an error condition
+ */
+asmlinkage int32_t sys_getdents(int32_t fd, dirent_t *dirp, uint32_t count) {
+    return do_getdents(fd, dirp, count);
+}
+
+
+/**
+ * @brief A system call service routine for getting the inode, type and
+ * size of a file
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param pathname : A path, from the current directory unless it starts with '/'
+ * @param st : filled with the information
+ * @return int32_t : 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_stat(const int8_t *pathname, stat_t *st) {
+    return do_stat(pathname, st);
+}
+
+
+/**
+ * @brief A system call service routine for getting the inode, type and
+ * size of an open file
+ * The calling convation of this function is to use the
+ * arguments from the stack
+ *
+ * @param fd : The file descriptor of the file
+ * @param st : filled with the information
+ * @return int32_t : 0 denote success, negative values denote an error condition
+ */
+asmlinkage int32_t sys_fstat(int32_t fd, stat_t *st) {
+    return do_fstat(fd, st);
+}
@@ -0,0 +1,113 @@
+/**
+ * @file vdso.c
+ * @brief A read-only page shared by the kernel with every process.
+ * @overview:
+ * getpid(), getppid() and time queries only read a value the kernel
+ * already has, but a system call costs a trap and a return. Instead the
+ * kernel writes these values into one page that is mapped into user space
+ * at VDSO_ADDR, and the user library reads them from there.
+ *
+ * Each CPU has its own page, mapped at the same address in its own page
+ * directory, since each runs its own task. The per-task fields (pid, 
+ * ppid) are rewritten by context_switch() on that CPU, the time fields 
+ * of every page by the timer interrupt. A user read can be interrupted
+ * or overlap with an update from the BSP, so the writer bumps seq before
+ * and after every update and the reader retries until it sees the same 
+ * even seq on both sides of its read. Writers are serialized by the 
+ * kernel lock.
+ *
+ * @reference:
+ * Linux, vDSO and the vsyscall page (arch/x86/entry/vdso)
+ *
+ */
+
+#include <boot/vdso.h>
+#include <boot/page.h>
+#include <boot/x86_desc.h>
+#include <drivers/time.h>
+#include <pro/process.h>
+#include <pro/cfs.h>
+#include <lib.h>
+
+
+/* one page per CPU */
+static vdso_page_t vdso[NR_CPUS] __attribute__((aligned(PAGE_SIZE)));
+
+
+/* enter and leave an update of a page */
+#define vdso_write_begin(p)                 \
+do {                                        \
+    (p)->data.seq++;                        \
+    asm volatile ("" : : : "memory");       \
+} while (0)
+
+#define vdso_write_end(p)                   \
+do {                                        \
+    asm volatile ("" : : : "memory");       \
+    (p)->data.seq++;                        \
+} while (0)
+
+
+/**
+ * @brief fill the pages and map the BSP's one at VDSO_ADDR, 
+ * user readable but not writable
+ * 
+ */
+void vdso_init(void) {
+    memset((void *)vdso, 0, sizeof(vdso));
+
+    vdso_update_time();
+
+    vidmap_table[(VDSO_ADDR - VIR_VID_MEM) >> PDE_OFFSET_4KB] = 
+        PTE_PRESENT | PTE_US | ADDR_TO_PTE((uint32_t)&vdso[0]);
+
+    flush_tlb();
+}
+
+
+/**
+ * @brief map the page of an AP in its own vidmap table, 
+ * before the AP starts
+ * 
+ * @param cpu : the AP
+ */
+void vdso_cpu_init(cpu_t *cpu) {
+    cpu->vidmap[(VDSO_ADDR - VIR_VID_MEM) >> PDE_OFFSET_4KB] = 
+        PTE_PRESENT | PTE_US | ADDR_TO_PTE((uint32_t)&vdso[cpu->id]);
+}
+
+
+/**
+ * @brief publish the ids of the task about to run
+ * 
+ * @param task : next running task
+ */
+void vdso_update_task(thread_t *task) {
+    vdso_page_t *p = &vdso[task->cpu];
+
+    vdso_write_begin(p);
+    p->data.pid = task->pid;
+    p->data.ppid = task->parent ? task->parent->pid : 0;
+    vdso_write_end(p);
+}
+
+
+/**
+ * @brief publish the clocks, called on every timer tick
+ * 
+ */
+void vdso_update_time(void) {
+    vdso_page_t *p;
+    uint32_t i;
+
+    for (i = 0; i < ncpus; ++i) {
+        p = &vdso[i];
+        vdso_write_begin(p);
+        p->data.ticks = sys_ticks;
+        p->data.clock_lo = (uint32_t)sched_clock;
+        p->data.clock_hi = (uint32_t)(sched_clock >> 32);
+        p->data.tv_sec = sys_clock.tv_sec;
+        p->data.tv_nsec = sys_clock.tv_nsec;
+        vdso_write_end(p);
+    }
+}
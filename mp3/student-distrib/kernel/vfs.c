@@ -1,49 +1,69 @@
 #include <drivers/fs.h>
 #include <drivers/rtc.h>
 #include <pro/process.h>
+#include <boot/page.h>
 #include <vfs/vfs.h>
+#include <vfs/pipe.h>
 #include <kmalloc.h>
 #include <errno.h>
 #include <access.h>
 #include <lib.h>
 
 /* File operation used for regular files. */
-static file_op f_op = {
+static const file_op f_op = {
     .open = file_open,
     .close = file_close,
     .read = file_read,
-    .write = file_write
+    .write = file_write,
+    .lseek = file_lseek
 };
 
 /* Directory operation used for '.'. */
-static file_op dir_op = {
+static const file_op dir_op = {
     .open = directory_open,
     .close = directory_close,
     .read = directory_read,
-    .write = directory_write
+    .write = directory_write,
+    .lseek = directory_lseek
 };
 
 /* Terminal operation used for stdin and stdout. */
-static file_op terminal_op = {
+static const file_op terminal_op = {
     .open = terminal_open,
     .close = terminal_close,
     .read = terminal_read,
-    .write = terminal_write
+    .write = terminal_write,
+    .poll = terminal_poll
+};
+
+/* Pipe operation used for both ends of a pipe. */
+static const file_op pipe_op = {
+    .open = pipe_open,
+    .close = pipe_close,
+    .read = pipe_read,
+    .write = pipe_write,
+    .poll = pipe_poll
 };
 
 
-static int32_t validate_fd(int32_t fd, thread_t *curr);
 static int32_t validate_fname(const int8_t *filename);
+static int32_t validate_iov(const iovec_t *iov, int32_t iovcnt);
+static int32_t get_dentry(int32_t fd, dentry_t *dentry);
+static int32_t pipe_install(pipe_t *pipe, uint32_t mode, thread_t *curr);
 
 /**
  * @brief open a file
  * 
- * @param filename : A file name
+ * @param filename : A path, from the current directory unless it starts with '/'
  * @return int32_t : positive or 0 denote success, negative values denote an error condition
  */
 int32_t do_open(const int8_t *filename) {
+   thread_t *curr;
+   dentry_t dentry;
    int32_t errno;
 
+   GETPRO(curr);
+
    /* validate file descriptor */
    if ((errno = validate_fname(filename)) < 0)
       return errno;
@@ -53,11 +73,19 @@ int32_t do_open(const int8_t *filename) {
    //                            strlen(filename))) <= 0)
    if (!filename || !*filename)
       return -1;
-   if (*filename == '.') 
+   if ((errno = namei(filename, curr->cwd, &dentry)) < 0)
+      return errno;
+
+   switch (dentry.type) {
+   case DIRECTORY:
       return directory_open(filename);
-   if (!strcmp(filename, "rtc")) 
+   case RTC:
       return rtc_open(filename);
-   return file_open(filename);
+   case REGULAR:
+      return file_open(filename);
+   default:
+      return -EPERM;
+   }
 }
 
 
@@ -68,20 +96,18 @@ int32_t do_open(const int8_t *filename) {
  * @return int32_t : positive or 0 denote success, negative values denote an error condition
  */
 int32_t do_close(int32_t fd) {
-   thread_t *curr;
    int32_t errno;
-   file_op f_op;
-
-   GETPRO(curr);
+   file_t *file;
 
    /* validate file descriptor */
-   if ((errno = validate_fd(fd, curr)) < 0)
-      return errno;
-   
+   if (!(file = fget(fd)))
+      return -EBADF;
 
    /* invoke close routine */
-   f_op = curr->fds->fd[fd].f_op;
-   return f_op.close(fd); 
+   errno = file->f_op->close(fd); 
+   fput(file);
+
+   return errno;
 }
 
 
@@ -96,28 +122,24 @@ int32_t do_close(int32_t fd) {
  */
 int32_t do_read(int32_t fd, void *buf, uint32_t nbytes) {
    int32_t errno;
-   file_op f_op;
-   thread_t *curr;
-
-   GETPRO(curr);
+   file_t *file;
 
    /* validate file descriptor */
-   if ((errno = validate_fd(fd, curr)) < 0)
-      return errno;
+   if (!(file = fget(fd)))
+      return -EBADF;
 
    /* Might be unsuitable for reading: return -EINVAL in the future */
    
-   /* validate nbytes */
-   if (nbytes < 0) return -1;
-
    /* copy data from user space to kernel space */
    // if ((errno = copy_from_user((void *)kbuf, (void *)buf, nbytes)) <= 0)
    //    return errno;
    
    /* copy data from user space to kernel space*/
    /* invoke read routine */
-   f_op = curr->fds->fd[fd].f_op;
-   return f_op.read(fd, (void *)buf, nbytes);
+   errno = file->f_op->read(fd, (void *)buf, nbytes);
+   fput(file);
+
+   return errno;
 }
 
 
@@ -131,45 +153,650 @@ int32_t do_read(int32_t fd, void *buf, uint32_t nbytes) {
  */
 int32_t do_write(int32_t fd, const void *buf, uint32_t nbytes) {
    int32_t errno;
-   file_op f_op;
-   thread_t *curr;
-
-   GETPRO(curr);
+   file_t *file;
 
    /* validate file descriptor */
-   if ((errno = validate_fd(fd, curr)) < 0)
-      return errno;
+   if (!(file = fget(fd)))
+      return -EBADF;
 
    /* Might be unsuitable for writing: return -EINVAL in the future */
 
-   /* validate nbytes */
-   if (nbytes < 0) return -1;
-
    /* copy data from user space to kernel space */
    // if ((errno = copy_from_user((void *)kbuf, (void *)buf, nbytes)) <= 0)
    //       return errno;
 
    /* invoke write routine */
-   f_op = curr->fds->fd[fd].f_op;
-   return f_op.write(fd, (void *)buf, nbytes);
+   errno = file->f_op->write(fd, (void *)buf, nbytes);
+   fput(file);
+
+   return errno;
+}
+
+
+
+/**
+ * @brief move the file pointer of an open file
+ * 
+ * @param fd : The file descriptor of the file
+ * @param offset : bytes (entries for a directory) from the point given by whence
+ * @param whence : SEEK_SET, SEEK_CUR or SEEK_END
+ * @return int32_t : the new file pointer, -ESPIPE for a pipe, the terminal or the rtc,
+ *                   negative values denote an error condition
+ */
+int32_t do_lseek(int32_t fd, int32_t offset, int32_t whence) {
+   int32_t errno;
+   file_t *file;
+
+   if (!(file = fget(fd)))
+      return -EBADF;
+
+   if (file->f_op->lseek)
+      errno = file->f_op->lseek(fd, offset, whence);
+   else
+      errno = -ESPIPE;
+   fput(file);
+
+   return errno;
+}
+
+
+/**
+ * @brief give a device specific command to an open file
+ * 
+ * @param fd : The file descriptor of the file
+ * @param cmd : the command, its meaning depends on the file (RTC_IRQP_SET for the rtc)
+ * @param arg : the argument of the command
+ * @return int32_t : what the command returns, -ENOTTY if the file takes no commands,
+ *                   negative values denote an error condition
+ */
+int32_t do_ioctl(int32_t fd, uint32_t cmd, uint32_t arg) {
+   int32_t errno;
+   file_t *file;
+
+   if (!(file = fget(fd)))
+      return -EBADF;
+
+   if (file->f_op->ioctl)
+      errno = file->f_op->ioctl(fd, cmd, arg);
+   else
+      errno = -ENOTTY;
+   fput(file);
+
+   return errno;
+}
+
+
+/**
+ * @brief read a regular file at a given offset, the file pointer is left alone
+ * 
+ * @param fd : The file descriptor of the file
+ * @param iov : the buffer to read into (one iovec, as a system call takes 
+ *              only three arguments)
+ * @param offset : first byte to read
+ * @return int32_t : number of bytes read, negative values denote an error condition
+ */
+int32_t do_pread(int32_t fd, const iovec_t *iov, int32_t offset) {
+   int32_t errno;
+   file_t *file;
+
+   if ((errno = validate_iov(iov, 1)) < 0)
+      return errno;
+   if (offset < 0)
+      return -EINVAL;
+
+   if (!(file = fget(fd)))
+      return -EBADF;
+
+   if (!file->f_op->lseek)
+      errno = -ESPIPE;
+   else if (file->f_dentry.type != REGULAR)
+      errno = -EISDIR;
+   else
+      errno = read_data(file->f_dentry.inode, offset, (uint8_t *)iov->iov_base, iov->iov_len);
+   fput(file);
+
+   return errno;
+}
+
+
+/**
+ * @brief write a regular file at a given offset, the file pointer is left alone
+ * 
+ * @param fd : The file descriptor of the file
+ * @param iov : the buffer to write (one iovec, as a system call takes 
+ *              only three arguments)
+ * @param offset : first byte to write
+ * @return int32_t : number of bytes written, negative values denote an error condition
+ */
+int32_t do_pwrite(int32_t fd, const iovec_t *iov, int32_t offset) {
+   int32_t errno;
+   file_t *file;
+
+   if ((errno = validate_iov(iov, 1)) < 0)
+      return errno;
+   if (offset < 0)
+      return -EINVAL;
+
+   if (!(file = fget(fd)))
+      return -EBADF;
+
+   if (!file->f_op->lseek)
+      errno = -ESPIPE;
+   else if (file->f_dentry.type != REGULAR)
+      errno = -EISDIR;
+   else
+      errno = write_data(file->f_dentry.inode, offset, (const uint8_t *)iov->iov_base, iov->iov_len);
+   fput(file);
+
+   return errno;
+}
+
+
+/**
+ * @brief read a file into several buffers, filled in order, with one
+ * system call. The read stops at the first short read.
+ * 
+ * @param fd : The file descriptor of the file
+ * @param iov : array of iovcnt buffers
+ * @param iovcnt : number of buffers, at most IOV_MAX
+ * @return int32_t : total number of bytes read, negative values denote an error condition
+ */
+int32_t do_readv(int32_t fd, const iovec_t *iov, int32_t iovcnt) {
+   int32_t errno, n, i, total = 0;
+   file_t *file;
+
+   if ((errno = validate_iov(iov, iovcnt)) < 0)
+      return errno;
+   if (!(file = fget(fd)))
+      return -EBADF;
+
+   for (i = 0; i < iovcnt; i++) {
+      if (!iov[i].iov_len)
+         continue;
+      if ((n = file->f_op->read(fd, iov[i].iov_base, iov[i].iov_len)) < 0) {
+         if (!total)
+            total = n;
+         break;
+      }
+      total += n;
+      if (n < iov[i].iov_len)
+         break;
+   }
+   fput(file);
+
+   return total;
+}
+
+
+/**
+ * @brief write several buffers to a file, in order, with one system call.
+ * The write stops at the first short write.
+ * 
+ * @param fd : The file descriptor of the file
+ * @param iov : array of iovcnt buffers
+ * @param iovcnt : number of buffers, at most IOV_MAX
+ * @return int32_t : total number of bytes written, negative values denote an error condition
+ */
+int32_t do_writev(int32_t fd, const iovec_t *iov, int32_t iovcnt) {
+   int32_t errno, n, i, total = 0;
+   file_t *file;
+
+   if ((errno = validate_iov(iov, iovcnt)) < 0)
+      return errno;
+   if (!(file = fget(fd)))
+      return -EBADF;
+
+   for (i = 0; i < iovcnt; i++) {
+      if (!iov[i].iov_len)
+         continue;
+      if ((n = file->f_op->write(fd, iov[i].iov_base, iov[i].iov_len)) < 0) {
+         if (!total)
+            total = n;
+         break;
+      }
+      total += n;
+      if (n < iov[i].iov_len)
+         break;
+   }
+   fput(file);
+
+   return total;
+}
+
+
+/**
+ * @brief create a pipe
+ * 
+ * @param fds : fds[0] is set to the read end, fds[1] to the write end
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t do_pipe(int32_t *fds) {
+   thread_t *curr;
+   pipe_t *pipe;
+   int32_t rfd, wfd;
+
+   GETPRO(curr);
+
+   if (!fds) return -EFAULT;
+
+   if (!(pipe = pipe_alloc()))
+      return -ENOMEM;
+
+   if ((rfd = pipe_install(pipe, FMODE_READ, curr)) < 0) {
+      pipe_free(pipe);
+      return rfd;
+   }
+
+   /* closing the read end frees the pipe once the write end is gone */
+   if ((wfd = pipe_install(pipe, FMODE_WRITE, curr)) < 0) {
+      pipe_release(pipe, FMODE_WRITE);
+      file_close(rfd);
+      return wfd;
+   }
+
+   fds[0] = rfd;
+   fds[1] = wfd;
+   return 0;
+}
+
+
+/**
+ * @brief make newfd refer to the same file as oldfd, closing newfd first
+ * if it is open
+ * 
+ * @param oldfd : an open file descriptor
+ * @param newfd : the file descriptor to set
+ * @return int32_t : newfd on success, negative values denote an error condition
+ */
+int32_t do_dup2(int32_t oldfd, int32_t newfd) {
+   if (newfd < 0)
+      return -EBADF;
+
+   return fd_dup(oldfd, newfd);
+}
+
+
+/**
+ * @brief make the lowest free file descriptor refer to the same file as
+ * oldfd, the two share the file pointer
+ * 
+ * @param oldfd : an open file descriptor
+ * @return int32_t : the new file descriptor, negative values denote an error condition
+ */
+int32_t do_dup(int32_t oldfd) {
+   return fd_dup(oldfd, -1);
+}
+
+
+/**
+ * @brief create a regular file, or empty it if it exists, and open it
+ * 
+ * @param filename : A file name
+ * @return int32_t : a file descriptor, negative values denote an error condition
+ */
+int32_t do_creat(const int8_t *filename) {
+   thread_t *curr;
+   dentry_t dentry;
+   int8_t name[NAMESIZE + 1];
+   uint32_t dir;
+   int32_t errno;
+
+   GETPRO(curr);
+
+   if (validate_fname(filename) < 0)
+      return -ENAMETOOLONG;
+
+   if ((errno = fs_parent(filename, curr->cwd, &dir, name)) < 0)
+      return errno;
+
+   if ((errno = fs_create(dir, name, REGULAR, &dentry)) == -EEXIST) {
+      if (namei(filename, curr->cwd, &dentry) < 0)
+         return -ENOENT;
+      if (dentry.type != REGULAR)
+         return (dentry.type == DIRECTORY) ? -EISDIR : -EPERM;
+      errno = fs_truncate(dentry.inode, 0);
+   }
+
+   if (errno < 0)
+      return errno;
+
+   return file_open(filename);
+}
+
+
+/**
+ * @brief remove a regular file
+ * 
+ * @param filename : A file name
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t do_unlink(const int8_t *filename) {
+   thread_t *curr;
+   int8_t name[NAMESIZE + 1];
+   uint32_t dir;
+   int32_t errno;
+
+   GETPRO(curr);
+
+   if (validate_fname(filename) < 0)
+      return -ENOENT;
+
+   if ((errno = fs_parent(filename, curr->cwd, &dir, name)) < 0)
+      return errno;
+
+   return fs_unlink(dir, name);
+}
+
+
+/**
+ * @brief create an empty directory
+ * 
+ * @param pathname : A path
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t do_mkdir(const int8_t *pathname) {
+   thread_t *curr;
+   dentry_t dentry;
+   int8_t name[NAMESIZE + 1];
+   uint32_t dir;
+   int32_t errno;
+
+   GETPRO(curr);
+
+   if (validate_fname(pathname) < 0)
+      return -ENAMETOOLONG;
+
+   if ((errno = fs_parent(pathname, curr->cwd, &dir, name)) < 0)
+      return errno;
+
+   return fs_create(dir, name, DIRECTORY, &dentry);
+}
+
+
+/**
+ * @brief remove an empty directory
+ * 
+ * @param pathname : A path
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t do_rmdir(const int8_t *pathname) {
+   thread_t *curr;
+   int8_t name[NAMESIZE + 1];
+   uint32_t dir;
+   int32_t errno;
+
+   GETPRO(curr);
+
+   if (validate_fname(pathname) < 0)
+      return -ENOENT;
+
+   if ((errno = fs_parent(pathname, curr->cwd, &dir, name)) < 0)
+      return (errno == -EEXIST) ? -EBUSY : errno;
+
+   /* a thread may still be in it, its path then no longer resolves */
+   return fs_rmdir(dir, name);
+}
+
+
+/**
+ * @brief change the current directory of the calling thread
+ * 
+ * @param pathname : A path
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t do_chdir(const int8_t *pathname) {
+   thread_t *curr;
+
+   GETPRO(curr);
+
+   if (validate_fname(pathname) < 0)
+      return -ENAMETOOLONG;
+
+   return fs_chdir(pathname, &curr->cwd);
+}
+
+
+/**
+ * @brief get the path of the current directory
+ * 
+ * @param buf : filled with the path
+ * @param size : size of buf
+ * @return int32_t : length of the path, negative values denote an error condition
+ */
+int32_t do_getcwd(int8_t *buf, uint32_t size) {
+   thread_t *curr;
+
+   GETPRO(curr);
+
+   if (!buf)
+      return -EFAULT;
+
+   return fs_getcwd(curr->cwd, buf, size);
+}
+
+
+/**
+ * @brief set the size of an open regular file
+ * 
+ * @param fd : The file descriptor of the file
+ * @param length : the new size in bytes
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t do_ftruncate(int32_t fd, int32_t length) {
+   dentry_t dentry;
+
+   if (length < 0)
+      return -EINVAL;
+
+   if (get_dentry(fd, &dentry) < 0)
+      return -EBADF;
+
+   if (dentry.type != REGULAR)
+      return -EINVAL;
+
+   return fs_truncate(dentry.inode, length);
+}
+
+
+/**
+ * @brief map part of an open regular file into memory, read only. The
+ * pages are the data blocks of the file system image, mapped when they
+ * are first touched, so the data is never copied.
+ * 
+ * @param fd : The file descriptor of the file
+ * @param offset : first byte to map, a multiple of PAGE_SIZE
+ * @param length : number of bytes to map
+ * @return int32_t : address of the mapping, negative values denote an error condition
+ */
+int32_t do_mmap_file(int32_t fd, uint32_t offset, uint32_t length) {
+   thread_t *curr;
+   dentry_t dentry;
+   uint32_t va;
+
+   GETPRO(curr);
+
+   if (!length || offset % PAGE_SIZE)
+      return -EINVAL;
+   if (length > FILE_MAP_END - FILE_MAP_START)
+      return -ENOMEM;
+
+   if (get_dentry(fd, &dentry) < 0)
+      return -EBADF;
+
+   /* the data blocks of a disk are not in memory to map */
+   if (dentry.type != REGULAR || fs->dev)
+      return -ENODEV;
+
+   if (!(va = map_file(curr->vm, dentry.inode, offset / PAGE_SIZE, (length + PAGE_SIZE - 1) / PAGE_SIZE)))
+      return -ENOMEM;
+
+   return va;
+}
+
+
+/**
+ * @brief write the changes of the file system to its disk
+ * 
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t do_sync(void) {
+   return fs_sync();
+}
+
+
+/**
+ * @brief read the entries of a directory, as many as fit in the buffer,
+ * each with the inode, type and size of its file
+ * 
+ * @param fd : The file descriptor of the directory, its file pointer 
+ *             moves past the entries read
+ * @param dirp : filled with records of DIRENT_LEN(length of the name) bytes
+ * @param count : size of dirp in bytes
+ * @return int32_t : number of bytes filled, 0 at the end of the directory,
+ *                   -EINVAL if the next record does not fit,
+ *                   negative values denote an error condition
+ */
+int32_t do_getdents(int32_t fd, dirent_t *dirp, uint32_t count) {
+   dentry_t dentry;
+   stat_t st;
+   dirent_t *d;
+   file_t *file;
+   uint32_t len, reclen, pos = 0;
+
+   if (!dirp)
+      return -EFAULT;
+
+   if (!(file = fget(fd)))
+      return -EBADF;
+
+   if (file->f_dentry.type != DIRECTORY) {
+      fput(file);
+      return -ENOTDIR;
+   }
+
+   while (fs_readdir(file->f_dentry.inode, file->f_pos, &dentry, &st) == 0) {
+      for (len = 0; len < NAMESIZE && dentry.fname[len]; len++)
+         ;
+      reclen = DIRENT_LEN(len);
+      if (reclen > count - pos)
+         break;
+
+      d = (dirent_t *)((uint8_t *)dirp + pos);
+      d->d_ino = st.st_ino;
+      d->d_size = st.st_size;
+      d->d_reclen = reclen;
+      d->d_type = st.st_type;
+      memcpy(d->d_name, dentry.fname, len);
+      d->d_name[len] = '\0';
+
+      pos += reclen;
+      file->f_pos++;
+   }
+
+   /* the buffer cannot hold a single record */
+   if (!pos && fs_readdir(file->f_dentry.inode, file->f_pos, &dentry, &st) == 0) {
+      fput(file);
+      return -EINVAL;
+   }
+   fput(file);
+
+   return pos;
+}
+
+
+/**
+ * @brief get the inode, type and size of a file
+ * 
+ * @param pathname : A path, from the current directory unless it starts with '/'
+ * @param st : filled with the information
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t do_stat(const int8_t *pathname, stat_t *st) {
+   thread_t *curr;
+   dentry_t dentry;
+   int32_t errno;
+
+   GETPRO(curr);
+
+   if (validate_fname(pathname) < 0)
+      return -ENAMETOOLONG;
+   if (!st)
+      return -EFAULT;
+
+   if ((errno = namei(pathname, curr->cwd, &dentry)) < 0)
+      return errno;
+
+   fs_stat(&dentry, st);
+   return 0;
 }
 
 
+/**
+ * @brief get the inode, type and size of an open file
+ * 
+ * @param fd : The file descriptor of the file
+ * @param st : filled with the information
+ * @return int32_t : 0 on success, negative values denote an error condition
+ */
+int32_t do_fstat(int32_t fd, stat_t *st) {
+   dentry_t dentry;
+   int32_t errno;
+
+   if (!st)
+      return -EFAULT;
+
+   if ((errno = get_dentry(fd, &dentry)) < 0)
+      return errno;
+
+   fs_stat(&dentry, st);
+   return 0;
+}
+
 
 /**
- * @brief Validate a file descriptor
+ * @brief Get the dentry of an open file
  * 
  * @param fd : a file descriptor
- * @return int32_t : 0 denote success, negative values denote an error condition
+ * @param dentry : filled with the dentry of fd
+ * @return int32_t : 0 denote success, -EBADF if fd is not open
  */
-static int32_t validate_fd(int32_t fd, thread_t *curr) {
-   int max_fd = curr->fds->max_fd;
+static int32_t get_dentry(int32_t fd, dentry_t *dentry) {
+   file_t *file;
 
-   if (fd < 0 || fd >= max_fd) return -1;
+   if (!(file = fget(fd)))
+      return -EBADF;
 
-   if (!curr->fds->fd[fd].f_count) return -1;
+   *dentry = file->f_dentry;
+   fput(file);
 
-   /* should check if the file has permission to access in the future */
+   return 0;
+}
+
+
+/**
+ * @brief Validate an array of buffers for readv or writev
+ * 
+ * @param iov : array of iovcnt buffers
+ * @param iovcnt : number of buffers
+ * @return int32_t : 0 denote success, -EINVAL if there are too many buffers
+ *                   or the total size does not fit a return value
+ */
+static int32_t validate_iov(const iovec_t *iov, int32_t iovcnt) {
+   uint32_t total = 0;
+   int32_t i;
+
+   if (iovcnt < 0 || iovcnt > IOV_MAX)
+      return -EINVAL;
+   if (iovcnt && !iov)
+      return -EFAULT;
+
+   for (i = 0; i < iovcnt; i++) {
+      if (iov[i].iov_len > 0x7fffffff - total)
+         return -EINVAL;
+      if (iov[i].iov_len && !iov[i].iov_base)
+         return -EFAULT;
+      total += iov[i].iov_len;
+   }
 
    return 0;
 }
@@ -184,7 +811,7 @@ static int32_t validate_fd(int32_t fd, thread_t *curr) {
 static int32_t validate_fname(const int8_t *filename) {
    if (!filename) return -1;
 
-   if (strlen(filename) > NAMESIZE) return -1;
+   if (strlen(filename) >= PATH_MAX) return -1;
 
    return 0;
 }
@@ -197,24 +824,19 @@ static int32_t validate_fname(const int8_t *filename) {
  * @return int32_t : 0 on success, otherwise on failure.
  */
 int32_t fd_init(thread_t *curr) {
-    int i;
-    
-    curr->fds = kmalloc(sizeof(files));
-    
-    curr->fds->count = 0;
-    curr->fds->max_fd = OPEN_MAX;
+    if (!(curr->fds = kmalloc(sizeof(files))))
+        return -ENOMEM;
 
-    for (i = 0; i < OPEN_MAX; ++i) {
-        curr->fds->fd[i].f_count = 0;
-    }
+    files_init(curr->fds);
 
-    return (__open(0, "stdin", TERMINAL, &terminal_op, curr)) + (__open(1, "stdout", TERMINAL, &terminal_op, curr));
+    return (__open(0, "stdin", TERMINAL, FMODE_READ, &terminal_op, curr)) +
+           (__open(1, "stdout", TERMINAL, FMODE_WRITE, &terminal_op, curr));
 }
 
 /**
  * @brief Open the file named fname.
  * 
- * @param fname : A file name.
+ * @param fname : A path, from the current directory unless it starts with '/'.
  * @return int32_t : A file descriptor on success, -1 on failure.
  */
 int32_t file_open(const int8_t *fname) {
@@ -226,13 +848,13 @@ int32_t file_open(const int8_t *fname) {
 
     GETPRO(curr);
     
-    /* Call read_dentry_by_name to get a new dentry */
-    if (!(fd = read_dentry_by_name(fname, &dentry))) { 
+    /* Call namei to get a new dentry */
+    if (!(fd = namei(fname, curr->cwd, &dentry))) { 
         /* Initialize the current file object. */
-        fd = file_init(2, &file, &dentry, &f_op, curr); 
-
-        /* Copy the file object into the vfs fd. */
-        memcpy((void*)&(curr->fds->fd[fd]), (void*)&file, sizeof(file_t));
+        file.f_mode = 0;
+        file.private_data = NULL;
+        if ((fd = file_init(2, &file, &dentry, &f_op, curr)) >= 0 && dentry.type == REGULAR)
+            fs_iget(dentry.inode);
     }
     return fd;
 }
@@ -245,15 +867,14 @@ int32_t file_open(const int8_t *fname) {
  * @return int32_t 0 on success, -1 on failure.
  */
 int32_t file_close(int32_t fd) {
-    thread_t *curr;
-    GETPRO(curr);
+    file_t *file;
 
-    if (!curr->fds->fd[fd].f_count) {
+    /* another thread may have closed it first */
+    if (!(file = fd_uninstall(fd)))
         return -1;
-    }
 
-    /* Close the file. */
-    curr->fds->fd[fd].f_count--; 
+    /* the file is released once no other descriptor refers to it */
+    fput(file);
     return 0;
 }
 
@@ -268,13 +889,10 @@ int32_t file_close(int32_t fd) {
  *                    number of bytes read on success.
  */
 int32_t file_read(int32_t fd, void *buf, int32_t nbytes) {
-    thread_t *curr;
+    file_t *file = fd_file(fd);
     int32_t nread;
 
-    GETPRO(curr);
-
-    file_t *file = &(curr->fds->fd[fd]);
-    if (!file->f_count) {
+    if (!file) {
         return -1;
     }
 
@@ -287,25 +905,49 @@ int32_t file_read(int32_t fd, void *buf, int32_t nbytes) {
 
 
 /**
- * @brief Write buf into the file.
+ * @brief Write buf into the file at the file pointer.
  * 
- * @return int32_t : -1 for now.
+ * @param fd : The file descriptor of the file we want to write.
+ * @param buf : A buffer array that copys the content to the file.
+ * @param nbytes The number of bytes to write to the file.
+ * @return int32_t : number of bytes written on success,
+ *                   negative values denote an error condition
  */
 int32_t file_write(int32_t fd, const void *buf, int32_t nbytes) {
-    return -1;
+    file_t *file = fd_file(fd);
+    int32_t nwritten;
+
+    if (!file || file->f_dentry.type != REGULAR) {
+        return -1;
+    }
+
+    /* Write data into the file. */
+    if ((nwritten = write_data(file->f_dentry.inode, file->f_pos, (const uint8_t *)buf, nbytes)) > 0) {
+        file->f_pos += nwritten;    /* Update file pointer. */
+    }
+    return nwritten;
 }
 
 
 /**
  * @brief Open the directory named fname.
  * 
- * @param fname : A directory name.
+ * @param fname : A path, from the current directory unless it starts with '/'.
  * @return int32_t : A file descriptor on success, -1 on failure.
  */
 int32_t directory_open(const int8_t *fname) {
     thread_t *curr;
+    file_t file;
+    dentry_t dentry;
+
     GETPRO(curr);
-    return __open(2, fname, DIRECTORY, &dir_op, curr);
+
+    if (namei(fname, curr->cwd, &dentry) < 0 || dentry.type != DIRECTORY)
+        return -1;
+
+    file.f_mode = 0;
+    file.private_data = NULL;
+    return file_init(2, &file, &dentry, &dir_op, curr);
 }
 
 
@@ -330,21 +972,21 @@ int32_t directory_close(int32_t fd) {
  */
 int32_t directory_read(int32_t fd, void *buf, int32_t nbytes) {
     int32_t nread;
-    thread_t *curr;
+    file_t *file;
+    dentry_t dentry;
 
-    GETPRO(curr);
-
-    if (!curr->fds->fd[fd].f_count) {
+    if (!(file = fd_file(fd))) {
         return -1;
     }
 
-    if (curr->fds->fd[fd].f_pos >= fs->boot->n_dir) 
+    if (dir_read(file->f_dentry.inode, file->f_pos, &dentry) < 0) 
         return 0;
+    file->f_pos++;
     if (nbytes > NAMESIZE)
         nread = NAMESIZE;
     else
         nread = nbytes;
-    memcpy(buf, (void*)(fs->boot->dirs[curr->fds->fd[fd].f_pos++].fname), nread);
+    memcpy(buf, (void*)dentry.fname, nread);
     return nread;
 }
 
@@ -360,6 +1002,73 @@ int32_t directory_write(int32_t fd, const void *buf, int32_t nbytes) {
 
 
 
+/**
+ * @brief Move the file pointer of a regular file. It may go past the end,
+ * a write there fills the gap with zeros.
+ * 
+ * @param fd : The file descriptor of the file.
+ * @param offset : Bytes from the point given by whence.
+ * @param whence : SEEK_SET, SEEK_CUR or SEEK_END.
+ * @return int32_t : the new file pointer, negative values denote an error condition
+ */
+int32_t file_lseek(int32_t fd, int32_t offset, int32_t whence) {
+    file_t *file;
+    int32_t pos;
+
+    if (!(file = fd_file(fd)))
+        return -EBADF;
+
+    switch (whence) {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = file->f_pos + offset;
+        break;
+    case SEEK_END:
+        pos = fs->inodes[file->f_dentry.inode].size + offset;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    if (pos < 0)
+        return -EINVAL;
+
+    return file->f_pos = pos;
+}
+
+
+/**
+ * @brief Move the file pointer of a directory, which counts entries:
+ * lseek(fd, 0, SEEK_SET) starts the listing over.
+ * 
+ * @param fd : The file descriptor of the directory.
+ * @param offset : Entries from the point given by whence.
+ * @param whence : SEEK_SET or SEEK_CUR.
+ * @return int32_t : the new file pointer, negative values denote an error condition
+ */
+int32_t directory_lseek(int32_t fd, int32_t offset, int32_t whence) {
+    file_t *file;
+    int32_t pos;
+
+    if (!(file = fd_file(fd)))
+        return -EBADF;
+
+    if (whence == SEEK_SET)
+        pos = offset;
+    else if (whence == SEEK_CUR)
+        pos = file->f_pos + offset;
+    else
+        return -EINVAL;
+
+    if (pos < 0)
+        return -EINVAL;
+
+    return file->f_pos = pos;
+}
+
+
 /**
  * @brief Open a file for stdin, stdout, and directory.
  * 
@@ -367,10 +1076,12 @@ int32_t directory_write(int32_t fd, const void *buf, int32_t nbytes) {
  * @param fname : A file name.
  * @param op : A file opeartion list.
  * @param type : The file type.
+ * @param mode : FMODE_READ and/or FMODE_WRITE, checked by the file 
+ *               operations, 0 if they do not check
  * @param p : the current process
  * @return int32_t : The file descriptor on success, -1 on failure.
  */
-int32_t __open(int32_t fd, const int8_t *fname, file_type_t type, file_op *op, thread_t *curr) {
+int32_t __open(int32_t fd, const int8_t *fname, file_type_t type, uint32_t mode, const file_op *op, thread_t *curr) {
     file_t file;
     dentry_t dentry; 
 
@@ -379,29 +1090,35 @@ int32_t __open(int32_t fd, const int8_t *fname, file_type_t type, file_op *op, t
     dentry.inode = 0;   /* ignored here. */
     dentry.type = type;
 
+    file.f_mode = mode;
+    file.private_data = NULL;
+
     if ((fd = file_init(fd, &file, &dentry, op, curr)) < 0) {
         return -1;
     }
-    memcpy((void*)&(curr->fds->fd[fd]), (void*)&file, sizeof(file_t));
     return fd;
 }
 
 
 
 /**
- * @brief copy file descriptor only when a child process first accessing its
- * file descriptors
+ * @brief Install one end of a pipe in the lowest free file descriptor.
  * 
+ * @param pipe : the pipe
+ * @param mode : FMODE_READ for the read end, FMODE_WRITE for the write end
+ * @param curr : the current process
+ * @return int32_t : The file descriptor on success, negative values denote an error condition
  */
-void fdcopy(void) {
-    thread_t *curr;
-    GETPRO(curr);
+static int32_t pipe_install(pipe_t *pipe, uint32_t mode, thread_t *curr) {
+    file_t file;
+    dentry_t dentry;
 
-    /* copy file descriptor when it first tried to open a file */
-    if (!curr->fds) {
-        curr->fds = kmalloc(sizeof(files));
-        curr->fds->count = 0;
-        curr->fds->max_fd = OPEN_MAX;
-        memcpy((void*)curr->fds, (void*)curr->parent->fds, sizeof(files));
-    }
+    memset((void*)&dentry, 0, sizeof(dentry));
+    strcpy(dentry.fname, "pipe");
+    dentry.type = PIPE;
+
+    file.f_mode = mode;
+    file.private_data = pipe;
+
+    return file_init(0, &file, &dentry, &pipe_op, curr);
 }
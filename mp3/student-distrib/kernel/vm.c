@@ -3,7 +3,11 @@
 #include <kmalloc.h>
 #include <lib.h>
 #include <pro/process.h>
+#include <drivers/fs.h>
+#include <access.h>
 #include <io.h>
+#include <drivers/vga.h>
+#include <boot/smp.h>
 
 /**
  * @brief Turn on paging related registers.
@@ -28,13 +32,13 @@ buddy ufree_list[MAX_ORDER + 1];
 
 pd_descriptor_t pdesc[ENTRY_NUM];
 
-void enable_paging()
+void enable_paging(pde_t *dir)
 {
     /* set CR3 to directory base address */
     asm volatile(
 	"movl %0, %%eax             ;"
 	"movl %%eax, %%cr3          ;"
-	:  : "r"(page_directory): "eax" );
+	:  : "r"(dir): "eax" );
 
     /* Turn on page size extension */
     asm volatile(
@@ -91,8 +95,8 @@ void page_init()
     for(i = 0; i < ENTRY_NUM; i++)
     {
         /* only video memory is initialized as present */
-        if(i == (VIDEO >> PDE_OFFSET_4KB) ) {
-            page_table[i] = page_table[i] | PTE_PRESENT | PTE_RW | ADDR_TO_PTE(VIDEO); 
+        if(i >= (VIDEO >> PDE_OFFSET_4KB) && i < (VIDEO >> PDE_OFFSET_4KB) + VIDEO_PAGES) {
+            page_table[i] = page_table[i] | PTE_PRESENT | PTE_RW | ADDR_TO_PTE(i << PDE_OFFSET_4KB); 
         }
         else {
             page_table[i] = 0 | PTE_RW;  
@@ -113,7 +117,7 @@ void page_init()
         page_table[VIDEO_BUF_3 >> PDE_OFFSET_4KB] = PTE_PRESENT | PTE_RW | ADDR_TO_PTE(VIDEO_BUF_3);
 
     /* turn on paging registers */
-    enable_paging();
+    enable_paging(page_directory);
     return;
 }
 
@@ -131,6 +135,9 @@ int32_t do_vidmap(uint8_t **screen_start)
 
     *screen_start = current->vidmap;
 
+    /* the page shows the screen from its first line */
+    vga_home(t->terminal->vidmem, &t->terminal->top);
+
     // if(t == current->task) {
     //     *screen_start = (uint8_t*) (VIR_VID_MEM + VIDEO);
     // }
@@ -250,7 +257,7 @@ pte_t*
 _walk(uint32_t va, uint32_t flags, int alloc)
 {
     uint32_t pde_i = PDE_MB_ADDR(va);
-    pde_t* pde = &page_directory[pde_i];                        /* Get pde entry. */
+    pde_t* pde = &this_cpu()->pgdir[pde_i];                     /* Get pde entry of this CPU. */
     uint32_t ptaddr;
 
     if(!(*pde & PTE_PRESENT)) {
@@ -292,7 +299,7 @@ int mmap(uint32_t va, uint32_t pa, int size, int flags)
             return -1;
 
         *pte = PTE_PRESENT | flags | (ADDR_TO_PTE(pa) + i * PAGE_SIZE);     /* Create map. */
-        pdesc[PDE_MB_ADDR(addr)].count ++;
+        this_cpu()->pdesc[PDE_MB_ADDR(addr)].count ++;
 
         addr += PAGE_SIZE;
     }
@@ -304,27 +311,30 @@ int mmap(uint32_t va, uint32_t pa, int size, int flags)
 /**
  * @brief           Delete a memory map on a virtual address.
  *                  *Do not free the physical memory.*
+ *                  Pages that are not mapped (pages of a file mapping 
+ *                  that were never touched) are skipped.
  * 
  * @param va        Virtual address.
  * @param size      Size of map to delete.
- * @return int      0 if succeed, -1 if failed.
+ * @return int      0.
  */
 int
 freemap(uint32_t va, int size)
 {
+    cpu_t* cpu = this_cpu();                            /* Each CPU maps the task it runs. */
     pte_t* pte;
     uint32_t addr;
 
     for(addr = va; addr < va + size; addr += PAGE_SIZE) {
         if((pte = _walk(addr, 0, 0)) == 0)              /* Find the PTE to free. */
-            return -1;
+            continue;
 
         if(!((*pte) & PTE_PRESENT))
-            return -1;
+            continue;
 
         *pte = 0;
-        if((pdesc[PDE_MB_ADDR(addr)].count--) == 0) {   /* If the page table became empty, free it. */
-            free_page((void*)ADDR_TO_PTE(page_directory[PDE_MB_ADDR(addr)]), 0);
+        if((cpu->pdesc[PDE_MB_ADDR(addr)].count--) == 0) {   /* If the page table became empty, free it. */
+            free_page((void*)ADDR_TO_PTE(cpu->pgdir[PDE_MB_ADDR(addr)]), 0);
         }
     }
 
@@ -348,7 +358,7 @@ void process_vm_init(vmem_t* vm)
     vm->size = 0;
     vm->file_length = 0;
     vm->start_brk = vm->brk = 0x8800000;
-    vm->count = 0;
+    vm->count = 1;
 
     file->next = heap;
     file->vmend = PROGRAM_IMG_BEGIN + PAGE_SIZE * vm->file_length;
@@ -370,6 +380,52 @@ void process_vm_init(vmem_t* vm)
 }
 
 
+/**
+ * @brief       Allocate and initialize the virtual memory structure of a
+ *              new process.
+ * 
+ * @return vmem_t*  Virtual memory struct, NULL if out of memory.
+ */
+vmem_t* vm_alloc(void)
+{
+    vmem_t* vm;
+
+    if((vm = kmalloc(sizeof(vmem_t))) == 0)
+        return 0;
+
+    process_vm_init(vm);
+    return vm;
+}
+
+
+/**
+ * @brief       Drop a reference to a virtual memory structure shared by
+ *              threads, the last user frees the area structures.
+ * 
+ * @param vm    Virtual memory struct.
+ */
+void put_vm(vmem_t* vm)
+{
+    vm_area_t* area, *next;
+
+    if(vm == 0 || --vm->count > 0)
+        return;
+
+    area = vm->map_list;
+    while(area != 0) {
+        next = area->next;
+        if(area->vmflag & VM_FILE)
+            fs_mput(area->inode);
+        if(area->vmend != area->vmstart)
+            kfree(area->mmap);
+        kfree(area);
+        area = next;
+    }
+
+    kfree(vm);
+}
+
+
 /**
  * @brief       Expand a virtual memory area. Allocate physical memory 
  *              to it and create the mapping.
@@ -445,7 +501,8 @@ void vmdealloc(vm_area_t* vm, int decsize, int mapping)
             freemap(va, PAGE_SIZE);     
         
         pa = ADDR_TO_PTE(vm->mmap[--i]);    /* Fetch physical address from mmap structure. */
-        free_user_page(pa, 0);              /* Free the physical address. */
+        if(!(vm->vmflag & VM_FILE))         /* File pages belong to the file system image. */
+            free_user_page(pa, 0);          /* Free the physical address. */
     }
 
     if(newend != vm->vmend) {               /* Shrink the mmap structure. */
@@ -505,35 +562,43 @@ int vmcopy(vmem_t* dest, vmem_t* src)
         destarea->vmstart = srcarea->vmstart;
         destarea->vmend = srcarea->vmend;
         destarea->vmflag = srcarea->vmflag;
-
-        /* For each mmap area to copy, loop through all pages. */
-        i = 0;
-        for(va = srcarea->vmstart; va < srcarea->vmend; va += PAGE_SIZE) {
-
-            if((pte = _walk(va, 0, 0)) == 0) {      /* Obtain PTE entry for current virtual address. */
-                panic("vmcopy: walk error");
-            }
-            if((*pte & PTE_PRESENT) == 0) {
-                panic("vmcopy: src not present");
-            }
+        destarea->inode = srcarea->inode;
+        destarea->pgoff = srcarea->pgoff;
+
+        if(srcarea->vmflag & VM_FILE) {
+            /* File pages are shared, not copied. */
+            memcpy(destarea->mmap, srcarea->mmap, sizeof(uint32_t) * length);
+            fs_mget(srcarea->inode);
+        } else {
+            /* For each mmap area to copy, loop through all pages. */
+            i = 0;
+            for(va = srcarea->vmstart; va < srcarea->vmend; va += PAGE_SIZE) {
+
+                if((pte = _walk(va, 0, 0)) == 0) {      /* Obtain PTE entry for current virtual address. */
+                    panic("vmcopy: walk error");
+                }
+                if((*pte & PTE_PRESENT) == 0) {
+                    panic("vmcopy: src not present");
+                }
             
-            if((pa = get_user_page(0)) == 0) {      /* Alloc physical memory for dest. */
-                panic("vmcopy: get user page failed");
-            }
+                if((pa = get_user_page(0)) == 0) {      /* Alloc physical memory for dest. */
+                    panic("vmcopy: get user page failed");
+                }
             
-            memcpy(cache, (char*)va, PAGE_SIZE);    /* Copy mapping data onto the temp storage. */
+                memcpy(cache, (char*)va, PAGE_SIZE);    /* Copy mapping data onto the temp storage. */
             
-            freemap(va, PAGE_SIZE);                 /* Delete previous memory map. */
+                freemap(va, PAGE_SIZE);                 /* Delete previous memory map. */
 
-            if(mmap(va, pa, PAGE_SIZE, GETBIT_12(srcarea->mmap[i])) == -1) {    /* Map new physical memory to the pagedir. */
-                free_user_page(pa, 0);
-                panic("vmcopy: remap failed");
-            }
+                if(mmap(va, pa, PAGE_SIZE, GETBIT_12(srcarea->mmap[i])) == -1) {    /* Map new physical memory to the pagedir. */
+                    free_user_page(pa, 0);
+                    panic("vmcopy: remap failed");
+                }
             
-            memcpy((char*)va, cache, PAGE_SIZE);    /* Copy data to current virtual memory. */
+                memcpy((char*)va, cache, PAGE_SIZE);    /* Copy data to current virtual memory. */
 
-            destarea->mmap[i] = PTE_PRESENT | GETBIT_12(srcarea->mmap[i]) | (ADDR_TO_PTE(pa));
-            i ++;
+                destarea->mmap[i] = PTE_PRESENT | GETBIT_12(srcarea->mmap[i]) | (ADDR_TO_PTE(pa));
+                i ++;
+            }
         }
 
         srcarea = srcarea->next;
@@ -552,6 +617,288 @@ int vmcopy(vmem_t* dest, vmem_t* src)
     return 0;
 }
 
+/**
+ * @brief           Grow the stack area down so that it covers addr. The new
+ *                  pages are mapped on the current virtual memory, which
+ *                  must be the one of vm (a page fault, or exec writing the
+ *                  arguments of a new program).
+ * 
+ * @param vm        Virtual memory struct.
+ * @param addr      Lowest address the stack must cover.
+ * @return int      0 if succeed, -1 if failed.
+ */
+int expand_stack(vmem_t* vm, uint32_t addr)
+{
+    vm_area_t* area;
+    uint32_t pa, length;
+    uint32_t* temp;
+
+    if(addr >= USER_STACK_ADDR || addr <= USER_STACK_ADDR - USER_STACK_MAX)
+        return -1;
+
+    for(area = vm->map_list; area != 0; area = area->next)
+        if(area->vmflag & VM_STACK)
+            break;
+    if(area == 0)
+        return -1;
+
+    while(area->vmstart > addr) {
+        length = (area->vmend - area->vmstart) / PAGE_SIZE;
+
+        if((pa = get_user_page(0)) == 0)                        /* Alloc physical memory. */
+            return -1;
+
+        /* the new page goes in front of the old ones */
+        if((temp = kmalloc(sizeof(uint32_t) * (length + 1))) == 0) {
+            free_user_page(pa, 0);
+            return -1;
+        }
+        if(length) {
+            memcpy((char*)(temp + 1), (char*)area->mmap, sizeof(uint32_t) * length);
+            kfree(area->mmap);
+        }
+        area->mmap = temp;
+
+        area->vmstart = area->vmstart - PAGE_SIZE;
+        mmap(area->vmstart, pa, PAGE_SIZE, PTE_RW | PTE_US);    /* Create mmap. */
+        area->mmap[0] = ADDR_TO_PTE(pa) | PTE_PRESENT | PTE_RW | PTE_US;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief           Map npages pages of a file, from page pgoff of the file,
+ *                  at the first free address of the file mapping window.
+ *                  No page is mapped yet: file_fault() maps each page onto
+ *                  its data block in the file system image when it is
+ *                  first touched, read only, so nothing is copied.
+ * 
+ * @param vm        Virtual memory struct of the current process.
+ * @param inode     Inode of a regular file.
+ * @param pgoff     First page of the file to map.
+ * @param npages    Number of pages to map.
+ * @return uint32_t Virtual address of the mapping, 0 if failed.
+ */
+uint32_t map_file(vmem_t* vm, uint32_t inode, uint32_t pgoff, uint32_t npages)
+{
+    vm_area_t *area, *t;
+    uint32_t va, len;
+
+    if(npages == 0 || npages > (FILE_MAP_END - FILE_MAP_START) / PAGE_SIZE)
+        return 0;
+    len = npages * PAGE_SIZE;
+
+    /* Move past every area in the way, then check all of them again. */
+    va = FILE_MAP_START;
+    t = vm->map_list;
+    while(t != 0) {
+        if(t->vmstart < va + len && va < t->vmend) {
+            va = ADDR_TO_PTE(t->vmend + PAGE_SIZE - 1);
+            t = vm->map_list;
+            continue;
+        }
+        t = t->next;
+    }
+    if(va + len > FILE_MAP_END)
+        return 0;
+
+    if((area = kmalloc(sizeof(vm_area_t))) == 0)
+        return 0;
+    if((area->mmap = kmalloc(sizeof(uint32_t) * npages)) == 0) {
+        kfree(area);
+        return 0;
+    }
+    memset(area->mmap, 0, sizeof(uint32_t) * npages);      /* No page present. */
+
+    area->vmstart = va;
+    area->vmend = va + len;
+    area->vmflag = VM_READ | VM_FILE;
+    area->inode = inode;
+    area->pgoff = pgoff;
+
+    /* Keep the areas sorted, the program image is always the first one. */
+    for(t = vm->map_list; t->next != 0 && t->next->vmstart < va; t = t->next)
+        ;
+    area->next = t->next;
+    t->next = area;
+
+    fs_mget(inode);
+    return va;
+}
+
+/**
+ * @brief           Remove the file mapping that starts at va. vm must be
+ *                  the current virtual memory.
+ * 
+ * @param vm        Virtual memory struct.
+ * @param va        Start of the mapping.
+ * @return int      0 if succeed, -1 if there is no file mapping at va.
+ */
+int unmap_file(vmem_t* vm, uint32_t va)
+{
+    vm_area_t *area, *prev = 0;
+
+    for(area = vm->map_list; area != 0; prev = area, area = area->next)
+        if(area->vmstart == va && (area->vmflag & VM_FILE))
+            break;
+    if(area == 0 || prev == 0)
+        return -1;
+
+    prev->next = area->next;
+    freemap(area->vmstart, area->vmend - area->vmstart);
+    fs_mput(area->inode);
+
+    kfree(area->mmap);
+    kfree(area);
+    return 0;
+}
+
+/**
+ * @brief           Remove all the file mappings (exec). vm must be the
+ *                  current virtual memory.
+ * 
+ * @param vm        Virtual memory struct.
+ */
+void unmap_files(vmem_t* vm)
+{
+    vm_area_t *area, *next;
+
+    for(area = vm->map_list; area != 0; area = next) {
+        next = area->next;
+        if(area->vmflag & VM_FILE)
+            unmap_file(vm, area->vmstart);
+    }
+}
+
+/**
+ * @brief           Map the page of a file mapping that addr falls in onto
+ *                  the data block of the file (page fault).
+ * 
+ * @param vm        Virtual memory struct of the current process.
+ * @param addr      Faulting address.
+ * @return int      0 if succeed, -1 if addr is not in a file mapping or
+ *                  is past the end of the file.
+ */
+int file_fault(vmem_t* vm, uint32_t addr)
+{
+    vm_area_t* area;
+    uint32_t i, pa;
+
+    for(area = vm->map_list; area != 0; area = area->next) {
+        if(!(area->vmflag & VM_FILE) || addr < area->vmstart || addr >= area->vmend)
+            continue;
+
+        i = (addr - area->vmstart) / PAGE_SIZE;
+        if(area->mmap[i] & PTE_PRESENT)
+            return -1;
+        if((pa = fs_block_addr(area->inode, area->pgoff + i)) == 0)
+            return -1;
+
+        area->mmap[i] = PTE_PRESENT | PTE_US | ADDR_TO_PTE(pa);
+        return mmap(ADDR_TO_PTE(addr), pa, PAGE_SIZE, PTE_US);
+    }
+
+    return -1;
+}
+
+/**
+ * @brief           Find the physical address behind a user virtual address
+ *                  of any process, mapped or not in the current page directory.
+ * 
+ * @param vm        Virtual memory struct of the process.
+ * @param va        User virtual address.
+ * @param vmflag    VM_* flags the area must have (VM_WRITE to write to it).
+ * @return uint32_t Physical address, 0 if va is not in an area with vmflag.
+ */
+uint32_t user_virt_to_phys(vmem_t* vm, uint32_t va, uint32_t vmflag)
+{
+    vm_area_t* area;
+    uint32_t pte;
+
+    for(area = vm->map_list; area != 0; area = area->next) {
+        if(va < area->vmstart || va >= area->vmend)
+            continue;
+        if((area->vmflag & vmflag) != vmflag)
+            return 0;
+        pte = area->mmap[(va - area->vmstart) / PAGE_SIZE];
+        if(!(pte & PTE_PRESENT))            /* A file page not touched yet. */
+            return 0;
+        return ADDR_TO_PTE(pte) | GETBIT_12(va);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief           Check that a range of user memory of the current process
+ *                  can be reached by the kernel without a page fault. The
+ *                  pages a fault would bring in (the stack growing down, a
+ *                  page of a mapped file) are mapped first.
+ * 
+ * @param vm        Virtual memory struct of the current process.
+ * @param va        First user virtual address.
+ * @param len       Bytes in the range.
+ * @param vmflag    VM_* flags the areas must have (VM_WRITE to write to it).
+ * @return int      1 if every page of the range is mapped with vmflag, 0 if not.
+ */
+int user_access_ok(vmem_t* vm, uint32_t va, uint32_t len, uint32_t vmflag)
+{
+    uint32_t page, last, addr;
+
+    if(len == 0)
+        return 1;
+    if(va + len - 1 < va)
+        return 0;
+
+    last = (va + len - 1) & ~(PAGE_SIZE - 1);
+
+    for(page = va & ~(PAGE_SIZE - 1); ; page += PAGE_SIZE) {
+        addr = (page < va) ? va : page;
+
+        if(!user_virt_to_phys(vm, addr, vmflag)) {
+            if(expand_stack(vm, page) < 0 && file_fault(vm, addr) < 0)
+                return 0;
+            if(!user_virt_to_phys(vm, addr, vmflag))
+                return 0;
+        }
+
+        if(page == last)
+            break;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief           Map a physical page at KMAP_ADDR, so the kernel can reach
+ *                  user memory of a process that is not running (user pages
+ *                  live above the identity map). There is only one window:
+ *                  the caller keeps interrupts off until kunmap_atomic().
+ * 
+ * @param pa        Physical address.
+ * @return void*    Kernel virtual address of pa.
+ */
+void* kmap_atomic(uint32_t pa)
+{
+    uint32_t va = KMAP_ADDR + GETBIT_12(pa);
+
+    page_table[PTE_ADDR(KMAP_ADDR) & GETBIT_10] = PTE_PRESENT | PTE_RW | ADDR_TO_PTE(pa);
+    asm volatile("invlpg (%0)" : : "r"(va) : "memory");
+
+    return (void*)va;
+}
+
+/**
+ * @brief           Remove the mapping made by kmap_atomic().
+ * 
+ */
+void kunmap_atomic(void)
+{
+    page_table[PTE_ADDR(KMAP_ADDR) & GETBIT_10] = PTE_RW;
+    asm volatile("invlpg (%0)" : : "r"(KMAP_ADDR) : "memory");
+}
+
 void show_mmap(vmem_t* vm)
 {
     vm_area_t* area;
@@ -0,0 +1,117 @@
+/**
+ * @file wait.c
+ * @brief Wait queues.
+ * @overview:
+ * A wait queue is the list of threads sleeping until the state of
+ * some object changes (data arrives in a pipe, space is freed in it).
+ * The queue has no lock of its own, it is protected by the lock of
+ * the object it belongs to:
+ *
+ *     spin_lock_irqsave(&obj->lock, flags);
+ *     while (!condition)
+ *         sleep_on(&obj->wait, &obj->lock);
+ *     ...
+ *     spin_unlock_irqrestore(&obj->lock, flags);
+ *
+ * and whoever changes the condition calls wake_up() with the lock held.
+ * Interrupts stay off from the check of the condition until the thread
+ * is asleep, so a wakeup cannot be lost in between (the same rule as
+ * for futexes and the worker thread).
+ *
+ * sleep_on() returns after one sleep, off the queue. The caller must
+ * check the condition again: another thread may have got there first,
+ * or the thread was woken up by something else. A signal sent to the
+ * thread also ends the sleep (or prevents it), the caller checks
+ * signal_pending() and returns -EINTR. sleep_on_uninterruptible() is
+ * not ended by signals, for waits that always complete (disk I/O).
+ *
+ * @reference:
+ * Love, Robert, Linux Kernel Development (Chapter 4, Sleeping and Waking Up)
+ *
+ */
+
+#include <pro/wait.h>
+#include <pro/process.h>
+#include <access.h>
+
+
+/**
+ * @brief put the current thread to sleep on q
+ *
+ * @param q : wait queue
+ * @param lock : lock protecting q, held with interrupts off
+ * @param intr : 1 if a signal ends the sleep
+ */
+static void __sleep_on(wait_queue_head_t *q, spinlock_t *lock, uint8_t intr) {
+    wait_queue_t wait;
+    thread_t *curr;
+
+    GETPRO(curr);
+
+    /* a signal is waiting: do not go to sleep */
+    if (intr && signal_pending(curr))
+        return;
+
+    wait.task = curr;
+    list_add_tail(&wait.node, &q->task_list);
+
+    spin_unlock(lock);
+    curr->sigsleep = intr;
+    sched_sleep(curr);
+    curr->sigsleep = 0;
+    spin_lock(lock);
+
+    /* woken up for another reason (terminal switch, signal), leave the queue */
+    if (wait.task)
+        list_del(&wait.node);
+}
+
+
+/**
+ * @brief sleep on q until woken up by wake_up() or a signal
+ *
+ * The caller holds lock with interrupts off, the lock is released
+ * while sleeping and taken again before returning.
+ *
+ * @param q : wait queue
+ * @param lock : lock protecting q and the condition waited for
+ */
+void sleep_on(wait_queue_head_t *q, spinlock_t *lock) {
+    __sleep_on(q, lock, 1);
+}
+
+
+/**
+ * @brief sleep on q until woken up by wake_up(), a signal does not end
+ * the sleep. For waits that cannot fail with -EINTR (a disk request, a
+ * mutex), the caller still checks its condition again.
+ *
+ * @param q : wait queue
+ * @param lock : lock protecting q and the condition waited for
+ */
+void sleep_on_uninterruptible(wait_queue_head_t *q, spinlock_t *lock) {
+    __sleep_on(q, lock, 0);
+}
+
+
+/**
+ * @brief wake up all threads sleeping on q, the caller holds the lock
+ * protecting q
+ *
+ * @param q : wait queue
+ */
+void wake_up(wait_queue_head_t *q) {
+    list_head *node, *next;
+    wait_queue_t *wait;
+    thread_t *task;
+
+    for (node = q->task_list.next; node != &q->task_list; node = next) {
+        next = node->next;
+        wait = list_entry(node, wait_queue_t, node);
+
+        list_del(&wait->node);
+        task = wait->task;
+        wait->task = NULL;
+        wake_up_process(task);
+    }
+}
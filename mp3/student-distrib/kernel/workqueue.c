@@ -0,0 +1,114 @@
+/**
+ * @file workqueue.c
+ * @brief Deferred work (bottom halves) run by a kernel worker thread.
+ * @overview:
+ * An interrupt handler should only do what cannot wait (read the device,
+ * send EOI) and leave the rest to a work item. schedule_work() puts the
+ * item on a list and wakes up the worker thread, which runs the items
+ * one by one as a normal schedulable task with interrupts enabled.
+ *
+ * A work item is queued at most once: scheduling a pending item again
+ * does nothing, its function will see all the data queued so far.
+ *
+ * @reference:
+ * Love, Robert, Linux Kernel Development (Chapter 8, Bottom Halves and Deferring Work)
+ *
+ */
+
+#include <pro/workqueue.h>
+#include <pro/process.h>
+#include <spinlock.h>
+#include <lib.h>
+
+
+static LIST_HEAD(worklist);         /* work items waiting for the worker */
+static thread_t *kworker;           /* the worker thread */
+static DEFINE_SPINLOCK(work_lock);  /* protects worklist and pending flags */
+
+
+static int32_t worker_thread(void *arg);
+
+
+/**
+ * @brief create the worker thread
+ *
+ */
+void workqueue_init(void) {
+    pid_t pid;
+
+    if ((pid = kernel_thread(worker_thread, NULL, KWORKER)) < 0)
+        panic("cannot create kworker");
+
+    kworker = find_task_by_pid(pid);
+
+    /* deferred interrupt work should not wait behind user tasks */
+    set_user_nice(kworker, MIN_NICE);
+}
+
+
+/**
+ * @brief queue a work item and wake up the worker,
+ * safe to call from interrupt handlers
+ *
+ * @param work : work item
+ * @return int32_t : 1 if queued, 0 if it was already pending
+ */
+int32_t schedule_work(work_t *work) {
+    uint32_t flags;
+
+    spin_lock_irqsave(&work_lock, flags);
+
+    if (work->pending) {
+        spin_unlock_irqrestore(&work_lock, flags);
+        return 0;
+    }
+
+    work->pending = 1;
+    list_add_tail(&work->entry, &worklist);
+
+    if (kworker)
+        wake_up_process(kworker);
+
+    spin_unlock_irqrestore(&work_lock, flags);
+    return 1;
+}
+
+
+/**
+ * @brief the task of the worker thread: run work items,
+ * and sleep when there is none
+ *
+ * @param arg : unused
+ * @return int32_t : never returns
+ */
+static int32_t worker_thread(void *arg) {
+    thread_t *self;
+    work_t *work;
+    uint32_t flags;
+
+    GETPRO(self);
+
+    while (1) {
+        spin_lock_irqsave(&work_lock, flags);
+
+        /* interrupts stay off from the check until we are asleep,
+         * so a wakeup cannot be lost */
+        while (list_empty(&worklist)) {
+            spin_unlock(&work_lock);
+            sched_sleep(self);
+            spin_lock(&work_lock);
+        }
+
+        work = list_entry(worklist.next, work_t, entry);
+        list_del(&work->entry);
+
+        /* the item can be queued again while it runs */
+        work->pending = 0;
+
+        spin_unlock_irqrestore(&work_lock, flags);
+
+        work->func(work);
+    }
+
+    return 0;
+}
@@ -9,6 +9,7 @@
 
 int screen_x = 0;
 int screen_y = 0;
+uint8_t screen_top = 0;
 
 
 int32_t fputs(int32_t fd, const int8_t* s) {
@@ -24,7 +25,7 @@ void clear(void) {
     terminal_t *terminal;
 
     if (!terminal_boot) {
-        vga_clear(video_mem);
+        vga_clear(video_mem, &screen_top);
         screen_x = 0;
         screen_y = 0;
         return;
@@ -33,7 +34,7 @@ void clear(void) {
     curr = current->task;
     terminal = curr->terminal;
     
-    vga_clear(terminal->vidmem);
+    vga_clear(terminal->vidmem, &terminal->top);
     terminal->screen_x = 0;
     terminal->screen_y = 0;
 }
@@ -183,43 +184,46 @@ int32_t puts(int8_t* s) {
 
 void _putc(uint8_t c, terminal_t* terminal) {
     int32_t x, y;
-    uint8_t *vidmem;
+    char *vidmem;
+    uint8_t *top;
 
     if (!terminal_boot) {
         x = screen_x;
         y = screen_y;
-        vidmem = (uint8_t*)video_mem;
+        vidmem = video_mem;
+        top = &screen_top;
     } else {  
         x = terminal->screen_x;
         y = terminal->screen_y;
         vidmem = terminal->vidmem;
+        top = &terminal->top;
     }
      if(c == '\n' || c == '\r') {
         if (y + 1 == NUM_ROWS) 
-            vga_scrolling(vidmem);
+            vga_scrolling(vidmem, top);
         else
            y++; 
         x = 0;
     } else {
-        vga_write(vidmem, x, y, c);
+        vga_write(vidmem, *top, x, y, c);
         x++;
         x %= NUM_COLS;
         if (x == 0) {
             if (y + 1 != NUM_ROWS)
                 y++;
             else
-                vga_scrolling(vidmem);
+                vga_scrolling(vidmem, top);
         }
     }
     if (!terminal_boot) {
         screen_x = x;
         screen_y = y;
-        vga_update_cursor(x, y);
+        vga_update_cursor(*top, x, y);
     } else {
         terminal->screen_x = x;
         terminal->screen_y = y;
         if (terminal == current->task->terminal)
-            vga_update_cursor(x, y);
+            vga_update_cursor(*top, x, y);
     }
 }
 
@@ -261,9 +265,9 @@ void back(terminal_t *terminal) {
     } else {
         terminal->screen_x--;
     }
-    vga_write(terminal->vidmem, terminal->screen_x, terminal->screen_y, ' ');
+    vga_write(terminal->vidmem, terminal->top, terminal->screen_x, terminal->screen_y, ' ');
     if (terminal == current->task->terminal)
-        vga_update_cursor(terminal->screen_x, terminal->screen_y);
+        vga_update_cursor(terminal->top, terminal->screen_x, terminal->screen_y);
 }
 
 void panic(int8_t *s)
@@ -226,6 +226,23 @@ void* memmove(void* dest, const void* src, uint32_t n) {
     return dest;
 }
 
+/* int32_t memcmp(const void* s1, const void* s2, uint32_t n)
+ * Inputs: const void* s1 = first memory area
+ *         const void* s2 = second memory area
+ *             uint32_t n = number of bytes to compare
+ * Return Value: zero if the areas are equal, otherwise the difference
+ *               of the first pair of bytes (as unsigned) that differ
+ * Function: compares two memory areas byte by byte */
+int32_t memcmp(const void* s1, const void* s2, uint32_t n) {
+    const uint8_t *p1 = s1, *p2 = s2;
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        if (p1[i] != p2[i])
+            return p1[i] - p2[i];
+    }
+    return 0;
+}
+
 /* int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n)
  * Inputs: const int8_t* s1 = first string to compare
  *         const int8_t* s2 = second string to compare
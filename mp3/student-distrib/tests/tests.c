@@ -8,6 +8,8 @@
 #include <boot/syscall.h>
 #include <boot/page.h>
 #include <kmalloc.h>
+#include <pro/process.h>
+#include <errno.h>
 
 	
 #define PASS 1
@@ -601,6 +603,126 @@ void test_kmalloc() {
 	// printf("umalloc 1MB: %x\n", get_user_page(8));
 }
 
+#define LOOKUP_ROUNDS	1000
+
+static inline uint32_t rdtsc_lo(void) {
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+	return lo;
+}
+
+/* the lookup before the name hash: compare with every entry */
+static int32_t linear_lookup(const int8_t *fname) {
+	int i;
+	for (i = 0; i < fs->boot->n_dir; ++i)
+		if (!strncmp(fname, (int8_t *)fs->boot->dirs[i].fname, NAMESIZE))
+			return i;
+	return -1;
+}
+
+/**
+ * @brief lookup microbenchmark on a boot block with all FILES_MAX
+ * entries: every name and a missing one are looked up through the
+ * name hash and by the old linear scan, results must agree
+ * Coverage: read_dentry_by_name, fs_hash_init
+ * Files: fs.c
+ */
+int test_dentry_lookup() {
+	TEST_HEADER;
+	boot_block *fake, *real = fs->boot;
+	dentry_t d;
+	int8_t names[FILES_MAX + 1][NAMESIZE + 1];
+	uint32_t start, hashed, linear;
+	int i, r, result = PASS;
+
+	if (!(fake = kmalloc(sizeof(boot_block))))
+		return FAIL;
+
+	memset(fake, 0, sizeof(boot_block));
+	fake->n_dir = FILES_MAX;
+	for (i = 0; i < FILES_MAX; ++i) {
+		strcpy(names[i], "file");
+		itoa(i, names[i] + 4, 10);
+		strcpy((int8_t *)fake->dirs[i].fname, names[i]);
+		fake->dirs[i].type = REGULAR;
+		fake->dirs[i].inode = i;
+	}
+	strcpy(names[FILES_MAX], "missing");
+
+	fs->boot = fake;
+	fs_hash_init();
+
+	for (i = 0; i <= FILES_MAX; ++i) {
+		r = read_dentry_by_name(names[i], &d);
+		if ((r < 0 ? -1 : (int32_t)d.inode) != linear_lookup(names[i]))
+			result = FAIL;
+	}
+
+	start = rdtsc_lo();
+	for (r = 0; r < LOOKUP_ROUNDS; ++r)
+		for (i = 0; i <= FILES_MAX; ++i)
+			read_dentry_by_name(names[i], &d);
+	hashed = rdtsc_lo() - start;
+
+	start = rdtsc_lo();
+	for (r = 0; r < LOOKUP_ROUNDS; ++r)
+		for (i = 0; i <= FILES_MAX; ++i)
+			linear_lookup(names[i]);
+	linear = rdtsc_lo() - start;
+
+	printf("dentry lookup: hashed %d cycles, linear %d cycles\n",
+		   hashed / (LOOKUP_ROUNDS * (FILES_MAX + 1)),
+		   linear / (LOOKUP_ROUNDS * (FILES_MAX + 1)));
+
+	fs->boot = real;
+	fs_hash_init();
+	kfree(fake);
+
+	return result;
+}
+
+/**
+ * @brief descriptors made by dup and dup2 reach the terminal like the
+ * ones they copy: a copy of stdout writes and cannot read, a copy of
+ * stdin cannot write, and a copy is closed where stdout is not
+ * Coverage: terminal_read, terminal_write, terminal_close, dup, dup2
+ * Files: terminal.c, vfs.c, file.c
+ */
+int test_terminal_dup() {
+	TEST_HEADER;
+	thread_t *curr;
+	char msg[] = "dup\n";
+	char buf[4];
+	int fd, own = 0, result = PASS;
+
+	GETPRO(curr);
+	if (!curr->fds) {
+		if (fd_init(curr) < 0)
+			return FAIL;
+		own = 1;
+	}
+
+	fd = do_dup(stdout);
+	if (fd < 0 || do_write(fd, msg, 4) != 4 || do_read(fd, buf, 4) != -1)
+		result = FAIL;
+	if (do_close(fd) != 0 || do_write(fd, msg, 4) != -EBADF)
+		result = FAIL;
+
+	if (do_dup2(stdout, 5) != 5 || do_write(5, msg, 4) != 4 || do_close(5) != 0)
+		result = FAIL;
+
+	fd = do_dup(stdin);
+	if (fd < 0 || do_write(fd, msg, 4) != -1 || do_close(fd) != 0)
+		result = FAIL;
+
+	if (do_close(stdout) != -1 || do_write(stdout, msg, 4) != 4)
+		result = FAIL;
+
+	if (own)
+		put_files(curr);
+	return result;
+}
+
 /* Test suite entry point */
 void launch_tests() {
 	printf("--------------------------------- Test begins ---------------------------------\n");
@@ -609,5 +731,7 @@ void launch_tests() {
 	//page_access_test();
 	//test_checkpoint3();
 	test_kmalloc();
+	TEST_OUTPUT("test_dentry_lookup", test_dentry_lookup());
+	TEST_OUTPUT("test_terminal_dup", test_terminal_dup());
 	printf("---------------------------------- Test Ends ----------------------------------\n");
 }
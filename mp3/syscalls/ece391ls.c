@@ -3,26 +3,52 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
-#define SBUFSIZE 33
+#define BUFSIZE 1024
+#define NAMECOL 34
+
+/* one letter for each file type */
+static const uint8_t type_char[] = "cd-tp";
+
+static int32_t print_entry (ece391_dirent_t* d)
+{
+    uint8_t line[NAMECOL + 16];
+    uint8_t num[12];
+    uint32_t len, i;
+
+    ece391_strcpy (line, d->d_name);
+    len = ece391_strlen (line);
+    for (i = len; i < NAMECOL; i++)
+        line[i] = ' ';
+    line[NAMECOL] = (d->d_type < sizeof (type_char) - 1) ? type_char[d->d_type] : '?';
+    line[NAMECOL + 1] = ' ';
+    ece391_itoa (d->d_size, num, 10);
+    ece391_strcpy (line + NAMECOL + 2, num);
+    len = ece391_strlen (line);
+    line[len] = '\n';
+
+    return ece391_write (1, line, len + 1);
+}
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, pos;
+    uint8_t buf[BUFSIZE];
 
     if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
-        if (-1 == cnt) {
+    /* a batch of entries with their type and size per call */
+    while (0 != (cnt = ece391_getdents (fd, buf, BUFSIZE))) {
+        if (cnt < 0) {
 	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	        return 3;
 	    }
-	    buf[cnt] = '\n';
-	    if (-1 == ece391_write (1, buf, cnt + 1))
-	        return 3;
+        for (pos = 0; pos < cnt; pos += ((ece391_dirent_t*)(buf + pos))->d_reclen) {
+            if (-1 == print_entry ((ece391_dirent_t*)(buf + pos)))
+                return 3;
+        }
     }
 
     return 0;
@@ -22,6 +22,35 @@ extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
 extern int32_t ece391_fork(void);
+extern int32_t ece391_getdents (int32_t fd, void* buf, int32_t nbytes);
+extern int32_t ece391_stat (const uint8_t* filename, void* buf);
+extern int32_t ece391_fstat (int32_t fd, void* buf);
+
+/* file types, in d_type and st_type */
+enum filetypes {
+	ECE391_RTC = 0,
+	ECE391_DIR,
+	ECE391_REG,
+	ECE391_TERM,
+	ECE391_PIPE
+};
+
+/* A record filled by getdents, the next one starts d_reclen bytes further. */
+typedef struct {
+	uint32_t d_ino;
+	uint32_t d_size;
+	uint16_t d_reclen;
+	uint8_t  d_type;
+	uint8_t  d_name[1];		/* '\0' terminated */
+} ece391_dirent_t;
+
+/* Filled by stat and fstat. */
+typedef struct {
+	uint32_t st_ino;
+	uint32_t st_type;
+	uint32_t st_size;
+	uint32_t st_blocks;
+} ece391_stat_t;
 
 enum signums {
 	DIV_ZERO = 0,
@@ -12,5 +12,8 @@
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
 #define SYS_FORK 11
+#define SYS_GETDENTS 47
+#define SYS_STAT 48
+#define SYS_FSTAT 49
 
 #endif /* ECE391SYSNUM_H */
@@ -0,0 +1,595 @@
+/**
+ * @file fsimg.c
+ * @brief Host tool that builds the file system image (filesys_img) from
+ * a directory, and checks (and repairs) an image.
+ * @overview:
+ * The layout is the one of student-distrib/include/drivers/fs.h: a boot
+ * block with the entries of the root directory and where the maps are,
+ * the inodes (INODES unless -i says otherwise), the map of used inodes
+ * and the map of used data blocks, then the data blocks. An image 
+ * without FS_MAPS keeps both maps in the boot block and is checked as 
+ * such, covering INODES_MAX inodes and DATAB_MAX data blocks. A built 
+ * image has "." and "rtc", then one regular file per file of the 
+ * directory and one directory inode per subdirectory, walked down to the
+ * last level (names are cut to NAMESIZE bytes), and free data blocks for
+ * files written by the kernel. A subdirectory holds "." and "..", then 
+ * its entries.
+ *
+ * The check walks the directories from the root and finds what an update
+ * stopped halfway or a bad image leaves: entries with the same name or 
+ * inode, inodes pointing out of the image or at blocks of another file, 
+ * and maps that do not match the entries. With -f the later of two 
+ * conflicting entries is dropped, a file is cut before its first bad 
+ * block, and the maps are rebuilt.
+ *
+ * usage: fsimg build [-b free_blocks] [-i inodes] dir image
+ *        fsimg check [-f] image
+ *
+ * An image with state 0 predates the maps and the clean marker: the 
+ * kernel rebuilds its maps, so only its entries and inodes are checked.
+ *
+ * check exits with 0 if the image is clean, 1 if errors were repaired,
+ * 4 if errors are left.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* same as drivers/fs.h */
+#define FILES_MAX   63
+#define BLOCK_SIZE  4096
+#define NAMESIZE    32
+#define INODES_MAX  64
+#define DATAB_MAX   320
+#define FILE_BLOCKS 1023
+#define FS_CLEAN    0x4e4c4346
+#define FS_DIRTY    0x54524944
+#define FS_MAPS     0x70616d66
+#define MAP_BITS    (BLOCK_SIZE * 8)
+
+#define RTC         0
+#define DIRECTORY   1
+#define REGULAR     2
+
+#define ROOT_INO    0
+#define DIR_ENTRIES (BLOCK_SIZE / sizeof(dentry_t))
+
+#define INODES      64          /* default inodes of a built image */
+#define FREE_BLOCKS 64          /* default free data blocks of a built image */
+
+typedef struct {
+    char     fname[NAMESIZE];
+    uint32_t type;
+    uint32_t inode;
+    uint8_t  reserved[24];
+} dentry_t;
+
+typedef struct {
+    uint32_t n_dir;
+    uint32_t n_inode;
+    uint32_t n_datab;
+    uint32_t state;
+    union {
+        struct {
+            uint8_t inode_map[INODES_MAX / 8];
+            uint8_t block_map[DATAB_MAX / 8];
+        } legacy;
+        struct {
+            uint32_t magic;
+            uint32_t start;
+            uint32_t blocks;
+        } ext;
+    } maps;
+    dentry_t dirs[FILES_MAX];
+} boot_block;
+
+typedef struct {
+    uint32_t size;
+    uint32_t data_block[FILE_BLOCKS];
+} inode_t;
+
+#define map_test(map, i)    ((map)[(i) >> 3] & (1 << ((i) & 7)))
+#define map_set(map, i)     ((map)[(i) >> 3] |= (1 << ((i) & 7)))
+
+#define map_bytes(n)        (((n) + 7) / 8)
+#define map_blocks(n)       (((n) + MAP_BITS - 1) / MAP_BITS)
+#define has_maps(b)         ((b)->state && (b)->maps.ext.magic == FS_MAPS)
+
+#define size_blocks(size)   (((size) + BLOCK_SIZE - 1) / BLOCK_SIZE)
+#define is_dot(name)        ((name)[0] == '.' && (!(name)[1] || ((name)[1] == '.' && !(name)[2])))
+
+
+/* the whole image in memory */
+static uint8_t *img;
+static size_t img_len;
+
+#define boot        ((boot_block *) img)
+#define inodes      ((inode_t *) (img + BLOCK_SIZE))
+#define datab(i)    (img + (meta_blocks() + (i)) * BLOCK_SIZE)
+
+/* inodes and data blocks covered by the maps, as fs_setup() */
+#define max_inode   (has_maps(boot) || boot->n_inode < INODES_MAX ? boot->n_inode : INODES_MAX)
+#define max_datab   (has_maps(boot) || boot->n_datab < DATAB_MAX ? boot->n_datab : DATAB_MAX)
+
+
+/* a file or directory of the tree an image is built from */
+typedef struct {
+    char     name[NAMESIZE + 1];
+    char     *path;
+    int      dir;               /* 1 for a directory */
+    int      parent;            /* index of the parent, -1 for the root */
+    uint32_t size;
+} node_t;
+
+static node_t *nodes;
+static uint32_t nnodes, nalloc;
+
+
+/* blocks before the data: boot block, inodes and maps */
+static uint32_t meta_blocks(void) {
+    return has_maps(boot) ? boot->maps.ext.start + boot->maps.ext.blocks : 1 + boot->n_inode;
+}
+
+/* the inode map of the image */
+static uint8_t *inode_map(void) {
+    return has_maps(boot) ? img + boot->maps.ext.start * BLOCK_SIZE : boot->maps.legacy.inode_map;
+}
+
+/* the block map of the image */
+static uint8_t *block_map(void) {
+    if (has_maps(boot))
+        return img + (boot->maps.ext.start + map_blocks(boot->n_inode)) * BLOCK_SIZE;
+    return boot->maps.legacy.block_map;
+}
+
+
+static int cmp_names(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* number of entries of a directory */
+static uint32_t dir_count(uint32_t dir) {
+    return dir == ROOT_INO ? boot->n_dir : inodes[dir].size / sizeof(dentry_t);
+}
+
+/* entry i of a directory */
+static dentry_t *dir_entry(uint32_t dir, uint32_t i) {
+    if (dir == ROOT_INO)
+        return &boot->dirs[i];
+    return (dentry_t *) datab(inodes[dir].data_block[i / DIR_ENTRIES]) + i % DIR_ENTRIES;
+}
+
+/* mark the inodes and blocks used by the entries, walking the 
+ * directories from the root, as fs_rebuild_maps() */
+static void build_maps(uint8_t *imap, uint8_t *bmap) {
+    uint32_t *queue = malloc(max_inode * sizeof(uint32_t));
+    uint32_t head = 0, tail = 0, dir, i, n;
+    dentry_t *d;
+    inode_t *f;
+
+    memset(imap, 0, map_bytes(max_inode));
+    memset(bmap, 0, map_bytes(max_datab));
+    map_set(imap, ROOT_INO);
+    queue[tail++] = ROOT_INO;
+
+    while (head < tail) {
+        dir = queue[head++];
+
+        for (i = 0; i < dir_count(dir); ++i) {
+            d = dir_entry(dir, i);
+            if ((d->type != REGULAR && d->type != DIRECTORY) || is_dot(d->fname) ||
+                d->inode >= max_inode || map_test(imap, d->inode))
+                continue;
+            map_set(imap, d->inode);
+            f = &inodes[d->inode];
+            for (n = 0; n < size_blocks(f->size) && n < FILE_BLOCKS; ++n)
+                if (f->data_block[n] < max_datab)
+                    map_set(bmap, f->data_block[n]);
+            if (d->type == DIRECTORY && tail < max_inode)
+                queue[tail++] = d->inode;
+        }
+    }
+    free(queue);
+}
+
+static void set_entry(dentry_t *d, const char *name, uint32_t type, uint32_t inode) {
+    memset(d, 0, sizeof(*d));
+    memcpy(d->fname, name, strnlen(name, NAMESIZE));
+    d->type = type;
+    d->inode = inode;
+}
+
+static void add_entry(const char *name, uint32_t type, uint32_t inode) {
+    set_entry(&boot->dirs[boot->n_dir++], name, type, inode);
+}
+
+/* add the files and subdirectories of dir to nodes, sorted, then 
+ * the contents of each subdirectory */
+static int scan(const char *dir, int parent) {
+    char *names[FILES_MAX * 16];
+    char path[4096];
+    uint32_t n = 0, first = nnodes, i;
+    struct dirent *ent;
+    struct stat st;
+    DIR *dp;
+
+    if (!(dp = opendir(dir))) {
+        perror(dir);
+        return -1;
+    }
+
+    while ((ent = readdir(dp))) {
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        if (ent->d_name[0] == '.' || stat(path, &st) < 0 || 
+            (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)))
+            continue;
+        if (n == sizeof(names) / sizeof(names[0])) {
+            fprintf(stderr, "fsimg: too many files in %s\n", dir);
+            return -1;
+        }
+        names[n++] = strdup(ent->d_name);
+    }
+    closedir(dp);
+
+    qsort(names, n, sizeof(char *), cmp_names);
+
+    /* the root holds "." and "rtc" too */
+    if (parent < 0 && n > FILES_MAX - 2) {
+        fprintf(stderr, "fsimg: more than %d files in %s\n", FILES_MAX - 2, dir);
+        return -1;
+    }
+
+    for (i = 0; i < n; ++i) {
+        node_t *node;
+
+        if (nnodes == nalloc) {
+            nalloc = nalloc ? 2 * nalloc : INODES;
+            if (!(nodes = realloc(nodes, nalloc * sizeof(node_t)))) {
+                perror("fsimg");
+                return -1;
+            }
+        }
+        node = &nodes[nnodes];
+
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        stat(path, &st);
+        if (strlen(names[i]) > NAMESIZE)
+            fprintf(stderr, "fsimg: %s: name cut to %d bytes\n", path, NAMESIZE);
+
+        strncpy(node->name, names[i], NAMESIZE);
+        node->path = strdup(path);
+        node->dir = S_ISDIR(st.st_mode);
+        node->parent = parent;
+        node->size = node->dir ? 0 : st.st_size;
+        if (node->size > (uint32_t) FILE_BLOCKS * BLOCK_SIZE) {
+            fprintf(stderr, "fsimg: %s: larger than %d blocks\n", path, FILE_BLOCKS);
+            return -1;
+        }
+        nnodes++;
+        free(names[i]);
+    }
+
+    for (i = first; i < first + n; ++i) {
+        if (nodes[i].dir && scan(nodes[i].path, i) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int build(const char *dir, const char *image, uint32_t nfree, uint32_t ninode) {
+    uint32_t used = 0, ndirs = 0, nmap, i, j, n, b, k;
+    dentry_t *ents;
+    inode_t *f;
+    FILE *fp;
+
+    nnodes = 0;
+    if (scan(dir, -1) < 0)
+        return 1;
+
+    /* inode 0 is the root */
+    if (nnodes >= ninode) {
+        fprintf(stderr, "fsimg: %u files need -i %u or more\n", nnodes, nnodes + 1);
+        return 1;
+    }
+
+    /* a directory holds ".", ".." and its children */
+    for (i = 0; i < nnodes; ++i) {
+        if (nodes[i].dir) {
+            for (n = 0, j = 0; j < nnodes; ++j)
+                n += (nodes[j].parent == (int) i);
+            nodes[i].size = (2 + n) * sizeof(dentry_t);
+            ndirs++;
+        }
+        used += size_blocks(nodes[i].size);
+    }
+
+    /* the maps follow the inodes */
+    nmap = map_blocks(ninode) + map_blocks(used + nfree);
+    img_len = (size_t) (1 + ninode + nmap + used + nfree) * BLOCK_SIZE;
+    if (!(img = calloc(1, img_len))) {
+        perror("fsimg");
+        return 1;
+    }
+
+    boot->n_inode = ninode;
+    boot->n_datab = used + nfree;
+    boot->state = FS_CLEAN;
+    boot->maps.ext.magic = FS_MAPS;
+    boot->maps.ext.start = 1 + ninode;
+    boot->maps.ext.blocks = nmap;
+
+    add_entry(".", DIRECTORY, 0);
+    add_entry("rtc", RTC, 0);
+
+    /* node i is inode i + 1 */
+    for (i = 0, b = 0; i < nnodes; ++i) {
+        f = &inodes[i + 1];
+        f->size = nodes[i].size;
+        for (n = 0; n < size_blocks(f->size); ++n)
+            f->data_block[n] = b++;
+
+        if (nodes[i].parent < 0)
+            add_entry(nodes[i].name, nodes[i].dir ? DIRECTORY : REGULAR, i + 1);
+
+        if (!nodes[i].dir) {
+            if (!(fp = fopen(nodes[i].path, "rb"))) {
+                perror(nodes[i].path);
+                return 1;
+            }
+            for (n = 0; n < size_blocks(f->size); ++n) {
+                if (fread(datab(f->data_block[n]), 1, BLOCK_SIZE, fp) == 0 && ferror(fp)) {
+                    perror(nodes[i].path);
+                    return 1;
+                }
+            }
+            fclose(fp);
+            continue;
+        }
+
+        /* data blocks are consecutive, so are the entries */
+        ents = (dentry_t *) datab(f->data_block[0]);
+        set_entry(&ents[0], ".", DIRECTORY, i + 1);
+        set_entry(&ents[1], "..", DIRECTORY, nodes[i].parent < 0 ? ROOT_INO : nodes[i].parent + 1);
+        for (k = 2, j = 0; j < nnodes; ++j)
+            if (nodes[j].parent == (int) i)
+                set_entry(&ents[k++], nodes[j].name, nodes[j].dir ? DIRECTORY : REGULAR, j + 1);
+    }
+
+    build_maps(inode_map(), block_map());
+
+    if (!(fp = fopen(image, "wb")) || fwrite(img, 1, img_len, fp) != img_len) {
+        perror(image);
+        return 1;
+    }
+    fclose(fp);
+
+    printf("%s: %u files in %u directories, %u of %u inodes, %u of %u data blocks used\n", image,
+           nnodes - ndirs, ndirs + 1, nnodes + 1, ninode, used, used + nfree);
+    return 0;
+}
+
+/* drop entry i of dir, the last one takes its place as in fs_unlink() */
+static void drop_entry(uint32_t dir, uint32_t i) {
+    uint32_t last = dir_count(dir) - 1;
+
+    *dir_entry(dir, i) = *dir_entry(dir, last);
+    memset(dir_entry(dir, last), 0, sizeof(dentry_t));
+
+    if (dir == ROOT_INO)
+        boot->n_dir--;
+    else
+        inodes[dir].size -= sizeof(dentry_t);
+}
+
+/* the boot block fits the image, as image_ok() */
+static int layout_ok(void) {
+    size_t nblocks = img_len / BLOCK_SIZE;
+
+    if (boot->n_dir > FILES_MAX || !boot->n_inode || !boot->n_datab)
+        return 0;
+
+    if (has_maps(boot))
+        return boot->n_inode < nblocks && boot->maps.ext.start > boot->n_inode &&
+               boot->maps.ext.start < nblocks &&
+               boot->maps.ext.blocks == map_blocks(boot->n_inode) + map_blocks(boot->n_datab) &&
+               boot->maps.ext.blocks <= nblocks - boot->maps.ext.start &&
+               boot->n_datab <= nblocks - boot->maps.ext.start - boot->maps.ext.blocks;
+
+    return boot->n_inode <= INODES_MAX && 1 + (size_t) boot->n_inode + boot->n_datab <= nblocks;
+}
+
+static int check(const char *image, int fix) {
+    uint8_t *imap, *bmap, *owner;
+    uint32_t *queue, *blocks;
+    uint32_t i, j, n, dir, head = 0, tail = 0, entries = 0, errors = 0;
+    dentry_t *d;
+    inode_t *f;
+    FILE *fp;
+    long len;
+
+    if (!(fp = fopen(image, "rb")) || fseek(fp, 0, SEEK_END) < 0 || (len = ftell(fp)) < BLOCK_SIZE) {
+        fprintf(stderr, "fsimg: %s: cannot read image\n", image);
+        return 4;
+    }
+    rewind(fp);
+    img_len = len;
+    if (!(img = malloc(img_len)) || fread(img, 1, img_len, fp) != img_len) {
+        perror(image);
+        return 4;
+    }
+    fclose(fp);
+
+    if (!layout_ok()) {
+        fprintf(stderr, "%s: bad boot block (%u entries, %u inodes, %u data blocks)\n",
+                image, boot->n_dir, boot->n_inode, boot->n_datab);
+        return 4;
+    }
+
+    /* state 0 is an image from before the maps were kept: the kernel 
+     * rebuilds them at boot, there is nothing to compare */
+    if (!boot->state) {
+        printf("%s: legacy image, the kernel rebuilds the maps from the entries\n", image);
+    } else if (boot->state != FS_CLEAN) {
+        printf("%s: not marked clean, the maps are rebuilt from the entries\n", image);
+        errors++;
+    }
+
+    /* 1 for each data block of a file */
+    blocks = calloc(boot->n_datab + 1, sizeof(uint32_t));
+    owner = calloc(boot->n_inode, 1);
+    queue = malloc(boot->n_inode * sizeof(uint32_t));
+    imap = malloc(map_bytes(max_inode));
+    bmap = malloc(map_bytes(max_datab));
+    if (!blocks || !owner || !queue || !imap || !bmap) {
+        perror("fsimg");
+        return 4;
+    }
+
+    /* a directory is walked after its own inode and blocks are checked */
+    owner[ROOT_INO] = 1;
+    queue[tail++] = ROOT_INO;
+
+    while (head < tail) {
+        dir = queue[head++];
+
+        for (i = 0; i < dir_count(dir); ++i) {
+            d = dir_entry(dir, i);
+
+            for (j = 0; j < i; ++j) {
+                if (!strncmp(d->fname, dir_entry(dir, j)->fname, NAMESIZE)) {
+                    printf("dir %u, entry %u: %.32s listed twice\n", dir, i, d->fname);
+                    break;
+                }
+            }
+            if (j < i || d->type > REGULAR || !d->fname[0]) {
+                if (j == i)
+                    printf("dir %u, entry %u: bad name or type %u\n", dir, i, d->type);
+                errors++;
+                drop_entry(dir, i--);
+                continue;
+            }
+
+            entries++;
+            if (d->type == RTC || is_dot(d->fname))
+                continue;
+
+            if (!d->inode || d->inode >= max_inode || owner[d->inode]) {
+                printf("dir %u, entry %u: %.32s: bad or shared inode %u\n", dir, i, d->fname, d->inode);
+                errors++;
+                entries--;
+                drop_entry(dir, i--);
+                continue;
+            }
+            owner[d->inode] = 1;
+
+            f = &inodes[d->inode];
+            if (f->size > FILE_BLOCKS * BLOCK_SIZE) {
+                printf("%.32s: size %u too large\n", d->fname, f->size);
+                errors++;
+                f->size = FILE_BLOCKS * BLOCK_SIZE;
+            }
+
+            for (n = 0; n < size_blocks(f->size); ++n) {
+                if (f->data_block[n] >= boot->n_datab || blocks[f->data_block[n]]) {
+                    printf("%.32s: block %u is %s, file cut to %u bytes\n", d->fname,
+                           f->data_block[n], f->data_block[n] >= boot->n_datab ?
+                           "out of the image" : "used by another file", n * BLOCK_SIZE);
+                    errors++;
+                    f->size = n * BLOCK_SIZE;
+                    break;
+                }
+                blocks[f->data_block[n]] = 1;
+            }
+
+            if (d->type == DIRECTORY)
+                queue[tail++] = d->inode;
+        }
+    }
+    free(blocks);
+    free(owner);
+    free(queue);
+
+    build_maps(imap, bmap);
+
+    if (boot->state == FS_CLEAN) {
+        for (i = 0; i < max_inode; ++i) {
+            if (!map_test(imap, i) != !map_test(inode_map(), i)) {
+                printf("inode %u: marked %s\n", i, map_test(imap, i) ? "free but used" : "used but free");
+                errors++;
+            }
+        }
+        for (i = 0; i < max_datab; ++i) {
+            if (!map_test(bmap, i) != !map_test(block_map(), i)) {
+                printf("block %u: marked %s\n", i, map_test(bmap, i) ? "free but used" : "used but free");
+                errors++;
+            }
+        }
+    }
+
+    if (!errors) {
+        printf("%s: clean, %u entries in %u directories\n", image, entries, tail);
+        return 0;
+    }
+
+    if (!fix) {
+        printf("%s: %u errors\n", image, errors);
+        return 4;
+    }
+
+    memcpy(inode_map(), imap, map_bytes(max_inode));
+    memcpy(block_map(), bmap, map_bytes(max_datab));
+    boot->state = FS_CLEAN;
+
+    if (!(fp = fopen(image, "r+b")) || fwrite(img, 1, img_len, fp) != img_len) {
+        perror(image);
+        return 4;
+    }
+    fclose(fp);
+
+    printf("%s: %u errors repaired\n", image, errors);
+    return 1;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: fsimg build [-b free_blocks] [-i inodes] dir image\n"
+                    "       fsimg check [-f] image\n");
+    exit(4);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t nfree = FREE_BLOCKS, ninode = INODES;
+    int fix = 0, i;
+
+    if (argc < 3)
+        usage();
+
+    if (!strcmp(argv[1], "build")) {
+        for (i = 2; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+            if (!strcmp(argv[i], "-b"))
+                nfree = atoi(argv[i + 1]);
+            else if (!strcmp(argv[i], "-i") && atoi(argv[i + 1]) > 0)
+                ninode = atoi(argv[i + 1]);
+            else
+                usage();
+        }
+        if (argc - i != 2)
+            usage();
+        return build(argv[i], argv[i + 1], nfree, ninode);
+    }
+
+    if (!strcmp(argv[1], "check")) {
+        if (argc == 4 && !strcmp(argv[2], "-f"))
+            fix = 1;
+        else if (argc != 3)
+            usage();
+        return check(argv[argc - 1], fix);
+    }
+
+    usage();
+    return 4;
+}